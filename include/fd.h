@@ -54,6 +54,37 @@ ssize_t fd_sendmsg(const struct fd *fd, const struct msghdr *msg,
 ssize_t fd_read(const struct fd *fd, void *buf, size_t nbytes,
 		where_t where);
 
+/*
+ * Buffered (non-blocking) output.
+ *
+ * Once enabled, fd_sendmsg() never blocks: what the socket won't
+ * accept is appended to a buffer and the call succeeds.  Should the
+ * buffer grow beyond MAX bytes the reader is assumed to be gone; the
+ * buffer is discarded, the socket shut down, and further output
+ * fails.
+ *
+ * fd_flush() writes out as much of the buffer as it can (with BLOCK,
+ * all of it) returning the number of bytes still buffered, or -1
+ * when output has failed.  fd_read() flushes everything first so
+ * that a prompt is seen before the answer is waited for.
+ *
+ * fd_claim_flush() returns true, once, when there is buffered output
+ * and nothing is yet responsible for flushing it (for instance a
+ * writable event); the claim is released when fd_flush() empties the
+ * buffer, or output fails.
+ *
+ * The buffer is locked so other threads can write.  Output still
+ * buffered when the last reference is dropped is discarded; whatever
+ * flushes the buffer should hold a reference.
+ */
+void fd_buffer_output(struct fd *fd, size_t max);
+ssize_t fd_flush(const struct fd *fd, bool block);
+size_t fd_output_pending(const struct fd *fd);
+bool fd_claim_flush(const struct fd *fd);
+
+/* the underlying descriptor, for adding to an event loop */
+int fd_fileno(const struct fd *fd);
+
 /*
  * Is FD valid (as in something non-negative)?
  *
@@ -0,0 +1,56 @@
+/* two-level free bitmap, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#ifndef FREE_BITMAP_H
+#define FREE_BITMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Track which of the indices [0..NR_BITS) are free, handing out the
+ * lowest free index first.
+ *
+ * The first level has a bit per index; the second level has a bit
+ * per first-level word that has a free index.  Together with
+ * .first_free (no second-level word below it has a bit set) taking
+ * and releasing an index is O(1) in practice: a scan only walks
+ * second-level words, each covering 4096 indices.
+ *
+ * Growing reallocates the bitmap words (an eighth of a byte per
+ * index), never anything indexed by them.
+ */
+
+struct free_bitmap {
+	unsigned nr_bits;	/* indices [0..nr_bits) */
+	unsigned nr_free;
+	unsigned first_free;	/* lowest summary word that may be non-zero */
+	unsigned nr_words;	/* allocated */
+	uint64_t *words;	/* bit set: index is free */
+	uint64_t *summary;	/* bit set: words[] has a free index */
+};
+
+#define EMPTY_FREE_BITMAP { .nr_bits = 0, }
+
+/* add [.nr_bits..NR_BITS) as free indices */
+void grow_free_bitmap(struct free_bitmap *bitmap, unsigned nr_bits);
+
+/* lowest free index, or false */
+bool take_free_bitmap(struct free_bitmap *bitmap, unsigned *index);
+void release_free_bitmap(struct free_bitmap *bitmap, unsigned index);
+bool is_free_bitmap(const struct free_bitmap *bitmap, unsigned index);
+
+void free_free_bitmap(struct free_bitmap *bitmap);
+
+#endif
@@ -49,6 +49,7 @@ enum keyword_string_config_field {
 	KSF_SYSLOG,
 	KSF_DUMPDIR,
 	KSF_STATSBINARY,
+	KSF_UPDOWN_HELPER,
 	KSF_IPSECDIR,
 	KSF_NSSDIR,
 	KSF_SECRETSFILE,
@@ -82,6 +83,7 @@ enum keyword_numeric_config_field {
 	KBF_IKEPORT,
 	KBF_IKEBUF,
 	KBF_IKE_ERRQUEUE,
+	KBF_IKE_SOCKET_QUEUES,
 	KBF_PERPEERLOG,
 	KBF_XFRMLIFETIME,
 	KBF_CRL_STRICT,
@@ -100,7 +102,12 @@ enum keyword_numeric_config_field {
 	KBF_KEEPALIVE,
 	KBF_PLUTODEBUG,
 	KBF_NHELPERS,
+	KBF_DH_KEYPAIR_POOL_LOW,
+	KBF_DH_KEYPAIR_POOL_HIGH,
+	KBF_DH_KEYPAIR_POOL_LIFETIME,
+	KBF_CERT_CACHE_LIFETIME,
 	KBF_SHUNTLIFETIME,
+	KBF_SA_COUNTER_CACHE,
 	KBF_FORCEBUSY, 		/* obsoleted for KBF_DDOS_MODE */
 	KBF_DDOS_IKE_THRESHOLD,
 	KBF_MAX_HALFOPEN_IKE,
@@ -26,7 +26,11 @@ struct file_lex_position {
 	struct file_lex_position *previous;
 };
 
-extern struct file_lex_position *flp;
+/*
+ * Per-thread so that pluto can (re)load the secrets file in the
+ * background while the main thread reads other files.
+ */
+extern __thread struct file_lex_position *flp;
 
 extern bool lexopen(struct file_lex_position *new_flp, const char *name,
 		    bool optional);
@@ -59,6 +59,9 @@ enum ike_version {
 
 #define PLUTO_SHUNT_LIFE_DURATION_DEFAULT (15 * secs_per_minute)
 #define PLUTO_HALFOPEN_SA_LIFE (secs_per_minute )
+#define DH_KEYPAIR_POOL_LIFETIME_DEFAULT (5 * secs_per_minute)
+#define CERT_CACHE_LIFETIME_DEFAULT (15 * secs_per_minute)
+#define SA_COUNTER_CACHE_DEFAULT 2 /* seconds; 0 disables */
 
 #define SA_REPLACEMENT_MARGIN_DEFAULT (9 * secs_per_minute) /* IPSEC & IKE */
 #define SA_REPLACEMENT_FUZZ_DEFAULT 100 /* (IPSEC & IKE) 100% of MARGIN */
@@ -67,6 +70,7 @@ enum ike_version {
 #define SA_LIFE_DURATION_K_DEFAULT 0xFFFFFFFFlu
 
 #define IKE_BUF_AUTO 0 /* use system values for IKE socket buffer size */
+#define MAX_IKE_SOCKET_QUEUES 16 /* SO_REUSEPORT sockets per UDP IKE port */
 
 #define DEFAULT_XFRM_IF_NAME "ipsec1"
 
@@ -186,6 +190,12 @@ enum global_timer {
 	EVENT_NAT_T_KEEPALIVE,		/* NAT Traversal Keepalive */
 
 	EVENT_PROCESS_KERNEL_QUEUE,	/* non-netkey */
+
+	EVENT_RESIZE_HASH_TABLES,	/* grow/shrink hash tables a few buckets at a time */
+
+	EVENT_FLUSH_NETLINK_BATCH,	/* send queued XFRM requests */
+
+	EVENT_EXPIRE_PUBKEYS,		/* delete DNS public keys past their TTL */
 };
 
 enum event_type {
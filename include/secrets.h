@@ -243,13 +243,11 @@ extern void unreference_key(struct pubkey **pkp);
 extern err_t add_public_key(const struct id *id,
 			    enum dns_auth_level dns_auth_level,
 			    const struct pubkey_type *type,
-			    const chunk_t *key,
-			    struct pubkey_list **head);
+			    const chunk_t *key);
 extern err_t add_ipseckey(const struct id *id,
 			  enum dns_auth_level dns_auth_level,
 			  const struct pubkey_type *type, uint32_t ttl,
-			  uint32_t ttl_used, const chunk_t *key,
-			  struct pubkey_list **head);
+			  uint32_t ttl_used, const chunk_t *key);
 
 extern bool same_RSA_public_key(const struct RSA_public_key *a,
 				const struct RSA_public_key *b);
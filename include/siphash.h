@@ -0,0 +1,47 @@
+/* SipHash keyed hash, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+#include <stdint.h>
+#include <stddef.h>		/* for size_t */
+
+/*
+ * SipHash (Aumasson and Bernstein) is a fast keyed PRF intended for
+ * hash tables exposed to untrusted input: without the 128-bit key
+ * an attacker can't predict which bucket a value lands in.
+ *
+ * SipHash-1-3 (one compression round, three finalization rounds)
+ * is used for hash tables; SipHash-2-4, the conservative choice,
+ * is used as a MAC for IKEv2 cookies (and is what the published
+ * test vectors check).
+ *
+ * Input is consumed 8 bytes at a time (little-endian).  The _u64()
+ * and _u64x2() variants are fast paths for fixed-size keys; they
+ * return the same value as hashing the equivalent 8 or 16 byte
+ * little-endian buffer.
+ */
+
+struct siphash_key {
+	uint64_t k[2];
+};
+
+uint64_t siphash13(const struct siphash_key *key, const void *data, size_t len);
+uint64_t siphash13_u64(const struct siphash_key *key, uint64_t w0);
+uint64_t siphash13_u64x2(const struct siphash_key *key, uint64_t w0, uint64_t w1);
+
+uint64_t siphash24(const struct siphash_key *key, const void *data, size_t len);
+
+#endif
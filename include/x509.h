@@ -76,6 +76,9 @@ extern deltatime_t crl_check_interval;
 
 extern bool same_dn(chunk_t a, chunk_t b);
 extern bool match_dn(chunk_t a, chunk_t b, int *wildcards);
+extern bool fold_dn(chunk_t dn,
+		    void (*fold)(const void *ptr, size_t len, void *arg),
+		    void *arg);
 extern int dn_count_wildcards(chunk_t dn);
 extern err_t atodn(const char *src, chunk_t *dn);
 extern void free_generalNames(generalName_t *gn, bool free_name);
@@ -79,16 +79,22 @@ static void ipsecconf_default_values(struct starter_config *cfg)
 	SOPT(KBF_PERPEERLOG, FALSE);
 	SOPT(KBF_IKEPORT, IKE_UDP_PORT);
 	SOPT(KBF_IKEBUF, IKE_BUF_AUTO);
+	SOPT(KBF_IKE_SOCKET_QUEUES, 1);
 	SOPT(KBF_IKE_ERRQUEUE, TRUE);
 	SOPT(KBF_NFLOG_ALL, 0); /* disabled per default */
 	SOPT(KBF_XFRMLIFETIME, XFRM_LIFETIME_DEFAULT); /* not used by pluto itself */
 	SOPT(KBF_NHELPERS, -1); /* see also plutomain.c */
+	SOPT(KBF_DH_KEYPAIR_POOL_LOW, 0); /* disabled per default */
+	SOPT(KBF_DH_KEYPAIR_POOL_HIGH, 0); /* twice the low watermark */
+	SOPT(KBF_DH_KEYPAIR_POOL_LIFETIME, DH_KEYPAIR_POOL_LIFETIME_DEFAULT);
+	SOPT(KBF_CERT_CACHE_LIFETIME, CERT_CACHE_LIFETIME_DEFAULT);
 
 	SOPT(KBF_KEEPALIVE, 0);                  /* config setup */
 	SOPT(KBF_NATIKEPORT, NAT_IKE_UDP_PORT);
 	SOPT(KBF_DDOS_IKE_THRESHOLD, DEFAULT_IKE_SA_DDOS_THRESHOLD);
 	SOPT(KBF_MAX_HALFOPEN_IKE, DEFAULT_MAXIMUM_HALFOPEN_IKE_SA);
 	SOPT(KBF_SHUNTLIFETIME, PLUTO_SHUNT_LIFE_DURATION_DEFAULT);
+	SOPT(KBF_SA_COUNTER_CACHE, SA_COUNTER_CACHE_DEFAULT);
 	/* Don't inflict BSI requirements on everyone */
 	SOPT(KBF_SEEDBITS, 0);
 	SOPT(KBF_DROP_OPPO_NULL, FALSE);
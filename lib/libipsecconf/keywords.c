@@ -382,10 +382,12 @@ const struct keyword_def ipsec_conf_keywords[] = {
   { "nssdir", kv_config, kt_dirname, KSF_NSSDIR, NULL, NULL, },
   { "secretsfile",  kv_config,  kt_dirname,  KSF_SECRETSFILE, NULL, NULL, },
   { "statsbin",  kv_config,  kt_dirname,  KSF_STATSBINARY, NULL, NULL, },
+  { "updown-helper",  kv_config,  kt_filename,  KSF_UPDOWN_HELPER, NULL, NULL, },
   { "perpeerlog",  kv_config,  kt_bool,  KBF_PERPEERLOG, NULL, NULL, },
   { "perpeerlogdir",  kv_config,  kt_dirname,  KSF_PERPEERDIR, NULL, NULL, },
   { "uniqueids",  kv_config,  kt_bool,  KBF_UNIQUEIDS, NULL, NULL, },
   { "shuntlifetime",  kv_config,  kt_time,  KBF_SHUNTLIFETIME, NULL, NULL, },
+  { "sa-counter-cache",  kv_config,  kt_time,  KBF_SA_COUNTER_CACHE, NULL, NULL, },
   { "global-redirect", kv_config, kt_string, KSF_GLOBAL_REDIRECT, NULL, NULL },
   { "global-redirect-to", kv_config, kt_string, KSF_GLOBAL_REDIRECT_TO, NULL, NULL, },
 
@@ -418,6 +420,7 @@ const struct keyword_def ipsec_conf_keywords[] = {
   { "ikeport",  kv_config,  kt_number,  KBF_IKEPORT, NULL, NULL, },
   { "ike-socket-bufsize",  kv_config,  kt_number,  KBF_IKEBUF, NULL, NULL, },
   { "ike-socket-errqueue",  kv_config,  kt_bool,  KBF_IKE_ERRQUEUE, NULL, NULL, },
+  { "ike-socket-queues",  kv_config,  kt_number,  KBF_IKE_SOCKET_QUEUES, NULL, NULL, },
   { "nflog-all",  kv_config,  kt_number,  KBF_NFLOG_ALL, NULL, NULL, },
   { "xfrmlifetime",  kv_config,  kt_number,  KBF_XFRMLIFETIME, NULL, NULL, },
   { "virtual_private",  kv_config | kv_alias,  kt_string,  KSF_VIRTUALPRIVATE, NULL, NULL, },  /* obsolete _ */
@@ -433,6 +436,10 @@ const struct keyword_def ipsec_conf_keywords[] = {
   { "listen",  kv_config,  kt_string,  KSF_LISTEN, NULL, NULL, },
   { "protostack",  kv_config,  kt_string,  KSF_PROTOSTACK,  &kw_proto_stack, NULL, },
   { "nhelpers",  kv_config,  kt_number,  KBF_NHELPERS, NULL, NULL, },
+  { "dh-keypair-pool-low",  kv_config,  kt_number,  KBF_DH_KEYPAIR_POOL_LOW, NULL, NULL, },
+  { "dh-keypair-pool-high",  kv_config,  kt_number,  KBF_DH_KEYPAIR_POOL_HIGH, NULL, NULL, },
+  { "dh-keypair-pool-lifetime",  kv_config,  kt_time,  KBF_DH_KEYPAIR_POOL_LIFETIME, NULL, NULL, },
+  { "cert-cache-lifetime",  kv_config,  kt_time,  KBF_CERT_CACHE_LIFETIME, NULL, NULL, },
   { "drop-oppo-null",  kv_config,  kt_bool,  KBF_DROP_OPPO_NULL, NULL, NULL, },
 #ifdef HAVE_LABELED_IPSEC
   /* It is really an attribute type, not a value */
@@ -19,6 +19,8 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <fcntl.h>
+#include <string.h>	/* for memcpy() */
+#include <pthread.h>
 
 #include "fd.h"
 #include "lswalloc.h"
@@ -29,6 +31,26 @@ struct fd {
 	unsigned magic;
 	int fd;
 	refcnt_t refcnt;
+	/*
+	 * Separate so that output can be buffered through a const
+	 * FD.
+	 */
+	struct fd_output *output;
+};
+
+struct fd_output {
+	/*
+	 * Helper threads log to whack (through a cloned logger) so
+	 * everything below is locked.
+	 */
+	pthread_mutex_t mutex;
+	size_t max;		/* beyond this the reader is dead */
+	uint8_t *buf;
+	size_t size;		/* allocated */
+	size_t start;		/* first unsent byte */
+	size_t len;		/* unsent bytes */
+	bool claimed;		/* someone will call fd_flush() */
+	bool broken;
 };
 
 struct fd *dup_any_fd(struct fd *fd, where_t where)
@@ -43,6 +65,19 @@ static void free_fd(struct fd **fdp, where_t where)
 	struct fd *fd = *fdp;
 	*fdp = NULL;
 	pexpect(fd->magic == FD_MAGIC);
+	if (fd->output != NULL && fd_output_pending(fd) > 0) {
+		/*
+		 * Last reference, and nothing is flushing the output
+		 * (that holds a reference).  Blocking would stall the
+		 * caller so send what the socket will take and drop
+		 * the rest.
+		 */
+		ssize_t left = fd_flush(fd, false/*don't block*/);
+		if (left > 0) {
+			dbg("freeref "PRI_FD" dropping %zd bytes of output",
+			    pri_fd(fd), left);
+		}
+	}
 	if (close(fd->fd) != 0) {
 		dbg("freeref "PRI_FD" close(%d) failed: "PRI_ERRNO" "PRI_WHERE"",
 		    pri_fd(fd), fd->fd, pri_errno(errno), pri_where(where));
@@ -51,6 +86,11 @@ static void free_fd(struct fd **fdp, where_t where)
 		    pri_fd(fd), pri_where(where));
 	}
 	fd->magic = ~FD_MAGIC;
+	if (fd->output != NULL) {
+		pthread_mutex_destroy(&fd->output->mutex);
+		pfreeany(fd->output->buf);
+		pfree(fd->output);
+	}
 	pfree(fd);
 }
 
@@ -68,6 +108,109 @@ void fd_leak(struct fd **fd, where_t where)
 	ref_delete(fd, free_fd, where);
 }
 
+static void break_output(const struct fd *fd, bool hangup)
+{
+	struct fd_output *out = fd->output;
+	out->broken = true;
+	out->claimed = false;
+	pfreeany(out->buf);
+	out->size = out->start = out->len = 0;
+	if (hangup) {
+		/* let the reader see EOF rather than wait forever */
+		shutdown(fd->fd, SHUT_RDWR);
+	}
+}
+
+static bool would_block(int error)
+{
+	return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+static ssize_t buffered_sendmsg_locked(const struct fd *fd, const struct msghdr *msg,
+				       int flags)
+{
+	struct fd_output *out = fd->output;
+	if (out->broken) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	size_t total = 0;
+	/* XXX: on BSD msg_iovlen is an INT */
+	for (unsigned i = 0; i < (unsigned)msg->msg_iovlen; i++) {
+		total += msg->msg_iov[i].iov_len;
+	}
+
+	/* when nothing is queued, try the socket first */
+	size_t sent = 0;
+	if (out->len == 0) {
+		ssize_t n = sendmsg(fd->fd, msg, flags | MSG_DONTWAIT);
+		if (n < 0) {
+			if (!would_block(errno)) {
+				int e = errno;
+				break_output(fd, false);
+				errno = e;
+				return -1;
+			}
+			n = 0;
+		}
+		sent = n;
+	}
+	if (sent == total) {
+		return total;
+	}
+
+	/* append the rest */
+	size_t rest = total - sent;
+	if (out->len + rest > out->max) {
+		dbg("whack output of %zu bytes exceeds %zu; giving up on "PRI_FD"",
+		    out->len + rest, out->max, pri_fd(fd));
+		break_output(fd, true);
+		errno = ENOBUFS;
+		return -1;
+	}
+	if (out->start + out->len + rest > out->size) {
+		if (out->start > 0) {
+			memmove(out->buf, out->buf + out->start, out->len);
+			out->start = 0;
+		}
+		if (out->len + rest > out->size) {
+			size_t size = out->size == 0 ? 4096 : out->size;
+			while (size < out->len + rest) {
+				size *= 2;
+			}
+			realloc_bytes((void**)&out->buf, out->size, size,
+				      "fd output");
+			out->size = size;
+		}
+	}
+	uint8_t *end = out->buf + out->start + out->len;
+	for (unsigned i = 0; i < (unsigned)msg->msg_iovlen; i++) {
+		const struct iovec *iov = &msg->msg_iov[i];
+		if (sent >= iov->iov_len) {
+			sent -= iov->iov_len;
+			continue;
+		}
+		size_t n = iov->iov_len - sent;
+		memcpy(end, (const uint8_t *)iov->iov_base + sent, n);
+		end += n;
+		sent = 0;
+	}
+	out->len += rest;
+	return total;
+}
+
+static ssize_t buffered_sendmsg(const struct fd *fd, const struct msghdr *msg,
+				int flags)
+{
+	pthread_mutex_lock(&fd->output->mutex);
+	ssize_t n = buffered_sendmsg_locked(fd, msg, flags);
+	int e = errno;
+	pthread_mutex_unlock(&fd->output->mutex);
+	errno = e;
+	return n;
+}
+
 ssize_t fd_sendmsg(const struct fd *fd, const struct msghdr *msg,
 		   int flags, where_t where)
 {
@@ -107,6 +250,9 @@ ssize_t fd_sendmsg(const struct fd *fd, const struct msghdr *msg,
 		}
 		return -1;
 	}
+	if (fd->output != NULL) {
+		return buffered_sendmsg(fd, msg, flags);
+	}
 	return sendmsg(fd->fd, msg, flags);
 }
 
@@ -148,9 +294,95 @@ ssize_t fd_read(const struct fd *fd, void *buf, size_t nbytes, where_t where)
 		log_pexpect(where, "wrong magic for "PRI_FD"", pri_fd(fd));
 		return -1;
 	}
+	if (fd->output != NULL) {
+		/* make certain any prompt was seen */
+		fd_flush(fd, true);
+	}
 	return read(fd->fd, buf, nbytes);
 }
 
+void fd_buffer_output(struct fd *fd, size_t max)
+{
+	if (fd->output == NULL) {
+		fd->output = alloc_thing(struct fd_output, "fd output");
+		pthread_mutex_init(&fd->output->mutex, NULL);
+	}
+	fd->output->max = max;
+}
+
+static ssize_t flush_locked(const struct fd *fd, bool block)
+{
+	struct fd_output *out = fd->output;
+	if (out->broken) {
+		return -1;
+	}
+	while (out->len > 0) {
+		ssize_t n = send(fd->fd, out->buf + out->start, out->len,
+				 MSG_NOSIGNAL | (block ? 0 : MSG_DONTWAIT));
+		if (n < 0) {
+			if (errno == EINTR || (!block && would_block(errno))) {
+				if (block) {
+					continue;
+				}
+				break;
+			}
+			dbg("flushing "PRI_FD" failed: "PRI_ERRNO"",
+			    pri_fd(fd), pri_errno(errno));
+			break_output(fd, false);
+			return -1;
+		}
+		out->start += n;
+		out->len -= n;
+	}
+	if (out->len == 0) {
+		out->start = 0;
+		out->claimed = false;
+	}
+	return out->len;
+}
+
+ssize_t fd_flush(const struct fd *fd, bool block)
+{
+	if (fd->output == NULL) {
+		return 0;
+	}
+	pthread_mutex_lock(&fd->output->mutex);
+	ssize_t len = flush_locked(fd, block);
+	pthread_mutex_unlock(&fd->output->mutex);
+	return len;
+}
+
+size_t fd_output_pending(const struct fd *fd)
+{
+	if (fd == NULL || fd->output == NULL) {
+		return 0;
+	}
+	pthread_mutex_lock(&fd->output->mutex);
+	size_t len = fd->output->len;
+	pthread_mutex_unlock(&fd->output->mutex);
+	return len;
+}
+
+bool fd_claim_flush(const struct fd *fd)
+{
+	struct fd_output *out = fd->output;
+	if (out == NULL) {
+		return false;
+	}
+	pthread_mutex_lock(&out->mutex);
+	bool claim = !out->broken && out->len > 0 && !out->claimed;
+	if (claim) {
+		out->claimed = true;
+	}
+	pthread_mutex_unlock(&out->mutex);
+	return claim;
+}
+
+int fd_fileno(const struct fd *fd)
+{
+	return fd->fd;
+}
+
 bool fd_p(const struct fd *fd)
 {
 	if (fd == NULL) {
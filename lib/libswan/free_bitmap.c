@@ -0,0 +1,123 @@
+/* two-level free bitmap, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "free_bitmap.h"
+#include "lswalloc.h"
+#include "passert.h"
+
+#define BITS 64
+
+static unsigned nr_summary_words(unsigned nr_words)
+{
+	return (nr_words + BITS - 1) / BITS;
+}
+
+static void mark_free(struct free_bitmap *bitmap, unsigned index)
+{
+	unsigned w = index / BITS;
+	bitmap->words[w] |= UINT64_C(1) << (index % BITS);
+	bitmap->summary[w / BITS] |= UINT64_C(1) << (w % BITS);
+	if (w / BITS < bitmap->first_free) {
+		bitmap->first_free = w / BITS;
+	}
+	bitmap->nr_free++;
+}
+
+void grow_free_bitmap(struct free_bitmap *bitmap, unsigned nr_bits)
+{
+	passert(nr_bits >= bitmap->nr_bits);
+	unsigned nr_words = (nr_bits + BITS - 1) / BITS;
+	if (nr_words > bitmap->nr_words) {
+		/* double, so that growing a bit at a time is amortized */
+		unsigned new_nr_words = bitmap->nr_words * 2;
+		if (new_nr_words < nr_words) {
+			new_nr_words = nr_words;
+		}
+		realloc_things(bitmap->words, bitmap->nr_words,
+			       new_nr_words, "free bitmap words");
+		realloc_things(bitmap->summary,
+			       nr_summary_words(bitmap->nr_words),
+			       nr_summary_words(new_nr_words),
+			       "free bitmap summary");
+		/* realloc_bytes() leaves the new space zeroed */
+		bitmap->nr_words = new_nr_words;
+	}
+	/* set the new bits a word at a time where possible */
+	unsigned index = bitmap->nr_bits;
+	while (index < nr_bits) {
+		if (index % BITS == 0 && nr_bits - index >= BITS) {
+			unsigned w = index / BITS;
+			bitmap->words[w] = ~UINT64_C(0);
+			bitmap->summary[w / BITS] |= UINT64_C(1) << (w % BITS);
+			if (w / BITS < bitmap->first_free) {
+				bitmap->first_free = w / BITS;
+			}
+			bitmap->nr_free += BITS;
+			index += BITS;
+		} else {
+			mark_free(bitmap, index);
+			index++;
+		}
+	}
+	bitmap->nr_bits = nr_bits;
+}
+
+bool take_free_bitmap(struct free_bitmap *bitmap, unsigned *index)
+{
+	if (bitmap->nr_free == 0) {
+		return false;
+	}
+	unsigned nr_summary = nr_summary_words(bitmap->nr_words);
+	for (unsigned s = bitmap->first_free; s < nr_summary; s++) {
+		if (bitmap->summary[s] == 0) {
+			/* nothing free here; skip it next time */
+			bitmap->first_free = s + 1;
+			continue;
+		}
+		unsigned w = s * BITS + __builtin_ctzll(bitmap->summary[s]);
+		passert(bitmap->words[w] != 0);
+		unsigned i = w * BITS + __builtin_ctzll(bitmap->words[w]);
+		passert(i < bitmap->nr_bits);
+		bitmap->words[w] &= ~(UINT64_C(1) << (i % BITS));
+		if (bitmap->words[w] == 0) {
+			bitmap->summary[s] &= ~(UINT64_C(1) << (w % BITS));
+		}
+		bitmap->nr_free--;
+		*index = i;
+		return true;
+	}
+	/* NR_FREE said there was something */
+	passert(bitmap->nr_free == 0);
+	return false;
+}
+
+void release_free_bitmap(struct free_bitmap *bitmap, unsigned index)
+{
+	passert(index < bitmap->nr_bits);
+	passert(!is_free_bitmap(bitmap, index));
+	mark_free(bitmap, index);
+}
+
+bool is_free_bitmap(const struct free_bitmap *bitmap, unsigned index)
+{
+	passert(index < bitmap->nr_bits);
+	return (bitmap->words[index / BITS] >> (index % BITS)) & 1;
+}
+
+void free_free_bitmap(struct free_bitmap *bitmap)
+{
+	pfreeany(bitmap->words);
+	pfreeany(bitmap->summary);
+	*bitmap = (struct free_bitmap) EMPTY_FREE_BITMAP;
+}
@@ -27,7 +27,7 @@
 #include "lex.h"
 #include "lswlog.h"
 
-struct file_lex_position *flp = NULL;
+__thread struct file_lex_position *flp = NULL;
 
 /*
  * Open a file for lexical processing.
@@ -65,6 +65,7 @@
 #include "nss_cert_load.h"
 #include "ike_alg.h"
 #include "ike_alg_hash.h"
+#include "siphash.h"
 
 /* this does not belong here, but leave it here for now */
 const struct id empty_id;	/* ID_NONE */
@@ -121,8 +122,208 @@ struct secret {
 	struct secret  *next;
 	struct id_list *ids;
 	struct private_key_stuff pks;
+	/* shared by every secret on the list; see below */
+	struct secrets_index *index;
+	unsigned long serial;		/* larger is newer (nearer the head) */
+	unsigned long visited;		/* index->visits of last lookup */
 };
 
+/*
+ * Index of a list of secrets.
+ *
+ * With many thousands of secrets, scanning (and scoring) the whole
+ * list for each lookup is too slow.  Instead, each list (all secrets
+ * on it point at the same index) keeps:
+ *
+ * - BY_ID: each secret under each of its IDs; hashed so that two IDs
+ *   that are same_id() land in the same bucket (DNs, which same_id()
+ *   compares semantically, are only hashed by kind)
+ *
+ * - WILDCARDS: secrets with no IDs or with an any_id() ID; these
+ *   match anything
+ *
+ * - BY_CKAID: public key secrets hashed by CKAID
+ *
+ * A lookup only scores the candidates from the relevant buckets, but
+ * does so in list order, so the result is the same as scanning the
+ * entire list.
+ *
+ * Secrets are only ever added to a list, and the list is freed in
+ * one go, so entries are never removed.
+ */
+
+struct secret_ref {
+	struct secret *secret;
+	uint64_t hash;
+	struct secret_ref *next;
+};
+
+struct secret_buckets {
+	unsigned long nr_entries;
+	unsigned long nr_buckets;
+	struct secret_ref **buckets;
+};
+
+struct secrets_index {
+	struct siphash_key key;
+	unsigned long serial;
+	unsigned long visits;
+	struct secret_buckets by_id;
+	struct secret_buckets by_ckaid;
+	struct secret_ref *wildcards;
+};
+
+static struct secrets_index *alloc_secrets_index(void)
+{
+	struct secrets_index *index = alloc_thing(struct secrets_index, "secrets index");
+	if (PK11_GenerateRandom((uint8_t *)&index->key, sizeof(index->key)) != SECSuccess) {
+		/* still works; just predictable */
+		dbg("NSS: could not generate secrets index key");
+	}
+	return index;
+}
+
+static void free_secret_refs(struct secret_ref **refs)
+{
+	struct secret_ref *r = *refs;
+	while (r != NULL) {
+		struct secret_ref *next = r->next;
+		pfree(r);
+		r = next;
+	}
+	*refs = NULL;
+}
+
+static void free_secret_buckets(struct secret_buckets *b)
+{
+	for (unsigned long i = 0; i < b->nr_buckets; i++) {
+		free_secret_refs(&b->buckets[i]);
+	}
+	pfreeany(b->buckets);
+	zero(b);
+}
+
+static void free_secrets_index(struct secrets_index **index)
+{
+	free_secret_buckets(&(*index)->by_id);
+	free_secret_buckets(&(*index)->by_ckaid);
+	free_secret_refs(&(*index)->wildcards);
+	pfree(*index);
+	*index = NULL;
+}
+
+static struct secret_ref *secret_bucket(const struct secret_buckets *b,
+					uint64_t hash)
+{
+	if (b->nr_buckets == 0) {
+		return NULL;
+	}
+	/* nr_buckets is a power of two */
+	return b->buckets[hash & (b->nr_buckets - 1)];
+}
+
+/*
+ * Double the number of buckets once the average chain is longer than
+ * two.
+ */
+static void add_secret_bucket_entry(struct secret_buckets *b,
+				    struct secret *secret, uint64_t hash)
+{
+	if (b->nr_entries >= 2 * b->nr_buckets) {
+		unsigned long nr_buckets = (b->nr_buckets == 0 ? 64 : 2 * b->nr_buckets);
+		struct secret_ref **buckets = alloc_things(struct secret_ref *, nr_buckets,
+							   "secret buckets");
+		for (unsigned long i = 0; i < b->nr_buckets; i++) {
+			struct secret_ref *r = b->buckets[i];
+			while (r != NULL) {
+				struct secret_ref *next = r->next;
+				struct secret_ref **head = &buckets[r->hash & (nr_buckets - 1)];
+				r->next = *head;
+				*head = r;
+				r = next;
+			}
+		}
+		pfreeany(b->buckets);
+		b->buckets = buckets;
+		b->nr_buckets = nr_buckets;
+	}
+	struct secret_ref *r = alloc_thing(struct secret_ref, "secret ref");
+	r->secret = secret;
+	r->hash = hash;
+	struct secret_ref **head = &b->buckets[hash & (b->nr_buckets - 1)];
+	r->next = *head;
+	*head = r;
+	b->nr_entries++;
+}
+
+static uint64_t hash_id(const struct secrets_index *index, const struct id *id)
+{
+	/* must be consistent with same_id() */
+	shunk_t bytes = null_shunk;
+	char name[256];
+	switch (id->kind) {
+	case ID_IPV4_ADDR:
+	case ID_IPV6_ADDR:
+		bytes = address_as_shunk(&id->ip_addr);
+		break;
+	case ID_FQDN:
+	case ID_USER_FQDN:
+	{
+		/* ignore case and trailing dots */
+		size_t len = id->name.len;
+		while (len > 0 && id->name.ptr[len - 1] == '.') {
+			len--;
+		}
+		len = min(len, sizeof(name));
+		for (size_t i = 0; i < len; i++) {
+			name[i] = tolower(id->name.ptr[i]);
+		}
+		bytes = shunk2(name, len);
+		break;
+	}
+	case ID_KEY_ID:
+		bytes = shunk2(id->name.ptr, id->name.len);
+		break;
+	default:
+		/* DNs et.al. are only hashed by kind */
+		break;
+	}
+	uint64_t hash = siphash13(&index->key, bytes.ptr, bytes.len);
+	return siphash13_u64x2(&index->key, id->kind, hash);
+}
+
+static uint64_t hash_ckaid(const struct secrets_index *index,
+			   const void *ptr, size_t len)
+{
+	return siphash13(&index->key, ptr, len);
+}
+
+static void index_secret(struct secrets_index *index, struct secret *s)
+{
+	s->index = index;
+	s->serial = ++index->serial;
+	bool wildcard = (s->ids == NULL);
+	for (struct id_list *i = s->ids; i != NULL; i = i->next) {
+		if (any_id(&i->id)) {
+			wildcard = true;
+		} else {
+			add_secret_bucket_entry(&index->by_id, s,
+						hash_id(index, &i->id));
+		}
+	}
+	if (wildcard) {
+		struct secret_ref *r = alloc_thing(struct secret_ref, "secret ref");
+		r->secret = s;
+		r->next = index->wildcards;
+		index->wildcards = r;
+	}
+	const ckaid_t *ckaid = secret_ckaid(s);
+	if (ckaid != NULL) {
+		add_secret_bucket_entry(&index->by_ckaid, s,
+					hash_ckaid(index, ckaid->ptr, ckaid->len));
+	}
+}
+
 struct private_key_stuff *lsw_get_pks(struct secret *s)
 {
 	return &s->pks;
@@ -584,22 +785,28 @@ static struct secret *find_pubkey_secret_by_ckaid(struct secret *secrets,
 						  const struct pubkey_type *type,
 						  const SECItem *pubkey_ckaid)
 {
-	for (struct secret *s = secrets; s != NULL; s = s->next) {
-		const struct private_key_stuff *pks = &s->pks;
-		dbg("trying secret %s:%s",
-		    enum_name(&pkk_names, pks->kind),
-		    (pks->kind == PKK_RSA ? pks->u.RSA_private_key.pub.keyid :
-		     pks->kind == PKK_ECDSA ? pks->u.ECDSA_private_key.pub.keyid :
-		     "N/A"));
-		if (s->pks.pubkey_type == type) {
-			const ckaid_t *s_ckaid = secret_ckaid(s);
-			if (ckaid_eq_nss(s_ckaid, pubkey_ckaid)) {
-				dbg("matched");
-				return s;
-			}
+	if (secrets == NULL) {
+		return NULL;
+	}
+	/* newest first, same as the list */
+	struct secrets_index *index = secrets->index;
+	struct secret *best = NULL;
+	for (struct secret_ref *r = secret_bucket(&index->by_ckaid,
+						  hash_ckaid(index, pubkey_ckaid->data,
+							     pubkey_ckaid->len));
+	     r != NULL; r = r->next) {
+		struct secret *s = r->secret;
+		if (s->pks.pubkey_type == type &&
+		    ckaid_eq_nss(secret_ckaid(s), pubkey_ckaid) &&
+		    (best == NULL || s->serial > best->serial)) {
+			best = s;
 		}
 	}
-	return NULL;
+	if (best != NULL) {
+		dbg("matched secret %s:%s",
+		    enum_name(&pkk_names, best->pks.kind), secret_keyid(best));
+	}
+	return best;
 }
 
 struct secret *lsw_find_secret_by_public_key(struct secret *secrets,
@@ -612,188 +819,276 @@ struct secret *lsw_find_secret_by_public_key(struct secret *secrets,
 					   &nss_ckaid);
 }
 
-struct secret *lsw_find_secret_by_id(struct secret *secrets,
-				     enum PrivateKeyKind kind,
-				     const struct id *local_id,
-				     const struct id *remote_id,
-				     bool asym)
-{
-	enum {
-		match_none = 000,
+enum {
+	match_none = 000,
 
-		/* bits */
-		match_default = 001,
-		match_any = 002,
-		match_remote = 004,
-		match_local = 010
-	};
-	unsigned int best_match = match_none;
-	struct secret *best = NULL;
+	/* bits */
+	match_default = 001,
+	match_any = 002,
+	match_remote = 004,
+	match_local = 010
+};
 
-	for (struct secret *s = secrets; s != NULL; s = s->next) {
-		if (DBGP(DBG_BASE)) {
-			id_buf idl;
-			DBG_log("line %d: key type %s(%s) to type %s",
-				s->pks.line,
-				enum_name(&pkk_names, kind),
-				str_id(local_id, &idl),
-				enum_name(&pkk_names, s->pks.kind));
-		}
+static void match_secret_by_id(struct secret *s,
+			       enum PrivateKeyKind kind,
+			       const struct id *local_id,
+			       const struct id *remote_id,
+			       bool asym,
+			       unsigned int *best_match,
+			       struct secret **best)
+{
+	if (DBGP(DBG_BASE)) {
+		id_buf idl;
+		DBG_log("line %d: key type %s(%s) to type %s",
+			s->pks.line,
+			enum_name(&pkk_names, kind),
+			str_id(local_id, &idl),
+			enum_name(&pkk_names, s->pks.kind));
+	}
 
-		if (s->pks.kind == kind) {
-			unsigned int match = match_none;
+	if (s->pks.kind == kind) {
+		unsigned int match = match_none;
 
-			if (s->ids == NULL) {
-				/*
-				 * a default (signified by lack of ids):
-				 * accept if no more specific match found
-				 */
-				match = match_default;
-			} else {
-				/* check if both ends match ids */
-				struct id_list *i;
-				int idnum = 0;
-
-				for (i = s->ids; i != NULL; i = i->next) {
-					idnum++;
-					if (any_id(&i->id)) {
-						/*
-						 * match any will
-						 * automatically match
-						 * local and remote so
-						 * treat it as its own
-						 * match type so that
-						 * specific matches
-						 * get a higher
-						 * "match" value and
-						 * are used in
-						 * preference to "any"
-						 * matches.
-						 */
-						match |= match_any;
-					} else {
-						if (same_id(&i->id, local_id)) {
-							match |= match_local;
-						}
-
-						if (remote_id != NULL &&
-						    same_id(&i->id, remote_id)) {
-							match |= match_remote;
-						}
+		if (s->ids == NULL) {
+			/*
+			 * a default (signified by lack of ids):
+			 * accept if no more specific match found
+			 */
+			match = match_default;
+		} else {
+			/* check if both ends match ids */
+			struct id_list *i;
+			int idnum = 0;
+
+			for (i = s->ids; i != NULL; i = i->next) {
+				idnum++;
+				if (any_id(&i->id)) {
+					/*
+					 * match any will
+					 * automatically match
+					 * local and remote so
+					 * treat it as its own
+					 * match type so that
+					 * specific matches
+					 * get a higher
+					 * "match" value and
+					 * are used in
+					 * preference to "any"
+					 * matches.
+					 */
+					match |= match_any;
+				} else {
+					if (same_id(&i->id, local_id)) {
+						match |= match_local;
 					}
 
-					if (DBGP(DBG_BASE)) {
-						id_buf idi;
-						id_buf idl;
-						id_buf idr;
-						DBG_log("%d: compared key %s to %s / %s -> 0%02o",
-							idnum,
-							str_id(&i->id, &idi),
-							str_id(local_id, &idl),
-							(remote_id == NULL ? "" : str_id(remote_id, &idr)),
-							match);
+					if (remote_id != NULL &&
+					    same_id(&i->id, remote_id)) {
+						match |= match_remote;
 					}
 				}
 
-				/*
-				 * If our end matched the only id in the list,
-				 * default to matching any peer.
-				 * A more specific match will trump this.
-				 */
-				if (match == match_local &&
-				    s->ids->next == NULL)
-					match |= match_default;
+				if (DBGP(DBG_BASE)) {
+					id_buf idi;
+					id_buf idl;
+					id_buf idr;
+					DBG_log("%d: compared key %s to %s / %s -> 0%02o",
+						idnum,
+						str_id(&i->id, &idi),
+						str_id(local_id, &idl),
+						(remote_id == NULL ? "" : str_id(remote_id, &idr)),
+						match);
+				}
 			}
 
-			dbg("line %d: match=0%02o", s->pks.line, match);
+			/*
+			 * If our end matched the only id in the list,
+			 * default to matching any peer.
+			 * A more specific match will trump this.
+			 */
+			if (match == match_local &&
+			    s->ids->next == NULL)
+				match |= match_default;
+		}
+
+		dbg("line %d: match=0%02o", s->pks.line, match);
 
-			switch (match) {
-			case match_local:
+		switch (match) {
+		case match_local:
+			/*
+			 * if this is an asymmetric
+			 * (eg. public key) system, allow
+			 * this-side-only match to count, even
+			 * if there are other ids in the list.
+			 */
+			if (!asym)
+				break;
+			/* FALLTHROUGH */
+		case match_default:	/* default all */
+		case match_any:	/* a wildcard */
+		case match_local | match_default:	/* default peer */
+		case match_local | match_any: /* %any/0.0.0.0 and local */
+		case match_remote | match_any: /* %any/0.0.0.0 and remote */
+		case match_local | match_remote:	/* explicit */
+			if (match == *best_match) {
 				/*
-				 * if this is an asymmetric
-				 * (eg. public key) system, allow
-				 * this-side-only match to count, even
-				 * if there are other ids in the list.
+				 * two good matches are equally good:
+				 * do they agree?
 				 */
-				if (!asym)
+				bool same = FALSE;
+
+				switch (kind) {
+				case PKK_NULL:
+					same = TRUE;
+					break;
+				case PKK_PSK:
+					same = hunk_eq(s->pks.u.preshared_secret,
+						       (*best)->pks.u.preshared_secret);
 					break;
-				/* FALLTHROUGH */
-			case match_default:	/* default all */
-			case match_any:	/* a wildcard */
-			case match_local | match_default:	/* default peer */
-			case match_local | match_any: /* %any/0.0.0.0 and local */
-			case match_remote | match_any: /* %any/0.0.0.0 and remote */
-			case match_local | match_remote:	/* explicit */
-				if (match == best_match) {
+				case PKK_RSA:
 					/*
-					 * two good matches are equally good:
-					 * do they agree?
+					 * Dirty trick: since we have
+					 * code to compare RSA public
+					 * keys, but not private keys,
+					 * we make the assumption that
+					 * equal public keys mean equal
+					 * private keys. This ought to
+					 * work.
 					 */
-					bool same = FALSE;
-
-					switch (kind) {
-					case PKK_NULL:
-						same = TRUE;
-						break;
-					case PKK_PSK:
-						same = hunk_eq(s->pks.u.preshared_secret,
-							       best->pks.u.preshared_secret);
-						break;
-					case PKK_RSA:
-						/*
-						 * Dirty trick: since we have
-						 * code to compare RSA public
-						 * keys, but not private keys,
-						 * we make the assumption that
-						 * equal public keys mean equal
-						 * private keys. This ought to
-						 * work.
-						 */
-						same = same_RSA_public_key(
-							&s->pks.u.RSA_private_key.pub,
-							&best->pks.u.RSA_private_key.pub);
-						break;
-					case PKK_ECDSA:
-						/* there are no ECDSA kind of secrets */
-						/* ??? this seems not to be the case */
-						break;
-					case PKK_XAUTH:
-						/*
-						 * We don't support this yet,
-						 * but no need to die
-						 */
-						break;
-					case PKK_PPK:
-						same = hunk_eq(s->pks.ppk,
-							       best->pks.ppk);
-						break;
-					default:
-						bad_case(kind);
-					}
-					if (!same) {
-						dbg("multiple ipsec.secrets entries with distinct secrets match endpoints: first secret used");
-						/*
-						 * list is backwards:
-						 * take latest in list
-						 */
-						best = s;
-					}
-				} else if (match > best_match) {
-					dbg("match 0%02o beats previous best_match 0%02o match=%p (line=%d)",
-					    match,
-					    best_match,
-					    s, s->pks.line);
-
-					/* this is the best match so far */
-					best_match = match;
-					best = s;
-				} else {
-					dbg("match 0%02o loses to best_match 0%02o",
-					    match, best_match);
+					same = same_RSA_public_key(
+						&s->pks.u.RSA_private_key.pub,
+						&(*best)->pks.u.RSA_private_key.pub);
+					break;
+				case PKK_ECDSA:
+					/* there are no ECDSA kind of secrets */
+					/* ??? this seems not to be the case */
+					break;
+				case PKK_XAUTH:
+					/*
+					 * We don't support this yet,
+					 * but no need to die
+					 */
+					break;
+				case PKK_PPK:
+					same = hunk_eq(s->pks.ppk,
+						       (*best)->pks.ppk);
+					break;
+				default:
+					bad_case(kind);
 				}
+				if (!same) {
+					dbg("multiple ipsec.secrets entries with distinct secrets match endpoints: first secret used");
+					/*
+					 * list is backwards:
+					 * take latest in list
+					 */
+					*best = s;
+				}
+			} else if (match > *best_match) {
+				dbg("match 0%02o beats previous best_match 0%02o match=%p (line=%d)",
+				    match,
+				    *best_match,
+				    s, s->pks.line);
+
+				/* this is the best match so far */
+				*best_match = match;
+				*best = s;
+			} else {
+				dbg("match 0%02o loses to best_match 0%02o",
+				    match, *best_match);
 			}
 		}
 	}
+}
+
+/*
+ * Gather the secrets that could match LOCAL_ID or REMOTE_ID (see
+ * struct secrets_index) in list order, i.e., newest first.
+ */
+
+static int secret_newest_first(const void *l, const void *r)
+{
+	const struct secret *ls = *(const struct secret *const *)l;
+	const struct secret *rs = *(const struct secret *const *)r;
+	return (ls->serial < rs->serial ? 1 :
+		ls->serial > rs->serial ? -1 : 0);
+}
+
+static void add_candidates(struct secrets_index *index,
+			   const struct secret_ref *refs,
+			   bool by_hash, uint64_t hash,
+			   struct secret ***candidates,
+			   unsigned *nr_candidates,
+			   unsigned *max_candidates)
+{
+	for (const struct secret_ref *r = refs; r != NULL; r = r->next) {
+		struct secret *s = r->secret;
+		if ((by_hash && r->hash != hash) ||
+		    s->visited == index->visits) {
+			continue;
+		}
+		s->visited = index->visits;
+		if (*nr_candidates == *max_candidates) {
+			*max_candidates = (*max_candidates == 0 ? 16 : 2 * *max_candidates);
+			struct secret **grown = alloc_things(struct secret *, *max_candidates,
+							     "secret candidates");
+			if (*nr_candidates > 0) {
+				memcpy(grown, *candidates, *nr_candidates * sizeof(grown[0]));
+			}
+			pfreeany(*candidates);
+			*candidates = grown;
+		}
+		(*candidates)[(*nr_candidates)++] = s;
+	}
+}
+
+struct secret *lsw_find_secret_by_id(struct secret *secrets,
+				     enum PrivateKeyKind kind,
+				     const struct id *local_id,
+				     const struct id *remote_id,
+				     bool asym)
+{
+	unsigned int best_match = match_none;
+	struct secret *best = NULL;
+
+	if (secrets == NULL) {
+		/* nothing to match */
+	} else if (local_id->kind == ID_NONE ||
+		   (remote_id != NULL && remote_id->kind == ID_NONE)) {
+		/* same_id() treats ID_NONE as matching everything */
+		for (struct secret *s = secrets; s != NULL; s = s->next) {
+			match_secret_by_id(s, kind, local_id, remote_id, asym,
+					   &best_match, &best);
+		}
+	} else {
+		struct secrets_index *index = secrets->index;
+		struct secret **candidates = NULL;
+		unsigned nr_candidates = 0;
+		unsigned max_candidates = 0;
+		index->visits++;
+		add_candidates(index, index->wildcards, false, 0,
+			       &candidates, &nr_candidates, &max_candidates);
+		uint64_t local_hash = hash_id(index, local_id);
+		add_candidates(index, secret_bucket(&index->by_id, local_hash),
+			       true, local_hash,
+			       &candidates, &nr_candidates, &max_candidates);
+		if (remote_id != NULL) {
+			uint64_t remote_hash = hash_id(index, remote_id);
+			add_candidates(index, secret_bucket(&index->by_id, remote_hash),
+				       true, remote_hash,
+				       &candidates, &nr_candidates, &max_candidates);
+		}
+		dbg("%u of %lu secrets are candidates", nr_candidates, index->serial);
+		if (nr_candidates > 1) {
+			qsort(candidates, nr_candidates, sizeof(candidates[0]),
+			      secret_newest_first);
+		}
+		for (unsigned i = 0; i < nr_candidates; i++) {
+			match_secret_by_id(candidates[i], kind, local_id, remote_id, asym,
+					   &best_match, &best);
+		}
+		pfreeany(candidates);
+	}
 
 	dbg("concluding with best_match=0%02o best=%p (lineno=%d)",
 	    best_match, best,
@@ -1211,6 +1506,7 @@ static void add_secret(struct secret **slist,
 	}
 
 	lock_certs_and_keys(story);
+	index_secret(*slist == NULL ? alloc_secrets_index() : (*slist)->index, s);
 	s->next = *slist;
 	*slist = s;
 	unlock_certs_and_keys(story);
@@ -1492,6 +1788,7 @@ void lsw_free_preshared_secrets(struct secret **psecrets)
 		struct secret *s, *ns;
 
 		libreswan_log("forgetting secrets");
+		free_secrets_index(&(*psecrets)->index);
 
 		for (s = *psecrets; s != NULL; s = ns) {
 			struct id_list *i, *ni;
@@ -0,0 +1,111 @@
+/* SipHash keyed hash, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include <string.h>		/* for memcpy() */
+
+#include "siphash.h"
+
+#define ROTL(X, B) (((X) << (B)) | ((X) >> (64 - (B))))
+
+struct sip {
+	uint64_t v0, v1, v2, v3;
+};
+
+static void sip_round(struct sip *s)
+{
+	s->v0 += s->v1; s->v1 = ROTL(s->v1, 13); s->v1 ^= s->v0; s->v0 = ROTL(s->v0, 32);
+	s->v2 += s->v3; s->v3 = ROTL(s->v3, 16); s->v3 ^= s->v2;
+	s->v0 += s->v3; s->v3 = ROTL(s->v3, 21); s->v3 ^= s->v0;
+	s->v2 += s->v1; s->v1 = ROTL(s->v1, 17); s->v1 ^= s->v2; s->v2 = ROTL(s->v2, 32);
+}
+
+static struct sip sip_init(const struct siphash_key *key)
+{
+	return (struct sip) {
+		.v0 = key->k[0] ^ UINT64_C(0x736f6d6570736575),
+		.v1 = key->k[1] ^ UINT64_C(0x646f72616e646f6d),
+		.v2 = key->k[0] ^ UINT64_C(0x6c7967656e657261),
+		.v3 = key->k[1] ^ UINT64_C(0x7465646279746573),
+	};
+}
+
+static void sip_compress(struct sip *s, uint64_t m, unsigned c_rounds)
+{
+	s->v3 ^= m;
+	for (unsigned r = 0; r < c_rounds; r++) {
+		sip_round(s);
+	}
+	s->v0 ^= m;
+}
+
+static uint64_t sip_finalize(struct sip *s, unsigned d_rounds)
+{
+	s->v2 ^= 0xff;
+	for (unsigned r = 0; r < d_rounds; r++) {
+		sip_round(s);
+	}
+	return s->v0 ^ s->v1 ^ s->v2 ^ s->v3;
+}
+
+static uint64_t load_le64(const uint8_t *p)
+{
+	uint64_t w = 0;
+	for (unsigned i = 0; i < 8; i++) {
+		w |= (uint64_t)p[i] << (8 * i);
+	}
+	return w;
+}
+
+static uint64_t siphash(const struct siphash_key *key, const void *data, size_t len,
+			unsigned c_rounds, unsigned d_rounds)
+{
+	struct sip s = sip_init(key);
+	const uint8_t *bytes = data;
+	const uint8_t *end = bytes + (len & ~(size_t)7);
+	for (; bytes < end; bytes += 8) {
+		sip_compress(&s, load_le64(bytes), c_rounds);
+	}
+	/* last block: remaining bytes, length in the top byte */
+	uint8_t tail[8] = { [7] = (uint8_t)len, };
+	memcpy(tail, bytes, len & 7);
+	sip_compress(&s, load_le64(tail), c_rounds);
+	return sip_finalize(&s, d_rounds);
+}
+
+uint64_t siphash13(const struct siphash_key *key, const void *data, size_t len)
+{
+	return siphash(key, data, len, 1, 3);
+}
+
+uint64_t siphash24(const struct siphash_key *key, const void *data, size_t len)
+{
+	return siphash(key, data, len, 2, 4);
+}
+
+uint64_t siphash13_u64(const struct siphash_key *key, uint64_t w0)
+{
+	struct sip s = sip_init(key);
+	sip_compress(&s, w0, 1);
+	sip_compress(&s, (uint64_t)8 << 56, 1);
+	return sip_finalize(&s, 3);
+}
+
+uint64_t siphash13_u64x2(const struct siphash_key *key, uint64_t w0, uint64_t w1)
+{
+	struct sip s = sip_init(key);
+	sip_compress(&s, w0, 1);
+	sip_compress(&s, w1, 1);
+	sip_compress(&s, (uint64_t)16 << 56, 1);
+	return sip_finalize(&s, 3);
+}
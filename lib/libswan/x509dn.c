@@ -1015,6 +1015,46 @@ bool match_dn(chunk_t a, chunk_t b, int *wildcards)
 	return TRUE;
 }
 
+/*
+ * Feed the OID and value of each RDN in DN to FOLD, with the value
+ * lower-cased, so that DNs that are same_dn() produce the same byte
+ * sequence; used to hash a DN.  Returns FALSE when DN can't be
+ * parsed (what was folded should then be discarded).
+ */
+bool fold_dn(chunk_t dn, void (*fold)(const void *ptr, size_t len, void *arg),
+	     void *arg)
+{
+	chunk_t rdn;
+	chunk_t attribute;
+	bool more;
+
+	if (init_rdn(dn, &rdn, &attribute, &more) != NULL)
+		return FALSE;
+
+	while (more) {
+		chunk_t oid;
+		chunk_t value_ber;
+		asn1_t value_type;
+		chunk_t value_content;
+
+		if (get_next_rdn(&rdn, &attribute, &oid, &value_ber,
+				 &value_type, &value_content, &more) != NULL)
+			return FALSE;
+
+		fold(oid.ptr, oid.len, arg);
+
+		/* lower-case the value a block at a time */
+		uint8_t block[64];
+		for (size_t i = 0; i < value_content.len; i += sizeof(block)) {
+			size_t n = min(sizeof(block), value_content.len - i);
+			for (size_t j = 0; j < n; j++)
+				block[j] = tolower(value_content.ptr[i + j]);
+			fold(block, n, arg);
+		}
+	}
+	return TRUE;
+}
+
 /*
  * free the dynamic memory used to store generalNames
  */
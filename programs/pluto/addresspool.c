@@ -39,207 +39,153 @@
 #include "ip_range.h"
 #include "log.h"
 #include "state_db.h"
-
-#define SENTINEL (unsigned)-1
-#define ENTRY_UNUSED (unsigned)-2
-
-struct entry {
-	unsigned prev;
-	unsigned next;
-};
-
-static const struct entry empty_entry = {
-	.prev = ENTRY_UNUSED,
-	.next = ENTRY_UNUSED,
-};
-
-struct list {
-	unsigned first;
-	unsigned last;
-	unsigned nr;
-};
-
-static const struct list empty_list = {
-	.nr = 0,
-	.first = SENTINEL,
-	.last = SENTINEL,
-};
-
-#define IS_INSERTED(WHAT, LIST) (WHAT->LIST.prev != ENTRY_UNUSED || \
-				 WHAT->LIST.next != ENTRY_UNUSED)
-
-#define IS_EMPTY(WHAT, LIST)						\
-	({								\
-		bool empty_ = (WHAT->LIST.nr == 0);			\
-		if (empty_) {						\
-			passert(WHAT->LIST.first == SENTINEL);		\
-			passert(WHAT->LIST.last == SENTINEL);		\
-		} else {						\
-			passert(WHAT->LIST.first != SENTINEL);		\
-			passert(WHAT->LIST.first < pool->nr_leases);	\
-			passert(WHAT->LIST.last != SENTINEL);		\
-			passert(WHAT->LIST.last < pool->nr_leases);	\
-                }							\
-	        empty_;							\
-        })
-
-#define HEAD(WHAT, LIST, ENTRY)						\
-	({								\
-		struct lease *result_;					\
-		if (IS_EMPTY(WHAT, LIST)) {				\
-			result_ = NULL;					\
-		} else {						\
-			result_ = &pool->leases[WHAT->LIST.first];	\
-		}							\
-		result_;						\
-	})
-
-#define REMOVE(WHAT, LIST, ENTRY, LEASE)				\
-	{								\
-		passert(IS_INSERTED(LEASE, ENTRY));			\
-		unsigned index = LEASE - pool->leases;			\
-		if (WHAT->LIST.first == index) {			\
-			WHAT->LIST.first = LEASE->ENTRY.next;		\
-		} else {						\
-			/* not first; must have prev */			\
-			passert(LEASE->ENTRY.prev != SENTINEL);		\
-			passert(LEASE->ENTRY.prev < pool->nr_leases);	\
-			pool->leases[LEASE->ENTRY.prev].ENTRY.next =	\
-				LEASE->ENTRY.next;			\
-		}							\
-		if (WHAT->LIST.last == index) {				\
-			WHAT->LIST.last = LEASE->ENTRY.prev;		\
-		} else {						\
-			/* not last; must have next */			\
-			passert(LEASE->ENTRY.next != SENTINEL);		\
-			passert(LEASE->ENTRY.next < pool->nr_leases);	\
-			pool->leases[LEASE->ENTRY.next].ENTRY.prev =	\
-				LEASE->ENTRY.prev;			\
-		}							\
-		LEASE->ENTRY.next = LEASE->ENTRY.prev = ENTRY_UNUSED;	\
-		WHAT->LIST.nr--;					\
-		passert(!IS_INSERTED(LEASE, ENTRY));			\
-	}
-
-#define FILL(WHAT, LIST, ENTRY, LEASE)					\
-	{								\
-		/* empty */						\
-		unsigned index = LEASE - pool->leases;			\
-		WHAT->LIST.first = WHAT->LIST.last = index;		\
-		LEASE->ENTRY.next = LEASE->ENTRY.prev = SENTINEL;	\
-	}
-
-#define APPEND(WHAT, LIST, ENTRY, LEASE)				\
-	{								\
-		passert(!IS_INSERTED(LEASE, ENTRY));			\
-		if (IS_EMPTY(WHAT, LIST)) {				\
-			FILL(WHAT, LIST, ENTRY, LEASE);			\
-		} else {						\
-			unsigned index = LEASE - pool->leases;		\
-			unsigned old_last = WHAT->LIST.last;		\
-			LEASE->ENTRY.next = SENTINEL;			\
-			LEASE->ENTRY.prev = old_last;			\
-			pool->leases[old_last].ENTRY.next = index;	\
-			WHAT->LIST.last = index;			\
-		}							\
-		WHAT->LIST.nr++;					\
-		passert(IS_INSERTED(LEASE, ENTRY));			\
-	}
-
-#define PREPEND(WHAT, LIST, ENTRY, LEASE)				\
-	{								\
-		passert(!IS_INSERTED(LEASE, ENTRY));			\
-		if (IS_EMPTY(WHAT, LIST)) {				\
-			/* empty */					\
-			FILL(WHAT, LIST, ENTRY, LEASE);			\
-		} else {						\
-			unsigned index = LEASE - WHAT->leases;		\
-			unsigned old_first = WHAT->LIST.first;		\
-			LEASE->ENTRY.next = old_first;			\
-			LEASE->ENTRY.prev = SENTINEL;			\
-			pool->leases[old_first].ENTRY.prev = index;	\
-			WHAT->LIST.first = index;			\
-		}							\
-		WHAT->LIST.nr++;					\
-		passert(IS_INSERTED(LEASE, ENTRY));			\
-	}
+#include "spd_route_db.h"
+#include "hash_table.h"
+#include "free_bitmap.h"
 
 /*
  * A pool is a range of IP addresses to be individually allocated.
  * A connection may have a pool.
  * That pool may be shared with other connections (hence the reference count).
  *
- * A pool has a linked list of leases.
+ * A pool has an array of leases, one per address that has been
+ * handed out (so far).
  */
 
 struct lease {
 	co_serial_t assigned_to; /* ALWAYS 1:1 */
-
-	struct entry free_entry;
-	struct entry reusable_entry;
+	unsigned index;		/* address is r.start+index */
+	struct ip_pool *pool;
 
 	char *reusable_name;
-	struct list reusable_bucket;
+	struct list_entry reusable_name_entry;	/* in lease_names */
+	struct list_entry lingering_entry;	/* on pool->lingering */
 };
 
+/*
+ * The lease array grows by doubling.  So that a lease never moves,
+ * each doubling is a new segment: segment 0 has lease 0, segment S>0
+ * has leases [2^(S-1)..2^S).
+ */
+#define NR_LEASE_SEGMENTS 33
+
 struct ip_pool {
 	unsigned pool_refcount;	/* reference counted! */
 	ip_range r;
 	uint32_t size; /* number of addresses within range */
 
 	unsigned nr_reusable;
-	struct list free_list;
 	unsigned nr_in_use;	/* active */
-	/* --- .free.nr + .nr_in_use --- */
-	unsigned nr_leases;	/* nr elements in leases array */
+	/* --- .free_leases.nr_free + .nr_lingering + .nr_in_use --- */
+	unsigned nr_leases;	/* nr leases in segments */
+
+	/*
+	 * Leases that are free: never used, or a one-time lease that
+	 * was returned.  The lowest address is handed out first.
+	 */
+	struct free_bitmap free_leases;
 
 	/*
-	 * An array of leases with NR_LEASES elements.  Entry A is for
-	 * address r.start+A.
+	 * Reusable leases that are not in use, oldest first.  Only
+	 * when there are no free leases is one stolen.
 	 */
-	struct lease *leases;
+	struct list_head lingering;
+	unsigned nr_lingering;
+
+	struct lease *segments[NR_LEASE_SEGMENTS];
 
 	struct ip_pool *next;	/* next pool */
 };
 
 static struct ip_pool *pluto_pools = NULL;
 
+static unsigned lease_segment(unsigned index)
+{
+	return index == 0 ? 0 : 32 - __builtin_clz(index);
+}
+
+static unsigned segment_start(unsigned segment)
+{
+	return segment == 0 ? 0 : 1U << (segment - 1);
+}
+
+static struct lease *lease_by_index(const struct ip_pool *pool, unsigned index)
+{
+	passert(index < pool->nr_leases);
+	unsigned segment = lease_segment(index);
+	return &pool->segments[segment][index - segment_start(segment)];
+}
+
+static unsigned nr_free_leases(const struct ip_pool *pool)
+{
+	return pool->free_leases.nr_free + pool->nr_lingering;
+}
+
 static void free_lease_content(struct lease *lease)
 {
 	pfreeany(lease->reusable_name);
 }
 
-static unsigned hasher(const char *name)
+static void jam_lease(struct lswlog *buf, const void *data)
 {
-	/*
-	 * 251 is a prime close to 256 (so like <<8).
-	 *
-	 * There's no real rationale for doing this.
-	 */
-	unsigned hash = 0;
-	for (const char *c = name; *c; c++) {
-		hash = hash * 251 + (uint8_t) *c;
+	if (data == NULL) {
+		jam(buf, "lease NULL");
+	} else {
+		const struct lease *lease = data;
+		jam(buf, "lease %u '%s'", lease->index,
+		    lease->reusable_name == NULL ? "" : lease->reusable_name);
 	}
-	return hash;
 }
 
-static struct lease *lease_id_bucket(struct ip_pool *pool, const char *name)
+static const struct list_info lingering_lease_info = {
+	.name = "lingering leases",
+	.jam = jam_lease,
+};
+
+/*
+ * Reusable leases, of all pools, indexed by pool and name.
+ */
+
+static hash_t lease_name_hasher(const struct ip_pool *pool, const char *name)
+{
+	return hash_table_hasher(shunk1(name),
+				 hash_table_hash_u64((uintptr_t)pool));
+}
+
+static hash_t reusable_name_hasher(const void *data)
+{
+	const struct lease *lease = data;
+	return lease_name_hasher(lease->pool, lease->reusable_name);
+}
+
+static struct list_entry *reusable_name_entry(void *data)
 {
-	unsigned hash = hasher(name);
-	return &pool->leases[hash % pool->nr_leases];
+	struct lease *lease = data;
+	return &lease->reusable_name_entry;
 }
 
+static struct list_head lease_name_slots[STATE_TABLE_SIZE];
+
+static struct hash_table lease_names = {
+	.info = {
+		.name = "addresspool lease name table",
+		.jam = jam_lease,
+	},
+	.hasher = reusable_name_hasher,
+	.entry = reusable_name_entry,
+	.nr_slots = elemsof(lease_name_slots),
+	.slots = lease_name_slots,
+};
+
 static void hash_lease_id(struct ip_pool *pool, struct lease *lease)
 {
-	struct lease *bucket = lease_id_bucket(pool, lease->reusable_name);
-	APPEND(bucket, reusable_bucket, reusable_entry, lease);
+	add_hash_table_entry(&lease_names, lease);
 	pool->nr_reusable++;
 }
 
 static void unhash_lease_id(struct ip_pool *pool, struct lease *lease)
 {
-	struct lease *bucket = lease_id_bucket(pool, lease->reusable_name);
-	REMOVE(bucket, reusable_bucket, reusable_entry, lease);
+	del_hash_table_entry(&lease_names, lease);
 	pool->nr_reusable--;
 }
 
@@ -256,8 +202,7 @@ static ip_address lease_address(const struct ip_pool *pool,
 	ptr += addr_chunk.len - sizeof(addr_n);
 	memcpy(&addr_n, ptr, sizeof(addr_n));
 	/* new value - overflow? */
-	unsigned i = lease - pool->leases;
-	addr_n = htonl(ntohl(addr_n) + i);
+	addr_n = htonl(ntohl(addr_n) + lease->index);
 	/* put it back */
 	memcpy(ptr, &addr_n, sizeof(addr_n));
 	return addr;
@@ -279,7 +224,7 @@ static void DBG_pool(bool verbose, const struct ip_pool *pool,
 		if (verbose) {
 			jam(buf, "; pool-refcount %u size %u leases %u in-use %u free %u reusable %u",
 			    pool->pool_refcount, pool->size, pool->nr_leases,
-			    pool->nr_in_use, pool->free_list.nr, pool->nr_reusable);
+			    pool->nr_in_use, nr_free_leases(pool), pool->nr_reusable);
 		}
 	}
 }
@@ -308,7 +253,7 @@ static void DBG_lease(bool verbose, const struct ip_pool *pool, const struct lea
 		if (verbose) {
 			jam(buf, "; leases %u in-use %u free %u reusable %u",
 			    pool->nr_leases, pool->nr_in_use,
-			    pool->free_list.nr, pool->nr_reusable);
+			    nr_free_leases(pool), pool->nr_reusable);
 		}
 	}
 }
@@ -387,7 +332,7 @@ static struct lease *connection_lease(struct connection *c)
 	uint32_t i = ntohl_address(&cp) - ntohl_address(&pool->r.start);
 	passert(pool->nr_leases <= pool->size);
 	passert(i < pool->nr_leases);
-	struct lease *lease = &pool->leases[i];
+	struct lease *lease = lease_by_index(pool, i);
 	pexpect(co_serial_is_set(lease->assigned_to));
 	pexpect(co_serial_eq(lease->assigned_to, c->serialno));
 	return lease;
@@ -418,7 +363,8 @@ void free_that_address_lease(struct connection *c)
 	struct ip_pool *pool = c->pool;
 	if (lease->reusable_name != NULL) {
 		/* the lease is reusable, leave it lingering */
-		APPEND(pool, free_list, free_entry, lease);
+		insert_list_entry(&pool->lingering, &lease->lingering_entry);
+		pool->nr_lingering++;
 		pool->nr_in_use--;
 		if (DBGP(DBG_BASE)) {
 			connection_buf cb;
@@ -427,7 +373,7 @@ void free_that_address_lease(struct connection *c)
 		}
 	} else {
 		/* cannot share: free it */
-		PREPEND(pool, free_list, free_entry, lease);
+		release_free_bitmap(&pool->free_leases, lease->index);
 		pool->nr_in_use--;
 		if (DBGP(DBG_BASE)) {
 			connection_buf cb;
@@ -448,24 +394,20 @@ void free_that_address_lease(struct connection *c)
 static struct lease *recover_lease(const struct connection *c, const char *that_name)
 {
 	struct ip_pool *pool = c->pool;
-	if (pool->nr_leases == 0) {
-		return NULL;
-	}
-
-	struct lease *bucket = lease_id_bucket(pool, that_name);
-	if (IS_EMPTY(bucket, reusable_bucket)) {
+	if (pool->nr_reusable == 0) {
 		return NULL;
 	}
 
+	struct list_head *bucket =
+		hash_table_bucket(&lease_names, lease_name_hasher(pool, that_name));
 	struct lease *lease;
-	for (unsigned current = bucket->reusable_bucket.first;
-	     current != SENTINEL; current = lease->reusable_entry.next) {
-		passert(current < pool->nr_leases);
-		lease = &pool->leases[current];
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, lease) {
 		passert(lease->reusable_name != NULL);
-		if (streq(that_name, lease->reusable_name)) {
-			if (IS_INSERTED(lease, free_entry)) {
-				REMOVE(pool, free_list, free_entry, lease);
+		if (lease->pool == pool &&
+		    streq(that_name, lease->reusable_name)) {
+			if (!detached_list_entry(&lease->lingering_entry)) {
+				remove_list_entry(&lease->lingering_entry);
+				pool->nr_lingering--;
 				pool->nr_in_use++;
 			}
 			if (DBGP(DBG_BASE)) {
@@ -479,6 +421,56 @@ static struct lease *recover_lease(const struct connection *c, const char *that_
 	return NULL;
 }
 
+static struct lease *oldest_lingering_lease(struct ip_pool *pool)
+{
+	struct lease *lease;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&pool->lingering, lease) {
+		return lease;
+	}
+	return NULL;
+}
+
+/*
+ * Double the number of leases, adding the new ones to the free
+ * bitmap; nothing already leased moves.
+ */
+
+static bool grow_addresspool(struct ip_pool *pool)
+{
+	if (pool->nr_leases >= pool->size) {
+		return false;
+	}
+	unsigned old_nr_leases = pool->nr_leases;
+	if (pool->nr_leases == 0) {
+		pool->nr_leases = min(1U, pool->size);
+	} else {
+		pool->nr_leases = min((uint64_t)pool->nr_leases * 2,
+				      (uint64_t)pool->size);
+	}
+	unsigned segment = lease_segment(old_nr_leases);
+	passert(segment < elemsof(pool->segments));
+	passert(pool->segments[segment] == NULL);
+	passert(segment_start(segment) == old_nr_leases);
+	unsigned nr = pool->nr_leases - old_nr_leases;
+	struct lease *leases = alloc_things(struct lease, nr, "leases");
+	for (unsigned l = 0; l < nr; l++) {
+		struct lease *lease = &leases[l];
+		*lease = (struct lease) {
+			.index = old_nr_leases + l,
+			.pool = pool,
+		};
+		lease->reusable_name_entry = list_entry(&lease_names.info, lease);
+		lease->lingering_entry = list_entry(&lingering_lease_info, lease);
+	}
+	pool->segments[segment] = leases;
+	grow_free_bitmap(&pool->free_leases, pool->nr_leases);
+	if (DBGP(DBG_BASE)) {
+		DBG_pool(false, pool, "growing address pool from %u to %u",
+			 old_nr_leases, pool->nr_leases);
+	}
+	return true;
+}
+
 err_t lease_that_address(struct connection *c, const struct state *st)
 {
 	struct lease *lease = connection_lease(c);
@@ -524,69 +516,34 @@ err_t lease_that_address(struct connection *c, const struct state *st)
 		story = "recovered";
 	}
 	if (new_lease == NULL) {
-		if (IS_EMPTY(pool, free_list)) {
-			/* try to grow the address pool */
-			if (pool->nr_leases >= pool->size) {
-				if (DBGP(DBG_BASE)) {
-					DBG_pool(true, pool, "no free address and no space to grow");
-				}
-				return "no free address in addresspool"; /* address pool exhausted */
-			}
-			unsigned old_nr_leases = pool->nr_leases;
-			if (pool->nr_leases == 0) {
-				pool->nr_leases = min(1U, pool->size);
-			} else {
-				pool->nr_leases = min(pool->nr_leases * 2, pool->size);
-			}
-			realloc_things(pool->leases, old_nr_leases, pool->nr_leases, "leases");
-			DBG_pool(false, pool, "growing address pool from %u to %u",
-				 old_nr_leases, pool->nr_leases);
-			/* initialize new leases (and add to free list) */
-			for (unsigned l = old_nr_leases; l < pool->nr_leases; l++) {
-				struct lease *lease = &pool->leases[l];
-				/*
-				 * Danger: must initialize entire
-				 * struct as resize_things(), which
-				 * may use realloc(), can leave the
-				 * data uninitialized.
-				 */
-				*lease = (struct lease) {
-					.free_entry = empty_entry,
-					.reusable_entry = empty_entry,
-					.reusable_bucket = empty_list,
-				};
-				PREPEND(pool, free_list, free_entry, lease);
-			}
-			/* destroy existing hash table */
-			for (unsigned l = 0; l < old_nr_leases; l++) {
-				struct lease *lease = &pool->leases[l];
-				lease->reusable_entry = empty_entry;
-				lease->reusable_bucket = empty_list;
-			}
-			/* build a new hash table containing old */
-			pool->nr_reusable = 0;
-			for (unsigned l = 0; l < old_nr_leases; l++) {
-				struct lease *lease = &pool->leases[l];
-				if (lease->reusable_name != NULL) {
-					hash_lease_id(pool, lease);
-				}
-			}
-		}
-		new_lease = HEAD(pool, free_list, free_entry);
-		passert(new_lease != NULL);
-		REMOVE(pool, free_list, free_entry, new_lease);
-		pool->nr_in_use++;
-		if (new_lease->reusable_name != NULL) {
-			/* oops; takeing over this lingering lease */
+		unsigned index;
+		struct lease *lingering;
+		if (take_free_bitmap(&pool->free_leases, &index)) {
+			new_lease = lease_by_index(pool, index);
+			passert(new_lease->reusable_name == NULL);
+			story = "unused";
+		} else if ((lingering = oldest_lingering_lease(pool)) != NULL) {
+			/* oops; taking over this lingering lease */
+			new_lease = lingering;
 			if (DBGP(DBG_BASE)) {
 				DBG_lease(false, pool, new_lease, "stealing reusable lease from '%s'",
 					  new_lease->reusable_name);
 			}
+			remove_list_entry(&new_lease->lingering_entry);
+			pool->nr_lingering--;
 			unhash_lease_id(pool, new_lease);
 			story = "stolen";
-		} else {
+		} else if (grow_addresspool(pool) &&
+			   take_free_bitmap(&pool->free_leases, &index)) {
+			new_lease = lease_by_index(pool, index);
 			story = "unused";
+		} else {
+			if (DBGP(DBG_BASE)) {
+				DBG_pool(true, pool, "no free address and no space to grow");
+			}
+			return "no free address in addresspool"; /* address pool exhausted */
 		}
+		pool->nr_in_use++;
 		free_lease_content(new_lease);
 		if (reusable) {
 			new_lease->reusable_name = clone_str(thatstr, "lease name");
@@ -603,6 +560,7 @@ err_t lease_that_address(struct connection *c, const struct state *st)
 	c->spd.that.has_lease = true;
 	c->spd.that.has_client = true;
 	c->spd.that.client = selector_from_address(&ia, &unset_protoport);
+	rehash_spd_routes(c);
 	new_lease->assigned_to = c->serialno;
 
 	if (DBGP(DBG_BASE)) {
@@ -632,9 +590,16 @@ static void free_addresspool(struct ip_pool *pool)
 		if (*pp == pool) {
 			*pp = pool->next;	/* unlink pool */
 			for (unsigned l = 0; l < pool->nr_leases; l++) {
-				free_lease_content(&pool->leases[l]);
+				struct lease *lease = lease_by_index(pool, l);
+				if (lease->reusable_name != NULL) {
+					unhash_lease_id(pool, lease);
+				}
+				free_lease_content(lease);
+			}
+			for (unsigned s = 0; s < elemsof(pool->segments); s++) {
+				pfreeany(pool->segments[s]);
 			}
-			pfreeany(pool->leases);
+			free_free_bitmap(&pool->free_leases);
 			pfree(pool);
 			return;
 		}
@@ -756,8 +721,10 @@ struct ip_pool *install_addresspool(const ip_range *pool_range)
 
 		pool->nr_in_use = 0;
 		pool->nr_leases = 0;
-		pool->free_list = empty_list;
-		pool->leases = NULL;
+		pool->free_leases = (struct free_bitmap) EMPTY_FREE_BITMAP;
+		pool->lingering = (struct list_head) INIT_LIST_HEAD(&pool->lingering,
+								    &lingering_lease_info);
+		pool->nr_lingering = 0;
 		/* insert */
 		pool->next = *head;
 		*head = pool;
@@ -769,6 +736,11 @@ struct ip_pool *install_addresspool(const ip_range *pool_range)
 	return pool;
 }
 
+void init_addresspools(void)
+{
+	init_hash_table(&lease_names);
+}
+
 void show_addresspool_status(struct show *s)
 {
 	show_separator(s);
@@ -783,25 +755,27 @@ void show_addresspool_status(struct show *s)
 		show_comment(s, "address pool %s: %u addresses, %u leases, %u in-use, %u free (%u reusable)",
 			     str_range(&pool->r, &rb),
 			     pool->size, pool->nr_leases, pool->nr_in_use,
-			     pool->free_list.nr,
+			     nr_free_leases(pool),
 			     pool->nr_reusable);
 		unsigned nr_free = 0;
 		unsigned nr_reusable_entries = 0;
 		unsigned nr_reusable_names = 0;
 		for (unsigned l = 0; l < pool->nr_leases; l++) {
-			struct lease *lease = &pool->leases[l];
+			struct lease *lease = lease_by_index(pool, l);
+			bool free = (is_free_bitmap(&pool->free_leases, l) ||
+				     !detached_list_entry(&lease->lingering_entry));
 			ip_address lease_ip = lease_address(pool, lease);
 			address_buf lease_ipb;
 			const char *lease_str = str_address(&lease_ip, &lease_ipb);
 			struct connection *c = connection_by_serialno(lease->assigned_to);
-			nr_free += IS_INSERTED(lease, free_entry) ? 1 : 0;
-			nr_reusable_entries += IS_INSERTED(lease, reusable_entry) ? 1 : 0;
+			nr_free += free ? 1 : 0;
+			nr_reusable_entries += detached_list_entry(&lease->reusable_name_entry) ? 0 : 1;
 			nr_reusable_names += lease->reusable_name != NULL ? 1 : 0;
 			{
 				/* fudge indent so show*() calls are aligned */
 				show_comment(s, "    %*s %s "PRI_CO" %s%s",
 					     (int)strlen(lease_str), lease_str,
-					     IS_INSERTED(lease, free_entry) ? "free" : "assigned to",
+					     free ? "free" : "assigned to",
 					     pri_co(lease->assigned_to),
 					     lease->reusable_name != NULL ? " " : "",
 					     lease->reusable_name != NULL ? lease->reusable_name : "");
@@ -816,10 +790,11 @@ void show_addresspool_status(struct show *s)
 					     (int)strlen(lease_str), "",
 					     pri_co(lease->assigned_to));
 			}
-			CHECK(IS_INSERTED(lease, reusable_entry), lease->reusable_name != NULL);
+			CHECK(!detached_list_entry(&lease->reusable_name_entry),
+			      lease->reusable_name != NULL);
 		}
-		CHECK(pool->nr_leases, pool->nr_in_use + pool->free_list.nr);
-		CHECK(nr_free, pool->free_list.nr);
+		CHECK(pool->nr_leases, pool->nr_in_use + nr_free_leases(pool));
+		CHECK(nr_free, nr_free_leases(pool));
 		CHECK(nr_reusable_entries, pool->nr_reusable);
 		CHECK(nr_reusable_names, pool->nr_reusable);
 #undef CHECK
@@ -1,4 +1,4 @@
-/* Connection database indexed by serialno, for libreswan
+/* Connection database indexed by serialno, name and alias, for libreswan
  *
  * Copyright (C) 2020 Andrew Cagney <cagney@gnu.org>
  *
@@ -13,6 +13,8 @@
  * for more details.
  */
 
+#include <string.h>		/* for strspn() */
+
 #include "connection_db.h"
 #include "connections.h"
 #include "log.h"
@@ -50,7 +52,7 @@ static struct list_head connection_serialno_list_head = INIT_LIST_HEAD(&connecti
 
 static hash_t serialno_hasher(const co_serial_t *serialno)
 {
-	return hash_table_hasher(shunk2(serialno, sizeof(*serialno)), zero_hash);
+	return hash_table_hash_u64(serialno->co);
 }
 
 static hash_t connection_serialno_hasher(const void *data)
@@ -82,6 +84,155 @@ struct connection *connection_by_serialno(co_serial_t serialno)
 	return NULL;
 }
 
+/*
+ * A table hashed by name.
+ *
+ * The hash is saved so that a connection renamed but not yet rehashed
+ * (for instance, one that is still being extracted) is not found
+ * under its new name.
+ */
+
+static hash_t name_hasher(const char *name)
+{
+	return hash_table_hasher(shunk1(name == NULL ? "" : name), zero_hash);
+}
+
+static void jam_connection_name(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "connection NULL");
+	} else {
+		const struct connection *c = data;
+		jam(buf, PRI_CO" %s", pri_co(c->serialno),
+		    c->name == NULL ? "<none>" : c->name);
+	}
+}
+
+static hash_t connection_name_hasher(const void *data)
+{
+	const struct connection *c = data;
+	return c->name_hash;
+}
+
+static struct list_entry *connection_name_entry(void *data)
+{
+	struct connection *c = data;
+	return &c->hash_table_entries[CONNECTION_NAME_HASH_TABLE];
+}
+
+struct list_head *connection_name_bucket(const char *name)
+{
+	return hash_table_bucket(&connection_hash_tables[CONNECTION_NAME_HASH_TABLE],
+				 name_hasher(name));
+}
+
+bool connection_name_indexed(const struct connection *c, const char *name)
+{
+	return (c->name != NULL && streq(c->name, name) &&
+		c->name_hash.hash == name_hasher(name).hash);
+}
+
+/*
+ * A multimap hashed by alias: a connection has an entry for each
+ * distinct (by hash) alias in its .connalias.
+ */
+
+static void jam_connection_alias(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "alias NULL");
+	} else {
+		const struct connection_alias *alias = data;
+		jam_connection_name(buf, alias->connection);
+	}
+}
+
+static hash_t connection_alias_hasher(const void *data)
+{
+	const struct connection_alias *alias = data;
+	return alias->hash;
+}
+
+static struct list_entry *connection_alias_entry(void *data)
+{
+	struct connection_alias *alias = data;
+	return &alias->entry;
+}
+
+static struct list_head alias_hash_slots[STATE_TABLE_SIZE];
+
+static struct hash_table connection_alias_hash_table = {
+	.info = {
+		.name = "connection alias table",
+		.jam = jam_connection_alias,
+	},
+	.hasher = connection_alias_hasher,
+	.entry = connection_alias_entry,
+	.nr_slots = elemsof(alias_hash_slots),
+	.slots = alias_hash_slots,
+};
+
+struct list_head *connection_alias_bucket(const char *alias)
+{
+	return hash_table_bucket(&connection_alias_hash_table,
+				 hash_table_hasher(shunk1(alias), zero_hash));
+}
+
+/* same parsing as lsw_alias_cmp(); returns the next alias, or NULL */
+static const char *next_alias(const char *s, size_t *aw)
+{
+	s += strspn(s, " \t");
+	if (*s == '\0') {
+		return NULL;
+	}
+	*aw = strcspn(s, " \t");
+	return s;
+}
+
+static void add_aliases_to_db(struct connection *c)
+{
+	/* a clone starts out with the template's array */
+	c->aliases = NULL;
+	c->nr_aliases = 0;
+	if (c->connalias == NULL) {
+		return;
+	}
+
+	unsigned max = 0;
+	size_t aw;
+	for (const char *s = c->connalias; (s = next_alias(s, &aw)) != NULL; s += aw) {
+		max++;
+	}
+	if (max == 0) {
+		return;
+	}
+
+	c->aliases = alloc_things(struct connection_alias, max, "connection aliases");
+	for (const char *s = c->connalias; (s = next_alias(s, &aw)) != NULL; s += aw) {
+		hash_t hash = hash_table_hasher(shunk2(s, aw), zero_hash);
+		/* skip duplicates; one entry per bucket is enough */
+		bool dup = false;
+		for (unsigned i = 0; i < c->nr_aliases; i++) {
+			dup |= (c->aliases[i].hash.hash == hash.hash);
+		}
+		if (!dup) {
+			struct connection_alias *alias = &c->aliases[c->nr_aliases++];
+			alias->connection = c;
+			alias->hash = hash;
+			add_hash_table_entry(&connection_alias_hash_table, alias);
+		}
+	}
+}
+
+static void remove_aliases_from_db(struct connection *c)
+{
+	for (unsigned i = 0; i < c->nr_aliases; i++) {
+		del_hash_table_entry(&connection_alias_hash_table, &c->aliases[i]);
+	}
+	pfreeany(c->aliases);
+	c->nr_aliases = 0;
+}
+
 /*
  * Maintain the contents of the hash tables.
  *
@@ -93,7 +244,7 @@ static struct list_head hash_slots[CONNECTION_HASH_TABLES_ROOF][STATE_TABLE_SIZE
 static struct hash_table connection_hash_tables[] = {
 	[CONNECTION_SERIALNO_HASH_TABLE] = {
 		.info = {
-			.name = "st_serialno table",
+			.name = "co_serialno table",
 			.jam = jam_connection_serialno,
 		},
 		.hasher = connection_serialno_hasher,
@@ -101,6 +252,16 @@ static struct hash_table connection_hash_tables[] = {
 		.nr_slots = elemsof(hash_slots[CONNECTION_SERIALNO_HASH_TABLE]),
 		.slots = hash_slots[CONNECTION_SERIALNO_HASH_TABLE],
 	},
+	[CONNECTION_NAME_HASH_TABLE] = {
+		.info = {
+			.name = "connection name table",
+			.jam = jam_connection_name,
+		},
+		.hasher = connection_name_hasher,
+		.entry = connection_name_entry,
+		.nr_slots = elemsof(hash_slots[CONNECTION_NAME_HASH_TABLE]),
+		.slots = hash_slots[CONNECTION_NAME_HASH_TABLE],
+	},
 };
 
 static void add_connection_to_db(struct connection *c)
@@ -113,9 +274,11 @@ static void add_connection_to_db(struct connection *c)
 	insert_list_entry(&connection_serialno_list_head,
 			  &c->serialno_list_entry);
 
+	c->name_hash = name_hasher(c->name);
 	for (unsigned h = 0; h < elemsof(connection_hash_tables); h++) {
 		add_hash_table_entry(&connection_hash_tables[h], c);
 	}
+	add_aliases_to_db(c);
 }
 
 static struct connection *finish_connection(struct connection *c)
@@ -146,6 +309,21 @@ void remove_connection_from_db(struct connection *c)
 	for (unsigned h = 0; h < elemsof(connection_hash_tables); h++) {
 		del_hash_table_entry(&connection_hash_tables[h], c);
 	}
+	remove_aliases_from_db(c);
+}
+
+/*
+ * .name or .connalias changed.
+ */
+void rehash_connection_in_db(struct connection *c)
+{
+	connection_buf cb;
+	dbg("Connection DB: rehashing connection "PRI_CO" "PRI_CONNECTION,
+	    pri_co(c->serialno), pri_connection(c, &cb));
+	c->name_hash = name_hasher(c->name);
+	rehash_table_entry(&connection_hash_tables[CONNECTION_NAME_HASH_TABLE], c);
+	remove_aliases_from_db(c);
+	add_aliases_to_db(c);
 }
 
 void init_connection_db(void)
@@ -153,4 +331,5 @@ void init_connection_db(void)
 	for (unsigned h = 0; h < elemsof(connection_hash_tables); h++) {
 		init_hash_table(&connection_hash_tables[h]);
 	}
+	init_hash_table(&connection_alias_hash_table);
 }
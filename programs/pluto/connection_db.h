@@ -16,9 +16,12 @@
 #ifndef CONNECTION_DB_H
 #define CONNECTION_DB_H
 
+#include <stdbool.h>
+
 #include "where.h"
 
 struct connection;
+struct list_head;
 
 typedef struct { unsigned long co; } co_serial_t;
 
@@ -35,16 +38,30 @@ void init_connection_db(void);
 
 struct connection *alloc_connection(where_t where);
 struct connection *clone_connection(struct connection *template, where_t where);
-/* void rehash_connection_in_db(struct connection *c); */
+void rehash_connection_in_db(struct connection *c);
 void remove_connection_from_db(struct connection *c);
 
 struct connection *connection_by_serialno(co_serial_t serialno);
 
+/*
+ * Lookup by .name, and by the aliases in .connalias.
+ *
+ * Both are indexed when the connection is added (for a clone, using
+ * the template's name and aliases); anything that then changes .name
+ * or .connalias must call rehash_connection_in_db().  The caller
+ * still needs to check each entry; the alias bucket can include
+ * connections with a different alias.
+ */
+struct list_head *connection_name_bucket(const char *name);
+bool connection_name_indexed(const struct connection *c, const char *name);
+struct list_head *connection_alias_bucket(const char *alias);
+
 /*
  * All the hash tables states are stored in.
  */
 enum connection_hash_tables {
 	CONNECTION_SERIALNO_HASH_TABLE,
+	CONNECTION_NAME_HASH_TABLE,
 	/* add tables here */
 	CONNECTION_HASH_TABLES_ROOF,
 };
@@ -81,6 +81,7 @@
 #include "ikev2.h"
 #include "virtual.h"	/* needs connections.h */
 #include "hostpair.h"
+#include "spd_route_db.h"
 #include "lswfips.h"
 #include "crypto.h"
 #include "kernel_xfrm.h"
@@ -92,6 +93,7 @@
 #include "iface.h"
 #include "ip_selector.h"
 #include "nss_cert_reread.h"
+#include "pubkey_db.h"
 
 struct connection *connections = NULL;
 
@@ -108,31 +110,19 @@ static bool idr_wildmatch(const struct end *this, const struct id *b);
  * If none is found, and strict&&!queit, a diagnostic is logged to
  * whack.
  *
- * XXX: Fun fact: this function re-orders the list, moving the entry
- * to the front as a side effect (ulgh)!.
+ * Uses connection_db.c's name index; when there's more than one
+ * match (a template and its instances) the newest is returned.
  */
 struct connection *conn_by_name(const char *nm, bool strict)
 {
-	struct connection *p, *prev;
-
-	dbg("FOR_EACH_CONNECTION_... in %s", __func__);
-	for (prev = NULL, p = connections; ; prev = p, p = p->ac_next) {
-		if (p == NULL) {
-			break;
-		}
-		if (streq(p->name, nm) &&
-		    (!strict || p->kind != CK_INSTANCE)) {
-			if (prev != NULL) {
-				/* remove p from list */
-				prev->ac_next = p->ac_next;
-				/* and stick it on front */
-				p->ac_next = connections;
-				connections = p;
-			}
-			break;
+	struct connection *c;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(connection_name_bucket(nm), c) {
+		if (connection_name_indexed(c, nm) &&
+		    (!strict || c->kind != CK_INSTANCE)) {
+			return c;
 		}
 	}
-	return p;
+	return NULL;
 }
 
 void release_connection(struct connection *c, bool relations, struct fd *whackfd)
@@ -246,6 +236,7 @@ static void discard_connection(struct connection *c,
 			break;
 		}
 	}
+	remove_spd_routes_from_db(c);
 
 	/* find and delete c from the host pair list */
 	host_pair_remove_connection(c, connection_valid);
@@ -305,22 +296,56 @@ static void discard_connection(struct connection *c,
 	pfree(c);
 }
 
+static int connection_serialno_compare_newest(const void *l, const void *r)
+{
+	const co_serial_t *ls = l;
+	const co_serial_t *rs = r;
+	return (ls->co < rs->co) - (ls->co > rs->co);
+}
+
 int foreach_connection_by_alias(const char *alias, struct fd *whackfd,
 				int (*f)(struct connection *c,
 					 struct fd *whackfd,
 					 void *arg),
 				void *arg)
 {
-	struct connection *p, *pnext;
-	int count = 0;
+	/*
+	 * F can delete connections (including ones in the bucket) so
+	 * snapshot the matches, newest first (the order of the
+	 * connections list), and then look each up again.
+	 */
+	struct list_head *bucket = connection_alias_bucket(alias);
+	unsigned nr = 0;
+	struct connection_alias *ca;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, ca) {
+		nr++;
+	}
+	if (nr == 0) {
+		return 0;
+	}
 
-	dbg("FOR_EACH_CONNECTION_... in %s", __func__);
-	for (p = connections; p != NULL; p = pnext) {
-		pnext = p->ac_next;
+	co_serial_t *matches = alloc_things(co_serial_t, nr, "alias matches");
+	unsigned nr_matches = 0;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, ca) {
+		if (lsw_alias_cmp(alias, ca->connection->connalias)) {
+			matches[nr_matches++] = ca->connection->serialno;
+		}
+	}
+	qsort(matches, nr_matches, sizeof(matches[0]),
+	      connection_serialno_compare_newest);
 
-		if (lsw_alias_cmp(alias, p->connalias))
-			count += (*f)(p, whackfd, arg);
+	int count = 0;
+	for (unsigned i = 0; i < nr_matches; i++) {
+		if (i > 0 && co_serial_eq(matches[i], matches[i - 1])) {
+			/* two aliases in the one bucket */
+			continue;
+		}
+		struct connection *c = connection_by_serialno(matches[i]);
+		if (c != NULL) {
+			count += (*f)(c, whackfd, arg);
+		}
 	}
+	pfree(matches);
 	return count;
 }
 
@@ -1037,7 +1062,7 @@ bool load_end_cert_and_preload_secret(struct fd *whackfd,
 	}
 
 	dbg("loading %s certificate \'%s\' pubkey", which, pubkey);
-	if (!add_pubkey_from_nss_cert(&pluto_pubkeys, &dst_end->id, cert, logger)) {
+	if (!add_pubkey_from_nss_cert(NULL, &dst_end->id, cert, logger)) {
 		CERT_DestroyCertificate(cert);
 		return false;
 	}
@@ -1786,6 +1811,8 @@ static bool extract_connection(struct fd *whackfd,
 	 */
 	c->ac_next = connections;
 	connections = c;
+	add_spd_routes_to_db(c);
+	rehash_connection_in_db(c);	/* now has .name and .connalias */
 
 	/* set internal fields */
 	c->instance_serial = 0;
@@ -1805,6 +1832,7 @@ static bool extract_connection(struct fd *whackfd,
 	if (c->policy & POLICY_OPPORTUNISTIC) {
 		c->spd.that.has_client = TRUE;
 		c->spd.that.client.maskbits = 0; /* ??? shouldn't this be 32 for v4? */
+		rehash_spd_routes(c);	/* indexed above */
 		/*
 		 * We cannot have unlimited keyingtries for Opportunistic, or else
 		 * we gain infinite partial IKE SA's. But also, more than one makes
@@ -1989,6 +2017,8 @@ char *add_group_instance(struct fd *whackfd,
 		/* add to connections list */
 		t->ac_next = connections;
 		connections = t;
+		add_spd_routes_to_db(t);
+		rehash_connection_in_db(t);	/* renamed */
 
 		/* same host_pair as parent: stick after parent on list */
 		/* t->hp_next = group->hp_next; */	/* done by clone_thing */
@@ -2064,6 +2094,7 @@ struct connection *instantiate(struct connection *c,
 	/* set internal fields */
 	d->ac_next = connections;
 	connections = d;
+	add_spd_routes_to_db(d);
 	d->spd.routing = RT_UNROUTED;
 	d->newest_isakmp_sa = SOS_NOBODY;
 	d->newest_ipsec_sa = SOS_NOBODY;
@@ -2112,6 +2143,7 @@ struct connection *rw_instantiate(struct connection *c,
 		 */
 		d->spd.that.client = subnet_type(&d->spd.that.client)->no_addresses;
 	}
+	rehash_spd_routes(d);
 	connection_buf inst;
 	address_buf b;
 	dbg("rw_instantiate() instantiated "PRI_CONNECTION" for %s",
@@ -2258,16 +2290,30 @@ struct connection *find_connection_for_clients(struct spd_route **srp,
 	    str_address(peer_client, &b),
 	    transport_proto, peer_port);
 
-	struct connection *c;
-
-	dbg("FOR_EACH_CONNECTION_... in %s", __func__);
-	for (c = connections; c != NULL; c = c->ac_next) {
-		if (c->kind == CK_GROUP)
+	/*
+	 * Probe the SPD route DB for each prefix of PEER_CLIENT that
+	 * is in use, longest first, so that only spd_routes whose
+	 * .that.client contains PEER_CLIENT are visited.
+	 */
+	const struct ip_info *afi = address_type(peer_client);
+	for (int maskbits = afi->mask_cnt; maskbits >= 0; maskbits--) {
+		struct list_head *bucket =
+			spd_route_bucket_by_that_prefix(peer_client, maskbits);
+		if (bucket == NULL)
 			continue;
 
 		struct spd_route *sr;
 
-		for (sr = &c->spd; best != c && sr; sr = sr->spd_next) {
+		FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, sr) {
+			struct connection *c = sr->connection;
+
+			/* once C is best, skip its other spd_routes */
+			if (c->kind == CK_GROUP || c == best ||
+			    sr->that.client.maskbits != maskbits)
+				continue;
+
+			pexpect(samesubnet(&sr->that.client, &sr->that_client_in_db));
+
 			if ((routed(sr->routing) ||
 					c->instance_initiation_ok) &&
 				addrinsubnet(our_client, &sr->this.client) &&
@@ -2405,6 +2451,7 @@ struct connection *oppo_instantiate(struct connection *c,
 
 	/* opportunistic connections do not use port selectors */
 	setportof(0, &d->spd.that.client.addr);
+	rehash_spd_routes(d);
 
 	if (sameaddr(peer_client, &d->spd.that.host_addr))
 		d->spd.that.has_client = FALSE;
@@ -2574,64 +2621,69 @@ struct connection *route_owner(struct connection *c,
 	enum routing_t best_routing = cur_spd->routing,
 		best_erouting = best_routing;
 
-	dbg("FOR_EACH_CONNECTION_... in %s", __func__);
-	for (struct connection *d = connections; d != NULL; d = d->ac_next) {
-		if (!oriented(*d))
-			continue;
-
-		/*
-		 * consider policies different if the either in or out marks
-		 * differ (after masking)
-		 */
-		if (DBGP(DBG_BASE)) {
-			DBG_log(" conn %s mark %" PRIu32 "/%#08" PRIx32 ", %" PRIu32 "/%#08" PRIx32 " vs",
-				c->name, c->sa_marks.in.val, c->sa_marks.in.mask,
-				c->sa_marks.out.val, c->sa_marks.out.mask);
-			DBG_log(" conn %s mark %" PRIu32 "/%#08" PRIx32 ", %" PRIu32 "/%#08" PRIx32,
-				d->name, d->sa_marks.in.val, d->sa_marks.in.mask,
-				d->sa_marks.out.val, d->sa_marks.out.mask);
-		}
-
-		if ( (c->sa_marks.in.val & c->sa_marks.in.mask) != (d->sa_marks.in.val & d->sa_marks.in.mask) ||
-		     (c->sa_marks.out.val & c->sa_marks.out.mask) != (d->sa_marks.out.val & d->sa_marks.out.mask) )
-			continue;
+	/*
+	 * Only spd_routes with the same .that.client can share a
+	 * route, so look them up in the SPD route DB.
+	 */
+	const struct spd_route *src;
 
+	for (src = &c->spd; src != NULL; src = src->spd_next) {
+		struct list_head *bucket =
+			spd_route_bucket_by_that_client(&src->that.client);
 		struct spd_route *srd;
 
-		for (srd = &d->spd; srd != NULL; srd = srd->spd_next) {
+		FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, srd) {
+			if (src == srd)
+				continue;
+
 			if (srd->routing == RT_UNROUTED)
 				continue;
 
-			const struct spd_route *src;
+			struct connection *d = srd->connection;
 
-			for (src = &c->spd; src != NULL; src = src->spd_next) {
-				if (src == srd)
-					continue;
+			if (!oriented(*d))
+				continue;
 
-				if (!samesubnet(&src->that.client,
-						&srd->that.client) ||
-				    src->that.protocol != srd->that.protocol ||
-				    src->that.port != srd->that.port ||
-				    !sameaddr(&src->this.host_addr,
-						&srd->this.host_addr))
-					continue;
+			/*
+			 * consider policies different if the either in or out marks
+			 * differ (after masking)
+			 */
+			if (DBGP(DBG_BASE)) {
+				DBG_log(" conn %s mark %" PRIu32 "/%#08" PRIx32 ", %" PRIu32 "/%#08" PRIx32 " vs",
+					c->name, c->sa_marks.in.val, c->sa_marks.in.mask,
+					c->sa_marks.out.val, c->sa_marks.out.mask);
+				DBG_log(" conn %s mark %" PRIu32 "/%#08" PRIx32 ", %" PRIu32 "/%#08" PRIx32,
+					d->name, d->sa_marks.in.val, d->sa_marks.in.mask,
+					d->sa_marks.out.val, d->sa_marks.out.mask);
+			}
 
-				if (srd->routing > best_routing) {
-					best_ro = d;
-					best_sr = srd;
-					best_routing = srd->routing;
-				}
+			if ( (c->sa_marks.in.val & c->sa_marks.in.mask) != (d->sa_marks.in.val & d->sa_marks.in.mask) ||
+			     (c->sa_marks.out.val & c->sa_marks.out.mask) != (d->sa_marks.out.val & d->sa_marks.out.mask) )
+				continue;
 
-				if (samesubnet(&src->this.client,
-						&srd->this.client) &&
-				    src->this.protocol == srd->this.protocol &&
-				    src->this.port == srd->this.port &&
-				    srd->routing > best_erouting)
-				{
-					best_ero = d;
-					best_esr = srd;
-					best_erouting = srd->routing;
-				}
+			if (!samesubnet(&src->that.client,
+					&srd->that.client) ||
+			    src->that.protocol != srd->that.protocol ||
+			    src->that.port != srd->that.port ||
+			    !sameaddr(&src->this.host_addr,
+				      &srd->this.host_addr))
+				continue;
+
+			if (srd->routing > best_routing) {
+				best_ro = d;
+				best_sr = srd;
+				best_routing = srd->routing;
+			}
+
+			if (samesubnet(&src->this.client,
+					&srd->this.client) &&
+			    src->this.protocol == srd->this.protocol &&
+			    src->this.port == srd->this.port &&
+			    srd->routing > best_erouting)
+			{
+				best_ero = d;
+				best_esr = srd;
+				best_erouting = srd->routing;
 			}
 		}
 	}
@@ -2698,6 +2750,12 @@ static chunk_t get_peer_ca(struct pubkey_list *const *pubkey_db,
 	return EMPTY_CHUNK;
 }
 
+/* find the peer's CA in the pubkey database */
+static bool rsa_pubkey(struct pubkey *key, void *arg UNUSED)
+{
+	return key->type == &pubkey_type_rsa;
+}
+
 /*
  * ??? NOTE: THESE IMPORTANT COMMENTS DO NOT REFLECT ANY CHANGES MADE AFTER FreeS/WAN.
  *
@@ -2807,7 +2865,10 @@ struct connection *refine_host_connection(const struct state *st,
 	chunk_t peer_ca = get_peer_ca(&st->st_remote_certs.pubkey_db, peer_id);
 
 	if (hunk_isempty(peer_ca)) {
-		peer_ca = get_peer_ca(&pluto_pubkeys, peer_id);
+		struct pubkey *key = find_pubkey_by_id(peer_id, rsa_pubkey, NULL);
+		if (key != NULL) {
+			peer_ca = key->issuer;
+		}
 	}
 
 	{
@@ -3994,16 +4055,55 @@ void show_one_connection(struct show *s,
 	show_kernel_alg_connection(s, c, instance);
 }
 
+/*
+ * Snapshot of the connections, sorted, for show_stream(); the
+ * connections are looked up by serial number as they are shown so
+ * ones deleted in the meantime are skipped.
+ */
+
+struct connection_cursor {
+	bool started;
+	unsigned active;
+	unsigned next;
+	unsigned nr;
+	co_serial_t serialno[];
+};
+
+static bool show_connections_step(struct show *s, void *arg)
+{
+	struct connection_cursor *cursor = arg;
+
+	if (!cursor->started) {
+		cursor->started = true;
+		show_separator(s);
+		show_comment(s, "Connection list:");
+		show_separator(s);
+	}
+
+	for (unsigned batch = 0; batch < SHOW_BATCH && cursor->next < cursor->nr; batch++) {
+		struct connection *c = connection_by_serialno(cursor->serialno[cursor->next++]);
+		if (c != NULL) {
+			show_one_connection(s, c);
+		}
+	}
+	if (cursor->next < cursor->nr) {
+		return false;
+	}
+
+	if (cursor->nr != 0) {
+		show_separator(s);
+	}
+	show_comment(s, "Total IPsec connections: loaded %u, active %u",
+		     cursor->nr, cursor->active);
+	return true;
+}
+
 void show_connections_status(struct show *s)
 {
-	int count = 0;
-	int active = 0;
+	unsigned count = 0;
+	unsigned active = 0;
 	struct connection *c;
 
-	show_separator(s);
-	show_comment(s, "Connection list:");
-	show_separator(s);
-
 	dbg("FOR_EACH_CONNECTION_... in %s", __func__);
 	for (c = connections; c != NULL; c = c->ac_next) {
 		count++;
@@ -4011,13 +4111,19 @@ void show_connections_status(struct show *s)
 			active++;
 	}
 
+	struct connection_cursor *cursor =
+		alloc_bytes(sizeof(struct connection_cursor) + count * sizeof(co_serial_t),
+			    "connection cursor");
+	cursor->nr = count;
+	cursor->active = active;
+
 	if (count != 0) {
-		/* make an array of connections, sort it, and report it */
+		/* make an array of connections, sort it, and snapshot it */
 
 		struct connection **array =
 			alloc_bytes(sizeof(struct connection *) * count,
 				"connection array");
-		int i = 0;
+		unsigned i = 0;
 
 		dbg("FOR_EACH_CONNECTION_... in %s", __func__);
 		for (c = connections; c != NULL; c = c->ac_next)
@@ -4028,14 +4134,12 @@ void show_connections_status(struct show *s)
 			connection_compare_qsort);
 
 		for (i = 0; i < count; i++)
-			show_one_connection(s, array[i]);
+			cursor->serialno[i] = array[i]->serialno;
 
 		pfree(array);
-		show_separator(s);
 	}
 
-	show_comment(s, "Total IPsec connections: loaded %d, active %d",
-		     count, active);
+	show_stream(s, show_connections_step, cursor);
 }
 
 /*
@@ -4133,24 +4237,22 @@ struct connection *eclipsed(const struct connection *c, struct spd_route **esrp
 	/* ??? this logic seems broken: it doesn't try all spd_routes of c */
 
 	/* XXX This logic also predates support for protoports, which isn't handled below */
-	struct connection *ue;
+	const struct spd_route *src;
 
-	dbg("FOR_EACH_CONNECTION_... in %s", __func__);
-	for (ue = connections; ue != NULL; ue = ue->ac_next) {
+	for (src = &c->spd; src != NULL; src = src->spd_next) {
+		struct list_head *bucket =
+			spd_route_bucket_by_that_client(&src->that.client);
 		struct spd_route *srue;
 
-		for (srue = &ue->spd; srue != NULL; srue =srue->spd_next) {
-			const struct spd_route *src;
-
-			for (src = &c->spd; src != NULL; src = src->spd_next) {
-				if (srue->routing == RT_ROUTED_ECLIPSED &&
-				    samesubnet(&src->this.client, &srue->this.client) &&
-				    samesubnet(&src->that.client, &srue->that.client))
-				{
-					dbg("%s eclipsed %s", c->name, ue->name);
-					*esrp = srue;
-					return ue;
-				}
+		FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, srue) {
+			if (srue->routing == RT_ROUTED_ECLIPSED &&
+			    samesubnet(&src->this.client, &srue->this.client) &&
+			    samesubnet(&src->that.client, &srue->that.client))
+			{
+				struct connection *ue = srue->connection;
+				dbg("%s eclipsed %s", c->name, ue->name);
+				*esrp = srue;
+				return ue;
 			}
 		}
 	}
@@ -244,6 +244,10 @@ struct spd_route {
 	so_serial_t eroute_owner;
 	enum routing_t routing; /* level of routing in place */
 	reqid_t reqid;
+	/* maintained by spd_route_db.c */
+	struct connection *connection;	/* owner, for lookups */
+	struct list_entry that_client_db_entry;
+	ip_selector that_client_in_db;	/* .that.client as hashed */
 };
 
 struct sa_mark {
@@ -271,6 +275,13 @@ struct ephemeral_variables {
 	ip_address old_gw_address;	/* address of old gateway */
 };
 
+/* an entry in connection_db.c's alias multimap */
+struct connection_alias {
+	struct list_entry entry;
+	struct connection *connection;
+	hash_t hash;
+};
+
 struct connection {
 	co_serial_t serialno;
 	char *name;
@@ -415,6 +426,10 @@ struct connection {
 
 	struct list_entry serialno_list_entry;
 	struct list_entry hash_table_entries[CONNECTION_HASH_TABLES_ROOF];
+	/* maintained by connection_db.c */
+	hash_t name_hash;		/* .name as hashed */
+	struct connection_alias *aliases;
+	unsigned nr_aliases;
 };
 
 #define oriented(c) ((c).interface != NULL)
@@ -580,6 +595,8 @@ extern int connection_compare(const struct connection *ca,
 			      const struct connection *cb);
 
 void connection_check_ddns(struct fd *whackfd);
+bool connection_needs_ddns(const struct connection *c);
+void connection_ddns_resolved(struct connection *c, const ip_address *new_addr);
 void connection_check_phase2(struct fd *whackfd);
 void init_connections(void);
 
@@ -20,6 +20,7 @@
  *
  */
 
+#include <pthread.h>    /* Must be the first include file */
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
@@ -55,13 +56,222 @@
 #include "test_buffer.h"
 #include "ike_alg.h"
 #include "crypt_dh.h"
+#include "list_entry.h"
+#include "pluto_stats.h"
+
+/*
+ * Pool of pre-computed DH keypairs, one per DH group.
+ *
+ * When enabled (dh-keypair-pool-low > 0), calc_ke() takes the oldest
+ * keypair from the group's pool instead of generating a new one.  A
+ * pool starts being refilled once it falls below the low watermark
+ * and stops when it reaches the high watermark; the refill is done
+ * by crypto helpers that have nothing else to do (see
+ * refill_dh_keypair_pool()).  Keypairs older than
+ * dh-keypair-pool-lifetime are discarded rather than used.
+ *
+ * Accessed by the crypto helpers, hence locked.
+ */
+
+unsigned dh_keypair_pool_low = 0;	/* disabled */
+unsigned dh_keypair_pool_high = 0;
+deltatime_t dh_keypair_pool_lifetime = DELTATIME_INIT(DH_KEYPAIR_POOL_LIFETIME_DEFAULT);
+
+struct dh_keypair {
+	struct dh_secret *secret;
+	chunk_t ke;
+	monotime_t created;
+	struct list_entry entry;
+};
+
+static void jam_dh_keypair(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "no DH keypair");
+	} else {
+		const struct dh_keypair *kp = data;
+		jam(buf, "DH keypair %p", kp->secret);
+	}
+}
+
+static const struct list_info dh_keypair_info = {
+	.name = "DH keypair pool",
+	.jam = jam_dh_keypair,
+};
+
+static struct dh_keypair_pool {
+	const struct dh_desc *group;
+	struct list_head keypairs;	/* oldest first */
+	unsigned nr_keypairs;
+	bool refill;
+} dh_keypair_pools[16];
+
+static pthread_mutex_t dh_keypair_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the counters are shown by pluto_stats.c */
+static void pool_stat(unsigned long *counters, const struct dh_desc *group)
+{
+	if (group->group < OAKLEY_GROUP_PSTATS_ROOF) {
+		counters[group->group]++;
+	}
+}
+
+/* pool must be locked */
+static struct dh_keypair_pool *dh_keypair_pool(const struct dh_desc *group)
+{
+	for (unsigned i = 0; i < elemsof(dh_keypair_pools); i++) {
+		struct dh_keypair_pool *pool = &dh_keypair_pools[i];
+		if (pool->group == NULL) {
+			pool->group = group;
+			pool->keypairs = (struct list_head) INIT_LIST_HEAD(&pool->keypairs,
+									   &dh_keypair_info);
+		}
+		if (pool->group == group) {
+			return pool;
+		}
+	}
+	return NULL;
+}
+
+static void free_dh_keypair(struct dh_keypair **kp)
+{
+	free_dh_secret(&(*kp)->secret);
+	free_chunk_content(&(*kp)->ke);
+	pfree(*kp);
+	*kp = NULL;
+}
+
+/* pool must be locked */
+static void expire_dh_keypairs(struct dh_keypair_pool *pool, monotime_t now)
+{
+	monotime_t cutoff = monotime_sub(now, dh_keypair_pool_lifetime);
+	struct dh_keypair *kp;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&pool->keypairs, kp) {
+		if (!monobefore(kp->created, cutoff)) {
+			break;
+		}
+		remove_list_entry(&kp->entry);
+		pool->nr_keypairs--;
+		pool_stat(pstats_dh_keypair_pool_expired, pool->group);
+		free_dh_keypair(&kp);
+	}
+}
+
+static struct dh_secret *take_dh_keypair(const struct dh_desc *group,
+					 chunk_t *local_ke)
+{
+	if (dh_keypair_pool_low == 0) {
+		return NULL;
+	}
+	struct dh_keypair *kp = NULL;
+	pthread_mutex_lock(&dh_keypair_pool_mutex);
+	{
+		struct dh_keypair_pool *pool = dh_keypair_pool(group);
+		if (pool != NULL) {
+			expire_dh_keypairs(pool, mononow());
+			FOR_EACH_LIST_ENTRY_OLD2NEW(&pool->keypairs, kp) { break; }
+			if (kp != NULL) {
+				remove_list_entry(&kp->entry);
+				pool->nr_keypairs--;
+				pool_stat(pstats_dh_keypair_pool_hit, group);
+			} else {
+				pool_stat(pstats_dh_keypair_pool_miss, group);
+			}
+			if (pool->nr_keypairs < dh_keypair_pool_low) {
+				pool->refill = true;
+			}
+		}
+	}
+	pthread_mutex_unlock(&dh_keypair_pool_mutex);
+	if (kp == NULL) {
+		return NULL;
+	}
+	struct dh_secret *secret = kp->secret;
+	*local_ke = kp->ke;
+	pfree(kp);
+	return secret;
+}
+
+/*
+ * MUST BE THREAD-SAFE
+ *
+ * Add one keypair to a pool that needs refilling; return false when
+ * no pool needs it.
+ */
+bool refill_dh_keypair_pool(void)
+{
+	if (dh_keypair_pool_low == 0) {
+		return false;
+	}
+	const struct dh_desc *group = NULL;
+	pthread_mutex_lock(&dh_keypair_pool_mutex);
+	{
+		monotime_t now = mononow();
+		for (unsigned i = 0; i < elemsof(dh_keypair_pools) &&
+			     dh_keypair_pools[i].group != NULL; i++) {
+			struct dh_keypair_pool *pool = &dh_keypair_pools[i];
+			expire_dh_keypairs(pool, now);
+			if (pool->nr_keypairs < dh_keypair_pool_low) {
+				pool->refill = true;
+			}
+			if (pool->refill && pool->nr_keypairs >= dh_keypair_pool_high) {
+				pool->refill = false;
+			}
+			if (pool->refill) {
+				group = pool->group;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&dh_keypair_pool_mutex);
+	if (group == NULL) {
+		return false;
+	}
+
+	/* the expensive bit, unlocked */
+	struct dh_keypair *kp = alloc_thing(struct dh_keypair, "DH keypair");
+	kp->secret = calc_dh_secret(group, &kp->ke);
+	kp->created = mononow();
+	kp->entry = list_entry(&dh_keypair_info, kp);
+
+	pthread_mutex_lock(&dh_keypair_pool_mutex);
+	{
+		struct dh_keypair_pool *pool = dh_keypair_pool(group);
+		insert_list_entry(&pool->keypairs, &kp->entry);
+		pool->nr_keypairs++;
+		if (pool->nr_keypairs >= dh_keypair_pool_high) {
+			pool->refill = false;
+		}
+	}
+	pthread_mutex_unlock(&dh_keypair_pool_mutex);
+	return true;
+}
+
+/* only after the crypto helpers have exited */
+void free_dh_keypair_pools(void)
+{
+	for (unsigned i = 0; i < elemsof(dh_keypair_pools) &&
+		     dh_keypair_pools[i].group != NULL; i++) {
+		struct dh_keypair_pool *pool = &dh_keypair_pools[i];
+		struct dh_keypair *kp;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&pool->keypairs, kp) {
+			remove_list_entry(&kp->entry);
+			free_dh_keypair(&kp);
+		}
+		pool->nr_keypairs = 0;
+		pool->refill = false;
+	}
+}
 
 /* MUST BE THREAD-SAFE */
 void calc_ke(struct pcr_kenonce *kn)
 {
 	const struct dh_desc *group = kn->group;
 
-	kn->secret = calc_dh_secret(kn->group, &kn->gi);
+	kn->secret = take_dh_keypair(kn->group, &kn->gi);
+	if (kn->secret == NULL) {
+		kn->secret = calc_dh_secret(kn->group, &kn->gi);
+	}
 
 	DBG(DBG_CRYPT,
 	    DBG_log("NSS: Local DH %s secret (pointer): %p",
@@ -0,0 +1,495 @@
+/* non-blocking DDNS lookups, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef USE_DNSSEC
+# error this file should only be compiled when DNSSEC is defined
+#endif
+
+#include <inttypes.h>
+#include <arpa/nameser.h>
+#include <ldns/ldns.h>	/* from ldns-devel */
+#include "unbound-event.h"
+
+#include "defs.h"
+#include "lswalloc.h"
+#include "log.h"
+#include "connections.h"
+#include "hostpair.h"		/* for check_orientations() */
+#include "dnssec.h"		/* for get_unbound_ctx() */
+#include "ip_info.h"
+#include "hash_table.h"
+#include "show.h"
+#include "whack.h"
+#include "ddns.h"
+
+/*
+ * Both families are queried; when the connection doesn't say which
+ * it wants, the first with an address is used: the order ttoaddr()
+ * tried them.
+ */
+
+enum ddns_family {
+	DDNS_IPv6,
+	DDNS_IPv4,
+#define DDNS_FAMILY_ROOF (DDNS_IPv4+1)
+};
+
+struct ddns_host;
+
+struct ddns_query {
+	struct ddns_host *host;
+	const struct ip_info *afi;
+	uint16_t qtype;
+	bool pending;
+	int ub_async_id;	/* to cancel a pending query */
+	err_t error;		/* string literal; NULL when there's an address */
+	ip_address address;
+	monotime_t expires;	/* answer, positive or negative, is good until */
+};
+
+struct ddns_host {
+	char *name;
+	struct ddns_query query[DDNS_FAMILY_ROOF];
+	unsigned nr_pending;
+	co_serial_t *waiting;	/* connections wanting the answer */
+	unsigned nr_waiting;
+	struct list_entry name_entry;	/* in ddns_host_table */
+	struct list_entry host_entry;	/* on ddns_hosts */
+};
+
+static struct {
+	unsigned long lookups;
+	unsigned long cache_hits;
+	unsigned long queries;
+	unsigned long failures;
+	unsigned pending;
+	unsigned hosts;
+} ddns_stats;
+
+static void jam_ddns_host(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "ddns host NULL");
+	} else {
+		const struct ddns_host *host = data;
+		jam(buf, "ddns host %s", host->name);
+	}
+}
+
+static const struct list_info ddns_host_info = {
+	.name = "ddns host list",
+	.jam = jam_ddns_host,
+};
+
+static struct list_head ddns_hosts = INIT_LIST_HEAD(&ddns_hosts, &ddns_host_info);
+
+static hash_t name_hasher(const char *name)
+{
+	return hash_table_hasher(shunk1(name), zero_hash);
+}
+
+static hash_t ddns_host_hasher(const void *data)
+{
+	const struct ddns_host *host = data;
+	return name_hasher(host->name);
+}
+
+static struct list_entry *ddns_host_entry(void *data)
+{
+	struct ddns_host *host = data;
+	return &host->name_entry;
+}
+
+static struct list_head ddns_host_slots[STATE_TABLE_SIZE];
+
+static struct hash_table ddns_host_table = {
+	.info = {
+		.name = "ddns host table",
+		.jam = jam_ddns_host,
+	},
+	.hasher = ddns_host_hasher,
+	.entry = ddns_host_entry,
+	.nr_slots = elemsof(ddns_host_slots),
+	.slots = ddns_host_slots,
+};
+
+static struct ddns_host *ddns_host_by_name(const char *name)
+{
+	struct list_head *bucket =
+		hash_table_bucket(&ddns_host_table, name_hasher(name));
+	struct ddns_host *host;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, host) {
+		if (streq(host->name, name)) {
+			return host;
+		}
+	}
+	return NULL;
+}
+
+static struct ddns_host *add_ddns_host(const char *name)
+{
+	struct ddns_host *host = alloc_thing(struct ddns_host, "ddns host");
+	host->name = clone_str(name, "ddns host name");
+	static const struct {
+		const struct ip_info *afi;
+		uint16_t qtype;
+	} families[DDNS_FAMILY_ROOF] = {
+		[DDNS_IPv6] = { &ipv6_info, LDNS_RR_TYPE_AAAA, },
+		[DDNS_IPv4] = { &ipv4_info, LDNS_RR_TYPE_A, },
+	};
+	for (enum ddns_family f = 0; f < DDNS_FAMILY_ROOF; f++) {
+		host->query[f] = (struct ddns_query) {
+			.host = host,
+			.afi = families[f].afi,
+			.qtype = families[f].qtype,
+			.error = "not yet looked up",
+			.address = unset_address,
+			.expires = monotime_epoch,
+		};
+	}
+	host->host_entry = list_entry(&ddns_host_info, host);
+	insert_list_entry(&ddns_hosts, &host->host_entry);
+	add_hash_table_entry(&ddns_host_table, host);
+	ddns_stats.hosts++;
+	return host;
+}
+
+static void free_ddns_host(struct ddns_host **hostp)
+{
+	struct ddns_host *host = *hostp;
+	*hostp = NULL;
+	for (enum ddns_family f = 0; f < DDNS_FAMILY_ROOF; f++) {
+		struct ddns_query *q = &host->query[f];
+		if (q->pending) {
+			ub_cancel(get_unbound_ctx(), q->ub_async_id);
+			q->pending = false;
+			ddns_stats.pending--;
+		}
+	}
+	del_hash_table_entry(&ddns_host_table, host);
+	remove_list_entry(&host->host_entry);
+	pfreeany(host->waiting);
+	pfree(host->name);
+	pfree(host);
+	ddns_stats.hosts--;
+}
+
+/*
+ * Usable answer, from the cache?  A negative answer, either NXDOMAIN
+ * or no record of that type (NODATA), is cached for the SOA's minimum
+ * TTL.
+ */
+
+static bool ddns_host_answered(const struct ddns_host *host, monotime_t now)
+{
+	if (host->nr_pending > 0) {
+		return false;
+	}
+	for (enum ddns_family f = 0; f < DDNS_FAMILY_ROOF; f++) {
+		if (!monobefore(now, host->query[f].expires)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Pick C's peer address from HOST's answers, or return why not.
+ */
+
+static err_t ddns_host_address(const struct ddns_host *host,
+			       const struct connection *c,
+			       ip_address *address)
+{
+	/* when this end has an address, the peer must match */
+	const struct ip_info *afi = address_type(&c->spd.this.host_addr);
+	err_t error = NULL;
+	for (enum ddns_family f = 0; f < DDNS_FAMILY_ROOF; f++) {
+		const struct ddns_query *q = &host->query[f];
+		if (afi != NULL && afi != q->afi) {
+			continue;
+		}
+		if (q->error == NULL) {
+			*address = q->address;
+			return NULL;
+		}
+		if (error == NULL) {
+			error = q->error;
+		}
+	}
+	return error;
+}
+
+static void resolve_waiting_connection(const struct ddns_host *host,
+				       struct connection *c)
+{
+	ip_address new_addr;
+	err_t e = ddns_host_address(host, c, &new_addr);
+	if (e != NULL) {
+		connection_buf cib;
+		dbg("pending ddns: connection "PRI_CONNECTION" lookup of \"%s\" failed: %s",
+		    pri_connection(c, &cib), c->dnshostname, e);
+		return;
+	}
+	connection_ddns_resolved(c, &new_addr);
+}
+
+/*
+ * All queries are back; hand the answer to each connection that is
+ * still waiting on it.
+ */
+
+static void answer_ddns_host(struct ddns_host *host)
+{
+	co_serial_t *waiting = host->waiting;
+	unsigned nr_waiting = host->nr_waiting;
+	host->waiting = NULL;
+	host->nr_waiting = 0;
+
+	for (unsigned i = 0; i < nr_waiting; i++) {
+		struct connection *c = connection_by_serialno(waiting[i]);
+		if (c == NULL) {
+			dbg("pending ddns: connection "PRI_CO" for \"%s\" has gone away",
+			    pri_co(waiting[i]), host->name);
+			continue;
+		}
+		/* things may have changed while waiting */
+		if (!connection_needs_ddns(c) ||
+		    !streq(c->dnshostname, host->name)) {
+			continue;
+		}
+		struct connection *old_connection = push_cur_connection(c);
+		resolve_waiting_connection(host, c);
+		pop_cur_connection(old_connection);
+	}
+	pfreeany(waiting);
+
+	if (nr_waiting > 0) {
+		check_orientations();
+	}
+}
+
+static void parse_ddns_answer(struct ddns_query *q, int rcode,
+			      void *wire, int wire_len,
+			      int secure, const char *why_bogus)
+{
+	monotime_t now = mononow();
+	q->address = unset_address;
+	q->expires = now;	/* failures aren't cached */
+
+	/* NXDOMAIN is a negative answer, and cached, like NODATA */
+	if (rcode != LDNS_RCODE_NOERROR && rcode != LDNS_RCODE_NXDOMAIN) {
+		ldns_lookup_table *rcode_txt = ldns_lookup_by_id(ldns_rcodes, rcode);
+		q->error = (rcode_txt != NULL ? rcode_txt->name : "DNS error");
+		return;
+	}
+
+	if (secure == UB_EVENT_BOGUS) {
+		libreswan_log("ERROR: %s failed DNSSEC validation: %s",
+			      q->host->name,
+			      why_bogus == NULL ? "unknown" : why_bogus);
+		q->error = "DNSSEC validation failed";
+		return;
+	}
+
+	if (secure != UB_EVNET_SECURE) {
+		dbg("warning: %s lookup was not protected by DNSSEC!",
+		    q->host->name);
+	}
+
+	ldns_pkt *ldnspkt = NULL;
+	if (wire == NULL ||
+	    ldns_wire2pkt(&ldnspkt, wire, wire_len) != LDNS_STATUS_OK) {
+		q->error = "ldns could not parse response wire format";
+		return;
+	}
+
+	/* first address; good for the smallest TTL */
+	bool found = false;
+	uint32_t ttl = 0;
+	ldns_rr_list *answers = ldns_pkt_answer(ldnspkt);
+	for (size_t i = 0; i < ldns_rr_list_rr_count(answers); i++) {
+		ldns_rr *ans = ldns_rr_list_rr(answers, i);
+		if (ldns_rr_get_type(ans) != q->qtype) {
+			continue;	/* e.g., CNAME */
+		}
+		ldns_rdf *rdf = ldns_rr_rdf(ans, 0);
+		ip_address address;
+		if (rdf == NULL ||
+		    data_to_address(ldns_rdf_data(rdf), ldns_rdf_size(rdf),
+				    q->afi, &address) != NULL) {
+			continue;
+		}
+		if (!found) {
+			q->address = address;
+			ttl = ldns_rr_ttl(ans);
+			found = true;
+		} else if (ldns_rr_ttl(ans) < ttl) {
+			ttl = ldns_rr_ttl(ans);
+		}
+	}
+
+	if (!found) {
+		q->error = (rcode == LDNS_RCODE_NXDOMAIN ? "NXDOMAIN" : "no address");
+		/* RFC 2308: negative answers last for the SOA's minimum */
+		ldns_rr_list *authority = ldns_pkt_authority(ldnspkt);
+		for (size_t i = 0; i < ldns_rr_list_rr_count(authority); i++) {
+			ldns_rr *soa = ldns_rr_list_rr(authority, i);
+			if (ldns_rr_get_type(soa) == LDNS_RR_TYPE_SOA &&
+			    ldns_rr_rdf(soa, 6) != NULL) {
+				uint32_t minimum = ldns_rdf2native_int32(ldns_rr_rdf(soa, 6));
+				ttl = ldns_rr_ttl(soa) < minimum ? ldns_rr_ttl(soa) : minimum;
+				break;
+			}
+		}
+	} else {
+		q->error = NULL;
+	}
+
+	ldns_pkt_free(ldnspkt);
+	q->expires = monotime_add(now, deltatime(ttl));
+	address_buf ab;
+	dbg("pending ddns: %s IN %s is %s for %"PRIu32" seconds",
+	    q->host->name, q->qtype == LDNS_RR_TYPE_A ? "A" : "AAAA",
+	    q->error != NULL ? q->error : str_address(&q->address, &ab), ttl);
+}
+
+/*
+ * Note libunbound call back quirk: when the answer is cached this is
+ * called before ub_resolve_event() returns.
+ */
+
+static void ddns_ub_cb(void *mydata, int rcode,
+		       void *wire, int wire_len, int secure, char *why_bogus
+#if (UNBOUND_VERSION_MAJOR == 1 && UNBOUND_VERSION_MINOR >= 8) || UNBOUND_VERSION_MAJOR > 1
+		       , int was_ratelimited UNUSED
+#endif
+		)
+{
+	struct ddns_query *q = mydata;
+	struct ddns_host *host = q->host;
+
+	passert(q->pending);
+	q->pending = false;
+	q->ub_async_id = 0;
+	ddns_stats.pending--;
+
+	parse_ddns_answer(q, rcode, wire, wire_len, secure, why_bogus);
+	if (q->error != NULL) {
+		ddns_stats.failures++;
+	}
+
+	passert(host->nr_pending > 0);
+	if (--host->nr_pending == 0) {
+		answer_ddns_host(host);
+	}
+}
+
+static void start_ddns_queries(struct ddns_host *host)
+{
+	passert(host->nr_pending == 0);
+	/* all pending before any can call back */
+	host->nr_pending = DDNS_FAMILY_ROOF;
+	for (enum ddns_family f = 0; f < DDNS_FAMILY_ROOF; f++) {
+		struct ddns_query *q = &host->query[f];
+		dbg("pending ddns: querying %s IN %s", host->name,
+		    q->qtype == LDNS_RR_TYPE_A ? "A" : "AAAA");
+		q->pending = true;
+		ddns_stats.pending++;
+		ddns_stats.queries++;
+		int async_id = 0;
+		int ub_ret = ub_resolve_event(get_unbound_ctx(), host->name,
+					      q->qtype, ns_c_in, q,
+					      ddns_ub_cb, &async_id);
+		if (ub_ret != 0) {
+			loglog(RC_LOG_SERIOUS, "unbound resolve call failed for %s: %s",
+			       host->name, ub_strerror(ub_ret));
+			q->pending = false;
+			ddns_stats.pending--;
+			ddns_stats.failures++;
+			q->error = "unbound resolve call failed";
+			q->address = unset_address;
+			q->expires = mononow();
+			if (--host->nr_pending == 0) {
+				answer_ddns_host(host);
+			}
+		} else if (q->pending) {
+			q->ub_async_id = async_id;
+		}
+	}
+}
+
+void resolve_connection_ddns(struct connection *c)
+{
+	passert(c->dnshostname != NULL);
+	passert(get_unbound_ctx() != NULL);
+	ddns_stats.lookups++;
+
+	struct ddns_host *host = ddns_host_by_name(c->dnshostname);
+	if (host == NULL) {
+		host = add_ddns_host(c->dnshostname);
+	} else if (ddns_host_answered(host, mononow())) {
+		ddns_stats.cache_hits++;
+		dbg("pending ddns: using cached answer for \"%s\"", host->name);
+		resolve_waiting_connection(host, c);
+		return;
+	}
+
+	/* join the queue; start the queries when not already in flight */
+	realloc_things(host->waiting, host->nr_waiting, host->nr_waiting + 1,
+		       "ddns waiting connections");
+	host->waiting[host->nr_waiting++] = c->serialno;
+	if (host->nr_pending == 0) {
+		start_ddns_queries(host);
+	} else {
+		connection_buf cib;
+		dbg("pending ddns: connection "PRI_CONNECTION" waiting for \"%s\"",
+		    pri_connection(c, &cib), host->name);
+	}
+}
+
+void expire_ddns_hosts(void)
+{
+	monotime_t now = mononow();
+	struct ddns_host *host;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&ddns_hosts, host) {
+		if (host->nr_pending == 0 && host->nr_waiting == 0 &&
+		    !ddns_host_answered(host, now)) {
+			free_ddns_host(&host);
+		}
+	}
+}
+
+void show_ddns_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	whack_print(whackfd, "current.ddns.hosts=%u", ddns_stats.hosts);
+	whack_print(whackfd, "current.ddns.pending=%u", ddns_stats.pending);
+	whack_print(whackfd, "total.ddns.lookups=%lu", ddns_stats.lookups);
+	whack_print(whackfd, "total.ddns.cache_hits=%lu", ddns_stats.cache_hits);
+	whack_print(whackfd, "total.ddns.queries=%lu", ddns_stats.queries);
+	whack_print(whackfd, "total.ddns.failures=%lu", ddns_stats.failures);
+}
+
+void init_ddns_hosts(void)
+{
+	init_hash_table(&ddns_host_table);
+}
+
+void free_ddns_hosts(void)
+{
+	struct ddns_host *host;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&ddns_hosts, host) {
+		free_ddns_host(&host);
+	}
+}
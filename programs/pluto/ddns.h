@@ -0,0 +1,44 @@
+/* non-blocking DDNS lookups, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef DDNS_H
+#define DDNS_H
+
+#ifndef USE_DNSSEC
+# error this file should only be included when DNSSEC is defined
+#endif
+
+struct connection;
+struct show;
+
+void init_ddns_hosts(void);
+void free_ddns_hosts(void);
+
+/*
+ * Look up C's dnshostname using pluto's (libevent) unbound context;
+ * when the answer arrives, possibly before this returns,
+ * connection_ddns_resolved() is called.
+ *
+ * Each hostname has one entry: connections waiting on the same name
+ * share the A and AAAA queries, which are sent together; and a
+ * positive answer is re-used until its TTL expires.
+ */
+
+void resolve_connection_ddns(struct connection *c);
+
+/* forget answers whose TTL has expired */
+void expire_ddns_hosts(void);
+
+void show_ddns_status(struct show *s);
+
+#endif
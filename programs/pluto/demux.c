@@ -72,6 +72,49 @@
 #include "ikev2_send.h"
 #include "iface.h"
 
+/*
+ * Create the real message digest for PACKET; and set up
+ * md->packet_pbs to describe it.
+ *
+ * When the packet is in a pooled buffer, the digest takes that over;
+ * otherwise the packet is copied to a new, properly sized buffer.
+ */
+
+static struct msg_digest *packet_md(const struct iface_port *ifp,
+				    struct iface_packet *packet)
+{
+	struct msg_digest *md = alloc_md("msg_digest in read_packet");
+	md->sender = packet->sender;
+	md->iface = ifp;
+	if (packet->buffer != NULL) {
+		md->packet_buffer = packet->buffer;
+		packet->buffer = NULL;
+		init_pbs(&md->packet_pbs, packet->ptr, packet->len, "packet");
+	} else {
+		init_pbs(&md->packet_pbs,
+			 clone_bytes(packet->ptr, packet->len,
+				     "message buffer in read_packet()"),
+			 packet->len, "packet");
+	}
+
+	endpoint_buf sb;
+	endpoint_buf lb;
+	dbg("*received %d bytes from %s on %s %s using %s",
+	    (int) pbs_room(&md->packet_pbs),
+	    str_endpoint(&md->sender, &sb),
+	    ifp->ip_dev->id_rname,
+	    str_endpoint(&ifp->local_endpoint, &lb),
+	    ifp->protocol->name);
+
+	if (DBGP(DBG_BASE)) {
+		DBG_dump(NULL, md->packet_pbs.start, pbs_room(&md->packet_pbs));
+	}
+
+	pstats_ike_in_bytes += pbs_room(&md->packet_pbs);
+
+	return md;
+}
+
 /*
  * read the message.
  *
@@ -97,34 +140,7 @@ static enum iface_status read_message(const struct iface_port *ifp,
 		return status;
 	}
 
-	/*
-	 * Create the real message digest; and set up md->packet_pbs
-	 * to describe it.
-	 */
-	struct msg_digest *md = alloc_md("msg_digest in read_packet");
-	md->sender = packet.sender;
-	md->iface = ifp;
-	init_pbs(&md->packet_pbs,
-		 clone_bytes(packet.ptr, packet.len,
-			     "message buffer in read_packet()"),
-		 packet.len, "packet");
-
-	endpoint_buf sb;
-	endpoint_buf lb;
-	dbg("*received %d bytes from %s on %s %s using %s",
-	    (int) pbs_room(&md->packet_pbs),
-	    str_endpoint(&md->sender, &sb),
-	    ifp->ip_dev->id_rname,
-	    str_endpoint(&ifp->local_endpoint, &lb),
-	    ifp->protocol->name);
-
-	if (DBGP(DBG_BASE)) {
-		DBG_dump(NULL, md->packet_pbs.start, pbs_room(&md->packet_pbs));
-	}
-
-	pstats_ike_in_bytes += pbs_room(&md->packet_pbs);
-
-	*mdp = md;
+	*mdp = packet_md(ifp, &packet);
 	return IFACE_OK;
 }
 
@@ -296,6 +312,16 @@ static void process_md(struct msg_digest **mdp)
 
 static bool impair_incoming(struct msg_digest *md);
 
+static void process_read_md(struct msg_digest **mdp, threadtime_t md_start)
+{
+	(*mdp)->md_inception = md_start;
+	if (!impair_incoming(*mdp)) {
+		process_md(mdp);
+	}
+	md_delref(mdp, HERE);
+	pexpect(*mdp == NULL);
+}
+
 enum iface_status handle_packet_cb(const struct iface_port *ifp)
 {
 	threadtime_t md_start = threadtime_start();
@@ -304,12 +330,7 @@ enum iface_status handle_packet_cb(const struct iface_port *ifp)
 	if (status != IFACE_OK) {
 		pexpect(md == NULL);
 	} else if (pexpect(md != NULL)) {
-		md->md_inception = md_start;
-		if (!impair_incoming(md)) {
-			process_md(&md);
-		}
-		md_delref(&md, HERE);
-		pexpect(md == NULL);
+		process_read_md(&md, md_start);
 	} else {
 		status = IFACE_FATAL;
 	}
@@ -319,6 +340,17 @@ enum iface_status handle_packet_cb(const struct iface_port *ifp)
 	return status;
 }
 
+void process_iface_packet(const struct iface_port *ifp,
+			  struct iface_packet *packet,
+			  threadtime_t md_start)
+{
+	struct msg_digest *md = packet_md(ifp, packet);
+	process_read_md(&md, md_start);
+	threadtime_stop(&md_start, SOS_NOBODY,
+			"%s() processing packet", __func__);
+	pexpect_reset_globals();
+}
+
 /*
  * Impair pluto by replaying packets.
  *
@@ -32,9 +32,19 @@
 
 struct state;   /* forward declaration of tag */
 struct iface_port;
+struct iface_packet;
 
 enum iface_status handle_packet_cb(const struct iface_port *ifp);
 
+/*
+ * Process PACKET, already read from IFP by the caller; when
+ * PACKET->buffer is non-NULL the digest takes it over (and it is
+ * set to NULL).
+ */
+void process_iface_packet(const struct iface_port *ifp,
+			  struct iface_packet *packet,
+			  threadtime_t md_start);
+
 /* State transition function infrastructure
  *
  * com_handle parses a message, decides what state object it applies to,
@@ -187,6 +197,7 @@ struct msg_digest {
 	 * msg_digest.
 	 */
 	pb_stream packet_pbs;			/* whole packet */
+	uint8_t *packet_buffer;			/* pooled buffer containing packet_pbs, or NULL */
 	pb_stream message_pbs;			/* message to be processed */
 
 #   define PAYLIMIT 30
@@ -229,6 +240,16 @@ extern struct msg_digest *alloc_md(const char *mdname);
 struct msg_digest *md_addref(struct msg_digest *md, where_t where);
 void md_delref(struct msg_digest **mdp, where_t where);
 
+/*
+ * Digests, and the buffers packets are received into, are recycled
+ * through small pools.  A packet larger than MD_PACKET_BUFFER_SIZE
+ * is given its own buffer.
+ */
+#define MD_PACKET_BUFFER_SIZE 8192
+uint8_t *alloc_md_packet_buffer(void);
+void free_md_packet_buffer(uint8_t **buffer);
+void free_md_pools(void);
+
 /* only the buffer */
 struct msg_digest *clone_raw_md(struct msg_digest *md, const char *name);
 
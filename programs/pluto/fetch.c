@@ -29,6 +29,7 @@
 
 #include <cert.h>
 #include <certdb.h>
+#include <secder.h>		/* for DER_DecodeTimeChoice() */
 
 
 #include "constants.h"
@@ -46,6 +47,8 @@
 #include "keys.h"
 #include "crl_queue.h"
 #include "server.h"
+#include "pubkey_db.h"
+#include "nss_cert_verify.h"	/* for flush_verified_chains() */
 
 #define FETCH_CMD_TIMEOUT       5       /* seconds */
 
@@ -98,104 +101,24 @@ static void free_fetch_request(fetch_req_t *req)
 	pfree(req);
 }
 
-#ifdef LIBCURL
-
-#include <curl/curl.h>	/* from libcurl devel */
-
 /*
- * Appends *ptr into (chunk_t *)data.
- * A call-back used with libcurl.
+ * A copy of a fetch request, taken so that the list isn't locked
+ * while the CRLs are being fetched.
  */
-static size_t write_buffer(void *ptr, size_t size, size_t nmemb, void *data)
-{
-	size_t realsize = size * nmemb;
-	chunk_t *mem = (chunk_t *)data;
 
-	/* note: memory allocated by realloc(3) */
-	unsigned char *m = realloc(mem->ptr, mem->len + realsize);
-
-	if (m == NULL) {
-		/* don't overwrite mem->ptr */
-		return 0;	/* failure */
-	} else {
-		memcpy(&(m[mem->len]), ptr, realsize);
-		mem->ptr = m;
-		mem->len += realsize;
-		return realsize;
-	}
-}
-
-/*
- * fetches a binary blob from a url with libcurl
- */
-static err_t fetch_curl(chunk_t url,
-			chunk_t *blob)
-{
-	char errorbuffer[CURL_ERROR_SIZE] = "";
-	char *uri;
-	chunk_t response = EMPTY_CHUNK;	/* managed by realloc/free */
-	long timeout = FETCH_CMD_TIMEOUT;
-	CURLcode res;
-
-	/* get it with libcurl */
-	CURL *curl = curl_easy_init();
-
-	if (curl != NULL) {
-		/* we need a NUL-terminated string for curl */
-		uri = clone_hunk_as_string(url, "NUL-terminated url");
-
-		if (curl_timeout > 0)
-			timeout = curl_timeout;
-
-		dbg("Trying cURL '%s' with connect timeout of %ld",
-			uri, timeout);
-
-		curl_easy_setopt(curl, CURLOPT_URL, uri);
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_buffer);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
-		curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorbuffer);
-		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
-		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 2 * timeout);
-		/* work around for libcurl signal bug */
-		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-		if (curl_iface != NULL)
-			curl_easy_setopt(curl, CURLOPT_INTERFACE, curl_iface);
-
-		res = curl_easy_perform(curl);
-
-		if (res == CURLE_OK) {
-			/* clone from realloc(3)ed memory to pluto-allocated memory */
-			*blob = clone_hunk(response, "curl blob");
-		} else {
-			libreswan_log("fetching uri (%s) with libcurl failed: %s", uri,
-			     errorbuffer);
-		}
-		curl_easy_cleanup(curl);
-
-		/* ??? where/how should this be logged? */
-		if (errorbuffer[0] != '\0') {
-			dbg("libcurl(%s) yielded %s", uri, errorbuffer);
-		}
-		pfreeany(uri);
-
-		if (response.ptr != NULL)
-			free(response.ptr);	/* allocated via realloc(3) */
-	}
-	/* ??? should this return errorbuffer instead? */
-	return strlen(errorbuffer) > 0 ? "libcurl error" : NULL;
-}
-
-#else	/* LIBCURL */
+struct crl_fetch {
+	chunk_t issuer;
+	generalName_t *distribution_points;	/* cloned */
+	const generalName_t *next_dp;		/* next one to try */
+	struct crl_transfer *transfer;		/* running, if any */
+	bool fetched;
+};
 
-static err_t fetch_curl(chunk_t url UNUSED,
-			chunk_t *blob UNUSED)
+static bool is_ldap_url(chunk_t url)
 {
-	return "not compiled with libcurl support";
+	return url.len >= 5 && strncaseeq((const char *)url.ptr, "ldap:", 5);
 }
 
-#endif	/* LIBCURL */
-
-
 #ifdef LIBLDAP
 
 #define LDAP_DEPRECATED 1
@@ -338,21 +261,15 @@ static err_t fetch_ldap_url(chunk_t url UNUSED,
 #endif
 
 /*
- * fetch an ASN.1 blob coded in PEM or DER format from a URL
+ * Convert a fetched blob, coded in PEM or DER format, to ASN.1.
  * Returns error message or NULL.
- * Iff no error, *blob contains fetched ASN.1 blob (to be freed by caller).
+ * Iff error, *blob is freed.
  */
-static err_t fetch_asn1_blob(chunk_t url, chunk_t *blob)
+static err_t decode_asn1_blob(chunk_t *blob)
 {
 	err_t ugh = NULL;
 
-	*blob = EMPTY_CHUNK;
-	if (url.len >= 5 && strncaseeq((const char *)url.ptr, "ldap:", 5))
-		ugh = fetch_ldap_url(url, blob);
-	else
-		ugh = fetch_curl(url, blob);
-	if (ugh != NULL) {
-	} else if (is_asn1(*blob)) {
+	if (is_asn1(*blob)) {
 		dbg("  fetched blob coded in DER format");
 	} else {
 		ugh = pemtobin(blob);
@@ -370,6 +287,39 @@ static err_t fetch_asn1_blob(chunk_t url, chunk_t *blob)
 	return ugh;
 }
 
+/*
+ * Is the fetched CRL newer (by thisUpdate) than the one NSS already
+ * has for the issuer?  If it isn't, there's no point in importing it
+ * again (which means forking the import helper and re-parsing every
+ * entry).
+ */
+static bool crl_is_newer(chunk_t blob)
+{
+	SECItem der = same_chunk_as_secitem(blob, siBuffer);
+	CERTSignedCrl *crl = CERT_DecodeDERCrlWithFlags(NULL, &der, SEC_CRL_TYPE,
+							CRL_DECODE_DONT_COPY_DER |
+							CRL_DECODE_SKIP_ENTRIES);
+	if (crl == NULL) {
+		/* let the import complain */
+		return true;
+	}
+
+	bool newer = true;
+	CERTSignedCrl *old = SEC_FindCrlByName(CERT_GetDefaultCertDB(),
+					       &crl->crl.derName, SEC_CRL_TYPE);
+	if (old != NULL) {
+		PRTime this_update, old_this_update;
+		if (DER_DecodeTimeChoice(&this_update, &crl->crl.lastUpdate) == SECSuccess &&
+		    DER_DecodeTimeChoice(&old_this_update, &old->crl.lastUpdate) == SECSuccess &&
+		    this_update <= old_this_update) {
+			newer = false;
+		}
+		SEC_DestroyCrl(old);
+	}
+	SEC_DestroyCrl(crl);
+	return newer;
+}
+
 /* Note: insert_crl_nss frees *blob */
 static bool insert_crl_nss(chunk_t *blob, const chunk_t crl_uri)
 {
@@ -388,6 +338,7 @@ static bool insert_crl_nss(chunk_t *blob, const chunk_t crl_uri)
 				      nss_err_str((PRInt32)r));
 		} else {
 			dbg("CRL imported");
+			flush_verified_chains("CRL imported");
 			ret = TRUE;
 		}
 		pfreeany(uri_str);
@@ -397,44 +348,456 @@ static bool insert_crl_nss(chunk_t *blob, const chunk_t crl_uri)
 	return ret;
 }
 
+/*
+ * Import the CRL fetched from DP; frees *blob.  Returns true when
+ * NSS has the CRL, either because it was imported or because it
+ * hasn't changed.
+ */
+static bool import_crl_blob(chunk_t *blob, const generalName_t *dp)
+{
+	err_t ugh = decode_asn1_blob(blob);
+	if (ugh != NULL) {
+		dbg("fetch failed:  %s", ugh);
+		return false;
+	}
+	if (!crl_is_newer(*blob)) {
+		dbg("CRL from '%.*s' has the same thisUpdate; not importing",
+		    (int)dp->name.len, dp->name.ptr);
+		free_chunk_content(blob);
+		return true;
+	}
+	return insert_crl_nss(blob, dp->name);
+}
+
+static bool fetch_ldap_crl(const generalName_t *dp)
+{
+	chunk_t blob = EMPTY_CHUNK;
+	err_t ugh = fetch_ldap_url(dp->name, &blob);
+	if (ugh != NULL) {
+		dbg("fetch failed:  %s", ugh);
+		free_chunk_content(&blob);
+		return false;
+	}
+	return import_crl_blob(&blob, dp);
+}
+
+#ifdef LIBCURL
+
+#include <curl/curl.h>	/* from libcurl devel */
+
+/*
+ * The transfers are run concurrently using curl's multi interface.
+ * Each request tries its distribution points in turn, so it has at
+ * most one transfer running.
+ */
+#define MAX_CRL_TRANSFERS 8
+#define MAX_CRL_TRANSFERS_PER_HOST 2
+
+/*
+ * The Last-Modified time and ETag returned with each CRL; sent back
+ * with the next fetch so that an unchanged CRL isn't downloaded
+ * again.  Only used by the fetch thread.
+ */
+
+struct crl_validator {
+	struct crl_validator *next;
+	char *url;
+	long last_modified;	/* -1 when unknown */
+	char *etag;		/* NULL when unknown */
+};
+
+static struct crl_validator *crl_validators;
+
+static struct crl_validator *crl_validator(const char *url)
+{
+	for (struct crl_validator *v = crl_validators; v != NULL; v = v->next) {
+		if (streq(v->url, url)) {
+			return v;
+		}
+	}
+	struct crl_validator *v = alloc_thing(struct crl_validator, "crl validator");
+	*v = (struct crl_validator) {
+		.next = crl_validators,
+		.url = clone_str(url, "crl validator url"),
+		.last_modified = -1,
+	};
+	crl_validators = v;
+	return v;
+}
+
+static void free_crl_validators(void)
+{
+	while (crl_validators != NULL) {
+		struct crl_validator *v = crl_validators;
+		crl_validators = v->next;
+		pfreeany(v->url);
+		pfreeany(v->etag);
+		pfree(v);
+	}
+}
+
+struct crl_transfer {
+	struct crl_fetch *fetch;
+	const generalName_t *dp;
+	CURL *curl;
+	char *url;
+	chunk_t response;	/* managed by realloc/free */
+	char *etag;		/* from the response */
+	struct curl_slist *headers;
+	char errorbuffer[CURL_ERROR_SIZE];
+};
+
+/*
+ * Appends *ptr into (chunk_t *)data.
+ * A call-back used with libcurl.
+ */
+static size_t write_buffer(void *ptr, size_t size, size_t nmemb, void *data)
+{
+	size_t realsize = size * nmemb;
+	chunk_t *mem = (chunk_t *)data;
+
+	/* note: memory allocated by realloc(3) */
+	unsigned char *m = realloc(mem->ptr, mem->len + realsize);
+
+	if (m == NULL) {
+		/* don't overwrite mem->ptr */
+		return 0;	/* failure */
+	} else {
+		memcpy(&(m[mem->len]), ptr, realsize);
+		mem->ptr = m;
+		mem->len += realsize;
+		return realsize;
+	}
+}
+
+/*
+ * Saves the response's ETag header in (struct crl_transfer *)data.
+ * A call-back used with libcurl.
+ */
+static size_t save_etag(char *buffer, size_t size, size_t nitems, void *data)
+{
+	struct crl_transfer *t = data;
+	size_t len = size * nitems;
+	static const char etag[] = "ETag:";
+
+	if (len > sizeof(etag) - 1 &&
+	    strncaseeq(buffer, etag, sizeof(etag) - 1)) {
+		const char *start = buffer + sizeof(etag) - 1;
+		const char *end = buffer + len;
+		while (start < end && (*start == ' ' || *start == '\t'))
+			start++;
+		while (end > start && (end[-1] == '\r' || end[-1] == '\n' ||
+				       end[-1] == ' ' || end[-1] == '\t'))
+			end--;
+		pfreeany(t->etag);
+		if (end > start)
+			t->etag = clone_bytes_as_string(start, end - start, "etag");
+	}
+	return len;
+}
+
+static bool nss_has_crl(chunk_t issuer)
+{
+	SECItem name = same_chunk_as_dercert_secitem(issuer);
+	CERTSignedCrl *crl = SEC_FindCrlByName(CERT_GetDefaultCertDB(),
+					       &name, SEC_CRL_TYPE);
+	if (crl == NULL) {
+		return false;
+	}
+	SEC_DestroyCrl(crl);
+	return true;
+}
+
+static void free_crl_transfer(CURLM *multi, struct crl_transfer **tp)
+{
+	struct crl_transfer *t = *tp;
+	curl_multi_remove_handle(multi, t->curl);
+	curl_easy_cleanup(t->curl);
+	curl_slist_free_all(t->headers);
+	if (t->response.ptr != NULL)
+		free(t->response.ptr);	/* allocated via realloc(3) */
+	pfreeany(t->etag);
+	pfreeany(t->url);
+	t->fetch->transfer = NULL;
+	pfree(t);
+	*tp = NULL;
+}
+
+static bool start_crl_transfer(CURLM *multi, struct crl_fetch *fetch,
+			       const generalName_t *dp)
+{
+	CURL *curl = curl_easy_init();
+	if (curl == NULL) {
+		libreswan_log("libcurl could not create a transfer");
+		return false;
+	}
+
+	struct crl_transfer *t = alloc_thing(struct crl_transfer, "crl transfer");
+	t->fetch = fetch;
+	t->dp = dp;
+	t->curl = curl;
+	/* we need a NUL-terminated string for curl */
+	t->url = clone_hunk_as_string(dp->name, "NUL-terminated url");
+
+	long timeout = (curl_timeout > 0 ? curl_timeout : FETCH_CMD_TIMEOUT);
+	dbg("Trying cURL '%s' with connect timeout of %ld", t->url, timeout);
+
+	curl_easy_setopt(curl, CURLOPT_URL, t->url);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)t);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_buffer);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&t->response);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, save_etag);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)t);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, t->errorbuffer);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 2 * timeout);
+	curl_easy_setopt(curl, CURLOPT_FILETIME, 1L);
+	/* work around for libcurl signal bug */
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+	if (curl_iface != NULL)
+		curl_easy_setopt(curl, CURLOPT_INTERFACE, curl_iface);
+
+	/*
+	 * Only ask whether the CRL changed when NSS still has the
+	 * copy it would be compared against.
+	 */
+	if (nss_has_crl(fetch->issuer)) {
+		struct crl_validator *v = crl_validator(t->url);
+		if (v->last_modified >= 0) {
+			curl_easy_setopt(curl, CURLOPT_TIMECONDITION,
+					 (long)CURL_TIMECOND_IFMODSINCE);
+			curl_easy_setopt(curl, CURLOPT_TIMEVALUE, v->last_modified);
+		}
+		if (v->etag != NULL) {
+			static const char if_none_match[] = "If-None-Match: ";
+			size_t len = sizeof(if_none_match) + strlen(v->etag);
+			char *header = alloc_bytes(len, "If-None-Match header");
+			snprintf(header, len, "%s%s", if_none_match, v->etag);
+			t->headers = curl_slist_append(NULL, header); /* copies */
+			pfree(header);
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, t->headers);
+		}
+	}
+
+	fetch->transfer = t;
+	if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+		libreswan_log("fetching uri (%s) with libcurl failed: could not add transfer",
+			      t->url);
+		free_crl_transfer(multi, &t);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Returns true when the CRL was fetched, or when it hasn't changed.
+ */
+static bool finish_crl_transfer(struct crl_transfer *t, CURLcode res)
+{
+	bool ok = false;
+	long code = 0;
+	curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &code);
+
+	if (res != CURLE_OK) {
+		libreswan_log("fetching uri (%s) with libcurl failed: %s", t->url,
+			      t->errorbuffer);
+	} else if (code == 304) {
+		dbg("CRL at '%s' not modified", t->url);
+		ok = true;
+	} else if (code >= 400) {
+		libreswan_log("fetching uri (%s) with libcurl failed: HTTP status %ld",
+			      t->url, code);
+	} else {
+		/* clone from realloc(3)ed memory to pluto-allocated memory */
+		chunk_t blob = clone_hunk(t->response, "curl blob");
+		ok = import_crl_blob(&blob, t->dp);
+		if (ok) {
+			struct crl_validator *v = crl_validator(t->url);
+			long filetime = -1;
+			curl_easy_getinfo(t->curl, CURLINFO_FILETIME, &filetime);
+			v->last_modified = filetime;
+			pfreeany(v->etag);
+			v->etag = t->etag;
+			t->etag = NULL;
+		}
+	}
+
+	/* ??? where/how should this be logged? */
+	if (t->errorbuffer[0] != '\0') {
+		dbg("libcurl(%s) yielded %s", t->url, t->errorbuffer);
+	}
+	return ok;
+}
+
+/*
+ * Start FETCH's next transfer; LDAP distribution points are fetched
+ * there and then.  Returns false when FETCH has nothing running.
+ */
+static bool next_crl_transfer(CURLM *multi, struct crl_fetch *fetch)
+{
+	while (!fetch->fetched && fetch->next_dp != NULL && !exiting_pluto) {
+		const generalName_t *dp = fetch->next_dp;
+		fetch->next_dp = dp->next;
+		if (is_ldap_url(dp->name)) {
+			fetch->fetched = fetch_ldap_crl(dp);
+		} else if (start_crl_transfer(multi, fetch, dp)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void run_crl_fetches(struct crl_fetch *fetches, unsigned nr_fetches)
+{
+	CURLM *multi = curl_multi_init();
+	if (multi == NULL) {
+		libreswan_log("libcurl could not be initialized for fetching CRLs");
+		return;
+	}
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+			  (long)MAX_CRL_TRANSFERS_PER_HOST);
+
+	unsigned next = 0;
+	unsigned running = 0;
+	while (!exiting_pluto) {
+		/* top up */
+		while (running < MAX_CRL_TRANSFERS && next < nr_fetches) {
+			if (next_crl_transfer(multi, &fetches[next])) {
+				running++;
+			}
+			next++;
+		}
+		if (running == 0) {
+			break;
+		}
+
+		int still_running;
+		curl_multi_perform(multi, &still_running);
+
+		CURLMsg *msg;
+		int msgs_left;
+		while ((msg = curl_multi_info_read(multi, &msgs_left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			CURLcode res = msg->data.result;
+			char *private;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &private);
+			struct crl_transfer *t = (struct crl_transfer *)private;
+			struct crl_fetch *fetch = t->fetch;
+			fetch->fetched = finish_crl_transfer(t, res);
+			free_crl_transfer(multi, &t);
+			/* try the next distribution point? */
+			if (!next_crl_transfer(multi, fetch)) {
+				running--;
+			}
+		}
+
+		if (running > 0) {
+			curl_multi_wait(multi, NULL, 0, 1000/*ms*/, NULL);
+		}
+	}
+
+	/* when exiting, abandon anything still running */
+	for (unsigned i = 0; i < nr_fetches; i++) {
+		if (fetches[i].transfer != NULL) {
+			free_crl_transfer(multi, &fetches[i].transfer);
+		}
+	}
+	curl_multi_cleanup(multi);
+}
+
+#else	/* LIBCURL */
+
+static void run_crl_fetches(struct crl_fetch *fetches, unsigned nr_fetches)
+{
+	for (unsigned i = 0; i < nr_fetches && !exiting_pluto; i++) {
+		struct crl_fetch *fetch = &fetches[i];
+		for (const generalName_t *dp = fetch->distribution_points;
+		     dp != NULL && !fetch->fetched; dp = dp->next) {
+			if (is_ldap_url(dp->name)) {
+				fetch->fetched = fetch_ldap_crl(dp);
+			} else {
+				dbg("fetch failed:  %s", "not compiled with libcurl support");
+			}
+		}
+	}
+}
+
+static void free_crl_validators(void)
+{
+}
+
+#endif	/* LIBCURL */
+
 /*
  * try to fetch the crls defined by the fetch requests
+ *
+ * The list is only locked while it is copied and while the results
+ * are recorded, so listing or adding requests isn't held up by a
+ * slow distribution point.
  */
 static void fetch_crls(void)
 {
 	lock_crl_fetch_list("fetch_crls");
 
-	for (fetch_req_t **reqp = &crl_fetch_reqs;
-	     *reqp != NULL && !exiting_pluto; ) {
-		fetch_req_t *req = *reqp;
-
-		for (generalName_t *gn = req->distributionPoints; ;
-		     gn = gn->next) {
-			if (gn == NULL) {
-				/* retain fetch request for next time */
-				req->trials++;
-				/* advance reqp for outer loop */
-				reqp = &req->next;
-				break;
+	unsigned nr_fetches = 0;
+	for (fetch_req_t *req = crl_fetch_reqs; req != NULL; req = req->next) {
+		nr_fetches++;
+	}
+	struct crl_fetch *fetches = NULL;
+	if (nr_fetches > 0) {
+		fetches = alloc_things(struct crl_fetch, nr_fetches, "crl fetches");
+		struct crl_fetch *fetch = fetches;
+		for (fetch_req_t *req = crl_fetch_reqs; req != NULL; req = req->next) {
+			fetch->issuer = clone_hunk(req->issuer, "crl fetch issuer");
+			/* clone, keeping the order */
+			generalName_t **tail = &fetch->distribution_points;
+			for (const generalName_t *gn = req->distributionPoints;
+			     gn != NULL; gn = gn->next) {
+				generalName_t *ngn = clone_const_thing(*gn, "generalName");
+				ngn->name = clone_hunk(gn->name, "crl fetch distribution point");
+				ngn->next = NULL;
+				*tail = ngn;
+				tail = &ngn->next;
 			}
+			fetch->next_dp = fetch->distribution_points;
+			fetch++;
+		}
+	}
+
+	unlock_crl_fetch_list("fetch_crls");
 
-			chunk_t blob;
-			err_t ugh = fetch_asn1_blob(gn->name, &blob);
+	run_crl_fetches(fetches, nr_fetches);
 
-			if (ugh != NULL) {
-				dbg("fetch failed:  %s", ugh);
-			} else if (insert_crl_nss(&blob, gn->name)) {
+	lock_crl_fetch_list("fetch_crls");
+
+	for (unsigned i = 0; i < nr_fetches; i++) {
+		struct crl_fetch *fetch = &fetches[i];
+		for (fetch_req_t **reqp = &crl_fetch_reqs; *reqp != NULL;
+		     reqp = &(*reqp)->next) {
+			fetch_req_t *req = *reqp;
+			if (!same_dn(fetch->issuer, req->issuer)) {
+				continue;
+			}
+			if (fetch->fetched) {
 				dbg("we have a valid crl");
 				/* delete fetch request */
 				*reqp = req->next;	/* remove from list */
 				free_fetch_request(req);
-				/* *reqp advanced (so don't change reqp) for outer loop */
-				break;
+			} else {
+				/* retain fetch request for next time */
+				req->trials++;
 			}
+			break;
 		}
+		free_chunk_content(&fetch->issuer);
+		free_generalNames(fetch->distribution_points, TRUE);
 	}
 
 	unlock_crl_fetch_list("fetch_crls");
+
+	pfreeany(fetches);
 }
 
 /*
@@ -447,6 +810,13 @@ static void fetch_crls(void)
  * Similarly, if check_crls() is called more frequently than
  * fetch_crls() can process, redundant fetches will be merged.
  */
+static void add_pubkey_issuer_request(chunk_t issuer_dn, void *arg)
+{
+	struct crl_fetch_request **requests = arg;
+	SECItem issuer = same_chunk_as_dercert_secitem(issuer_dn);
+	*requests = crl_fetch_request(&issuer, NULL, *requests);
+}
+
 void check_crls(struct fd *unused_whackfd UNUSED)
 {
 	schedule_oneshot_timer(EVENT_CHECK_CRLS, crl_check_interval);
@@ -489,15 +859,12 @@ void check_crls(struct fd *unused_whackfd UNUSED)
 	dbg("releasing crl list in %s", __func__);
 	PORT_FreeArena(crl_list->arena, PR_FALSE);
 
-	/* add the pubkeys distribution points to fetch list */
+	/*
+	 * Add the pubkeys distribution points to fetch list; the
+	 * database has each issuer once.
+	 */
 
-	for (struct pubkey_list *pkl = pluto_pubkeys; pkl != NULL; pkl = pkl->next) {
-		struct pubkey *key = pkl->key;
-		if (key != NULL) {
-			SECItem issuer = same_chunk_as_dercert_secitem(key->issuer);
-			requests = crl_fetch_request(&issuer, NULL, requests);
-		}
-	}
+	for_each_pubkey_issuer(add_pubkey_issuer_request, &requests);
 
 	/*
 	 * Iterate all X.509 certificates in database. This is needed to
@@ -622,6 +989,8 @@ void free_crl_fetch(void)
 
 	unlock_crl_fetch_list("free_crl_fetch");
 
+	free_crl_validators();
+
 #ifdef LIBCURL
 	if (deltasecs(crl_check_interval) > 0) {
 		/* cleanup curl */
@@ -19,34 +19,275 @@
 
 #include "defs.h"
 #include "hash_table.h"
+#include "timer.h"
+#include "log.h"		/* for whack_print() */
+#include "show.h"
+#include "siphash.h"
+#include "rnd.h"		/* for get_rnd_bytes() */
 
 const hash_t zero_hash = { 0 };
 
+static struct siphash_key hash_table_key;
+static bool hash_table_keyed;
+
+/*
+ * Linear hashing load factors.
+ *
+ * The table is grown once the average chain length exceeds
+ * GROW_LOAD and shrunk once it drops below SHRINK_LOAD; the gap
+ * stops a table hovering around a threshold from thrashing.
+ *
+ * Resizing is deferred to a timer so that it never happens while
+ * code is walking a bucket; each tick splits or merges at most
+ * RESIZE_BUCKETS_PER_TICK buckets per table.
+ */
+
+#define GROW_LOAD 2
+#define SHRINK_LOAD_DIVISOR 2	/* i.e., 1/2 */
+#define RESIZE_BUCKETS_PER_TICK 64
+
+static struct hash_table *hash_tables;	/* linked through .linear.next */
+static bool resizer_initialized;
+static bool resize_scheduled;
+
+static unsigned long nr_buckets(const struct hash_table *table)
+{
+	return table->linear.level_slots + table->linear.split;
+}
+
+static struct list_head *bucket_by_index(struct hash_table *table,
+					 unsigned long index)
+{
+	if (table->linear.segments == NULL) {
+		passert(index < table->nr_slots);
+		return &table->slots[index];
+	}
+	unsigned long segment = index / table->nr_slots;
+	passert(segment < table->linear.nr_segments);
+	return &table->linear.segments[segment][index % table->nr_slots];
+}
+
+unsigned long hash_table_nr_buckets(const struct hash_table *table)
+{
+	return nr_buckets(table);
+}
+
+struct list_head *hash_table_bucket_by_index(struct hash_table *table,
+					     unsigned long index)
+{
+	return bucket_by_index(table, index);
+}
+
+static unsigned long bucket_index(const struct hash_table *table, hash_t hash)
+{
+	unsigned long index = hash.hash % table->linear.level_slots;
+	if (index < table->linear.split) {
+		index = hash.hash % (table->linear.level_slots * 2);
+	}
+	return index;
+}
+
 void init_hash_table(struct hash_table *table)
 {
+	if (!hash_table_keyed) {
+		get_rnd_bytes(&hash_table_key, sizeof(hash_table_key));
+		hash_table_keyed = true;
+	}
+	passert(table->nr_slots > 0);
 	for (unsigned i = 0; i < table->nr_slots; i++) {
 		struct list_head *slot = &table->slots[i];
 		*slot = (struct list_head) INIT_LIST_HEAD(slot, &table->info);
 	}
+	table->linear.segments = NULL;
+	table->linear.nr_segments = 1;
+	table->linear.max_segments = 1;
+	table->linear.level_slots = table->nr_slots;
+	table->linear.split = 0;
+	if (!table->linear.registered) {
+		table->linear.next = hash_tables;
+		hash_tables = table;
+		table->linear.registered = true;
+	}
+}
+
+static hash_t fold_hash(uint64_t h)
+{
+	return (hash_t) { .hash = (unsigned)(h ^ (h >> 32)), };
 }
 
 hash_t hash_table_hasher(shunk_t data, hash_t hash)
 {
-	/*
-	 * 251 is a prime close to 256 (so like <<8).
-	 *
-	 * There's no real rationale for doing this.
-	 */
-	const uint8_t *bytes = data.ptr;
-	for (unsigned j = 0; j < data.len; j++) {
-		hash.hash = hash.hash * 251 + bytes[j];
-	}
-	return hash;
+	/* chain by perturbing the key with the previous hash */
+	struct siphash_key key = hash_table_key;
+	key.k[0] ^= hash.hash;
+	return fold_hash(siphash13(&key, data.ptr, data.len));
+}
+
+hash_t hash_table_hash_u64(uint64_t word)
+{
+	return fold_hash(siphash13_u64(&hash_table_key, word));
+}
+
+hash_t hash_table_hash_u64x2(uint64_t w0, uint64_t w1)
+{
+	return fold_hash(siphash13_u64x2(&hash_table_key, w0, w1));
 }
 
 struct list_head *hash_table_bucket(struct hash_table *table, hash_t hash)
 {
-	return &table->slots[hash.hash % table->nr_slots];
+	return bucket_by_index(table, bucket_index(table, hash));
+}
+
+/*
+ * Move all entries in FROM that belong elsewhere into their new
+ * bucket.  Walk oldest to newest so that, since insert puts entries
+ * at the front, the relative age of the moved entries is preserved.
+ */
+
+static void redistribute_bucket(struct hash_table *table, struct list_head *from)
+{
+	void *data;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(from, data) {
+		struct list_head *to = hash_table_bucket(table, table->hasher(data));
+		if (to != from) {
+			struct list_entry *entry = table->entry(data);
+			remove_list_entry(entry);
+			insert_list_entry(to, entry);
+		}
+	}
+}
+
+static bool need_grow(const struct hash_table *table)
+{
+	return (table->nr_entries > 0 &&
+		(unsigned long)table->nr_entries > nr_buckets(table) * GROW_LOAD);
+}
+
+static bool need_shrink(const struct hash_table *table)
+{
+	return (nr_buckets(table) > table->nr_slots &&
+		(unsigned long)table->nr_entries * SHRINK_LOAD_DIVISOR < nr_buckets(table));
+}
+
+static void split_bucket(struct hash_table *table)
+{
+	unsigned long new_index = table->linear.level_slots + table->linear.split;
+	unsigned long segment = new_index / table->nr_slots;
+	if (segment >= table->linear.nr_segments) {
+		/* first bucket in a new segment */
+		passert(segment == table->linear.nr_segments);
+		if (table->linear.segments == NULL) {
+			table->linear.max_segments = 8;
+			table->linear.segments = alloc_things(struct list_head *,
+							      table->linear.max_segments,
+							      "hash table segments");
+			table->linear.segments[0] = table->slots;
+		} else if (segment >= table->linear.max_segments) {
+			realloc_things(table->linear.segments,
+				       table->linear.max_segments,
+				       table->linear.max_segments * 2,
+				       "hash table segments");
+			table->linear.max_segments *= 2;
+		}
+		table->linear.segments[segment] =
+			alloc_things(struct list_head, table->nr_slots,
+				     "hash table segment");
+		table->linear.nr_segments++;
+	}
+	struct list_head *slot = bucket_by_index(table, new_index);
+	*slot = (struct list_head) INIT_LIST_HEAD(slot, &table->info);
+
+	struct list_head *old = bucket_by_index(table, table->linear.split);
+	table->linear.split++;
+	if (table->linear.split == table->linear.level_slots) {
+		table->linear.level_slots *= 2;
+		table->linear.split = 0;
+	}
+	redistribute_bucket(table, old);
+}
+
+static void merge_bucket(struct hash_table *table)
+{
+	if (table->linear.split == 0) {
+		table->linear.level_slots /= 2;
+		table->linear.split = table->linear.level_slots;
+	}
+	table->linear.split--;
+	unsigned long old_index = table->linear.level_slots + table->linear.split;
+	struct list_head *old = bucket_by_index(table, old_index);
+	redistribute_bucket(table, old);
+	passert(old->head.newer == &old->head);
+
+	if (old_index % table->nr_slots == 0) {
+		/* last bucket in the segment is gone */
+		unsigned long segment = old_index / table->nr_slots;
+		passert(segment > 0 && segment + 1 == table->linear.nr_segments);
+		pfree(table->linear.segments[segment]);
+		table->linear.segments[segment] = NULL;
+		table->linear.nr_segments--;
+		if (table->linear.nr_segments == 1) {
+			pfree(table->linear.segments);
+			table->linear.segments = NULL;
+			table->linear.max_segments = 1;
+		}
+	}
+}
+
+static void resize_hash_tables(struct fd *unused_whackfd UNUSED)
+{
+	resize_scheduled = false;
+	bool more = false;
+	for (struct hash_table *table = hash_tables; table != NULL;
+	     table = table->linear.next) {
+		unsigned n;
+		for (n = 0; n < RESIZE_BUCKETS_PER_TICK && need_grow(table); n++) {
+			split_bucket(table);
+		}
+		for (; n < RESIZE_BUCKETS_PER_TICK && need_shrink(table); n++) {
+			merge_bucket(table);
+		}
+		if (n > 0) {
+			dbg("%s: resized to %lu buckets for %ld entries",
+			    table->info.name, nr_buckets(table), table->nr_entries);
+		}
+		more |= need_grow(table) || need_shrink(table);
+	}
+	if (more) {
+		/* let the event-loop run before continuing */
+		resize_scheduled = true;
+		schedule_oneshot_timer(EVENT_RESIZE_HASH_TABLES, deltatime(0));
+	}
+}
+
+static void schedule_resize(struct hash_table *table)
+{
+	if (resizer_initialized && !resize_scheduled &&
+	    (need_grow(table) || need_shrink(table))) {
+		resize_scheduled = true;
+		schedule_oneshot_timer(EVENT_RESIZE_HASH_TABLES, deltatime(0));
+	}
+}
+
+void init_hash_table_resizer(void)
+{
+	init_oneshot_timer(EVENT_RESIZE_HASH_TABLES, resize_hash_tables);
+	resizer_initialized = true;
+}
+
+void free_hash_tables(void)
+{
+	/*
+	 * Fold any remaining entries back into the initial buckets;
+	 * this also releases the allocated segments.
+	 */
+	resizer_initialized = false;
+	for (struct hash_table *table = hash_tables; table != NULL;
+	     table = table->linear.next) {
+		while (nr_buckets(table) > table->nr_slots) {
+			merge_bucket(table);
+		}
+		passert(table->linear.segments == NULL);
+	}
 }
 
 void add_hash_table_entry(struct hash_table *table, void *data)
@@ -57,6 +298,7 @@ void add_hash_table_entry(struct hash_table *table, void *data)
 	struct list_head *bucket = hash_table_bucket(table, hash);
 	table->nr_entries++;
 	insert_list_entry(bucket, entry);
+	schedule_resize(table);
 }
 
 void del_hash_table_entry(struct hash_table *table, void *data)
@@ -64,6 +306,7 @@ void del_hash_table_entry(struct hash_table *table, void *data)
 	struct list_entry *entry = table->entry(data);
 	table->nr_entries--;
 	remove_list_entry(entry);
+	schedule_resize(table);
 }
 
 void rehash_table_entry(struct hash_table *table, void *data)
@@ -71,3 +314,41 @@ void rehash_table_entry(struct hash_table *table, void *data)
 	del_hash_table_entry(table, data);
 	add_hash_table_entry(table, data);
 }
+
+void show_hash_tables_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	for (struct hash_table *table = hash_tables; table != NULL;
+	     table = table->linear.next) {
+		/* "IKE SPI[ir] table" -> "ike_spi_ir" */
+		char name[64];
+		jambuf_t buf = ARRAY_AS_JAMBUF(name);
+		jam_status_name(&buf, table->info.name);
+		char *suffix = strstr(name, "_table");
+		if (suffix != NULL) {
+			*suffix = '\0';
+		}
+		unsigned long buckets = nr_buckets(table);
+		unsigned long longest = 0;
+		for (unsigned long b = 0; b < buckets; b++) {
+			unsigned long chain = 0;
+			void *data;
+			FOR_EACH_LIST_ENTRY_OLD2NEW(bucket_by_index(table, b), data) {
+				chain++;
+			}
+			if (chain > longest) {
+				longest = chain;
+			}
+		}
+		/* load factor in hundredths */
+		unsigned long load = table->nr_entries * 100 / buckets;
+		whack_print(whackfd, "current.hash_table.%s.entries=%ld",
+			    name, table->nr_entries);
+		whack_print(whackfd, "current.hash_table.%s.buckets=%lu",
+			    name, buckets);
+		whack_print(whackfd, "current.hash_table.%s.load_factor=%lu.%02lu",
+			    name, load / 100, load % 100);
+		whack_print(whackfd, "current.hash_table.%s.longest_chain=%lu",
+			    name, longest);
+	}
+}
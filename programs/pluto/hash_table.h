@@ -16,6 +16,8 @@
 #ifndef _hash_table_h_
 #define _hash_table_h_
 
+#include <stdint.h>
+
 #include "list_entry.h"
 #include "shunk.h"		/* has constant ptr */
 
@@ -26,6 +28,17 @@
 typedef struct { unsigned hash; } hash_t;
 extern const hash_t zero_hash;
 
+/*
+ * The table starts out with the NR_SLOTS buckets in SLOTS (typically
+ * a static array) and then grows (and shrinks) using linear hashing:
+ * each step splits (or merges) a single bucket so the cost of a
+ * resize is spread across many event-loop iterations.
+ *
+ * Additional buckets are allocated in segments of NR_SLOTS; since a
+ * segment is never moved, a list entry's pointers into its bucket
+ * remain valid while the table is resized.
+ */
+
 struct hash_table {
 	const struct list_info info;
 	hash_t (*hasher)(const void *data);
@@ -33,11 +46,48 @@ struct hash_table {
 	long nr_entries; /* approx? */
 	unsigned long nr_slots;
 	struct list_head *slots;
+	/* private: maintained by hash_table.c */
+	struct {
+		struct list_head **segments;	/* [0] == slots */
+		unsigned long nr_segments;	/* in use */
+		unsigned long max_segments;	/* allocated */
+		unsigned long level_slots;	/* nr_slots * 2^level */
+		unsigned long split;		/* next bucket to split */
+		struct hash_table *next;	/* all tables, for the resizer */
+		bool registered;
+	} linear;
 };
 
 void init_hash_table(struct hash_table *table);
 
+/*
+ * Start the event-loop timer that incrementally grows or shrinks
+ * the tables; call once the event loop exists.
+ */
+void init_hash_table_resizer(void);
+void free_hash_tables(void);
+
+/*
+ * For whack --globalstatus.
+ */
+struct show;
+void show_hash_tables_status(struct show *s);
+
+/*
+ * Keyed hashers.
+ *
+ * These use SipHash-1-3 keyed with a secret generated by the first
+ * init_hash_table() call so that a peer can't choose values (such as
+ * the IKE SPIi) that all land in the one bucket.
+ *
+ * hash_table_hasher() can be chained (pass in the previous HASH);
+ * the _u64() and _u64x2() variants are fast paths for fixed-size
+ * keys such as so_serial_t, reqid_t and ike_spis_t.
+ */
+
 hash_t hash_table_hasher(shunk_t data, hash_t hash);
+hash_t hash_table_hash_u64(uint64_t word);
+hash_t hash_table_hash_u64x2(uint64_t w0, uint64_t w1);
 
 /*
  * Maintain the table.
@@ -60,4 +110,27 @@ void rehash_table_entry(struct hash_table *table, void *data);
 
 struct list_head *hash_table_bucket(struct hash_table *table, hash_t hash);
 
+/*
+ * Iterate over every bucket, including those created by splits (which
+ * are not in .slots[]):
+ *
+ *   struct list_head *bucket;
+ *   FOR_EACH_HASH_TABLE_BUCKET(&table, bucket) {
+ *     FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, data) { ... }
+ *   }
+ *
+ * Since resizing is deferred to a timer, the buckets don't change
+ * while the table is being walked.
+ */
+
+unsigned long hash_table_nr_buckets(const struct hash_table *table);
+struct list_head *hash_table_bucket_by_index(struct hash_table *table,
+					     unsigned long index);
+
+#define FOR_EACH_HASH_TABLE_BUCKET(TABLE, BUCKET)			\
+	for (unsigned long bucket_index_ = 0;				\
+	     (bucket_index_ < hash_table_nr_buckets(TABLE) &&		\
+	      ((BUCKET) = hash_table_bucket_by_index(TABLE, bucket_index_)) != NULL); \
+	     bucket_index_++)
+
 #endif
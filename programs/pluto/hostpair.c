@@ -69,6 +69,7 @@
 #include "virtual.h"	/* needs connections.h */
 
 #include "hostpair.h"
+#include "spd_route_db.h"
 
 /*
  * Table of host_pairs (local->remote endpoints/addresses).
@@ -294,8 +295,8 @@ void connect_to_host_pair(struct connection *c)
 
 void release_dead_interfaces(struct fd *whackfd)
 {
-	for (unsigned i = 0; i < host_pairs.nr_slots; i++) {
-		struct list_head *bucket = &host_pairs.slots[i];
+	struct list_head *bucket;
+	FOR_EACH_HASH_TABLE_BUCKET(&host_pairs, bucket) {
 		struct host_pair *hp = NULL;
 		FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, hp) {
 			struct connection **pp, *p;
@@ -422,6 +423,7 @@ void update_host_pairs(struct connection *c)
 			 */
 			if (!d->spd.that.has_client) {
 				endtosubnet(&new_addr, &d->spd.that.client, HERE);
+				rehash_spd_routes(d);
 			}
 
 			d->spd.that.host_addr = new_addr;
@@ -480,8 +482,8 @@ void check_orientations(void)
 			if (i->ip_dev->ifd_change != IFD_ADD) {
 				continue;
 			}
-			for (unsigned u = 0; u < host_pairs.nr_slots; u++) {
-				struct list_head *bucket = &host_pairs.slots[u];
+			struct list_head *bucket;
+			FOR_EACH_HASH_TABLE_BUCKET(&host_pairs, bucket) {
 				struct host_pair *hp = NULL;
 				FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, hp) {
 					/*
@@ -36,6 +36,7 @@ struct iface_packet {
 	ssize_t len;
 	ip_endpoint sender;
 	uint8_t *ptr;
+	uint8_t *buffer;	/* pooled buffer containing PTR, or NULL */
 };
 
 enum iface_status {
@@ -52,6 +53,15 @@ struct iface_io {
 	ssize_t (*write_packet)(const struct iface_port *ifp,
 				const void *ptr, size_t len,
 				const ip_endpoint *remote_endpoint);
+	/*
+	 * Optional: send the same packet to each of the
+	 * NR_ENDPOINTS remote endpoints using as few system calls as
+	 * possible; returns how many were sent.
+	 */
+	unsigned (*write_packets)(const struct iface_port *ifp,
+				  const void *ptr, size_t len,
+				  const ip_endpoint *remote_endpoints,
+				  unsigned nr_endpoints);
 	void (*cleanup)(struct iface_port *ifp);
 	void (*listen)(struct iface_port *fip, struct logger *logger);
 	int (*bind_iface_port)(struct iface_dev *ifd,
@@ -125,6 +135,12 @@ struct iface_port {
 	bool float_nat_initiator;
 	/* udp only */
 	struct pluto_event *pev;
+	/* udp only: extra SO_REUSEPORT sockets, see ike-socket-queues= */
+	unsigned nr_queues;
+	struct {
+		int fd;
+		struct pluto_event *pev;
+	} queues[MAX_IKE_SOCKET_QUEUES - 1];
 	/* tcp port only */
 	struct evconnlistener *tcp_accept_listener;
 	/* tcp stream only */
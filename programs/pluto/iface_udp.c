@@ -24,6 +24,10 @@
  *
  */
 
+#if defined(linux)
+# define _GNU_SOURCE	/* for sendmmsg() */
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>		/* MSG_ERRQUEUE if defined */
 #include <netinet/udp.h>
@@ -50,7 +54,13 @@
 #include "ip_sockaddr.h"
 #include "nat_traversal.h"	/* for nat_traversal_enabled which seems like a broken idea */
 
-static int bind_udp_socket(const struct iface_dev *ifd, ip_port port)
+#if defined(linux) && defined(SO_ATTACH_REUSEPORT_CBPF)
+# define USE_IKE_SOCKET_QUEUES
+# include <linux/filter.h>	/* for struct sock_fprog */
+#endif
+
+static int bind_udp_socket(const struct iface_dev *ifd, ip_port port,
+			   bool reuseport)
 {
 	const struct ip_info *type = address_type(&ifd->id_address);
 	int fd = socket(type->af, SOCK_DGRAM, IPPROTO_UDP);
@@ -85,6 +95,18 @@ static int bind_udp_socket(const struct iface_dev *ifd, ip_port port)
 		return -1;
 	}
 
+#ifdef USE_IKE_SOCKET_QUEUES
+	if (reuseport &&
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+		       (const void *)&on, sizeof(on)) < 0) {
+		LOG_ERRNO(errno, "setsockopt SO_REUSEPORT in create_socket()");
+		close(fd);
+		return -1;
+	}
+#else
+	pexpect(!reuseport);
+#endif
+
 #ifdef SO_PRIORITY
 	static const int so_prio = 6; /* rumored maximum priority, might be 7 on linux? */
 	if (setsockopt(fd, SOL_SOCKET, SO_PRIORITY,
@@ -235,6 +257,9 @@ static bool nat_traversal_espinudp(int sk, struct iface_dev *ifd)
 static bool check_msg_errqueue(const struct iface_port *ifp, short interest, const char *func);
 #endif
 
+static enum iface_status check_udp_packet(const struct iface_port *ifp,
+					  struct iface_packet *packet);
+
 static enum iface_status udp_read_packet(const struct iface_port *ifp,
 					 struct iface_packet *packet)
 {
@@ -300,6 +325,27 @@ static enum iface_status udp_read_packet(const struct iface_port *ifp,
 		return IFACE_IGNORE;
 	}
 
+	if (packet->len < 0) {
+		struct msg_digest stack_md = {
+			.iface = ifp,
+			.sender = packet->sender,
+		};
+		log_md(RC_LOG, &stack_md, "recvfrom on %s failed "PRI_ERRNO,
+		       ifp->ip_dev->id_rname, pri_errno(packet_errno));
+		return IFACE_IGNORE;
+	}
+
+	return check_udp_packet(ifp, packet);
+}
+
+/*
+ * Strip and check the Non-ESP marker, and filter out stray
+ * keepalives.
+ */
+
+static enum iface_status check_udp_packet(const struct iface_port *ifp,
+					  struct iface_packet *packet)
+{
 	/*
 	 * Managed to decode the from address; fudge up an MD so that
 	 * it be used as log context prefix.
@@ -310,12 +356,6 @@ static enum iface_status udp_read_packet(const struct iface_port *ifp,
 		.sender = packet->sender,
 	};
 
-	if (packet->len < 0) {
-		log_md(RC_LOG, &stack_md, "recvfrom on %s failed "PRI_ERRNO,
-		       ifp->ip_dev->id_rname, pri_errno(packet_errno));
-		return IFACE_IGNORE;
-	}
-
 	if (ifp->add_ike_encapsulation_prefix) {
 		uint32_t non_esp;
 
@@ -379,14 +419,370 @@ static ssize_t udp_write_packet(const struct iface_port *ifp,
 	return sendto(ifp->fd, ptr, len, 0, &remote_sa.sa.sa, remote_sa.len);
 };
 
-static void handle_udp_packet_cb(evutil_socket_t unused_fd UNUSED,
+/* the most messages passed to one sendmmsg() call */
+#define UDP_WRITE_BATCH 64
+
+static unsigned udp_write_packets(const struct iface_port *ifp,
+				  const void *ptr, size_t len,
+				  const ip_endpoint *remote_endpoints,
+				  unsigned nr_endpoints)
+{
+#ifdef MSG_ERRQUEUE
+	if (pluto_sock_errqueue) {
+		check_msg_errqueue(ifp, POLLOUT, __func__);
+	}
+#endif
+
+	unsigned nr_sent = 0;
+#if defined(linux)
+	struct iovec iov = {
+		.iov_base = (void *)ptr,
+		.iov_len = len,
+	};
+	unsigned next = 0;
+	while (next < nr_endpoints) {
+		ip_sockaddr remote_sa[UDP_WRITE_BATCH];
+		struct mmsghdr msgs[UDP_WRITE_BATCH];
+		unsigned nr_msgs = 0;
+		while (nr_msgs < UDP_WRITE_BATCH && next + nr_msgs < nr_endpoints) {
+			remote_sa[nr_msgs] = sockaddr_from_endpoint(&remote_endpoints[next + nr_msgs]);
+			msgs[nr_msgs] = (struct mmsghdr) {
+				.msg_hdr = {
+					.msg_name = &remote_sa[nr_msgs].sa.sa,
+					.msg_namelen = remote_sa[nr_msgs].len,
+					.msg_iov = &iov,
+					.msg_iovlen = 1,
+				},
+			};
+			nr_msgs++;
+		}
+		/*
+		 * On an error part way through, sendmmsg() returns
+		 * what was sent and the next call reports the error;
+		 * skip the endpoint that failed, as a loop of
+		 * sendto() calls would.
+		 */
+		int n = sendmmsg(ifp->fd, msgs, nr_msgs, 0);
+		if (n <= 0) {
+			dbg("sendmmsg() on %s failed: "PRI_ERRNO,
+			    ifp->ip_dev->id_rname, pri_errno(errno));
+			next++;
+		} else {
+			nr_sent += n;
+			next += n;
+		}
+	}
+#else
+	for (unsigned i = 0; i < nr_endpoints; i++) {
+		ip_sockaddr remote_sa = sockaddr_from_endpoint(&remote_endpoints[i]);
+		if (sendto(ifp->fd, ptr, len, 0, &remote_sa.sa.sa, remote_sa.len) == (ssize_t)len) {
+			nr_sent++;
+		}
+	}
+#endif
+	return nr_sent;
+}
+
+#if defined(linux)
+
+/*
+ * Drain up to UDP_READ_BATCH datagrams per wakeup using recvmmsg().
+ *
+ * Each datagram is received straight into a pooled buffer which,
+ * when the packet is accepted, the message digest takes over.  The
+ * rare datagram that doesn't fit spills into a per-slot overflow
+ * area and is then copied.
+ */
+
+#define UDP_READ_BATCH 16
+
+static uint8_t udp_read_overflow[UDP_READ_BATCH][MAX_INPUT_UDP_SIZE - MD_PACKET_BUFFER_SIZE];
+
+static void udp_read_packets(const struct iface_port *ifp, int fd)
+{
+	threadtime_t md_start = threadtime_start();
+
+#ifdef MSG_ERRQUEUE
+	/*
+	 * See udp_read_packet().  Errors are queued on the socket
+	 * that sent the message, which is always IFP->fd.
+	 */
+	if (pluto_sock_errqueue && fd == ifp->fd) {
+		threadtime_t errqueue_start = threadtime_start();
+		bool errqueue_ok = check_msg_errqueue(ifp, POLLIN, __func__);
+		threadtime_stop(&errqueue_start, SOS_NOBODY,
+				"%s() calling check_incoming_msg_errqueue()", __func__);
+		if (!errqueue_ok) {
+			return; /* no normal message to read */
+		}
+	}
+#endif
+
+	uint8_t *buffers[UDP_READ_BATCH];
+	ip_sockaddr from[UDP_READ_BATCH];
+	struct iovec iov[UDP_READ_BATCH][2];
+	struct mmsghdr msgs[UDP_READ_BATCH];
+	for (unsigned i = 0; i < UDP_READ_BATCH; i++) {
+		buffers[i] = alloc_md_packet_buffer();
+		iov[i][0] = (struct iovec) {
+			.iov_base = buffers[i],
+			.iov_len = MD_PACKET_BUFFER_SIZE,
+		};
+		iov[i][1] = (struct iovec) {
+			.iov_base = udp_read_overflow[i],
+			.iov_len = sizeof(udp_read_overflow[i]),
+		};
+		msgs[i] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_name = &from[i].sa.sa,
+				.msg_namelen = sizeof(from[i].sa),
+				.msg_iov = iov[i],
+				.msg_iovlen = elemsof(iov[i]),
+			},
+		};
+	}
+
+	int n = recvmmsg(fd, msgs, UDP_READ_BATCH, MSG_DONTWAIT, NULL);
+	int packet_errno = errno; /* save!!! */
+	if (n < 0) {
+		if (packet_errno == ECONNREFUSED) {
+			/* see udp_read_packet() */
+			plog_global("recvfrom on %s failed; some IKE message we sent has been rejected with ECONNREFUSED (kernel supplied no details)",
+				    ifp->ip_dev->id_rname);
+		} else if (packet_errno != EAGAIN && packet_errno != EWOULDBLOCK) {
+			plog_global("recvmmsg on %s failed "PRI_ERRNO,
+				    ifp->ip_dev->id_rname, pri_errno(packet_errno));
+		}
+		n = 0;
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (i > 0) {
+			md_start = threadtime_start();
+		}
+		struct iface_packet packet = {
+			.len = msgs[i].msg_len,
+			.ptr = buffers[i],
+			.buffer = buffers[i],
+		};
+		from[i].len = msgs[i].msg_hdr.msg_namelen;
+		const char *from_ugh = sockaddr_to_endpoint(&ip_protocol_udp, &from[i],
+							    &packet.sender);
+		if (from_ugh != NULL) {
+			plog_global("recvfrom on %s returned malformed source sockaddr: %s",
+				    ifp->ip_dev->id_rname, from_ugh);
+			continue;
+		}
+		if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			/* can't happen; overflow is sized for the largest */
+			plog_global("recvmmsg on %s truncated a %zd byte packet",
+				    ifp->ip_dev->id_rname, packet.len);
+			continue;
+		}
+		if (packet.len > MD_PACKET_BUFFER_SIZE) {
+			/* reassemble; the digest will copy it */
+			packet.ptr = alloc_bytes(packet.len, "large UDP packet");
+			memcpy(packet.ptr, buffers[i], MD_PACKET_BUFFER_SIZE);
+			memcpy(packet.ptr + MD_PACKET_BUFFER_SIZE, udp_read_overflow[i],
+			       packet.len - MD_PACKET_BUFFER_SIZE);
+			packet.buffer = NULL;
+		}
+		uint8_t *large = (packet.buffer == NULL ? packet.ptr : NULL);
+		if (check_udp_packet(ifp, &packet) == IFACE_OK) {
+			process_iface_packet(ifp, &packet, md_start);
+			if (large == NULL) {
+				/* the digest took the buffer */
+				pexpect(packet.buffer == NULL);
+				buffers[i] = NULL;
+			}
+		}
+		pfreeany(large);
+	}
+
+	for (unsigned i = 0; i < UDP_READ_BATCH; i++) {
+		if (buffers[i] != NULL) {
+			free_md_packet_buffer(&buffers[i]);
+		}
+	}
+}
+
+#endif
+
+static void handle_udp_packet_cb(evutil_socket_t fd,
 				 const short unused_event UNUSED,
 				 void *arg)
 {
 	const struct iface_port *ifp = arg;
+#if defined(linux)
+	udp_read_packets(ifp, fd);
+#else
+	pexpect(fd == ifp->fd);
 	handle_packet_cb(ifp);
+#endif
 }
 
+static int bind_udp_ike_socket(struct iface_dev *ifd, ip_port port,
+			       bool add_ike_encapsulation_prefix, bool reuseport)
+{
+	int fd = bind_udp_socket(ifd, port, reuseport);
+	if (fd < 0) {
+		return -1;
+	}
+	if (add_ike_encapsulation_prefix &&
+	    !nat_traversal_espinudp(fd, ifd)) {
+		dbg("nat-traversal failed");
+	}
+	return fd;
+}
+
+static bool use_ike_socket_queues(void)
+{
+#ifdef USE_IKE_SOCKET_QUEUES
+	return pluto_sock_queues > 1;
+#else
+	return false;
+#endif
+}
+
+static int udp_bind_iface_port(struct iface_dev *ifd, ip_port port, bool add_ike_encapsulation_prefix)
+{
+	return bind_udp_ike_socket(ifd, port, add_ike_encapsulation_prefix,
+				   use_ike_socket_queues());
+}
+
+#ifdef USE_IKE_SOCKET_QUEUES
+
+/*
+ * A stateless pre-filter attached to each socket in the group.  The
+ * kernel runs it on the CPU that received the message, before it is
+ * queued, so junk that pluto would only drop after reading it on the
+ * main thread never gets that far: a message too short for an IKE
+ * header, one on the NAT-T port without the Non-ESP marker, one with
+ * a zero initiator SPI or major version 0, or one shorter than the
+ * length in its header.
+ *
+ * Unlike the reuseport filter, a socket filter sees the UDP header.
+ */
+
+static void attach_udp_prefilter(const struct iface_port *ifp, int fd)
+{
+	const uint32_t hdr = (sizeof(struct udphdr) +
+			      (ifp->add_ike_encapsulation_prefix ? NON_ESP_MARKER_SIZE : 0));
+	const uint8_t drop = 0xff;	/* patched to jump to the drop below */
+	struct sock_filter code[24];
+	unsigned n = 0;
+#define I(INSN) code[n++] = (struct sock_filter) INSN
+	/* long enough for an IKE header */
+	I(BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0));
+	I(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, hdr + sizeof(struct isakmp_hdr), 0, drop));
+	/* the Non-ESP marker is zero */
+	if (ifp->add_ike_encapsulation_prefix) {
+		I(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sizeof(struct udphdr)));
+		I(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, drop));
+	}
+	/* the initiator's SPI isn't zero */
+	I(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, hdr));
+	I(BPF_STMT(BPF_MISC | BPF_TAX, 0));
+	I(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, hdr + sizeof(uint32_t)));
+	I(BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0));
+	I(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, drop, 0));
+	/* the major version isn't zero */
+	I(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, hdr + offsetof(struct isakmp_hdr, isa_version)));
+	I(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 1 << ISA_MAJ_SHIFT, 0, drop));
+	/* the message is at least as long as its header claims */
+	I(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, hdr + offsetof(struct isakmp_hdr, isa_length)));
+	I(BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, hdr));
+	I(BPF_STMT(BPF_MISC | BPF_TAX, 0));
+	I(BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0));
+	I(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 0, drop));
+	I(BPF_STMT(BPF_RET | BPF_K, UINT32_MAX));
+	I(BPF_STMT(BPF_RET | BPF_K, 0));
+#undef I
+	passert(n <= elemsof(code));
+	for (unsigned i = 0; i < n; i++) {
+		if (BPF_CLASS(code[i].code) != BPF_JMP) {
+			continue;
+		}
+		if (code[i].jt == drop) {
+			code[i].jt = n - 1 - (i + 1);
+		}
+		if (code[i].jf == drop) {
+			code[i].jf = n - 1 - (i + 1);
+		}
+	}
+	struct sock_fprog prog = {
+		.len = n,
+		.filter = code,
+	};
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+		       (const void *)&prog, sizeof(prog)) < 0) {
+		/* pluto still drops these, just later */
+		LOG_ERRNO(errno, "setsockopt SO_ATTACH_FILTER on %s",
+			  ifp->ip_dev->id_rname);
+	}
+}
+
+/*
+ * ike-socket-queues=N: open N-1 more sockets on IFP's port, joining
+ * the SO_REUSEPORT group of the first (IFP->fd, also used for
+ * sending).
+ *
+ * Since each socket receives ESP-in-UDP, each needs espinudp; and
+ * since each is read separately, each gets the pre-filter.
+ */
+
+static void open_udp_queues(struct iface_port *ifp)
+{
+	ip_port port = endpoint_port(&ifp->local_endpoint);
+	attach_udp_prefilter(ifp, ifp->fd);
+	while (ifp->nr_queues + 1 < pluto_sock_queues) {
+		int fd = bind_udp_ike_socket(ifp->ip_dev, port,
+					     ifp->add_ike_encapsulation_prefix,
+					     true/*reuseport*/);
+		if (fd < 0) {
+			/* already logged */
+			break;
+		}
+		attach_udp_prefilter(ifp, fd);
+		ifp->queues[ifp->nr_queues].fd = fd;
+		ifp->queues[ifp->nr_queues].pev = NULL;
+		ifp->nr_queues++;
+	}
+
+	/*
+	 * Steer each message to a socket using the low 32 bits of
+	 * the initiator's SPI (after the Non-ESP marker when there is
+	 * one); all the messages of an IKE SA then end up on the same
+	 * socket.  The filter returns the socket's index in the group,
+	 * which is the order the sockets were bound.  A message too
+	 * short to have an SPI goes to the first socket.
+	 */
+	uint32_t spi_offset = ((ifp->add_ike_encapsulation_prefix ? NON_ESP_MARKER_SIZE : 0) +
+			       IKE_SA_SPI_SIZE - sizeof(uint32_t));
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, spi_offset),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, ifp->nr_queues + 1),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog = {
+		.len = elemsof(code),
+		.filter = code,
+	};
+	if (setsockopt(ifp->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		       (const void *)&prog, sizeof(prog)) < 0) {
+		/* the kernel falls back to hashing the addresses */
+		LOG_ERRNO(errno, "setsockopt SO_ATTACH_REUSEPORT_CBPF on %s",
+			  ifp->ip_dev->id_rname);
+	}
+
+	endpoint_buf b;
+	dbg("%s %s: receiving using %u SO_REUSEPORT sockets",
+	    ifp->ip_dev->id_rname, str_endpoint(&ifp->local_endpoint, &b),
+	    ifp->nr_queues + 1);
+}
+
+#endif
+
 static void udp_listen(struct iface_port *ifp,
 		       struct logger *unused_logger UNUSED)
 {
@@ -394,25 +790,35 @@ static void udp_listen(struct iface_port *ifp,
 	ifp->pev = add_fd_read_event_handler(ifp->fd,
 					     handle_udp_packet_cb,
 					     ifp, "ethX");
+#ifdef USE_IKE_SOCKET_QUEUES
+	if (use_ike_socket_queues() && ifp->nr_queues == 0) {
+		open_udp_queues(ifp);
+	}
+#endif
+	for (unsigned q = 0; q < ifp->nr_queues; q++) {
+		delete_pluto_event(&ifp->queues[q].pev);
+		ifp->queues[q].pev = add_fd_read_event_handler(ifp->queues[q].fd,
+							       handle_udp_packet_cb,
+							       ifp, "ethX");
+	}
 }
 
-static int udp_bind_iface_port(struct iface_dev *ifd, ip_port port, bool add_ike_encapsulation_prefix)
+static void udp_cleanup(struct iface_port *ifp)
 {
-	int fd = bind_udp_socket(ifd, port);
-	if (fd < 0) {
-		return -1;
+	for (unsigned q = 0; q < ifp->nr_queues; q++) {
+		delete_pluto_event(&ifp->queues[q].pev);
+		close(ifp->queues[q].fd);
+		ifp->queues[q].fd = -1;
 	}
-	if (add_ike_encapsulation_prefix &&
-	    !nat_traversal_espinudp(fd, ifd)) {
-		dbg("nat-traversal failed");
-	}
-	return fd;
+	ifp->nr_queues = 0;
 }
 
 const struct iface_io udp_iface_io = {
 	.protocol = &ip_protocol_udp,
 	.read_packet = udp_read_packet,
 	.write_packet = udp_write_packet,
+	.write_packets = udp_write_packets,
+	.cleanup = udp_cleanup,
 	.listen = udp_listen,
 	.bind_iface_port = udp_bind_iface_port,
 };
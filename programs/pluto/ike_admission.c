@@ -0,0 +1,173 @@
+/* admission control for new IKE exchanges, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "defs.h"
+#include "ike_admission.h"
+#include "demux.h"		/* for struct msg_digest */
+#include "state.h"		/* for require_ddos_cookies() */
+#include "server.h"		/* for pluto_ddos_mode */
+#include "pluto_crypt.h"	/* for crypto_helper_backlog() */
+#include "hash_table.h"		/* for hash_table_hasher() */
+#include "ip_address.h"
+#include "ip_info.h"
+#include "monotime.h"
+#include "log.h"
+#include "whack.h"		/* for whack_print() */
+#include "show.h"
+
+/*
+ * The token buckets are a fixed, direct-mapped, table indexed by the
+ * (keyed) hash of the prefix.  A prefix finding its slot taken by
+ * another simply takes it over, with a full bucket; since the hash
+ * is keyed, a sender can't aim for a particular victim's slot.  Only
+ * return-routable requests are charged so a flood from spoofed
+ * sources can't churn the table.
+ */
+
+#define IKE_ADMISSION_BUCKETS 4096
+#define MILLITOKENS_PER_REQUEST 1000
+
+struct admission_bucket {
+	hash_t prefix;
+	monotime_t refilled;	/* epoch when unused */
+	unsigned millitokens;
+};
+
+static struct admission_bucket admission_buckets[IKE_ADMISSION_BUCKETS];
+
+static unsigned long shed_debt;
+
+static struct {
+	unsigned long admitted;
+	unsigned long rate_limited;
+	unsigned long shed;
+} admission_stats;
+
+static hash_t hash_source_prefix(const ip_address *sender)
+{
+	shunk_t bytes = address_as_shunk(sender);
+	size_t prefix = (address_type(sender) == &ipv4_info ? 3 : 8);
+	if (bytes.len > prefix) {
+		bytes.len = prefix;
+	}
+	return hash_table_hasher(bytes, zero_hash);
+}
+
+static bool take_admission_token(const ip_address *sender)
+{
+	hash_t prefix = hash_source_prefix(sender);
+	struct admission_bucket *b = &admission_buckets[prefix.hash % IKE_ADMISSION_BUCKETS];
+	monotime_t now = mononow();
+	const unsigned full = IKE_ADMISSION_BURST * MILLITOKENS_PER_REQUEST;
+
+	if (is_monotime_epoch(b->refilled) || b->prefix.hash != prefix.hash) {
+		b->prefix = prefix;
+		b->millitokens = full;
+	} else {
+		intmax_t ms = deltamillisecs(monotimediff(now, b->refilled));
+		if (ms >= full / IKE_ADMISSION_RATE) {
+			b->millitokens = full;
+		} else if (ms > 0) {
+			b->millitokens += ms * IKE_ADMISSION_RATE;
+			if (b->millitokens > full) {
+				b->millitokens = full;
+			}
+		}
+	}
+	b->refilled = now;
+
+	if (b->millitokens < MILLITOKENS_PER_REQUEST) {
+		return false;
+	}
+	b->millitokens -= MILLITOKENS_PER_REQUEST;
+	return true;
+}
+
+/*
+ * From the cookie threshold on, requests that are not return-routable
+ * are dropped outright.  Between the cookie and shed thresholds drop
+ * the fraction (backlog - cookie) / (shed - cookie) of the rest; the
+ * debt spreads the drops evenly rather than in bursts.
+ */
+
+static bool shed_new_exchange(bool return_routable)
+{
+	unsigned long backlog = crypto_helper_backlog();
+	if (backlog >= IKE_ADMISSION_SHED_BACKLOG) {
+		return true;
+	}
+	if (backlog < IKE_ADMISSION_COOKIE_BACKLOG) {
+		shed_debt = 0;
+		return false;
+	}
+	if (!return_routable) {
+		/* cookies are required; keep the helpers for those */
+		return true;
+	}
+	if (backlog == IKE_ADMISSION_COOKIE_BACKLOG) {
+		return false;
+	}
+	shed_debt += backlog - IKE_ADMISSION_COOKIE_BACKLOG;
+	if (shed_debt >= IKE_ADMISSION_SHED_BACKLOG - IKE_ADMISSION_COOKIE_BACKLOG) {
+		shed_debt -= IKE_ADMISSION_SHED_BACKLOG - IKE_ADMISSION_COOKIE_BACKLOG;
+		return true;
+	}
+	return false;
+}
+
+bool crypto_backlog_requires_cookies(void)
+{
+	return crypto_helper_backlog() >= IKE_ADMISSION_COOKIE_BACKLOG;
+}
+
+bool ike_admission_rejected(const struct msg_digest *md, bool return_routable)
+{
+	if (pluto_ddos_mode == DDOS_FORCE_UNLIMITED) {
+		admission_stats.admitted++;
+		return false;
+	}
+
+	/* a spoofed source must not drain its victim's bucket */
+	if (return_routable && require_ddos_cookies() &&
+	    !take_admission_token(&md->sender)) {
+		/* only log for debug to prevent disk filling up */
+		address_buf b;
+		dbg("rate limiting new exchanges from %s's prefix; dropping",
+		    str_address(&md->sender, &b));
+		admission_stats.rate_limited++;
+		return true;
+	}
+
+	if (shed_new_exchange(return_routable)) {
+		dbg("crypto helpers are %lu requests behind; dropping new exchange",
+		    crypto_helper_backlog());
+		admission_stats.shed++;
+		return true;
+	}
+
+	admission_stats.admitted++;
+	return false;
+}
+
+void show_ike_admission_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	whack_print(whackfd, "current.ike.admission.crypto_backlog=%lu",
+		    crypto_helper_backlog());
+	whack_print(whackfd, "total.ike.admission.admitted=%lu",
+		    admission_stats.admitted);
+	whack_print(whackfd, "total.ike.admission.rate_limited=%lu",
+		    admission_stats.rate_limited);
+	whack_print(whackfd, "total.ike.admission.shed=%lu",
+		    admission_stats.shed);
+}
@@ -0,0 +1,58 @@
+/* admission control for new IKE exchanges, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef IKE_ADMISSION_H
+#define IKE_ADMISSION_H
+
+#include <stdbool.h>
+
+struct msg_digest;
+struct show;
+
+/*
+ * Admission control for requests that would create a new IKE SA
+ * (IKE_SA_INIT, Main and Aggressive Mode); it runs before any state
+ * is allocated.
+ *
+ * RETURN_ROUTABLE is true when the request carried a valid IKEv2
+ * cookie, proving that the sender can receive replies; only then can
+ * the source address be trusted.
+ *
+ * While DDoS cookies are required, each source prefix (/24 for IPv4,
+ * /64 for IPv6) has a token bucket holding IKE_ADMISSION_BURST
+ * requests and refilled at IKE_ADMISSION_RATE per second; a
+ * return-routable request that finds its bucket empty is dropped.
+ * Spoofed requests never get this far (they're sent a cookie) so
+ * can't drain a victim's bucket.
+ *
+ * Separately, once the crypto helpers are IKE_ADMISSION_COOKIE_BACKLOG
+ * requests behind (per helper) cookies are required and requests
+ * that are not return-routable are dropped; past that an increasing
+ * fraction of the remaining new exchanges are dropped until, at
+ * IKE_ADMISSION_SHED_BACKLOG, all are.
+ *
+ * ddos-mode=unlimited disables both.
+ */
+
+#define IKE_ADMISSION_RATE 8
+#define IKE_ADMISSION_BURST 32
+#define IKE_ADMISSION_COOKIE_BACKLOG 16
+#define IKE_ADMISSION_SHED_BACKLOG 64
+
+bool ike_admission_rejected(const struct msg_digest *md, bool return_routable);
+
+bool crypto_backlog_requires_cookies(void);
+
+void show_ike_admission_status(struct show *s);
+
+#endif
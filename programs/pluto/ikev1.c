@@ -163,6 +163,7 @@
 #include "initiate.h"
 #include "iface.h"
 #include "ip_selector.h"
+#include "spd_route_db.h"		/* for rehash_spd_routes() */
 
 #ifdef HAVE_NM
 #include "kernel.h"
@@ -1110,6 +1111,7 @@ static stf_status informational(struct state *st, struct msg_digest *md)
 							ipstr(&new_peer, &b));
 					}
 					tmp_c->spd.that.client.addr = new_peer;
+					rehash_spd_routes(tmp_c);
 				}
 
 				/*
@@ -37,6 +37,7 @@
 #include "ipsec_doi.h"  /* needs demux.h and state.h */
 #include "ikev1_send.h"
 #include "pluto_crypt.h"
+#include "ike_admission.h"
 #include "ikev1.h"
 #include "vendor.h"
 #include "nat_traversal.h"
@@ -141,7 +142,9 @@ stf_status aggr_inI1_outR1(struct state *unused_st UNUSED,
 	 */
 	struct payload_digest *const sa_pd = md->chain[ISAKMP_NEXT_SA];
 
-	if (drop_new_exchanges()) {
+	/* IKEv1 has no cookie exchange to prove the source */
+	if (ike_admission_rejected(md, false/*!return_routable*/) ||
+	    drop_new_exchanges()) {
 		return STF_IGNORE;
 	}
 
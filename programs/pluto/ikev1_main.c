@@ -73,6 +73,7 @@
 #include "kernel_alg.h"
 #include "plutoalg.h"
 #include "pluto_crypt.h"
+#include "ike_admission.h"
 #include "ikev1.h"
 #include "ikev1_continuations.h"
 #include "ikev1_message.h"
@@ -328,7 +329,7 @@ struct hash_signature v1_sign_hash_RSA(const struct connection *c,
  * Check a Main Mode RSA Signature against computed hash using RSA public
  * key k.
  *
- * As a side effect, on success, the public key is copied into the
+ * On success, check_signature_gen() copies the public key into the
  * state object to record the authenticator.
  *
  * Can fail because wrong public key is used or because hash disagrees.
@@ -352,13 +353,14 @@ struct hash_signature v1_sign_hash_RSA(const struct connection *c,
  * it is not: the knowledge of the private key allows more efficient (i.e.
  * different) computation for encryption.
  */
+static try_signature_fn try_RSA_signature_v1; /* type assertion */
+
 static err_t try_RSA_signature_v1(const struct crypt_mac *hash,
-				const pb_stream *sig_pbs, struct pubkey *kr,
-				struct state *st,
-				const struct hash_desc *hash_algo_unused UNUSED /* for ikev2 only */)
+				  shunk_t signature, const struct pubkey *kr,
+				  const struct hash_desc *hash_algo_unused UNUSED /* for ikev2 only */)
 {
-	const u_char *sig_val = sig_pbs->cur;
-	size_t sig_len = pbs_left(sig_pbs);
+	const u_char *sig_val = signature.ptr;
+	size_t sig_len = signature.len;
 	const struct RSA_public_key *k = &kr->u.rsa;
 
 	/* decrypt the signature -- reversing RSA_sign_hash */
@@ -372,14 +374,6 @@ static err_t try_RSA_signature_v1(const struct crypt_mac *hash,
 	if (ugh != NULL)
 		return ugh;
 
-	/*
-	 * Success: copy successful key into state.
-	 * There might be an old one if we previously aborted this
-	 * state transition.
-	 */
-	unreference_key(&st->st_peer_pubkey);
-	st->st_peer_pubkey = reference_key(kr);
-
 	return NULL; /* happy happy */
 }
 
@@ -542,7 +536,9 @@ stf_status main_inI1_outR1(struct state *unused_st UNUSED,
 	pb_stream r_sa_pbs;
 
 
-	if (drop_new_exchanges()) {
+	/* IKEv1 has no cookie exchange to prove the source */
+	if (ike_admission_rejected(md, false/*!return_routable*/) ||
+	    drop_new_exchanges()) {
 		return STF_IGNORE;
 	}
 
@@ -81,6 +81,7 @@
 #include "ip_address.h"
 #include "ip_info.h"
 #include "ikev1_hash.h"
+#include "spd_route_db.h"
 
 #include <blapit.h>
 
@@ -1130,6 +1131,7 @@ static stf_status quick_inI1_outR1_tail(struct verify_oppo_bundle *b)
 			char cthat[END_BUF];
 
 			c->spd.that.client = *peers_net;
+			rehash_spd_routes(c);
 			c->spd.that.has_client = TRUE;
 			c->spd.that.virt = NULL;	/* ??? leak? */
 
@@ -1627,6 +1629,7 @@ stf_status quick_inR1_outI2_tail(struct msg_digest *md,
 				endtosubnet(&st->hidden_variables.st_nat_oa,
 					    &st->st_connection->spd.that.client,
 					    HERE);
+				rehash_spd_routes(st->st_connection);
 				subnet_buf buf;
 				loglog(RC_LOG_SERIOUS,
 				       "IDcr was FQDN: %s, using NAT_OA=%s as IDcr",
@@ -79,6 +79,7 @@
 #include "ip_info.h"
 #include "ikev1_hash.h"
 #include "impair.h"
+#include "spd_route_db.h"
 
 /* forward declarations */
 static stf_status xauth_client_ackstatus(struct state *st,
@@ -1742,6 +1743,7 @@ stf_status modecfg_inR1(struct state *st, struct msg_digest *md)
 					passert(c->spd.spd_next == NULL);
 					c->spd.that.has_client = TRUE;
 					c->spd.that.client = ipv4_info.all_addresses;
+					rehash_spd_routes(c);
 				}
 
 				while (pbs_left(&strattr) > 0) {
@@ -1801,6 +1803,7 @@ stf_status modecfg_inR1(struct state *st, struct msg_digest *md)
 
 							unshare_connection_end(&sr->this);
 							unshare_connection_end(&sr->that);
+							add_spd_route_to_db(c, sr);
 							break;
 						}
 					}
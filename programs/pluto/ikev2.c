@@ -65,8 +65,9 @@
 #include "state_db.h"
 #include "ietf_constants.h"
 #include "ikev2_cookie.h"
+#include "ike_admission.h"
 #include "plutoalg.h" /* for default_ike_groups */
-#include "ikev2_message.h"	/* for ikev2_decrypt_msg() */
+#include "ikev2_message.h"	/* for submit_v2_decrypt_msg() */
 #include "pluto_stats.h"
 #include "keywords.h"
 #include "ikev2_msgid.h"
@@ -1234,6 +1235,9 @@ static bool is_duplicate_request(struct ike_sa *ike,
 		pexpect(responder == NULL ||
 			responder->st_v2_msgid_wip.responder == msgid);
 		if (responder != NULL) {
+			if (v2_hold_md(responder, md)) {
+				return true;
+			}
 			/* this generates the log message */
 			pexpect(verbose_state_busy(responder));
 			return true;
@@ -1247,6 +1251,9 @@ static bool is_duplicate_request(struct ike_sa *ike,
 	 * IDs updated to flag that the message as work-in-progress
 	 * (so above check will have succeeded).
 	 */
+	if (v2_hold_md(&ike->sa, md)) {
+		return true;
+	}
 	if (state_is_busy(&ike->sa)) {
 		/*
 		 * To keep tests happy, try to output text matching
@@ -1425,6 +1432,9 @@ static bool is_duplicate_response(struct ike_sa *ike,
 	 *
 	 * XXX: Is there a better way to handle this?
 	 */
+	if (v2_hold_md(initiator, md)) {
+		return true;
+	}
 	if (verbose_state_busy(initiator)) {
 		return true;
 	}
@@ -1754,6 +1764,20 @@ void ikev2_process_packet(struct msg_digest *md)
 				return;
 			}
 
+			/*
+			 * Admission control.  Only a request that
+			 * returned a valid cookie has shown that it
+			 * can receive replies; so only it is charged
+			 * to its source prefix.
+			 */
+			bool cookie_verified =
+				(md->hdr.isa_np == ISAKMP_NEXT_v2N &&
+				 md->chain[ISAKMP_NEXT_v2N] != NULL &&
+				 md->chain[ISAKMP_NEXT_v2N]->payload.v2n.isan_type == v2N_COOKIE);
+			if (ike_admission_rejected(md, cookie_verified)) {
+				return;
+			}
+
 			/*
 			 * Check for v2N_REDIRECT_SUPPORTED/v2N_REDIRECTED_FROM
 			 * notification. If redirection is a MUST, try to respond
@@ -2146,6 +2170,107 @@ static void hack_error_transition(struct state *st)
 	st->st_v2_transition = transition;
 }
 
+/*
+ * Decode the payloads within a freshly decrypted SK payload; when
+ * they are corrupt, fail the exchange and return false.
+ */
+
+static bool decode_v2_encrypted_payloads(struct ike_sa *ike, struct state *st,
+					 struct msg_digest *md)
+{
+	/*
+	 * The message is protected - the integrity
+	 * check passed - so it was definitely sent by
+	 * the other end of the secured IKE SA.
+	 *
+	 * However, for an AUTH packet, the other end
+	 * hasn't yet been authenticated (and an
+	 * INFORMATIONAL exchange immediately
+	 * following AUTH be due to failed
+	 * authentication).
+	 *
+	 * If there's something wrong with the message
+	 * contents, then the IKE SA gets abandoned,
+	 * but a new new one may be initiated.
+	 *
+	 * See "2.21.2.  Error Handling in IKE_AUTH"
+	 * and "2.21.3.  Error Handling after IKE SA
+	 * is Authenticated".
+	 *
+	 * For UNSUPPORTED_CRITICAL_PAYLOAD, while the
+	 * RFC clearly states that for the initial
+	 * exchanges and an INFORMATIONAL exchange
+	 * immediately following, the notification
+	 * causes a delete, it says nothing for
+	 * exchanges that follow.
+	 *
+	 * For moment treat it the same.  Given the
+	 * PAYLOAD ID that should identify the problem
+	 * isn't being returned this is the least of
+	 * our problems.
+	 */
+	struct payload_digest *sk = md->chain[ISAKMP_NEXT_v2SK];
+	md->encrypted_payloads = ikev2_decode_payloads(st->st_logger, md, &sk->pbs,
+						       sk->payload.generic.isag_np);
+	if (md->encrypted_payloads.n != v2N_NOTHING_WRONG) {
+		/*
+		 * XXX: Hack to get the
+		 * transition that would have
+		 * been run so it can be
+		 * 'failed'.
+		 */
+		hack_error_transition(st);
+		switch (v2_msg_role(md)) {
+		case MESSAGE_REQUEST:
+			/*
+			 * Send back a protected error
+			 * response.  Need to first
+			 * put the IKE SA into
+			 * responder mode.
+			 */
+			v2_msgid_start_responder(ike, st, md);
+			chunk_t data = chunk2(md->encrypted_payloads.data,
+					      md->encrypted_payloads.data_size);
+			record_v2N_response(st->st_logger, ike, md,
+					    md->encrypted_payloads.n, &data,
+					    ENCRYPTED_PAYLOAD);
+			break;
+		case MESSAGE_RESPONSE:
+			/*
+			 * Can't respond so kill the
+			 * IKE SA.  The secured
+			 * message contained crap so
+			 * there's little that can be
+			 * done.
+			 */
+			break;
+		default:
+			bad_case(v2_msg_role(md));
+		}
+		complete_v2_state_transition(st, md, STF_FATAL);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Continue processing a message once the crypto helper has verified
+ * and decrypted it.
+ */
+
+static void v2_decrypted(struct state *st, struct msg_digest *md, bool ok)
+{
+	if (!ok) {
+		log_state(RC_LOG, st, "encrypted payload seems to be corrupt; dropping packet");
+		return;
+	}
+	struct ike_sa *ike = ike_sa(st, HERE);
+	if (!decode_v2_encrypted_payloads(ike, st, md)) {
+		return;
+	}
+	ikev2_process_state_packet(ike, st, md);
+}
+
 /*
  * The SA the message is intended for has also been identified.
  * Continue ...
@@ -2298,8 +2423,8 @@ void ikev2_process_state_packet(struct ike_sa *ike, struct state *st,
 			/*
 			 * XXX: Shouldn't reach this point without
 			 * SKEYSEED so bail if somehow that hasn't
-			 * happened.  No point in even calling
-			 * ikev2_decrypt_msg() (it will also fail).
+			 * happened.  No point in even trying to
+			 * decrypt the message (it will also fail).
 			 *
 			 * Suspect it would be cleaner if the state
 			 * machine included an explicit SMF2_SKEYSEED
@@ -2312,85 +2437,18 @@ void ikev2_process_state_packet(struct ike_sa *ike, struct state *st,
 			}
 			/*
 			 * Decrypt the packet, checking it for
-			 * integrity.  Anything lacking integrity is
-			 * dropped.
-			 */
-			if (!ikev2_decrypt_msg(st, md)) {
-				log_state(RC_LOG, st, "encrypted payload seems to be corrupt; dropping packet");
-				return;
-			}
-			/*
-			 * The message is protected - the integrity
-			 * check passed - so it was definitely sent by
-			 * the other end of the secured IKE SA.
-			 *
-			 * However, for an AUTH packet, the other end
-			 * hasn't yet been authenticated (and an
-			 * INFORMATIONAL exchange immediately
-			 * following AUTH be due to failed
-			 * authentication).
-			 *
-			 * If there's something wrong with the message
-			 * contents, then the IKE SA gets abandoned,
-			 * but a new new one may be initiated.
-			 *
-			 * See "2.21.2.  Error Handling in IKE_AUTH"
-			 * and "2.21.3.  Error Handling after IKE SA
-			 * is Authenticated".
+			 * integrity, on a crypto helper.  Anything
+			 * lacking integrity is dropped.
 			 *
-			 * For UNSUPPORTED_CRITICAL_PAYLOAD, while the
-			 * RFC clearly states that for the initial
-			 * exchanges and an INFORMATIONAL exchange
-			 * immediately following, the notification
-			 * causes a delete, it says nothing for
-			 * exchanges that follow.
-			 *
-			 * For moment treat it the same.  Given the
-			 * PAYLOAD ID that should identify the problem
-			 * isn't being returned this is the least of
-			 * our problems.
+			 * Once decrypted, v2_decrypted() decodes the
+			 * encrypted payloads and re-enters this
+			 * function (which will find them parsed).
 			 */
-			struct payload_digest *sk = md->chain[ISAKMP_NEXT_v2SK];
-			md->encrypted_payloads = ikev2_decode_payloads(st->st_logger, md, &sk->pbs,
-								       sk->payload.generic.isag_np);
-			if (md->encrypted_payloads.n != v2N_NOTHING_WRONG) {
-				/*
-				 * XXX: Hack to get the
-				 * transition that would have
-				 * been run so it can be
-				 * 'failed'.
-				 */
-				hack_error_transition(st);
-				switch (v2_msg_role(md)) {
-				case MESSAGE_REQUEST:
-					/*
-					 * Send back a protected error
-					 * response.  Need to first
-					 * put the IKE SA into
-					 * responder mode.
-					 */
-					v2_msgid_start_responder(ike, st, md);
-					chunk_t data = chunk2(md->encrypted_payloads.data,
-							      md->encrypted_payloads.data_size);
-					record_v2N_response(st->st_logger, ike, md,
-							    md->encrypted_payloads.n, &data,
-							    ENCRYPTED_PAYLOAD);
-					break;
-				case MESSAGE_RESPONSE:
-					/*
-					 * Can't respond so kill the
-					 * IKE SA.  The secured
-					 * message contained crap so
-					 * there's little that can be
-					 * done.
-					 */
-					break;
-				default:
-					bad_case(v2_msg_role(md));
-				}
-				complete_v2_state_transition(st, md, STF_FATAL);
-				return;
-			}
+			submit_v2_decrypt_msg(ike, st, md, v2_decrypted);
+			return;
+		} else if (svm->flags & SMF2_NO_SKEYSEED) {
+			/* decrypted, so SKEYSEED is known */
+			continue;
 		} /* else { go ahead } */
 		struct ikev2_payload_errors encrypted_payload_errors
 			= ikev2_verify_payloads(md, &md->encrypted_payloads,
@@ -3271,7 +3329,7 @@ static void success_v2_state_transition(struct state *st, struct msg_digest *md,
 			 */
 			if (LIN(POLICY_OPPORTUNISTIC, c->policy)) {
 				struct spd_route *sr = &c->spd;
-				struct bare_shunt **bs = bare_shunt_ptr(&sr->this.client, &sr->that.client, sr->this.protocol);
+				struct bare_shunt *bs = bare_shunt_ptr(&sr->this.client, &sr->that.client, sr->this.protocol);
 
 				if (bs != NULL) {
 					dbg("deleting old bare shunt");
@@ -179,6 +179,15 @@ extern stf_status ikev2_verify_ecdsa_hash(struct ike_sa *ike,
 					pb_stream *sig_pbs,
 					const struct hash_desc *hash_algo);
 
+/* try_signature_fn (see keys.h); thread-safe */
+struct pubkey;
+extern err_t try_RSA_signature_v2(const struct crypt_mac *hash,
+				  shunk_t signature, const struct pubkey *kr,
+				  const struct hash_desc *hash_algo);
+extern err_t try_ECDSA_signature_v2(const struct crypt_mac *hash,
+				    shunk_t signature, const struct pubkey *kr,
+				    const struct hash_desc *hash_algo);
+
 extern bool ikev2_verify_psk_auth(enum keyword_authby authby,
 				  const struct ike_sa *ike,
 				  const struct crypt_mac *idhash,
@@ -67,4 +67,21 @@ bool submit_v2_auth_signature(struct ike_sa *ike,
 			      enum ikev2_auth_method auth_method,
 			      v2_auth_signature_cb *cb);
 
+/*
+ * Verify the peer's AUTH SIGNATURE using a crypto helper; once done
+ * CB is called with the (unsuspended) MD.  Returns false, having
+ * logged, when the signature can't be checked at all.
+ */
+
+typedef stf_status (v2_auth_verify_cb)(struct ike_sa *ike,
+				       struct msg_digest *md,
+				       bool authenticated);
+
+bool submit_v2_auth_verify(struct ike_sa *ike,
+			   const struct crypt_mac *idhash,
+			   shunk_t signature,
+			   const struct hash_desc *hash_algo,
+			   enum keyword_authby authby,
+			   v2_auth_verify_cb *cb);
+
 #endif
@@ -0,0 +1,131 @@
+/* IKEv2 Authentication signature verification helper, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "crypt_mac.h"
+
+#include "defs.h"
+#include "state.h"
+#include "ikev2_auth.h"
+#include "ikev2.h"		/* for try_RSA_signature_v2() et.al. */
+#include "keys.h"
+#include "pluto_crypt.h"
+#include "secrets.h"
+#include "log.h"
+#include "ike_alg.h"
+
+/*
+ * The candidate public keys are collected, and referenced, before
+ * the task is submitted so that the helper doesn't go near the
+ * shared pubkey lists (which the main thread can change).
+ */
+
+struct crypto_task {
+	/* in */
+	struct crypt_mac hash;
+	chunk_t signature;
+	const struct hash_desc *hash_algo;
+	try_signature_fn *try_signature;
+	v2_auth_verify_cb *cb;
+	/* in/out */
+	struct signature_keys keys;
+};
+
+static crypto_compute_fn v2_auth_verify_computer; /* type check */
+static crypto_completed_cb v2_auth_verify_completed; /* type check */
+static crypto_cancelled_cb v2_auth_verify_cancelled; /* type check */
+
+struct crypto_handler v2_auth_verify_handler = {
+	.name = "verify signature",
+	.compute_fn = v2_auth_verify_computer,
+	.completed_cb = v2_auth_verify_completed,
+	.cancelled_cb = v2_auth_verify_cancelled,
+};
+
+bool submit_v2_auth_verify(struct ike_sa *ike,
+			   const struct crypt_mac *idhash,
+			   shunk_t signature,
+			   const struct hash_desc *hash_algo,
+			   enum keyword_authby authby,
+			   v2_auth_verify_cb *cb)
+{
+	/* XXX: table lookup? */
+	if (hash_algo->common.ikev2_alg_id < 0) {
+		loglog(RC_LOG_SERIOUS, "unknown or unsupported hash algorithm");
+		return false;
+	}
+
+	if (signature.len == 0) {
+		loglog(RC_LOG_SERIOUS, "rejecting received zero-length %s signature",
+		       enum_name(&keyword_authby_names, authby));
+		return false;
+	}
+
+	struct crypto_task task = {
+		.cb = cb,
+		.hash_algo = hash_algo,
+	};
+
+	const struct pubkey_type *type;
+	switch (authby) {
+	case AUTHBY_RSASIG:
+		type = &pubkey_type_rsa;
+		task.try_signature = try_RSA_signature_v2;
+		break;
+	case AUTHBY_ECDSA:
+		type = &pubkey_type_ecdsa;
+		task.try_signature = try_ECDSA_signature_v2;
+		break;
+	default:
+		bad_case(authby);
+	}
+
+	task.hash = v2_calculate_sighash(ike, idhash, hash_algo,
+					 REMOTE_PERSPECTIVE);
+	collect_signature_keys(&ike->sa, type, &task.keys);
+	task.signature = clone_hunk(signature, "signature to verify");
+
+	submit_crypto(ike->sa.st_logger, &ike->sa /*state to resume*/,
+		      clone_thing(task, "verify signature task"),
+		      &v2_auth_verify_handler,
+		      "verifying peer signature");
+	return true;
+}
+
+static void v2_auth_verify_computer(struct logger *unused_logger UNUSED,
+				    struct crypto_task *task,
+				    int unused_my_thread UNUSED)
+{
+	try_signature_keys(&task->keys, &task->hash,
+			   shunk2(task->signature.ptr, task->signature.len),
+			   task->hash_algo, task->try_signature);
+}
+
+static stf_status v2_auth_verify_completed(struct state *st,
+					   struct msg_digest *md,
+					   struct crypto_task **task)
+{
+	stf_status status = report_signature_keys(st, &(*task)->keys,
+						  (*task)->hash_algo);
+	stf_status stf = (*task)->cb(pexpect_ike_sa(st), md, status == STF_OK);
+	free_chunk_content(&(*task)->signature);
+	pfreeany(*task);
+	return stf;
+}
+
+static void v2_auth_verify_cancelled(struct crypto_task **task)
+{
+	release_signature_keys(&(*task)->keys);
+	free_chunk_content(&(*task)->signature);
+	pfreeany(*task);
+}
@@ -31,59 +31,97 @@
 #include "rnd.h"
 #include "ikev2_cookie.h"
 #include "demux.h"
-#include "ike_alg_hash.h"	/* for sha2 */
-#include "crypt_hash.h"
+#include "siphash.h"
 #include "ikev2_send.h"
 #include "log.h"
 #include "state.h"
 #include "ikev2.h"
+#include "whack.h"		/* for whack_print() */
+#include "show.h"
 
 /*
- * That the cookie size of 32-bytes happens to match
- * SHA2_256_DIGEST_SIZE is just a happy coincidence.
+ * Cookie = <VersionIDofSecret> | MAC(Ni | IPi | SPIi)
+ *
+ * The MAC is two SipHash-2-4 outputs, each keyed with its own half of
+ * the 256-bit secret; it's a fraction of the cost of going through
+ * NSS for SHA-256.
+ *
+ * The secret is replaced every EVENT_REINIT_SECRET_DELAY and the
+ * previous generation kept, so a cookie handed out just before the
+ * change is still accepted.
  */
+
+#define V2_COOKIE_MAC_WORDS 2
+
 typedef struct {
-	uint8_t bytes[32];
+	uint8_t generation;
+	uint8_t mac[V2_COOKIE_MAC_WORDS * sizeof(uint64_t)];
 } v2_cookie_t;
 
-static v2_cookie_t v2_cookie_secret;
+struct v2_cookie_secret {
+	bool valid;
+	uint8_t generation;
+	struct siphash_key key[V2_COOKIE_MAC_WORDS];
+};
+
+/* [0] is current, [1] is previous */
+static struct v2_cookie_secret v2_cookie_secrets[2];
+
+static struct {
+	unsigned long sent;
+	unsigned long accepted;
+	unsigned long accepted_previous;
+	unsigned long rejected;
+} v2_cookie_stats;
 
 void refresh_v2_cookie_secret(void)
 {
-	get_rnd_bytes(&v2_cookie_secret, sizeof(v2_cookie_secret));
+	struct v2_cookie_secret *current = &v2_cookie_secrets[0];
+	v2_cookie_secrets[1] = *current;
+	current->valid = true;
+	current->generation++;
+	get_rnd_bytes(current->key, sizeof(current->key));
 	DBG(DBG_PRIVATE,
-	    DBG_dump_thing("v2_cookie_secret", v2_cookie_secret));
+	    DBG_log("v2_cookie_secret generation %u", current->generation);
+	    DBG_dump_thing("v2_cookie_secret", current->key));
 }
 
-/*
- * Cookie = <VersionIDofSecret> | Hash(Ni | IPi | SPIi | <secret>)
- * where <secret> is a randomly generated secret known only to us
- *
- * Our implementation does not use <VersionIDofSecret> which means
- * once a day and while under DOS attack, we could fail a few cookies
- * until the peer restarts from scratch.
- */
-static bool compute_v2_cookie_from_md(v2_cookie_t *cookie,
+static const struct v2_cookie_secret *v2_cookie_secret(uint8_t generation)
+{
+	for (unsigned i = 0; i < elemsof(v2_cookie_secrets); i++) {
+		const struct v2_cookie_secret *secret = &v2_cookie_secrets[i];
+		if (secret->valid && secret->generation == generation) {
+			return secret;
+		}
+	}
+	return NULL;
+}
+
+static void compute_v2_cookie_from_md(v2_cookie_t *cookie,
+				      const struct v2_cookie_secret *secret,
 				      struct msg_digest *md,
 				      shunk_t Ni)
 {
-	struct crypt_hash *ctx = crypt_hash_init("IKEv2 COOKIE",
-						 &ike_alg_hash_sha2_256);
+	uint8_t input[IKEv2_MAXIMUM_NONCE_SIZE + sizeof(struct in6_addr) + IKE_SA_SPI_SIZE];
+	size_t len = 0;
 
-	crypt_hash_digest_hunk(ctx, "Ni", Ni);
+	passert(Ni.len <= IKEv2_MAXIMUM_NONCE_SIZE);
+	memcpy(input + len, Ni.ptr, Ni.len);
+	len += Ni.len;
 
 	shunk_t IPi = address_as_shunk(&md->sender);
-	crypt_hash_digest_hunk(ctx, "IPi", IPi);
-
-	crypt_hash_digest_thing(ctx, "SPIi", md->hdr.isa_ike_initiator_spi);
-
-	crypt_hash_digest_thing(ctx, "<secret>", v2_cookie_secret);
+	passert(IPi.len <= sizeof(struct in6_addr));
+	memcpy(input + len, IPi.ptr, IPi.len);
+	len += IPi.len;
 
-	/* happy coincidence? */
-	pexpect(sizeof(cookie->bytes) == SHA2_256_DIGEST_SIZE);
-	crypt_hash_final_bytes(&ctx, cookie->bytes, sizeof(cookie->bytes));
+	memcpy(input + len, md->hdr.isa_ike_initiator_spi.bytes, IKE_SA_SPI_SIZE);
+	len += IKE_SA_SPI_SIZE;
 
-	return true;
+	cookie->generation = secret->generation;
+	for (unsigned i = 0; i < V2_COOKIE_MAC_WORDS; i++) {
+		uint64_t mac = siphash24(&secret->key[i], input, len);
+		memcpy(cookie->mac + i * sizeof(mac), &mac, sizeof(mac));
+	}
 }
 
 bool v2_rejected_initiator_cookie(struct msg_digest *md,
@@ -138,17 +176,14 @@ bool v2_rejected_initiator_cookie(struct msg_digest *md,
 		return true; /* reject cookie */
 	}
 
-	/* Most code paths require our cookie, compute it. */
-	v2_cookie_t my_cookie;
-	if (!compute_v2_cookie_from_md(&my_cookie, md, Ni)) {
-		return true; /* reject cookie */
-	}
-	chunk_t local_cookie = chunk2(&my_cookie, sizeof(my_cookie));
-
-	/* No cookie? demand one */
+	/* No cookie? demand one, using the current secret */
 	if (me_want_cookie && cookie_digest == NULL) {
+		v2_cookie_t my_cookie;
+		compute_v2_cookie_from_md(&my_cookie, &v2_cookie_secrets[0], md, Ni);
+		chunk_t local_cookie = chunk2(&my_cookie, sizeof(my_cookie));
 		rate_log(md, "DOS mode on; responding to IKE_SA_INIT with cookie notification request");
 		send_v2N_response_from_md(md, v2N_COOKIE, &local_cookie);
+		v2_cookie_stats.sent++;
 		return true; /* reject cookie */
 	}
 
@@ -170,10 +205,24 @@ bool v2_rejected_initiator_cookie(struct msg_digest *md,
 	    cookie_header->isan_spisize != 0 ||
 	    cookie_header->isan_length != sizeof(v2_cookie_t) + sizeof(struct ikev2_notify)) {
 		rate_log(md, "DOS cookie notification corrupt, or invalid - dropping message");
+		v2_cookie_stats.rejected++;
 		return true; /* reject cookie */
 	}
 	shunk_t remote_cookie = pbs_in_left_as_shunk(&cookie_digest->pbs);
 
+	/* the cookie's first byte identifies the secret */
+	const uint8_t *remote_generation = remote_cookie.ptr;
+	const struct v2_cookie_secret *secret = v2_cookie_secret(*remote_generation);
+	if (secret == NULL) {
+		rate_log(md, "DOS cookie secret expired - dropping message");
+		v2_cookie_stats.rejected++;
+		return true; /* reject cookie */
+	}
+
+	v2_cookie_t my_cookie;
+	compute_v2_cookie_from_md(&my_cookie, secret, md, Ni);
+	chunk_t local_cookie = chunk2(&my_cookie, sizeof(my_cookie));
+
 	if (DBGP(DBG_BASE)) {
 		DBG_dump_hunk("received cookie", remote_cookie);
 		DBG_dump_hunk("computed cookie", local_cookie);
@@ -181,13 +230,30 @@ bool v2_rejected_initiator_cookie(struct msg_digest *md,
 
 	if (!hunk_eq(local_cookie, remote_cookie)) {
 		rate_log(md, "DOS cookies do not match - dropping message");
+		v2_cookie_stats.rejected++;
 		return true; /* reject cookie */
 	}
 	dbg("cookies match");
+	v2_cookie_stats.accepted++;
+	if (secret != &v2_cookie_secrets[0]) {
+		v2_cookie_stats.accepted_previous++;
+	}
 
 	return false; /* love the cookie */
 }
 
+void show_v2_cookie_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	whack_print(whackfd, "current.ike.cookie.generation=%u",
+		    v2_cookie_secrets[0].generation);
+	whack_print(whackfd, "total.ike.cookie.sent=%lu", v2_cookie_stats.sent);
+	whack_print(whackfd, "total.ike.cookie.accepted=%lu", v2_cookie_stats.accepted);
+	whack_print(whackfd, "total.ike.cookie.accepted_previous=%lu",
+		    v2_cookie_stats.accepted_previous);
+	whack_print(whackfd, "total.ike.cookie.rejected=%lu", v2_cookie_stats.rejected);
+}
+
 static stf_status resume_IKE_SA_INIT_with_cookie(struct ike_sa *ike)
 {
 	if (!record_v2_IKE_SA_INIT_request(ike)) {
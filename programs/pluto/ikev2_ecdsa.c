@@ -56,11 +56,9 @@
 #include "lswnss.h"
 #include "ikev2_auth.h"
 
-static try_signature_fn try_ECDSA_signature_v2; /* type assert */
-static err_t try_ECDSA_signature_v2(const struct crypt_mac *hash,
-				    const pb_stream *sig_pbs, struct pubkey *kr,
-				    struct state *st,
-				    const struct hash_desc *hash_algo_unused UNUSED)
+err_t try_ECDSA_signature_v2(const struct crypt_mac *hash,
+			     shunk_t signature, const struct pubkey *kr,
+			     const struct hash_desc *hash_algo_unused UNUSED)
 {
 	PRArenaPool *arena = PORT_NewArena(DER_DEFAULT_CHUNKSIZE);
 	if (arena == NULL) {
@@ -122,8 +120,8 @@ static err_t try_ECDSA_signature_v2(const struct crypt_mac *hash,
 	 */
 	SECItem der_signature = {
 		.type = siBuffer,
-		.data = sig_pbs->cur,
-		.len = pbs_left(sig_pbs),
+		.data = DISCARD_CONST(uint8_t *, signature.ptr),
+		.len = signature.len,
 	};
 	LSWDBGP(DBG_BASE, buf) {
 		lswlogf(buf, "%d-byte DER encoded ECDSA signature: ",
@@ -172,8 +170,6 @@ static err_t try_ECDSA_signature_v2(const struct crypt_mac *hash,
 	dbg("NSS: verified signature");
 
 	SECITEM_FreeItem(raw_signature, PR_TRUE);
-	unreference_key(&st->st_peer_pubkey);
-	st->st_peer_pubkey = reference_key(kr);
 
 	return NULL;
 }
@@ -42,6 +42,7 @@
 #include "secrets.h"
 #include "ip_address.h"
 #include "ip_info.h"
+#include "pubkey_db.h"
 
 struct p_dns_req;
 
@@ -262,7 +263,7 @@ static err_t add_rsa_pubkey_to_pluto(struct p_dns_req *dnsr, ldns_rdf *rdf,
 			    str_id(&st->st_connection->spd.that.id, &thatidbuf));
 		}
 		/* delete only once. then multiple keys could be added */
-		delete_public_keys(&pluto_pubkeys, keyid, &pubkey_type_rsa);
+		delete_pubkeys_from_db(keyid, &pubkey_type_rsa);
 		dnsr->delete_existing_keys = FALSE;
 	}
 
@@ -285,7 +286,7 @@ static err_t add_rsa_pubkey_to_pluto(struct p_dns_req *dnsr, ldns_rdf *rdf,
 	}
 
 	err_t ugh = add_ipseckey(keyid, al, &pubkey_type_rsa, ttl, ttl_used,
-				 &keyval, &pluto_pubkeys);
+				 &keyval);
 	if (ugh != NULL) {
 		id_buf thatidbuf;
 		loglog(RC_LOG_SERIOUS, "Add publickey failed %s, %s, %s", ugh,
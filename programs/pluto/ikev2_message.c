@@ -47,6 +47,8 @@
 #include "ip_protocol.h"
 #include "ikev2_send.h"
 #include "log.h"
+#include "pluto_crypt.h"
+#include "crypt_symkey.h"
 
 /*
  * Determine the IKE version we will use for the IKE packet
@@ -475,9 +477,60 @@ stf_status encrypt_v2SK_payload(v2SK_payload_t *sk)
 }
 
 /*
- * ikev2_decrypt_msg: decode the payload.
- * The result is stored in-place.
- * Calls ikev2_process_payloads to decode the payloads within.
+ * The keys, and algorithms, needed to verify and decrypt a message
+ * from the peer.
+ *
+ * So that the work can be done on a helper thread, the task holds a
+ * reference to each key (the IKE SA could be deleted before the
+ * helper finishes).
+ */
+
+struct v2SK_decrypt_keys {
+	const struct encrypt_desc *encrypt;
+	const struct integ_desc *integ;
+	PK11SymKey *cipherkey;
+	PK11SymKey *authkey;
+	chunk_t salt;
+};
+
+static struct v2SK_decrypt_keys v2SK_decrypt_keys_addref(struct ike_sa *ike)
+{
+	struct v2SK_decrypt_keys keys = {
+		.encrypt = ike->sa.st_oakley.ta_encrypt,
+		.integ = ike->sa.st_oakley.ta_integ,
+	};
+	switch (ike->sa.st_sa_role) {
+	case SA_INITIATOR:
+		/* need responders key */
+		keys.cipherkey = ike->sa.st_skey_er_nss;
+		keys.authkey = ike->sa.st_skey_ar_nss;
+		keys.salt = ike->sa.st_skey_responder_salt;
+		break;
+	case SA_RESPONDER:
+		/* need initiators key */
+		keys.cipherkey = ike->sa.st_skey_ei_nss;
+		keys.authkey = ike->sa.st_skey_ai_nss;
+		keys.salt = ike->sa.st_skey_initiator_salt;
+		break;
+	default:
+		bad_case(ike->sa.st_sa_role);
+	}
+	keys.cipherkey = reference_symkey("SK", "cipherkey", keys.cipherkey);
+	keys.authkey = reference_symkey("SK", "authkey", keys.authkey);
+	keys.salt = clone_hunk(keys.salt, "SK salt");
+	return keys;
+}
+
+static void v2SK_decrypt_keys_delref(struct v2SK_decrypt_keys *keys)
+{
+	release_symkey("SK", "cipherkey", &keys->cipherkey);
+	release_symkey("SK", "authkey", &keys->authkey);
+	free_chunk_content(&keys->salt);
+}
+
+/*
+ * Verify and then decrypt, in-place, the encrypted part of an IKE
+ * message (or fragment).
  *
  * This code assumes that the encrypted part of an IKE message starts
  * with an Initialization Vector (IV) of WIRE_IV_SIZE random octets.
@@ -485,26 +538,20 @@ stf_status encrypt_v2SK_payload(v2SK_payload_t *sk)
  *
  * The (optional) salt, wire-iv, and (optional) 1 are combined to form
  * the actual starting-variable (a.k.a. IV).
+ *
+ * Runs on a helper thread so only touches CHUNK and KEYS.
  */
 
-static bool ikev2_verify_and_decrypt_sk_payload(struct ike_sa *ike,
-						struct msg_digest *md,
+static bool ikev2_verify_and_decrypt_sk_payload(struct logger *logger,
+						const struct v2SK_decrypt_keys *keys,
 						chunk_t *chunk,
 						unsigned int iv)
 {
-	if (!ike->sa.hidden_variables.st_skeyid_calculated) {
-		endpoint_buf b;
-		PEXPECT_LOG("received encrypted packet from %s  but no exponents for state #%lu to decrypt it",
-			    str_endpoint(&md->sender, &b),
-			    ike->sa.st_serialno);
-		return false;
-	}
-
 	u_char *wire_iv_start = chunk->ptr + iv;
-	size_t wire_iv_size = ike->sa.st_oakley.ta_encrypt->wire_iv_size;
-	size_t integ_size = (encrypt_desc_is_aead(ike->sa.st_oakley.ta_encrypt)
-			     ? ike->sa.st_oakley.ta_encrypt->aead_tag_size
-			     : ike->sa.st_oakley.ta_integ->integ_output_size);
+	size_t wire_iv_size = keys->encrypt->wire_iv_size;
+	size_t integ_size = (encrypt_desc_is_aead(keys->encrypt)
+			     ? keys->encrypt->aead_tag_size
+			     : keys->integ->integ_output_size);
 
 	/*
 	 * check to see if length is plausible:
@@ -515,8 +562,9 @@ static bool ikev2_verify_and_decrypt_sk_payload(struct ike_sa *ike,
 	 */
 	u_char *payload_end = chunk->ptr + chunk->len;
 	if (payload_end < (wire_iv_start + wire_iv_size + 1 + integ_size)) {
-		libreswan_log("encrypted payload impossibly short (%tu)",
-			      payload_end - wire_iv_start);
+		log_message(RC_LOG, logger,
+			    "encrypted payload impossibly short (%tu)",
+			    payload_end - wire_iv_start);
 		return false;
 	}
 
@@ -536,38 +584,23 @@ static bool ikev2_verify_and_decrypt_sk_payload(struct ike_sa *ike,
 	 * (originally this was being done between integrity and
 	 * decrypt).
 	 */
-	size_t enc_blocksize = ike->sa.st_oakley.ta_encrypt->enc_blocksize;
-	bool pad_to_blocksize = ike->sa.st_oakley.ta_encrypt->pad_to_blocksize;
+	size_t enc_blocksize = keys->encrypt->enc_blocksize;
+	bool pad_to_blocksize = keys->encrypt->pad_to_blocksize;
 	if (pad_to_blocksize) {
 		if (enc_size % enc_blocksize != 0) {
-			libreswan_log("discarding invalid packet: %zu octet payload length is not a multiple of encryption block-size (%zu)",
-				      enc_size, enc_blocksize);
+			log_message(RC_LOG, logger,
+				    "discarding invalid packet: %zu octet payload length is not a multiple of encryption block-size (%zu)",
+				    enc_size, enc_blocksize);
 			return false;
 		}
 	}
 
-	chunk_t salt;
-	PK11SymKey *cipherkey;
-	PK11SymKey *authkey;
-	switch (ike->sa.st_sa_role) {
-	case SA_INITIATOR:
-		/* need responders key */
-		cipherkey = ike->sa.st_skey_er_nss;
-		authkey = ike->sa.st_skey_ar_nss;
-		salt = ike->sa.st_skey_responder_salt;
-		break;
-	case SA_RESPONDER:
-		/* need initiators key */
-		cipherkey = ike->sa.st_skey_ei_nss;
-		authkey = ike->sa.st_skey_ai_nss;
-		salt = ike->sa.st_skey_initiator_salt;
-		break;
-	default:
-		bad_case(ike->sa.st_sa_role);
-	}
+	chunk_t salt = keys->salt;
+	PK11SymKey *cipherkey = keys->cipherkey;
+	PK11SymKey *authkey = keys->authkey;
 
 	/* authenticate and decrypt the block. */
-	if (encrypt_desc_is_aead(ike->sa.st_oakley.ta_encrypt)) {
+	if (encrypt_desc_is_aead(keys->encrypt)) {
 		/*
 		 * Additional Authenticated Data - AAD - size.
 		 * RFC5282 says: The Initialization Vector and Ciphertext
@@ -587,8 +620,8 @@ static bool ikev2_verify_and_decrypt_sk_payload(struct ike_sa *ike,
 			     enc_start, enc_size);
 		    DBG_dump("integ before authenticated decryption:",
 			     integ_start, integ_size));
-		if (!ike->sa.st_oakley.ta_encrypt->encrypt_ops
-		    ->do_aead(ike->sa.st_oakley.ta_encrypt,
+		if (!keys->encrypt->encrypt_ops
+		    ->do_aead(keys->encrypt,
 			      salt.ptr, salt.len,
 			      wire_iv_start, wire_iv_size,
 			      aad_start, aad_size,
@@ -604,13 +637,13 @@ static bool ikev2_verify_and_decrypt_sk_payload(struct ike_sa *ike,
 		 * check authenticator.  The last INTEG_SIZE bytes are
 		 * the truncated digest.
 		 */
-		struct crypt_prf *ctx = crypt_prf_init_symkey("auth", ike->sa.st_oakley.ta_integ->prf,
+		struct crypt_prf *ctx = crypt_prf_init_symkey("auth", keys->integ->prf,
 							      "authkey", authkey);
 		crypt_prf_update_bytes(ctx, "message", auth_start, integ_start - auth_start);
-		struct crypt_mac td = crypt_prf_final_mac(&ctx, ike->sa.st_oakley.ta_integ);
+		struct crypt_mac td = crypt_prf_final_mac(&ctx, keys->integ);
 
 		if (!hunk_memeq(td, integ_start, integ_size)) {
-			libreswan_log("failed to match authenticator");
+			log_message(RC_LOG, logger, "failed to match authenticator");
 			return false;
 		}
 
@@ -622,12 +655,12 @@ static bool ikev2_verify_and_decrypt_sk_payload(struct ike_sa *ike,
 		unsigned char enc_iv[MAX_CBC_BLOCK_SIZE];
 		construct_enc_iv("decryption IV/starting-variable", enc_iv,
 				 wire_iv_start, salt,
-				 ike->sa.st_oakley.ta_encrypt);
+				 keys->encrypt);
 
 		DBG(DBG_CRYPT,
 		    DBG_dump("payload before decryption:", enc_start, enc_size));
-		ike->sa.st_oakley.ta_encrypt->encrypt_ops
-			->do_crypt(ike->sa.st_oakley.ta_encrypt,
+		keys->encrypt->encrypt_ops
+			->do_crypt(keys->encrypt,
 				   enc_start, enc_size,
 				   cipherkey,
 				   enc_iv, FALSE);
@@ -649,8 +682,9 @@ static bool ikev2_verify_and_decrypt_sk_payload(struct ike_sa *ike,
 	 */
 	uint8_t padlen = enc_start[enc_size - 1] + 1;
 	if (padlen > enc_size) {
-		libreswan_log("discarding invalid packet: padding-length %u (octet 0x%02x) is larger than %zu octet payload length",
-			      padlen, padlen - 1, enc_size);
+		log_message(RC_LOG, logger,
+			    "discarding invalid packet: padding-length %u (octet 0x%02x) is larger than %zu octet payload length",
+			    padlen, padlen - 1, enc_size);
 		return false;
 	}
 	if (pad_to_blocksize) {
@@ -680,11 +714,160 @@ static bool ikev2_verify_and_decrypt_sk_payload(struct ike_sa *ike,
 }
 
 /*
- * Since the fragmented packet is intended for ST (either an IKE or
- * CHILD SA), ST contains the fragments.
+ * Decrypt the, possibly fragmented, message intended for ST on a
+ * crypto helper.
+ *
+ * Since the message fragments are stored in the recipient's ST
+ * (either IKE or CHILD SA), it, and not the IKE SA is needed.  The
+ * task takes ownership of the fragments, and a reference to MD, so
+ * nothing is shared with ST while the helper is running.
  */
+
+static crypto_compute_fn v2_decrypt_computer; /* type check */
+static crypto_completed_cb v2_decrypt_completed; /* type check */
+static crypto_cancelled_cb v2_decrypt_cancelled; /* type check */
+
+static const struct crypto_handler v2_decrypt_handler = {
+	.name = "verify and decrypt SK payload",
+	.compute_fn = v2_decrypt_computer,
+	.completed_cb = v2_decrypt_completed,
+	.cancelled_cb = v2_decrypt_cancelled,
+	/* the state isn't transitioning so leave its timers alone */
+	.keep_state_events = true,
+};
+
+struct crypto_task {
+	/* input */
+	struct msg_digest *md; /* counted reference */
+	struct v2SK_decrypt_keys keys;
+	struct v2_incomming_fragments *frags; /* owned; NULL for SK */
+	v2_decrypt_cb *cb;
+	/* in/out; points into MD's packet or FRAGS */
+	chunk_t plain[MAX_IKE_FRAGMENTS + 1];
+	unsigned iv; /* SK only */
+	/* output */
+	bool ok;
+};
+
+void submit_v2_decrypt_msg(struct ike_sa *ike, struct state *st,
+			   struct msg_digest *md, v2_decrypt_cb *cb)
+{
+	struct crypto_task task = {
+		.md = md_addref(md, HERE),
+		.keys = v2SK_decrypt_keys_addref(ike),
+		.cb = cb,
+	};
+
+	if (md->chain[ISAKMP_NEXT_v2SKF] != NULL) {
+		/*
+		 * ST points at the state (parent or child) that has
+		 * all the fragments; take them.
+		 */
+		struct v2_incomming_fragments **frags = &st->st_v2_incomming[v2_msg_role(md)];
+		passert(*frags != NULL);
+		task.frags = *frags;
+		*frags = NULL;
+		for (unsigned i = 1; i <= task.frags->total; i++) {
+			task.plain[i] = task.frags->frags[i].cipher;
+		}
+	} else {
+		pb_stream *e_pbs = &md->chain[ISAKMP_NEXT_v2SK]->pbs;
+		/*
+		 * If so impaired, clone the encrypted message before
+		 * it gets decrypted in-place (but only once).
+		 */
+		if (impair.replay_encrypted && !md->fake_clone) {
+			libreswan_log("IMPAIR: cloning incoming encrypted message and scheduling its replay");
+			schedule_md_event("replay encrypted message",
+					  clone_raw_md(md, "copy of encrypted message"));
+		}
+		if (impair.corrupt_encrypted && !md->fake_clone) {
+			libreswan_log("IMPAIR: corrupting incoming encrypted message's SK payload's first byte");
+			*e_pbs->cur = ~(*e_pbs->cur);
+		}
+
+		task.plain[0] = chunk2(md->packet_pbs.start,
+				       e_pbs->roof - md->packet_pbs.start);
+		task.iv = e_pbs->cur - md->packet_pbs.start;
+	}
+
+	st->st_v2_decrypting = true;
+	submit_crypto(st->st_logger, st,
+		      clone_thing(task, "verify and decrypt SK payload task"),
+		      &v2_decrypt_handler, "verify and decrypt SK payload");
+}
+
+bool v2_hold_md(struct state *st, struct msg_digest *md)
+{
+	/* the decrypt task may have been cancelled */
+	if (!st->st_v2_decrypting || st->st_offloaded_task == NULL) {
+		return false;
+	}
+	if (st->st_v2_nr_held_mds >= elemsof(st->st_v2_held_mds)) {
+		log_state(RC_LOG, st,
+			  "discarding packet received while decrypting; %u already held",
+			  st->st_v2_nr_held_mds);
+		return true;
+	}
+	dbg("#%lu holding packet received while decrypting", st->st_serialno);
+	/* MD has been partially parsed; keep the raw packet */
+	struct msg_digest *held = clone_raw_md(md, "message held while decrypting");
+	held->fake_clone = false;
+	st->st_v2_held_mds[st->st_v2_nr_held_mds++] = held;
+	return true;
+}
+
+/*
+ * Re-inject anything that arrived during the decryption; it runs
+ * after the decrypted message has been processed.
+ */
+static void release_v2_held_mds(struct state *st)
+{
+	for (unsigned i = 0; i < st->st_v2_nr_held_mds; i++) {
+		schedule_md_event("message held while decrypting",
+				  st->st_v2_held_mds[i]);
+		st->st_v2_held_mds[i] = NULL;
+	}
+	st->st_v2_nr_held_mds = 0;
+}
+
+static void v2_decrypt_computer(struct logger *logger,
+				struct crypto_task *task,
+				int my_thread UNUSED)
+{
+	if (task->frags == NULL) {
+		task->ok = ikev2_verify_and_decrypt_sk_payload(logger, &task->keys,
+							       &task->plain[0], task->iv);
+		return;
+	}
+
+	/*
+	 * PLAIN points at each encrypted fragment; decrypt in-place.
+	 * After the decryption, PLAIN will have been adjusted to just
+	 * point at the data.
+	 */
+	for (unsigned i = 1; i <= task->frags->total; i++) {
+		struct v2_incomming_fragment *frag = &task->frags->frags[i];
+		if (!ikev2_verify_and_decrypt_sk_payload(logger, &task->keys,
+							 &task->plain[i], frag->iv)) {
+			log_message(RC_LOG_SERIOUS, logger,
+				    "fragment %u of %u invalid",
+				    i, task->frags->total);
+			task->ok = false;
+			return;
+		}
+	}
+	task->ok = true;
+}
+
+/*
+ * All the fragments have been decrypted, re-assemble them into the
+ * .raw_packet buffer.
+ */
+
 static bool ikev2_reassemble_fragments(struct state *st,
-				       struct msg_digest *md)
+				       struct msg_digest *md,
+				       struct crypto_task *task)
 {
 	if (md->chain[ISAKMP_NEXT_v2SK] != NULL) {
 		PEXPECT_LOG("state #%lu has both SK ans SKF payloads",
@@ -697,42 +880,19 @@ static bool ikev2_reassemble_fragments(struct state *st,
 		return false;
 	}
 
-	struct v2_incomming_fragments **frags = &st->st_v2_incomming[v2_msg_role(md)];
-	passert(*frags != NULL);
-
-	chunk_t plain[MAX_IKE_FRAGMENTS + 1];
-	passert(elemsof(plain) == elemsof((*frags)->frags));
 	unsigned int size = 0;
-	for (unsigned i = 1; i <= (*frags)->total; i++) {
-		struct v2_incomming_fragment *frag = &(*frags)->frags[i];
-		/*
-		 * Point PLAIN at the encrypted fragment and then
-		 * decrypt in-place.  After the decryption, PLAIN will
-		 * have been adjusted to just point at the data.
-		 */
-		plain[i] = frag->cipher;
-		if (!ikev2_verify_and_decrypt_sk_payload(ike_sa(st, HERE), md,
-							 &plain[i], frag->iv)) {
-			loglog(RC_LOG_SERIOUS, "fragment %u of %u invalid",
-			       i, (*frags)->total);
-			free_v2_incomming_fragments(frags);
-			return false;
-		}
-		size += plain[i].len;
+	for (unsigned i = 1; i <= task->frags->total; i++) {
+		size += task->plain[i].len;
 	}
 
-	/*
-	 * All the fragments have been disassembled, re-assemble them
-	 * into the .raw_packet buffer.
-	 */
 	pexpect(md->raw_packet.ptr == NULL); /* empty */
 	md->raw_packet = alloc_chunk(size, "IKEv2 fragments buffer");
 	unsigned int offset = 0;
-	for (unsigned i = 1; i <= (*frags)->total; i++) {
-		passert(offset + plain[i].len <= size);
-		memcpy(md->raw_packet.ptr + offset, plain[i].ptr,
-		       plain[i].len);
-		offset += plain[i].len;
+	for (unsigned i = 1; i <= task->frags->total; i++) {
+		passert(offset + task->plain[i].len <= size);
+		memcpy(md->raw_packet.ptr + offset, task->plain[i].ptr,
+		       task->plain[i].len);
+		offset += task->plain[i].len;
 	}
 
 	/*
@@ -744,54 +904,31 @@ static bool ikev2_reassemble_fragments(struct state *st,
 	struct payload_digest sk = {
 		.pbs = same_chunk_as_in_pbs(md->raw_packet, "decrypted SFK payloads"),
 		.payload_type = ISAKMP_NEXT_v2SK,
-		.payload.generic.isag_np = (*frags)->first_np,
+		.payload.generic.isag_np = task->frags->first_np,
 	};
 	struct payload_digest *skf = md->chain[ISAKMP_NEXT_v2SKF];
 	md->chain[ISAKMP_NEXT_v2SKF] = NULL;
 	md->chain[ISAKMP_NEXT_v2SK] = skf;
 	*skf = sk; /* scribble */
 
-	free_v2_incomming_fragments(frags);
-
 	return true;
 }
 
-/*
- * Decrypt the, possibly fragmented message intended for ST.
- *
- * Since the message fragments are stored in the recipient's ST
- * (either IKE or CHILD SA), it, and not the IKE SA is needed.
- */
-bool ikev2_decrypt_msg(struct state *st, struct msg_digest *md)
+static stf_status v2_decrypt_completed(struct state *st,
+				       struct msg_digest *unused_md UNUSED,
+				       struct crypto_task **task)
 {
-	bool ok;
-	if (md->chain[ISAKMP_NEXT_v2SKF] != NULL) {
-		/*
-		 * ST points at the state (parent or child) that has
-		 * all the fragments.
-		 */
-		ok = ikev2_reassemble_fragments(st, md);
-	} else {
-		pb_stream *e_pbs = &md->chain[ISAKMP_NEXT_v2SK]->pbs;
-		/*
-		 * If so impaired, clone the encrypted message before
-		 * it gets decrypted in-place (but only once).
-		 */
-		if (impair.replay_encrypted && !md->fake_clone) {
-			libreswan_log("IMPAIR: cloning incoming encrypted message and scheduling its replay");
-			schedule_md_event("replay encrypted message",
-					  clone_raw_md(md, "copy of encrypted message"));
+	/* MD wasn't suspended; use the task's reference */
+	struct msg_digest *md = md_addref((*task)->md, HERE);
+
+	bool ok = (*task)->ok;
+	if (ok) {
+		if ((*task)->frags != NULL) {
+			ok = ikev2_reassemble_fragments(st, md, *task);
+		} else {
+			md->chain[ISAKMP_NEXT_v2SK]->pbs =
+				same_chunk_as_in_pbs((*task)->plain[0], "decrypted SK payload");
 		}
-		if (impair.corrupt_encrypted && !md->fake_clone) {
-			libreswan_log("IMPAIR: corrupting incoming encrypted message's SK payload's first byte");
-			*e_pbs->cur = ~(*e_pbs->cur);
-		}
-
-		chunk_t c = chunk2(md->packet_pbs.start,
-				  e_pbs->roof - md->packet_pbs.start);
-		ok = ikev2_verify_and_decrypt_sk_payload(ike_sa(st, HERE), md, &c,
-							 e_pbs->cur - md->packet_pbs.start);
-		md->chain[ISAKMP_NEXT_v2SK]->pbs = same_chunk_as_in_pbs(c, "decrypted SK payload");
 	}
 
 	dbg("#%lu ikev2 %s decrypt %s",
@@ -799,7 +936,24 @@ bool ikev2_decrypt_msg(struct state *st, struct msg_digest *md)
 	    enum_name(&ikev2_exchange_names, md->hdr.isa_xchg),
 	    ok ? "success" : "failed");
 
-	return ok;
+	v2_decrypt_cb *cb = (*task)->cb;
+	v2_decrypt_cancelled(task);
+
+	st->st_v2_decrypting = false;
+	release_v2_held_mds(st);
+	cb(st, md, ok);
+	release_any_md(&md);
+	return STF_SKIP_COMPLETE_STATE_TRANSITION;
+}
+
+static void v2_decrypt_cancelled(struct crypto_task **task)
+{
+	release_any_md(&(*task)->md);
+	v2SK_decrypt_keys_delref(&(*task)->keys);
+	if ((*task)->frags != NULL) {
+		free_v2_incomming_fragments(&(*task)->frags);
+	}
+	pfreeany(*task);
 }
 
 /*
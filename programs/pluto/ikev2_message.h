@@ -57,7 +57,21 @@ stf_status record_v2SK_message(struct pbs_out *msg,
 
 uint8_t build_ikev2_critical(bool impair);
 
-bool ikev2_decrypt_msg(struct state *st, struct msg_digest *md);
+/*
+ * Verify and decrypt (reassembling fragments) the message intended
+ * for ST on a crypto helper; CB is then called with the result.
+ */
+typedef void (v2_decrypt_cb)(struct state *st, struct msg_digest *md, bool ok);
+
+void submit_v2_decrypt_msg(struct ike_sa *ike, struct state *st,
+			   struct msg_digest *md, v2_decrypt_cb *cb);
+
+/*
+ * While ST is decrypting, rather than drop MD (the state is busy)
+ * hold a copy to be processed once the decryption finishes.  Returns
+ * false when ST isn't decrypting.
+ */
+bool v2_hold_md(struct state *st, struct msg_digest *md);
 
 struct ikev2_id build_v2_id_payload(const struct end *end, shunk_t *body);
 
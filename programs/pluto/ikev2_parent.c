@@ -103,6 +103,10 @@ struct mobike {
 	const struct iface_port *interface;
 };
 
+static stf_status ikev2_parent_inI2outR2_auth_checked(struct ike_sa *ike,
+						      struct msg_digest *md,
+						      bool authenticated);
+static v2_auth_verify_cb ikev2_parent_inI2outR2_auth_verified;
 static stf_status ikev2_parent_inI2outR2_auth_tail(struct state *st,
 						   struct msg_digest *md,
 						   bool pam_status);
@@ -278,22 +282,17 @@ static bool v2_accept_ke_for_proposal(struct ike_sa *ike,
 }
 
 /*
- * Called by ikev2_parent_inI2outR2_tail() and ikev2_parent_inR2()
- * Do the actual AUTH payload verification
+ * For the signature AUTH methods: check that RECV_AUTH is what
+ * THAT_AUTHBY wants and determine the hash (for DIGSIG, by matching
+ * the ASN.1 blob at the front of PBS).  Returns false, having logged,
+ * when it isn't acceptable.
  */
-/*
- * ??? Several verify routines return an stf_status and yet we just return a bool.
- *     We perhaps should return an stf_status so distinctions don't get lost.
- *
- * XXX: this is answering a simple yes/no question.  Did auth succeed.
- * Caller needs to decide what response is appropriate.
- */
-static bool v2_check_auth(enum ikev2_auth_method recv_auth,
-			  struct ike_sa *ike,
-			  const struct crypt_mac *idhash_in,
-			  pb_stream *pbs,
-			  const enum keyword_authby that_authby,
-			  const char *context)
+static bool v2_auth_signature_hash(enum ikev2_auth_method recv_auth,
+				   struct ike_sa *ike,
+				   pb_stream *pbs,
+				   const enum keyword_authby that_authby,
+				   const char *context,
+				   const struct hash_desc **hash_algo)
 {
 	switch (recv_auth) {
 	case IKEv2_AUTH_RSA:
@@ -305,58 +304,10 @@ static bool v2_check_auth(enum ikev2_auth_method recv_auth,
 				  context);
 			return false;
 		}
-
-		stf_status authstat = ikev2_verify_rsa_hash(ike, idhash_in, pbs,
-							    &ike_alg_hash_sha1);
-
-		if (authstat != STF_OK) {
-			log_state(RC_LOG, &ike->sa,
-				  "RSA authentication of %s failed", context);
-			return false;
-		}
+		*hash_algo = &ike_alg_hash_sha1;
 		return true;
 	}
 
-	case IKEv2_AUTH_PSK:
-	{
-		if (that_authby != AUTHBY_PSK) {
-			log_state(RC_LOG, &ike->sa,
-				  "peer attempted PSK authentication but we want %s in %s",
-				  enum_name(&keyword_authby_names, that_authby),
-				  context);
-			return FALSE;
-		}
-
-		if (!ikev2_verify_psk_auth(AUTHBY_PSK, ike, idhash_in, pbs)) {
-			log_state(RC_LOG, &ike->sa,
-				  "PSK Authentication failed: AUTH mismatch in %s!",
-				  context);
-			return FALSE;
-		}
-		return TRUE;
-	}
-
-	case IKEv2_AUTH_NULL:
-	{
-		if (!(that_authby == AUTHBY_NULL ||
-		      (that_authby == AUTHBY_RSASIG && LIN(POLICY_AUTH_NULL, ike->sa.st_connection->policy)))) {
-			log_state(RC_LOG, &ike->sa,
-				  "peer attempted NULL authentication but we want %s in %s",
-				  enum_name(&keyword_authby_names, that_authby),
-				  context);
-			return FALSE;
-		}
-
-		if (!ikev2_verify_psk_auth(AUTHBY_NULL, ike, idhash_in, pbs)) {
-			log_state(RC_LOG, &ike->sa,
-				  "NULL authentication failed: AUTH mismatch in %s! (implementation bug?)",
-				  context);
-			return FALSE;
-		}
-		ike->sa.st_ikev2_anon = TRUE;
-		return TRUE;
-	}
-
 	case IKEv2_AUTH_DIGSIG:
 	{
 		if (that_authby != AUTHBY_ECDSA && that_authby != AUTHBY_RSASIG) {
@@ -407,6 +358,58 @@ static bool v2_check_auth(enum ikev2_auth_method recv_auth,
 			dbg("st_hash_negotiated policy does not match hash algorithm %s",
 			    hap->algo->common.fqn);
 		}
+		*hash_algo = hap->algo;
+		return true;
+	}
+
+	default:
+		bad_case(recv_auth);
+	}
+}
+
+static void log_v2_auth_signature_failure(struct ike_sa *ike,
+					  enum ikev2_auth_method recv_auth,
+					  const enum keyword_authby that_authby,
+					  const char *context)
+{
+	if (recv_auth == IKEv2_AUTH_RSA) {
+		log_state(RC_LOG, &ike->sa,
+			  "RSA authentication of %s failed", context);
+	} else {
+		log_state(RC_LOG, &ike->sa,
+			  "Digital Signature authentication using %s failed in %s",
+			  enum_name(&keyword_authby_names, that_authby),
+			  context);
+	}
+}
+
+/*
+ * Called by ikev2_parent_inI2outR2_tail() and ikev2_parent_inR2()
+ * Do the actual AUTH payload verification
+ */
+/*
+ * ??? Several verify routines return an stf_status and yet we just return a bool.
+ *     We perhaps should return an stf_status so distinctions don't get lost.
+ *
+ * XXX: this is answering a simple yes/no question.  Did auth succeed.
+ * Caller needs to decide what response is appropriate.
+ */
+static bool v2_check_auth(enum ikev2_auth_method recv_auth,
+			  struct ike_sa *ike,
+			  const struct crypt_mac *idhash_in,
+			  pb_stream *pbs,
+			  const enum keyword_authby that_authby,
+			  const char *context)
+{
+	switch (recv_auth) {
+	case IKEv2_AUTH_RSA:
+	case IKEv2_AUTH_DIGSIG:
+	{
+		const struct hash_desc *hash_algo;
+		if (!v2_auth_signature_hash(recv_auth, ike, pbs, that_authby,
+					    context, &hash_algo)) {
+			return false;
+		}
 
 		/* try to match the hash */
 		stf_status authstat;
@@ -414,12 +417,12 @@ static bool v2_check_auth(enum ikev2_auth_method recv_auth,
 		switch (that_authby) {
 		case AUTHBY_RSASIG:
 			authstat = ikev2_verify_rsa_hash(ike, idhash_in, pbs,
-							 hap->algo);
+							 hash_algo);
 			break;
 
 		case AUTHBY_ECDSA:
 			authstat = ikev2_verify_ecdsa_hash(ike, idhash_in, pbs,
-							   hap->algo);
+							   hash_algo);
 			break;
 
 		default:
@@ -427,12 +430,49 @@ static bool v2_check_auth(enum ikev2_auth_method recv_auth,
 		}
 
 		if (authstat != STF_OK) {
+			log_v2_auth_signature_failure(ike, recv_auth, that_authby, context);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	case IKEv2_AUTH_PSK:
+	{
+		if (that_authby != AUTHBY_PSK) {
+			log_state(RC_LOG, &ike->sa,
+				  "peer attempted PSK authentication but we want %s in %s",
+				  enum_name(&keyword_authby_names, that_authby),
+				  context);
+			return FALSE;
+		}
+
+		if (!ikev2_verify_psk_auth(AUTHBY_PSK, ike, idhash_in, pbs)) {
+			log_state(RC_LOG, &ike->sa,
+				  "PSK Authentication failed: AUTH mismatch in %s!",
+				  context);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	case IKEv2_AUTH_NULL:
+	{
+		if (!(that_authby == AUTHBY_NULL ||
+		      (that_authby == AUTHBY_RSASIG && LIN(POLICY_AUTH_NULL, ike->sa.st_connection->policy)))) {
 			log_state(RC_LOG, &ike->sa,
-				  "Digital Signature authentication using %s failed in %s",
+				  "peer attempted NULL authentication but we want %s in %s",
 				  enum_name(&keyword_authby_names, that_authby),
 				  context);
 			return FALSE;
 		}
+
+		if (!ikev2_verify_psk_auth(AUTHBY_NULL, ike, idhash_in, pbs)) {
+			log_state(RC_LOG, &ike->sa,
+				  "NULL authentication failed: AUTH mismatch in %s! (implementation bug?)",
+				  context);
+			return FALSE;
+		}
+		ike->sa.st_ikev2_anon = TRUE;
 		return TRUE;
 	}
 
@@ -2787,8 +2827,30 @@ stf_status ikev2_parent_inI2outR2_id_tail(struct msg_digest *md)
 			dbg("NULL_AUTH verified");
 		} else {
 			dbg("verifying AUTH payload");
-			if (!v2_check_auth(md->chain[ISAKMP_NEXT_v2AUTH]->payload.v2auth.isaa_auth_method,
-					   ike, &idhash_in, &md->chain[ISAKMP_NEXT_v2AUTH]->pbs,
+			enum ikev2_auth_method recv_auth =
+				md->chain[ISAKMP_NEXT_v2AUTH]->payload.v2auth.isaa_auth_method;
+			pb_stream *auth_pbs = &md->chain[ISAKMP_NEXT_v2AUTH]->pbs;
+			if (recv_auth == IKEv2_AUTH_RSA || recv_auth == IKEv2_AUTH_DIGSIG) {
+				/*
+				 * Leave the public key operation to a
+				 * crypto helper; this state is suspended
+				 * until it is done.
+				 */
+				free_chunk_content(&null_auth);
+				const struct hash_desc *hash_algo;
+				if (!v2_auth_signature_hash(recv_auth, ike, auth_pbs, that_authby,
+							    "I2 Auth Payload", &hash_algo)) {
+					return ikev2_parent_inI2outR2_auth_checked(ike, md, false);
+				}
+				if (!submit_v2_auth_verify(ike, &idhash_in,
+							   pbs_in_left_as_shunk(auth_pbs),
+							   hash_algo, that_authby,
+							   ikev2_parent_inI2outR2_auth_verified)) {
+					return ikev2_parent_inI2outR2_auth_verified(ike, md, false);
+				}
+				return STF_SUSPEND;
+			}
+			if (!v2_check_auth(recv_auth, ike, &idhash_in, auth_pbs,
 					   st->st_connection->spd.that.authby, "I2 Auth Payload")) {
 				record_v2N_response(ike->sa.st_logger, ike, md,
 						    v2N_AUTHENTICATION_FAILED, NULL/*no data*/,
@@ -2804,11 +2866,42 @@ stf_status ikev2_parent_inI2outR2_id_tail(struct msg_digest *md)
 
 	free_chunk_content(&null_auth);
 
+	return ikev2_parent_inI2outR2_auth_checked(ike, md, true);
+}
+
+static stf_status ikev2_parent_inI2outR2_auth_checked(struct ike_sa *ike,
+						      struct msg_digest *md,
+						      bool authenticated)
+{
+	if (!authenticated) {
+		record_v2N_response(ike->sa.st_logger, ike, md,
+				    v2N_AUTHENTICATION_FAILED, NULL/*no data*/,
+				    ENCRYPTED_PAYLOAD);
+		pstat_sa_failed(&ike->sa, REASON_AUTH_FAILED);
+		return STF_FATAL;
+	}
+
+	/* AUTH succeeded */
+
 #ifdef XAUTH_HAVE_PAM
-	if (st->st_connection->policy & POLICY_IKEV2_PAM_AUTHORIZE)
-		return ikev2_start_pam_authorize(st);
+	if (ike->sa.st_connection->policy & POLICY_IKEV2_PAM_AUTHORIZE)
+		return ikev2_start_pam_authorize(&ike->sa);
 #endif
-	return ikev2_parent_inI2outR2_auth_tail(st, md, TRUE);
+	return ikev2_parent_inI2outR2_auth_tail(&ike->sa, md, TRUE);
+}
+
+/* called, on the main thread, once the helper has checked the I2 AUTH signature */
+static stf_status ikev2_parent_inI2outR2_auth_verified(struct ike_sa *ike,
+						       struct msg_digest *md,
+						       bool authenticated)
+{
+	if (!authenticated) {
+		log_v2_auth_signature_failure(ike,
+					      md->chain[ISAKMP_NEXT_v2AUTH]->payload.v2auth.isaa_auth_method,
+					      ike->sa.st_connection->spd.that.authby,
+					      "I2 Auth Payload");
+	}
+	return ikev2_parent_inI2outR2_auth_checked(ike, md, authenticated);
 }
 
 static v2_auth_signature_cb ikev2_parent_inI2outR2_auth_signature_continue; /* type check */
@@ -3021,14 +3114,6 @@ static stf_status ikev2_parent_inI2outR2_auth_signature_continue(struct ike_sa *
 	pexpect(md->svm->next_state == STATE_V2_ESTABLISHED_CHILD_SA);
 	ikev2_ike_sa_established(ike, md->svm, STATE_V2_ESTABLISHED_IKE_SA);
 
-	if (LHAS(st->hidden_variables.st_nat_traversal, NATED_HOST)) {
-		/* ensure we run keepalives if needed */
-		if (c->nat_keepalive) {
-			/* XXX: just trigger this event? */
-			nat_traversal_ka_event(null_fd);
-		}
-	}
-
 	/* send response */
 	if (LIN(POLICY_MOBIKE, c->policy) && st->st_seen_mobike) {
 		if (c->spd.that.host_type == KH_ANY) {
@@ -3673,14 +3758,6 @@ static stf_status v2_inR2_post_cert_decode(struct state *st, struct msg_digest *
 	pexpect(md->svm->next_state == STATE_V2_ESTABLISHED_CHILD_SA);
 	ikev2_ike_sa_established(pexpect_ike_sa(pst), md->svm, STATE_V2_ESTABLISHED_IKE_SA);
 
-	if (LHAS(st->hidden_variables.st_nat_traversal, NATED_HOST)) {
-		/* ensure we run keepalives if needed */
-		if (c->nat_keepalive) {
-			/* XXX: just trigger this event */
-			nat_traversal_ka_event(null_fd);
-		}
-	}
-
 	/* AUTH is ok, we can trust the notify payloads */
 	if (md->v2N.use_transport_mode) { /* FIXME: use new RFC logic turning this into a request, not requirement */
 		if (LIN(POLICY_TUNNEL, st->st_connection->policy)) {
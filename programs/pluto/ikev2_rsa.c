@@ -141,15 +141,12 @@ bool ikev2_calculate_rsa_hash(struct ike_sa *ike,
 	return TRUE;
 }
 
-static try_signature_fn try_RSA_signature_v2; /* type assertion */
-
-static err_t try_RSA_signature_v2(const struct crypt_mac *hash,
-				  const pb_stream *sig_pbs, struct pubkey *kr,
-				  struct state *st,
-				  const struct hash_desc *hash_algo)
+err_t try_RSA_signature_v2(const struct crypt_mac *hash,
+			   shunk_t signature, const struct pubkey *kr,
+			   const struct hash_desc *hash_algo)
 {
-	const u_char *sig_val = sig_pbs->cur;
-	size_t sig_len = pbs_left(sig_pbs);
+	const u_char *sig_val = signature.ptr;
+	size_t sig_len = signature.len;
 	const struct RSA_public_key *k = &kr->u.rsa;
 
 	if (k == NULL)
@@ -157,7 +154,7 @@ static err_t try_RSA_signature_v2(const struct crypt_mac *hash,
 
 	/* decrypt the signature -- reversing RSA_sign_hash */
 	if (sig_len != k->k) {
-		loglog(RC_LOG_SERIOUS, "sig length %zu does not match pubkey length %d", sig_len, k->k);
+		dbg("sig length %zu does not match pubkey length %d", sig_len, k->k);
 		return "1" "SIG length does not match public key length";
 	}
 
@@ -166,9 +163,6 @@ static err_t try_RSA_signature_v2(const struct crypt_mac *hash,
 	if (ugh != NULL)
 		return ugh;
 
-	unreference_key(&st->st_peer_pubkey);
-	st->st_peer_pubkey = reference_key(kr);
-
 	return NULL;
 }
 
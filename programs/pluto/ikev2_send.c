@@ -638,4 +638,8 @@ void free_v2_message_queues(struct state *st)
 		free_v2_outgoing_fragments(&st->st_v2_outgoing[message]);
 		free_v2_incomming_fragments(&st->st_v2_incomming[message]);
 	}
+	for (unsigned i = 0; i < st->st_v2_nr_held_mds; i++) {
+		release_any_md(&st->st_v2_held_mds[i]);
+	}
+	st->st_v2_nr_held_mds = 0;
 }
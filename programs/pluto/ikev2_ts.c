@@ -32,6 +32,7 @@
 #include "ip_info.h"
 #include "ip_selector.h"
 #include "log.h"
+#include "spd_route_db.h"
 
 /*
  * While the RFC seems to suggest that the traffic selectors come in
@@ -1230,6 +1231,7 @@ bool v2_process_ts_response(struct child_sa *child,
 	c->spd.that.protocol = st->st_ts_that.ipprotoid;
 	setportof(htons(c->spd.that.port),
 		  &c->spd.that.client.addr);
+	rehash_spd_routes(c);
 
 	c->spd.that.has_client =
 		!(subnetishost(&c->spd.that.client) &&
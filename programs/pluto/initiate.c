@@ -71,6 +71,10 @@
 #include "virtual.h"	/* needs connections.h */
 #include "iface.h"
 #include "hostpair.h"
+#include "spd_route_db.h"
+#ifdef USE_DNSSEC
+#include "ddns.h"
+#endif
 
 /*
  * swap ends and try again.
@@ -85,6 +89,7 @@ static void swap_ends(struct connection *c)
 
 	sr->this = sr->that;
 	sr->that = t;
+	rehash_spd_routes(c);
 
 	/*
 	 * in case of asymmetric auth c->policy contains left.authby
@@ -1035,22 +1040,17 @@ void initiate_ondemand(const ip_address *our_client,
 
 /* Find a connection that owns the shunt eroute between subnets.
  * There ought to be only one.
- * This might get to be a bottleneck -- try hashing if it does.
  */
 struct connection *shunt_owner(const ip_subnet *ours, const ip_subnet *peers)
 {
-	struct connection *c;
+	struct list_head *bucket = spd_route_bucket_by_that_client(peers);
+	struct spd_route *sr;
 
-	dbg("FOR_EACH_CONNECTION_... in %s", __func__);
-	for (c = connections; c != NULL; c = c->ac_next) {
-		const struct spd_route *sr;
-
-		for (sr = &c->spd; sr; sr = sr->spd_next) {
-			if (shunt_erouted(sr->routing) &&
-			    samesubnet(ours, &sr->this.client) &&
-			    samesubnet(peers, &sr->that.client))
-				return c;
-		}
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, sr) {
+		if (shunt_erouted(sr->routing) &&
+		    samesubnet(ours, &sr->this.client) &&
+		    samesubnet(peers, &sr->that.client))
+			return sr->connection;
 	}
 	return NULL;
 }
@@ -1060,23 +1060,19 @@ struct connection *shunt_owner(const ip_subnet *ours, const ip_subnet *peers)
 #define PENDING_DDNS_INTERVAL secs_per_minute
 
 /*
- * Call me periodically to check to see if any DDNS tunnel can come up.
+ * Does the connection still need its peer's DNS name looked up?
  * The order matters, we try to do the cheapest checks first.
  */
 
-static void connection_check_ddns1(struct connection *c)
+bool connection_needs_ddns(const struct connection *c)
 {
-	struct connection *d;
-	ip_address new_addr;
-	const char *e;
-
 	/* this is the cheapest check, so do it first */
 	if (c->dnshostname == NULL)
-		return;
+		return false;
 
 	/* should we let the caller get away with this? */
 	if (NEVER_NEGOTIATE(c->policy))
-		return;
+		return false;
 
 	/*
 	 * We do not update a resolved address once resolved. That might
@@ -1088,7 +1084,7 @@ static void connection_check_ddns1(struct connection *c)
 		connection_buf cib;
 		dbg("pending ddns: connection "PRI_CONNECTION" has address",
 		    pri_connection(c, &cib));
-		return;
+		return false;
 	}
 
 	if (c->spd.that.has_port_wildcard ||
@@ -1097,18 +1093,22 @@ static void connection_check_ddns1(struct connection *c)
 		connection_buf cib;
 		dbg("pending ddns: connection "PRI_CONNECTION" with wildcard not started",
 		    pri_connection(c, &cib));
-		return;
+		return false;
 	}
 
-	e = ttoaddr(c->dnshostname, 0, AF_UNSPEC, &new_addr);
-	if (e != NULL) {
-		connection_buf cib;
-		dbg("pending ddns: connection "PRI_CONNECTION" lookup of \"%s\" failed: %s",
-		    pri_connection(c, &cib), c->dnshostname, e);
-		return;
-	}
+	return true;
+}
 
-	if (isanyaddr(&new_addr)) {
+/*
+ * The lookup of the connection's dnshostname returned NEW_ADDR;
+ * update the connection and, if it should be up, initiate it.
+ */
+
+void connection_ddns_resolved(struct connection *c, const ip_address *new_addr)
+{
+	struct connection *d;
+
+	if (isanyaddr(new_addr)) {
 		connection_buf cib;
 		dbg("pending ddns: connection "PRI_CONNECTION" still no address for \"%s\"",
 		    pri_connection(c, &cib), c->dnshostname);
@@ -1125,7 +1125,7 @@ static void connection_check_ddns1(struct connection *c)
 	}
 
 	/* This cannot currently be reached. If in the future we do, don't do weird things */
-	if (sameaddr(&new_addr, &c->spd.that.host_addr)) {
+	if (sameaddr(new_addr, &c->spd.that.host_addr)) {
 		connection_buf cib;
 		dbg("pending ddns: IP address unchanged for connection "PRI_CONNECTION"",
 		    pri_connection(c, &cib));
@@ -1150,8 +1150,8 @@ static void connection_check_ddns1(struct connection *c)
 
 	dbg("pending ddns: updating IP address for %s from %s to %s",
 	    c->dnshostname, sensitive_ipstr(&c->spd.that.host_addr, &old),
-	    sensitive_ipstr(&new_addr, &new));
-	c->spd.that.host_addr = new_addr;
+	    sensitive_ipstr(new_addr, &new));
+	c->spd.that.host_addr = *new_addr;
 
 	/* a small bit of code from default_end to fixup the end point */
 	/* default nexthop to other side */
@@ -1162,6 +1162,7 @@ static void connection_check_ddns1(struct connection *c)
 	if (!c->spd.that.has_client) {
 		/* XXX: this uses ADDRESS:PORT */
 		endtosubnet(&c->spd.that.host_addr, &c->spd.that.client, HERE);
+		rehash_spd_routes(c);
 	}
 
 	/*
@@ -1193,11 +1194,41 @@ static void connection_check_ddns1(struct connection *c)
 	}
 }
 
+/*
+ * Call me periodically to check to see if any DDNS tunnel can come up.
+ */
+
+static void connection_check_ddns1(struct connection *c)
+{
+	if (!connection_needs_ddns(c))
+		return;
+
+#ifdef USE_DNSSEC
+	/* the answer may be cached, or arrive later */
+	resolve_connection_ddns(c);
+#else
+	ip_address new_addr;
+	err_t e = ttoaddr(c->dnshostname, 0, AF_UNSPEC, &new_addr);
+	if (e != NULL) {
+		connection_buf cib;
+		dbg("pending ddns: connection "PRI_CONNECTION" lookup of \"%s\" failed: %s",
+		    pri_connection(c, &cib), c->dnshostname, e);
+		return;
+	}
+
+	connection_ddns_resolved(c, &new_addr);
+#endif
+}
+
 void connection_check_ddns(struct fd *unused_whackfd UNUSED)
 {
 	struct connection *c, *cnext;
 	threadtime_t start = threadtime_start();
 
+#ifdef USE_DNSSEC
+	expire_ddns_hosts();
+#endif
+
 	dbg("FOR_EACH_CONNECTION_... in %s", __func__);
 	for (c = connections; c != NULL; c = cnext) {
 		cnext = c->ac_next;
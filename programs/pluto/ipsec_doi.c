@@ -84,6 +84,7 @@
 #include "pending.h"
 #include "iface.h"
 #include "ikev2_delete.h"	/* for record_v2_delete(); but call is dying */
+#include "pubkey_db.h"
 
 /*
  * Process KE values.
@@ -339,6 +340,12 @@ void ipsecdoi_replace(struct state *st, unsigned long try)
 /*
  * look for the existence of a non-expiring preloaded public key
  */
+static bool preloaded_public_key(struct pubkey *key, void *arg UNUSED)
+{
+	return key->type == &pubkey_type_rsa &&
+		is_realtime_epoch(key->until_time);
+}
+
 bool has_preloaded_public_key(const struct state *st)
 {
 	const struct connection *c = st->st_connection;
@@ -348,16 +355,10 @@ bool has_preloaded_public_key(const struct state *st)
 	 */
 	if (c->kind == CK_PERMANENT) {
 		/* look for a matching RSA public key */
-		for (const struct pubkey_list *p = pluto_pubkeys; p != NULL;
-		     p = p->next) {
-			const struct pubkey *key = p->key;
-
-			if (key->type == &pubkey_type_rsa &&
-			    same_id(&c->spd.that.id, &key->id) &&
-			    is_realtime_epoch(key->until_time)) {
-				/* found a preloaded public key */
-				return TRUE;
-			}
+		if (find_pubkey_by_id(&c->spd.that.id,
+				      preloaded_public_key, NULL) != NULL) {
+			/* found a preloaded public key */
+			return TRUE;
 		}
 	}
 	return FALSE;
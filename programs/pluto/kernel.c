@@ -83,6 +83,9 @@
 #include "ip_selector.h"
 #include "ip_encap.h"
 #include "show.h"
+#include "pubkey_db.h"
+#include "updown.h"
+#include "hash_table.h"
 
 bool can_do_IPcomp = TRUE;  /* can system actually perform IPCOMP? */
 
@@ -125,10 +128,89 @@ struct bare_shunt {
 	/* the connection from where it came - used to re-load /32 conns */
 	char *from_cn;
 
-	struct bare_shunt *next;
+	struct list_entry hash_entry;		/* in bare_shunt_table */
+	struct list_entry list_entry;		/* on bare_shunts */
+	struct list_entry activity_entry;	/* on bare_shunt_activity */
 };
 
-static struct bare_shunt *bare_shunts = NULL;
+/*
+ * Bare shunts are indexed three ways:
+ *
+ * - bare_shunt_table, by (our_client, peer_client, transport_proto),
+ *   for the lookups done on each ACQUIRE, replace and orphan
+ *
+ * - bare_shunts, oldest first, for "ipsec status"
+ *
+ * - bare_shunt_activity, by .last_activity, least recent first;
+ *   since .last_activity is only ever set to now and every shunt
+ *   has the same lifetime this is also expiry order, and
+ *   expire_bare_shunts() only looks at the shunts that expire
+ */
+
+static unsigned nr_bare_shunts;
+
+static void jam_bare_shunt(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "bare shunt NULL");
+	} else {
+		const struct bare_shunt *bs = data;
+		jam(buf, "bare shunt %p ", data);
+		jam_selector(buf, &bs->our_client);
+		jam(buf, " --%d--> ", bs->transport_proto);
+		jam_selector(buf, &bs->peer_client);
+	}
+}
+
+static const struct list_info bare_shunt_info = {
+	.name = "bare shunt list",
+	.jam = jam_bare_shunt,
+};
+
+static struct list_head bare_shunts = INIT_LIST_HEAD(&bare_shunts, &bare_shunt_info);
+static struct list_head bare_shunt_activity = INIT_LIST_HEAD(&bare_shunt_activity, &bare_shunt_info);
+
+static hash_t bare_shunt_client_hasher(const ip_selector *client, hash_t hash)
+{
+	ip_address address = endpoint_address(&client->addr);
+	hash = hash_table_hasher(THING_AS_SHUNK(client->maskbits), hash);
+	return hash_table_hasher(address_as_shunk(&address), hash);
+}
+
+static hash_t bare_shunt_key_hasher(const ip_selector *our_client,
+				    const ip_selector *peer_client,
+				    int transport_proto)
+{
+	hash_t hash = hash_table_hash_u64(transport_proto);
+	hash = bare_shunt_client_hasher(our_client, hash);
+	return bare_shunt_client_hasher(peer_client, hash);
+}
+
+static hash_t bare_shunt_hasher(const void *data)
+{
+	const struct bare_shunt *bs = data;
+	return bare_shunt_key_hasher(&bs->our_client, &bs->peer_client,
+				     bs->transport_proto);
+}
+
+static struct list_entry *bare_shunt_entry(void *data)
+{
+	struct bare_shunt *bs = data;
+	return &bs->hash_entry;
+}
+
+static struct list_head bare_shunt_slots[STATE_TABLE_SIZE];
+
+static struct hash_table bare_shunt_table = {
+	.info = {
+		.name = "bare shunt table",
+		.jam = jam_bare_shunt,
+	},
+	.hasher = bare_shunt_hasher,
+	.entry = bare_shunt_entry,
+	.nr_slots = elemsof(bare_shunt_slots),
+	.slots = bare_shunt_slots,
+};
 
 #ifdef IPSEC_CONNECTION_LIMIT
 static int num_ipsec_eroute = 0;
@@ -161,6 +243,28 @@ static void dbg_bare_shunt(const char *op, const struct bare_shunt *bs)
 	}
 }
 
+/* record activity; moves BS to the end of the expiry queue */
+static void touch_bare_shunt(struct bare_shunt *bs)
+{
+	bs->count = 0;
+	bs->last_activity = mononow();
+	remove_list_entry(&bs->activity_entry);
+	insert_list_entry(&bare_shunt_activity, &bs->activity_entry);
+}
+
+static void add_bare_shunt_to_db(struct bare_shunt *bs)
+{
+	bs->count = 0;
+	bs->last_activity = mononow();
+	bs->list_entry = list_entry(&bare_shunt_info, bs);
+	insert_list_entry(&bare_shunts, &bs->list_entry);
+	bs->activity_entry = list_entry(&bare_shunt_info, bs);
+	insert_list_entry(&bare_shunt_activity, &bs->activity_entry);
+	add_hash_table_entry(&bare_shunt_table, bs);
+	nr_bare_shunts++;
+	dbg_bare_shunt("add", bs);
+}
+
 /*
  * Note: "why" must be in stable storage (not auto, not heap)
  * because we use it indefinitely without copying or pfreeing.
@@ -171,11 +275,11 @@ void add_bare_shunt(const ip_subnet *our_client, const ip_subnet *peer_client,
 		    const char *why)
 {
 	/* report any duplication; this should NOT happen */
-	struct bare_shunt **bspp = bare_shunt_ptr(our_client, peer_client, transport_proto);
+	struct bare_shunt *old = bare_shunt_ptr(our_client, peer_client, transport_proto);
 
-	if (bspp != NULL) {
-		/* maybe: passert(bsp == NULL); */
-		log_bare_shunt(RC_LOG, "CONFLICTING existing", *bspp);
+	if (old != NULL) {
+		/* maybe: passert(old == NULL); */
+		log_bare_shunt(RC_LOG, "CONFLICTING existing", old);
 	}
 
 	struct bare_shunt *bs = alloc_thing(struct bare_shunt,
@@ -189,15 +293,10 @@ void add_bare_shunt(const ip_subnet *our_client, const ip_subnet *peer_client,
 	bs->policy_prio = BOTTOM_PRIO;
 
 	bs->said = said3(&subnet_type(our_client)->any_address, htonl(shunt_spi), &ip_protocol_internal);
-	bs->count = 0;
-	bs->last_activity = mononow();
-
-	bs->next = bare_shunts;
-	bare_shunts = bs;
-	dbg_bare_shunt("add", bs);
+	add_bare_shunt_to_db(bs);
 
 	/* report duplication; this should NOT happen */
-	if (bspp != NULL) {
+	if (old != NULL) {
 		log_bare_shunt(RC_LOG, "CONFLICTING      new", bs);
 	}
 }
@@ -227,11 +326,11 @@ void record_and_initiate_opportunistic(const ip_selector *our_client,
 	 * kernel and we want to keep track of it inside pluto.
 	 */
 
-	/*const*/ struct bare_shunt **bspp = bare_shunt_ptr(our_client, peer_client,
-							    transport_proto);
-	if (bspp != NULL &&
-	    (*bspp)->said.proto == &ip_protocol_internal &&
-	    (*bspp)->said.spi == htonl(SPI_HOLD)) {
+	const struct bare_shunt *bs = bare_shunt_ptr(our_client, peer_client,
+						     transport_proto);
+	if (bs != NULL &&
+	    bs->said.proto == &ip_protocol_internal &&
+	    bs->said.spi == htonl(SPI_HOLD)) {
 		log_global(RC_LOG_SERIOUS, null_fd, "existing bare shunt found - refusing to add a duplicate");
 		/* should we continue with initiate_ondemand() ? */
 	} else {
@@ -393,6 +492,15 @@ static void jam_clean_xauth_username(struct lswlog *buf, const char *src)
 	}
 }
 
+/* an RSA key issued by a CA trusted by .that.ca (ARG) */
+static bool peer_ca_pubkey(struct pubkey *key, void *arg)
+{
+	const chunk_t *that_ca = arg;
+	int pathlen;	/* value ignored */
+	return key->type == &pubkey_type_rsa &&
+		trusted_ca_nss(key->issuer, *that_ca, &pathlen);
+}
+
 /*
  * form the command string
  *
@@ -490,15 +598,11 @@ static void jam_common_shell_out(jambuf_t *buf, const struct connection *c,
 	jam(buf, "PLUTO_PEER_PROTOCOL='%u' ", sr->that.protocol);
 
 	jam(buf, "PLUTO_PEER_CA='");
-	for (struct pubkey_list *p = pluto_pubkeys; p != NULL; p = p->next) {
-		struct pubkey *key = p->key;
-		int pathlen;	/* value ignored */
-		if (key->type == &pubkey_type_rsa &&
-		    same_id(&sr->that.id, &key->id) &&
-		    trusted_ca_nss(key->issuer, sr->that.ca, &pathlen)) {
-			jam_dn_or_null(buf, key->issuer, "", jam_meta_escaped_bytes);
-			break;
-		}
+	chunk_t that_ca = sr->that.ca;
+	const struct pubkey *key = find_pubkey_by_id(&sr->that.id,
+						     peer_ca_pubkey, &that_ca);
+	if (key != NULL) {
+		jam_dn_or_null(buf, key->issuer, "", jam_meta_escaped_bytes);
 	}
 	jam(buf, "' ");
 
@@ -624,6 +728,17 @@ bool fmt_common_shell_out(char *buf, size_t blen, const struct connection *c,
 	return jambuf_ok(&jambuf);
 }
 
+/*
+ * The result of these is only logged, so they are left to run in the
+ * background; the others decide what pluto does next (for instance,
+ * a failed "route" is unwound) so pluto waits for them.
+ */
+
+static bool updown_verb_runs_in_background(const char *verb)
+{
+	return streq(verb, "up") || streq(verb, "down");
+}
+
 bool do_command(const struct connection *c,
 		const struct spd_route *sr,
 		const char *verb,
@@ -668,6 +783,27 @@ bool do_command(const struct connection *c,
 
 	dbg("command executing %s%s", verb, verb_suffix);
 
+	if (pluto_updown_helper != NULL) {
+		char common_shell_out_str[2048];
+		if (!fmt_common_shell_out(common_shell_out_str,
+					  sizeof(common_shell_out_str),
+					  c, sr, st)) {
+			loglog(RC_LOG_SERIOUS, "%s%s command too long!", verb,
+			       verb_suffix);
+			return FALSE;
+		}
+		/* after anything queued before the helper was running */
+		flush_updown_hooks(c->serialno);
+		bool ok;
+		if (updown_helper_command(verb, verb_suffix, sr->this.updown,
+					  common_shell_out_str,
+					  !updown_verb_runs_in_background(verb),
+					  &ok)) {
+			return ok;
+		}
+		/* no helper; run the script */
+	}
+
 	if (kernel_ops->docommand == NULL) {
 		dbg("no do_command for method %s", kernel_ops->kern_name);
 	} else {
@@ -676,7 +812,10 @@ bool do_command(const struct connection *c,
 	return TRUE;
 }
 
-bool invoke_command(const char *verb, const char *verb_suffix, const char *cmd)
+static bool popen_command(const char *verb, const char *verb_suffix, const char *cmd);
+
+bool invoke_command(const struct connection *c, struct state *st,
+		    const char *verb, const char *verb_suffix, const char *cmd)
 {
 #	define CHUNK_WIDTH	80	/* units for cmd logging */
 	if (DBGP(DBG_BASE)) {
@@ -693,7 +832,23 @@ bool invoke_command(const char *verb, const char *verb_suffix, const char *cmd)
 	}
 #	undef CHUNK_WIDTH
 
+	if (updown_verb_runs_in_background(verb)) {
+		queue_updown_hook(c->serialno,
+				  st == NULL ? SOS_NOBODY : st->st_serialno,
+				  verb, verb_suffix, cmd);
+		return TRUE;
+	}
+
+	/* run after anything already queued for this connection */
+	flush_updown_hooks(c->serialno);
+	monotime_t start = mononow();
+	bool ok = popen_command(verb, verb_suffix, cmd);
+	add_updown_latency(verb, start, ok);
+	return ok;
+}
 
+static bool popen_command(const char *verb, const char *verb_suffix, const char *cmd)
+{
 	{
 		/*
 		 * invoke the script, catching stderr and stdout
@@ -1116,52 +1271,46 @@ void set_text_said(char *text_said, const ip_address *dst,
 	jam_said(&jam, &said);
 }
 
-/* find an entry in the bare_shunt table.
- * Trick: return a pointer to the pointer to the entry;
- * this allows the entry to be deleted.
- */
-struct bare_shunt **bare_shunt_ptr(const ip_selector *our_client,
-				   const ip_selector *peer_client,
-				   int transport_proto)
+/* find an entry in the bare_shunt table */
+struct bare_shunt *bare_shunt_ptr(const ip_selector *our_client,
+				  const ip_selector *peer_client,
+				  int transport_proto)
 
 {
-	struct bare_shunt *p, **pp;
+	hash_t hash = bare_shunt_key_hasher(our_client, peer_client, transport_proto);
+	struct list_head *bucket = hash_table_bucket(&bare_shunt_table, hash);
+	struct bare_shunt *p;
 
-	for (pp = &bare_shunts; (p = *pp) != NULL; pp = &p->next) {
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, p) {
 		if (transport_proto == p->transport_proto &&
 		    selector_eq(our_client, &p->our_client) &&
 		    selector_eq(peer_client, &p->peer_client)) {
-			return pp;
+			return p;
 		}
 	}
 	return NULL;
 }
 
-/* free a bare_shunt entry, given a pointer to the pointer */
-static void free_bare_shunt(struct bare_shunt **pp)
+/* free a bare_shunt entry; *BSP is set to NULL */
+static void free_bare_shunt(struct bare_shunt **bsp)
 {
-	struct bare_shunt *p;
-
-	passert(pp != NULL);
+	passert(bsp != NULL && *bsp != NULL);
 
-	p = *pp;
+	struct bare_shunt *p = *bsp;
+	*bsp = NULL;
 
-	*pp = p->next;
 	dbg_bare_shunt("delete", p);
+	del_hash_table_entry(&bare_shunt_table, p);
+	remove_list_entry(&p->list_entry);
+	remove_list_entry(&p->activity_entry);
+	nr_bare_shunts--;
 	pfreeany(p->from_cn);
 	pfree(p);
 }
 
 unsigned shunt_count(void)
 {
-	unsigned i = 0;
-
-	for (const struct bare_shunt *bs = bare_shunts; bs != NULL; bs = bs->next)
-	{
-		i++;
-	}
-
-	return i;
+	return nr_bare_shunts;
 }
 
 void show_shunt_status(struct show *s)
@@ -1170,7 +1319,8 @@ void show_shunt_status(struct show *s)
 	show_comment(s, "Bare Shunt list:");
 	show_separator(s);
 
-	for (const struct bare_shunt *bs = bare_shunts; bs != NULL; bs = bs->next) {
+	const struct bare_shunt *bs;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(&bare_shunts, bs) {
 		/* Print interesting fields.  Ignore count and last_active. */
 		selector_buf ourb;
 		selector_buf peerb;
@@ -1272,13 +1422,55 @@ bool raw_eroute(const ip_address *this_host,
  * just routed.  We only consider "narrow" holds: ones for a single
  * address to single address.
  */
+static void clear_narrow_hold(const ip_selector *our_client,
+			      const ip_selector *peer_client,
+			      int transport_proto)
+{
+	struct bare_shunt *p = bare_shunt_ptr(our_client, peer_client, transport_proto);
+	if (p == NULL || p->said.spi != htonl(SPI_HOLD)) {
+		/* gone, or no longer a hold */
+		return;
+	}
+	if (!delete_bare_shunt(&p->our_client.addr, &p->peer_client.addr,
+			       transport_proto, SPI_HOLD,
+			       "removing clashing narrow hold")) {
+		/* ??? we could not delete a bare shunt */
+		log_bare_shunt(RC_LOG, "failed to delete", p);
+	} else if (bare_shunt_ptr(our_client, peer_client, transport_proto) == p) {
+		/*
+		 * ??? We deleted the wrong bare shunt!
+		 * This happened because more than one entry
+		 * matched and we happened to delete a
+		 * different one.
+		 * Log it!
+		 */
+		log_bare_shunt(RC_LOG, "UNEXPECTEDLY SURVIVING", p);
+	}
+}
+
 static void clear_narrow_holds(const ip_selector *our_client,
 			       const ip_selector *peer_client,
 			       int transport_proto)
 {
-	struct bare_shunt *p, **pp;
+	/* host-to-host: at most one hold can be within it */
+	if (subnetishost(our_client) && subnetishost(peer_client)) {
+		clear_narrow_hold(our_client, peer_client, transport_proto);
+		return;
+	}
 
-	for (pp = &bare_shunts; (p = *pp) != NULL; ) {
+	/*
+	 * Find the holds that are within {local,remote}, then delete
+	 * them.  Deleting one may delete another, so only their keys
+	 * are saved.
+	 */
+	struct narrow_hold {
+		ip_selector our_client;
+		ip_selector peer_client;
+	} *holds = NULL;
+	unsigned nr_holds = 0;
+
+	const struct bare_shunt *p;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&bare_shunts, p) {
 		/*
 		 * is p->{local,remote} within {local,remote}.
 		 */
@@ -1286,33 +1478,18 @@ static void clear_narrow_holds(const ip_selector *our_client,
 		    transport_proto == p->transport_proto &&
 		    selector_in_selector(&p->our_client, our_client) &&
 		    selector_in_selector(&p->peer_client, peer_client)) {
-			if (!delete_bare_shunt(&p->our_client.addr, &p->peer_client.addr,
-					       transport_proto, SPI_HOLD,
-					       "removing clashing narrow hold")) {
-				/* ??? we could not delete a bare shunt */
-				log_bare_shunt(RC_LOG, "failed to delete", p);
-				break;	/* unlikely to succeed a second time */
-			} else if (*pp == p) {
-				/*
-				 * ??? We deleted the wrong bare shunt!
-				 * This happened because more than one entry
-				 * matched and we happened to delete a
-				 * different one.
-				 * Log it!  And keep deleting.
-				 */
-				log_bare_shunt(RC_LOG, "UNEXPECTEDLY SURVIVING", p);
-				pp = &bare_shunts;	/* just in case, start over */
-			}
-			/*
-			 * ??? if we were sure that there could only be one
-			 * matching entry, we could break out of the FOR.
-			 * For an unknown reason this is not always the case,
-			 * so we will continue the loop, with pp unchanged.
-			 */
-		} else {
-			pp = &p->next;
+			realloc_things(holds, nr_holds, nr_holds + 1, "narrow holds");
+			holds[nr_holds].our_client = p->our_client;
+			holds[nr_holds].peer_client = p->peer_client;
+			nr_holds++;
 		}
 	}
+
+	for (unsigned i = 0; i < nr_holds; i++) {
+		clear_narrow_hold(&holds[i].our_client, &holds[i].peer_client,
+				  transport_proto);
+	}
+	pfreeany(holds);
 }
 
 /*
@@ -1353,12 +1530,14 @@ static bool fiddle_bare_shunt(const ip_address *src, const ip_address *dst,
 	dbg("%s specific host-to-host bare shunt", repl ? "replacing" : "removing");
 	if (kernel_ops->type == USE_NETKEY && strstr(why, "IGNORE_ON_XFRM:") != NULL) {
 		dbg("skipping raw_eroute because IGNORE_ON_XFRM");
-		struct bare_shunt **bs_pp = bare_shunt_ptr(
+		struct bare_shunt *bs = bare_shunt_ptr(
 			&this_client,
 			&that_client,
 			transport_proto);
 
-		free_bare_shunt(bs_pp);
+		if (bs != NULL) {
+			free_bare_shunt(&bs);
+		}
 		libreswan_log("raw_eroute() to op='%s' with transport_proto='%d' kernel shunt skipped - deleting from pluto shunt table",
 			repl ? "replace" : "delete",
 			transport_proto);
@@ -1376,19 +1555,19 @@ static bool fiddle_bare_shunt(const ip_address *src, const ip_address *dst,
 
 			op, why, NULL))
 	{
-		struct bare_shunt **bs_pp = bare_shunt_ptr(
+		struct bare_shunt *bs = bare_shunt_ptr(
 			&this_client,
 			&that_client,
 			transport_proto);
 
 		dbg("raw_eroute with op='%s' for transport_proto='%d' kernel shunt succeeded, bare shunt lookup %s",
 		    repl ? "replace" : "delete", transport_proto,
-		    (bs_pp == NULL) ? "failed" : "succeeded");
+		    (bs == NULL) ? "failed" : "succeeded");
 
 		/* we can have proto mismatching acquires with netkey - this is a bad workaround */
 		/* ??? what is the nature of those mismatching acquires? */
-		/* passert(bs_pp != NULL); */
-		if (bs_pp == NULL) {
+		/* passert(bs != NULL); */
+		if (bs == NULL) {
 			ipstr_buf srcb, dstb;
 
 			libreswan_log("can't find expected bare shunt to %s: %s->%s transport_proto='%d'",
@@ -1403,26 +1582,25 @@ static bool fiddle_bare_shunt(const ip_address *src, const ip_address *dst,
 			 * change over to new bare eroute
 			 * ours, peers, transport_proto are the same.
 			 */
-			struct bare_shunt *bs = *bs_pp;
-
 			bs->why = why;
 			bs->policy_prio = policy_prio;
 			bs->said = said3(&null_host, htonl(new_shunt_spi), &ip_protocol_internal);
-			bs->count = 0;
-			bs->last_activity = mononow();
+			touch_bare_shunt(bs);
 			dbg_bare_shunt("change", bs);
 		} else {
 			/* delete pluto bare shunt */
-			free_bare_shunt(bs_pp);
+			free_bare_shunt(&bs);
 		}
 		return TRUE;
 	} else {
-		struct bare_shunt **bs_pp = bare_shunt_ptr(
+		struct bare_shunt *bs = bare_shunt_ptr(
 			&this_client,
 			&that_client,
 			transport_proto);
 
-		free_bare_shunt(bs_pp);
+		if (bs != NULL) {
+			free_bare_shunt(&bs);
+		}
 		libreswan_log("raw_eroute() to op='%s' with transport_proto='%d' kernel shunt failed - deleting from pluto shunt table",
 			repl ? "replace" : "delete",
 			transport_proto);
@@ -1547,7 +1725,7 @@ bool assign_holdpass(const struct connection *c,
 		 * Although %hold or %pass is appropriately broad, it will
 		 * no longer be bare so we must ditch it from the bare table
 		 */
-		struct bare_shunt **old = bare_shunt_ptr(&sr->this.client, &sr->that.client, sr->this.protocol);
+		struct bare_shunt *old = bare_shunt_ptr(&sr->this.client, &sr->that.client, sr->this.protocol);
 
 		if (old == NULL) {
 			/* ??? should this happen?  It does. */
@@ -1555,7 +1733,7 @@ bool assign_holdpass(const struct connection *c,
 		} else {
 			/* ??? should this happen? */
 			dbg("assign_holdpass() removing bare shunt");
-			free_bare_shunt(old);
+			free_bare_shunt(&old);
 		}
 	} else {
 		dbg("assign_holdpass() need broad(er) shunt");
@@ -1661,6 +1839,35 @@ bool del_spi(ipsec_spi_t spi, const struct ip_protocol *proto,
 	return kernel_ops->del_sa(&sa);
 }
 
+/*
+ * Like del_spi() but, when the kernel allows, don't wait for the
+ * result; a failure is logged when it arrives.
+ */
+static void queue_del_spi(ipsec_spi_t spi, const struct ip_protocol *proto,
+			  const ip_address *src, const ip_address *dest)
+{
+	if (kernel_ops->queue_del_sa == NULL) {
+		(void) del_spi(spi, proto, src, dest);
+		return;
+	}
+
+	char text_said[SATOT_BUF];
+
+	set_text_said(text_said, dest, spi, proto);
+
+	dbg("queue delete %s", text_said);
+
+	struct kernel_sa sa = {
+		.spi = spi,
+		.proto = proto,
+		.src.address = src,
+		.dst.address = dest,
+		.text_said = text_said,
+	};
+
+	kernel_ops->queue_del_sa(&sa);
+}
+
 static void setup_esp_nic_offload(struct kernel_sa *sa, struct connection *c,
 		bool *nic_offload_fallback)
 {
@@ -2375,16 +2582,16 @@ fail:
 		/* undo the done SPIs */
 		while (said_next-- != said) {
 			if (said_next->proto != 0) {
-				(void) del_spi(said_next->spi,
-					said_next->proto,
-					&src, said_next->dst.address);
+				queue_del_spi(said_next->spi,
+					      said_next->proto,
+					      &src, said_next->dst.address);
 			}
 		}
 		return FALSE;
 	}
 }
 
-static bool teardown_half_ipsec_sa(struct state *st, bool inbound)
+static void teardown_half_ipsec_sa(struct state *st, bool inbound)
 {
 	/*
 	 * We need to delete AH, ESP, and IP in IP SPIs.
@@ -2471,11 +2678,10 @@ static bool teardown_half_ipsec_sa(struct state *st, bool inbound)
 		protos[i].proto = &ip_protocol_esp;
 		i++;
 	} else {
-		return TRUE;
+		return;
 	}
 	protos[i].proto = 0;
 
-	bool result = TRUE;
 	for (i = 0; protos[i].proto; i++) {
 		const struct ip_protocol *proto = protos[i].proto;
 		ipsec_spi_t spi;
@@ -2491,13 +2697,11 @@ static bool teardown_half_ipsec_sa(struct state *st, bool inbound)
 			dst = &c->spd.that.host_addr;
 		}
 
-		result &= del_spi(spi, proto, src, dst);
+		queue_del_spi(spi, proto, src, dst);
 	}
 
 	if (redirected)
 		c->spd.that.host_addr = tmp_ip;
-
-	return result;
 }
 
 static event_callback_routine kernel_process_msg_cb;
@@ -2537,6 +2741,7 @@ const struct kernel_ops *kernel_ops =
 	;
 
 deltatime_t bare_shunt_interval = DELTATIME_INIT(SHUNT_SCAN_INTERVAL);
+deltatime_t pluto_sa_counter_cache = DELTATIME_INIT(SA_COUNTER_CACHE_DEFAULT);
 
 static void kernel_scan_shunts(struct fd *unused_whackfd UNUSED)
 {
@@ -2580,6 +2785,8 @@ void init_kernel(void)
 		exit_pluto(PLUTO_EXIT_KERNEL_FAIL);
 	}
 
+	init_hash_table(&bare_shunt_table);
+
 	if (kernel_ops->init != NULL)
 		kernel_ops->init();
 
@@ -2798,7 +3005,7 @@ bool route_and_eroute(struct connection *c,
 	/* we should look for dest port as well? */
 	/* ports are now switched to the ones in this.client / that.client ??????? */
 	/* but port set is sr->this.port and sr.that.port ! */
-	struct bare_shunt **bspp = (ero == NULL) ?
+	struct bare_shunt *bs = (ero == NULL) ?
 		bare_shunt_ptr(&sr->this.client, &sr->that.client, sr->this.protocol) :
 		NULL;
 
@@ -2810,9 +3017,9 @@ bool route_and_eroute(struct connection *c,
 	bool new_eroute = FALSE;
 #endif
 
-	passert(bspp == NULL || ero == NULL);   /* only one non-NULL */
+	passert(bs == NULL || ero == NULL);   /* only one non-NULL */
 
-	if (bspp != NULL || ero != NULL) {
+	if (bs != NULL || ero != NULL) {
 		dbg("we are replacing an eroute");
 		/* if no state provided, then install a shunt for later */
 		if (st == NULL) {
@@ -2825,7 +3032,7 @@ bool route_and_eroute(struct connection *c,
 						"replace");
 		}
 
-		/* remember to free bspp if we make it out of here alive */
+		/* remember to free bs if we make it out of here alive */
 	} else {
 		/* we're adding an eroute */
 #ifdef IPSEC_CONNECTION_LIMIT
@@ -2931,8 +3138,8 @@ bool route_and_eroute(struct connection *c,
 	if (route_installed) {
 		/* Success! */
 
-		if (bspp != NULL) {
-			free_bare_shunt(bspp);
+		if (bs != NULL) {
+			free_bare_shunt(&bs);
 		} else if (ero != NULL && ero != c) {
 			/* check if ero is an ancestor of c. */
 			struct connection *ero2;
@@ -2994,7 +3201,7 @@ bool route_and_eroute(struct connection *c,
 			 * Since there is nothing much to be done if
 			 * the restoration fails, ignore success or failure.
 			 */
-			if (bspp != NULL) {
+			if (bs != NULL) {
 				/*
 				 * Restore old bare_shunt.
 				 * I don't think that this case is very likely.
@@ -3002,8 +3209,6 @@ bool route_and_eroute(struct connection *c,
 				 * assigned to a connection before we've
 				 * gotten this far.
 				 */
-				struct bare_shunt *bs = *bspp;
-
 				if (!raw_eroute(&bs->said.dst,        /* should be useless */
 						&bs->our_client,
 						&bs->said.dst,        /* should be useless */
@@ -3289,9 +3494,9 @@ void delete_ipsec_sa(struct state *st)
 					}
 				}
 			}
-			(void) teardown_half_ipsec_sa(st, FALSE);
+			teardown_half_ipsec_sa(st, FALSE);
 		}
-		(void) teardown_half_ipsec_sa(st, TRUE);
+		teardown_half_ipsec_sa(st, TRUE);
 
 		break;
 	default:
@@ -3314,11 +3519,13 @@ bool was_eroute_idle(struct state *st, deltatime_t since_when)
  *
  * Note: this mutates *st.
  */
-bool get_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */)
+static bool sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */,
+		    bool (*get_sa)(const struct kernel_sa *sa, uint64_t *bytes,
+				   uint64_t *add_time))
 {
 	struct connection *const c = st->st_connection;
 
-	if (kernel_ops->get_sa == NULL || (!st->st_esp.present && !st->st_ah.present)) {
+	if (get_sa == NULL || (!st->st_esp.present && !st->st_ah.present)) {
 		return FALSE;
 	}
 
@@ -3382,8 +3589,11 @@ bool get_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */)
 	uint64_t bytes;
 	uint64_t add_time;
 
-	if (!kernel_ops->get_sa(&sa, &bytes, &add_time))
+	if (!get_sa(&sa, &bytes, &add_time)) {
+		if (redirected)
+			c->spd.that.host_addr = tmp_ip;
 		return FALSE;
+	}
 
 	p2->add_time = add_time;
 
@@ -3413,6 +3623,20 @@ bool get_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */)
 	return TRUE;
 }
 
+bool get_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */)
+{
+	return sa_info(st, inbound, ago, kernel_ops->get_sa);
+}
+
+/*
+ * Same, but only when the kernel has cheap (cached) counters to hand;
+ * never queries the kernel.
+ */
+bool get_cached_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */)
+{
+	return sa_info(st, inbound, ago, kernel_ops->get_cached_sa);
+}
+
 bool orphan_holdpass(const struct connection *c, struct spd_route *sr,
 		int transport_proto, ipsec_spi_t failure_shunt)
 {
@@ -3460,10 +3684,10 @@ bool orphan_holdpass(const struct connection *c, struct spd_route *sr,
 		/* are we replacing a bare shunt ? */
 		setportof(htons(sr->this.port), &sr->this.client.addr);
 		setportof(htons(sr->that.port), &sr->that.client.addr);
-		struct bare_shunt **old = bare_shunt_ptr(&sr->this.client, &sr->that.client, sr->this.protocol);
+		struct bare_shunt *old = bare_shunt_ptr(&sr->this.client, &sr->that.client, sr->this.protocol);
 
 		if (old != NULL) {
-			free_bare_shunt(old);
+			free_bare_shunt(&old);
 		}
 	}
 
@@ -3480,15 +3704,11 @@ bool orphan_holdpass(const struct connection *c, struct spd_route *sr,
 		bs->said = said3(&subnet_type(&sr->this.client)->any_address,
 				 htonl(negotiation_shunt), &ip_protocol_internal);
 
-		bs->count = 0;
-		bs->last_activity = mononow();
 		if (strstr(c->name, "/32") != NULL || strstr(c->name, "/128") != NULL) {
 			bs->from_cn = clone_str(c->name, "conn name in bare shunt");
 		}
 
-		bs->next = bare_shunts;
-		bare_shunts = bs;
-		dbg_bare_shunt("add", bs);
+		add_bare_shunt_to_db(bs);
 
 		/* update kernel policy if needed */
 		/* This really causes the name to remain "oe-failing", we should be able to update only only the name of the shunt */
@@ -3510,36 +3730,61 @@ bool orphan_holdpass(const struct connection *c, struct spd_route *sr,
 	return TRUE;
 }
 
+/* the least recently active bare shunt, or NULL */
+static struct bare_shunt *oldest_bare_shunt(void)
+{
+	struct bare_shunt *bsp;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&bare_shunt_activity, bsp) {
+		return bsp;
+	}
+	return NULL;
+}
+
 /* XXX move to proper kernel_ops in kernel_netlink */
 void expire_bare_shunts(void)
 {
 	dbg("checking for aged bare shunts from shunt table to expire");
-	for (struct bare_shunt **bspp = &bare_shunts; *bspp != NULL; ) {
-		struct bare_shunt *bsp = *bspp;
-		time_t age = deltasecs(monotimediff(mononow(), bsp->last_activity));
+	monotime_t now = mononow();
+	for (;;) {
+		/*
+		 * Least recently active first; stop at the first
+		 * keeper.  Since deleting can change the list, start
+		 * again from the front each time.
+		 */
+		struct bare_shunt *bsp = oldest_bare_shunt();
+		if (bsp == NULL) {
+			break;
+		}
+		time_t age = deltasecs(monotimediff(now, bsp->last_activity));
+		if (age <= deltasecs(pluto_shunt_lifetime)) {
+			dbg_bare_shunt("keeping recent", bsp);
+			break;
+		}
+
 		struct connection *c = NULL;
 
-		if (age > deltasecs(pluto_shunt_lifetime)) {
-			dbg_bare_shunt("expiring old", bsp);
-			if (bsp->from_cn != NULL) {
-				c = conn_by_name(bsp->from_cn, FALSE);
-				if (c != NULL) {
-					if (!shunt_eroute(c, &c->spd, RT_ROUTED_PROSPECTIVE, ERO_ADD, "add")) {
-						libreswan_log("trap shunt install failed ");
-					}
+		dbg_bare_shunt("expiring old", bsp);
+		if (bsp->from_cn != NULL) {
+			c = conn_by_name(bsp->from_cn, FALSE);
+			if (c != NULL) {
+				if (!shunt_eroute(c, &c->spd, RT_ROUTED_PROSPECTIVE, ERO_ADD, "add")) {
+					libreswan_log("trap shunt install failed ");
 				}
 			}
-			if (!delete_bare_shunt(&bsp->our_client.addr, &bsp->peer_client.addr,
-					       bsp->transport_proto,
-					       ntohl(bsp->said.spi),
-					       (bsp->from_cn == NULL ? "expire_bare_shunt" :
-						"IGNORE_ON_XFRM: expire_bare_shunt"))) {
-				    log_global(RC_LOG_SERIOUS, null_fd, "failed to delete bare shunt");
-			}
-			passert(bsp != *bspp);
-		} else {
-			dbg_bare_shunt("keeping recent", bsp);
-			bspp = &bsp->next;
 		}
+		/* BSP is freed by the delete */
+		ip_selector our_client = bsp->our_client;
+		ip_selector peer_client = bsp->peer_client;
+		int transport_proto = bsp->transport_proto;
+		if (!delete_bare_shunt(&bsp->our_client.addr, &bsp->peer_client.addr,
+				       bsp->transport_proto,
+				       ntohl(bsp->said.spi),
+				       (bsp->from_cn == NULL ? "expire_bare_shunt" :
+					"IGNORE_ON_XFRM: expire_bare_shunt"))) {
+			    log_global(RC_LOG_SERIOUS, null_fd, "failed to delete bare shunt");
+		}
+		/* either way, it must be gone */
+		passert(bare_shunt_ptr(&our_client, &peer_client,
+				       transport_proto) == NULL);
 	}
 }
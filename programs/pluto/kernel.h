@@ -238,8 +238,13 @@ struct kernel_ops {
 	bool (*grp_sa)(const struct kernel_sa *sa_outer,
 		       const struct kernel_sa *sa_inner);
 	bool (*del_sa)(const struct kernel_sa *sa);
+	/* like del_sa() but a failure is only logged, later; optional */
+	void (*queue_del_sa)(const struct kernel_sa *sa);
 	bool (*get_sa)(const struct kernel_sa *sa, uint64_t *bytes,
 		       uint64_t *add_time);
+	/* like get_sa() but only from fresh cached counters; optional */
+	bool (*get_cached_sa)(const struct kernel_sa *sa, uint64_t *bytes,
+			      uint64_t *add_time);
 	ipsec_spi_t (*get_spi)(const ip_address *src,
 			       const ip_address *dst,
 			       const struct ip_protocol *proto,
@@ -293,7 +298,8 @@ extern bool fmt_common_shell_out(char *buf, size_t blen,
 extern bool do_command(const struct connection *c, const struct spd_route *sr,
 		       const char *verb, struct state *st);
 
-extern bool invoke_command(const char *verb, const char *verb_suffix,
+extern bool invoke_command(const struct connection *c, struct state *st,
+			   const char *verb, const char *verb_suffix,
 			   const char *cmd);
 
 /* information from /proc/net/ipsec_eroute */
@@ -332,9 +338,9 @@ struct eroute_info {
 extern void show_shunt_status(struct show *);
 extern unsigned shunt_count(void);
 
-struct bare_shunt **bare_shunt_ptr(const ip_subnet *ours,
-				   const ip_subnet *peers,
-				   int transport_proto);
+struct bare_shunt *bare_shunt_ptr(const ip_subnet *ours,
+				  const ip_subnet *peers,
+				  int transport_proto);
 
 /* A netlink header defines EM_MAXRELSPIS, the max number of SAs in a group.
  * Is there a PF_KEY equivalent?
@@ -400,6 +406,7 @@ extern bool route_and_eroute(struct connection *c,
 
 extern bool was_eroute_idle(struct state *st, deltatime_t idle_max);
 extern bool get_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */);
+extern bool get_cached_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */);
 extern bool migrate_ipsec_sa(struct state *st);
 extern bool del_spi(ipsec_spi_t spi,
 		    const struct ip_protocol *proto,
@@ -461,6 +468,7 @@ extern bool raw_eroute(const ip_address *this_host,
 		       const char *policy_label);
 
 extern deltatime_t bare_shunt_interval;
+extern deltatime_t pluto_sa_counter_cache;	/* how stale get_sa() counters may be */
 extern void set_text_said(char *text_said, const ip_address *dst,
 			  ipsec_spi_t spi, const struct ip_protocol *sa_proto);
 #define _KERNEL_H_
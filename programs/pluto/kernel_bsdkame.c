@@ -158,7 +158,7 @@ static bool bsdkame_do_command(const struct connection *c, const struct spd_rout
 		return FALSE;
 	}
 
-	return invoke_command(verb, verb_suffix, cmd);
+	return invoke_command(c, st, verb, verb_suffix, cmd);
 }
 
 static void bsdkame_algregister(int satype, int supp_exttype,
@@ -54,6 +54,7 @@
 #endif
 
 #include <unistd.h>
+#include <poll.h>
 #include <sys/stat.h>
 
 #include "kernel_xfrm_kameipsec.h"
@@ -85,6 +86,7 @@
 #include "log.h"
 #include "whack.h"	/* for RC_LOG_SERIOUS */
 #include "kernel_alg.h"
+#include "timer.h"
 
 #include "ike_alg.h"
 #include "ike_alg_integ.h"
@@ -95,6 +97,7 @@
 #include "iface.h"
 #include "ip_selector.h"
 #include "ip_encap.h"
+#include "hash_table.h"
 
 /* required for Linux 2.6.26 kernel and later */
 #ifndef XFRM_STATE_AF_UNSPEC
@@ -102,6 +105,7 @@
 #endif
 
 static int nl_send_fd = NULL_FD; /* to send to NETLINK_XFRM */
+static int nl_batch_fd = NULL_FD; /* to send batched requests to NETLINK_XFRM */
 static int nl_xfrm_fd = NULL_FD; /* listen to NETLINK_XFRM broadcast */
 static int nl_route_fd = NULL_FD; /* listen to NETLINK_ROUTE broadcast */
 
@@ -235,6 +239,9 @@ static void init_netlink_route_fd(void)
 }
 
 
+static void init_netlink_batch_fd(void);
+static void init_sa_counters_cache(void);
+
 /*
  * init_netlink - Initialize the netlink inferface.  Opens the sockets and
  * then binds to the broadcast socket.
@@ -251,6 +258,9 @@ static void init_netlink(void)
 	if (fcntl(nl_send_fd, F_SETFD, FD_CLOEXEC) != 0)
 		EXIT_LOG_ERRNO(errno, "fcntl(FD_CLOEXEC) in init_netlink()");
 
+	init_netlink_batch_fd();
+	init_sa_counters_cache();
+
 	nl_xfrm_fd = safe_socket(AF_NETLINK, SOCK_DGRAM, NETLINK_XFRM);
 
 	if (nl_xfrm_fd < 0)
@@ -322,6 +332,320 @@ struct nlm_resp {
 	} u;
 };
 
+/*
+ * Batched, asynchronous, netlink requests.
+ *
+ * Requests where the caller only logs a failure (deleting an SA or
+ * inbound policy during teardown) are appended to a batch and then
+ * sent, many to a datagram, using a single sendmsg() on NL_BATCH_FD.
+ * The batch is sent when it fills, at the end of the current
+ * event-loop pass, or before any synchronous request.
+ *
+ * Adding SAs and policies stays synchronous: install_ipsec_sa()
+ * needs each result before the next step, and to unwind a failure.
+ *
+ * Since the kernel processes each netlink request during sendmsg(),
+ * flushing the batch before a synchronous request means the kernel
+ * sees the requests in the order pluto made them.
+ *
+ * The kernel's ACKs (NLMSG_ERROR) are read by an event handler and
+ * matched, by sequence number, with the pending request so that any
+ * error can be logged.
+ */
+
+#define NETLINK_BATCH_SIZE (64 * 1024)
+#define NETLINK_BATCH_SOCKBUF (4 * 1024 * 1024)
+
+struct netlink_pending {
+	struct netlink_pending *next;
+	uint32_t seq;
+	uint16_t type;
+	int ok_error;		/* errno to ignore, or 0 */
+	const char *description;
+	char text_said[SATOT_BUF];
+};
+
+static struct {
+	uint32_t seq;
+	size_t len;
+	uint8_t buf[NETLINK_BATCH_SIZE];
+	/* queued, or sent and waiting for the ACK; oldest first */
+	struct netlink_pending *pending;
+	struct netlink_pending **pending_tail;
+	struct netlink_pending *unsent;	/* first queued but unsent */
+	unsigned nr_messages;		/* in BUF */
+} netlink_batch = {
+	.pending_tail = &netlink_batch.pending,
+};
+
+static void complete_netlink_pending(struct netlink_pending *p, int error)
+{
+	if (error != 0 && error != p->ok_error) {
+		loglog(RC_LOG_SERIOUS,
+		       "ERROR: netlink response for %s %s %s included errno %d: %s",
+		       sparse_val_show(xfrm_type_names, p->type),
+		       p->description, p->text_said,
+		       error, strerror(error));
+	}
+	pfree(p);
+}
+
+static void flush_netlink_batch(void)
+{
+	if (netlink_batch.nr_messages == 0) {
+		return;
+	}
+
+	dbg("netlink: sending batch of %u messages (%zu bytes)",
+	    netlink_batch.nr_messages, netlink_batch.len);
+
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,	/* nl_pid == 0: the kernel */
+	};
+	struct iovec iov = {
+		.iov_base = netlink_batch.buf,
+		.iov_len = netlink_batch.len,
+	};
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+
+	ssize_t r;
+	do {
+		r = sendmsg(nl_batch_fd, &msg, 0);
+	} while (r < 0 && errno == EINTR);
+
+	int error = (r < 0 ? errno :
+		     (size_t)r != netlink_batch.len ? EMSGSIZE :
+		     0);
+	if (error != 0) {
+		LOG_ERRNO(error, "netlink sendmsg() of batch of %u messages failed",
+			  netlink_batch.nr_messages);
+		/* none of the unsent messages will be ACKed */
+		struct netlink_pending **pp = &netlink_batch.pending;
+		while (*pp != netlink_batch.unsent) {
+			pp = &(*pp)->next;
+		}
+		while (*pp != NULL) {
+			struct netlink_pending *p = *pp;
+			*pp = p->next;
+			complete_netlink_pending(p, error);
+		}
+		netlink_batch.pending_tail = pp;
+	}
+
+	netlink_batch.unsent = NULL;
+	netlink_batch.nr_messages = 0;
+	netlink_batch.len = 0;
+	deschedule_oneshot_timer(EVENT_FLUSH_NETLINK_BATCH);
+}
+
+static void flush_netlink_batch_event(struct fd *unused_whackfd UNUSED)
+{
+	flush_netlink_batch();
+}
+
+/*
+ * Queue HDR; ERROR_OK is an errno value that isn't worth logging.
+ */
+
+static void queue_netlink_msg(struct nlmsghdr *hdr, int ok_error,
+			      const char *description, const char *text_said)
+{
+	size_t len = NLMSG_ALIGN(hdr->nlmsg_len);
+	passert(len <= sizeof(netlink_batch.buf));
+	if (netlink_batch.len + len > sizeof(netlink_batch.buf)) {
+		flush_netlink_batch();
+	}
+
+	hdr->nlmsg_flags |= NLM_F_ACK;
+	hdr->nlmsg_seq = ++netlink_batch.seq;
+	hdr->nlmsg_pid = 0;
+
+	struct netlink_pending *p = alloc_thing(struct netlink_pending, "netlink pending");
+	p->seq = hdr->nlmsg_seq;
+	p->type = hdr->nlmsg_type;
+	p->ok_error = ok_error;
+	p->description = description;
+	jam_str(p->text_said, sizeof(p->text_said), text_said);
+	*netlink_batch.pending_tail = p;
+	netlink_batch.pending_tail = &p->next;
+	if (netlink_batch.unsent == NULL) {
+		netlink_batch.unsent = p;
+	}
+
+	memcpy(netlink_batch.buf + netlink_batch.len, hdr, hdr->nlmsg_len);
+	netlink_batch.len += len;
+	if (netlink_batch.nr_messages++ == 0) {
+		/* send what accumulates during this event-loop pass */
+		schedule_oneshot_timer(EVENT_FLUSH_NETLINK_BATCH, deltatime(0));
+	}
+}
+
+static void process_netlink_batch_ack(const struct nlmsghdr *n)
+{
+	if (n->nlmsg_type != NLMSG_ERROR ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+		dbg("netlink: ignoring %s message in reply to batch",
+		    sparse_val_show(xfrm_type_names, n->nlmsg_type));
+		return;
+	}
+
+	const struct nlmsgerr *e = NLMSG_DATA(n);
+
+	/* ACKs arrive in order so this is normally the first */
+	for (struct netlink_pending **pp = &netlink_batch.pending;
+	     *pp != NULL && *pp != netlink_batch.unsent; pp = &(*pp)->next) {
+		struct netlink_pending *p = *pp;
+		if (p->seq == n->nlmsg_seq) {
+			*pp = p->next;
+			if (*pp == NULL) {
+				netlink_batch.pending_tail = pp;
+			}
+			complete_netlink_pending(p, -e->error);
+			return;
+		}
+	}
+	dbg("netlink: ignoring ACK for unknown batch sequence %u",
+	    n->nlmsg_seq);
+}
+
+/*
+ * Read all available ACKs; returns false when nothing was read.
+ */
+
+static bool read_netlink_batch_acks(void)
+{
+	bool progress = false;
+	for (;;) {
+		struct nlm_resp rsp;
+		struct sockaddr_nl addr;
+		socklen_t alen = sizeof(addr);
+		ssize_t r = recvfrom(nl_batch_fd, &rsp, sizeof(rsp), 0,
+				     (struct sockaddr *)&addr, &alen);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return progress;
+			if (errno == ENOBUFS) {
+				/*
+				 * ACKs were dropped; since they can't
+				 * be matched, forget everything sent.
+				 */
+				libreswan_log("netlink: receive buffer overrun; results of batched requests lost");
+				while (netlink_batch.pending != netlink_batch.unsent) {
+					struct netlink_pending *p = netlink_batch.pending;
+					netlink_batch.pending = p->next;
+					pfree(p);
+				}
+				if (netlink_batch.pending == NULL) {
+					netlink_batch.pending_tail = &netlink_batch.pending;
+				}
+				progress = true;
+				continue;
+			}
+			LOG_ERRNO(errno, "netlink recvfrom() of batch ACKs failed");
+			return progress;
+		}
+		progress = true;
+		if (addr.nl_pid != 0) {
+			/* not from the kernel */
+			continue;
+		}
+		size_t len = r;
+		for (struct nlmsghdr *n = &rsp.n; NLMSG_OK(n, len);
+		     n = NLMSG_NEXT(n, len)) {
+			process_netlink_batch_ack(n);
+		}
+	}
+}
+
+static void netlink_batch_ack_cb(evutil_socket_t fd UNUSED,
+				 const short event UNUSED, void *arg UNUSED)
+{
+	read_netlink_batch_acks();
+}
+
+/*
+ * Send anything queued and then wait (briefly) for the ACKs; for
+ * shutdown.
+ */
+
+static void drain_netlink_batch(void)
+{
+	flush_netlink_batch();
+	while (netlink_batch.pending != NULL) {
+		struct pollfd pfd = {
+			.fd = nl_batch_fd,
+			.events = POLLIN,
+		};
+		if (poll(&pfd, 1, 1000/*ms*/) <= 0 ||
+		    !read_netlink_batch_acks()) {
+			break;
+		}
+	}
+	/* give up on any stragglers */
+	while (netlink_batch.pending != NULL) {
+		struct netlink_pending *p = netlink_batch.pending;
+		netlink_batch.pending = p->next;
+		dbg("netlink: no ACK for %s %s",
+		    p->description, p->text_said);
+		pfree(p);
+	}
+	netlink_batch.pending_tail = &netlink_batch.pending;
+	netlink_batch.unsent = NULL;
+}
+
+static void init_netlink_batch_fd(void)
+{
+	nl_batch_fd = safe_socket(AF_NETLINK, SOCK_DGRAM, NETLINK_XFRM);
+
+	if (nl_batch_fd < 0)
+		EXIT_LOG_ERRNO(errno, "socket() for batch in init_netlink()");
+
+	if (fcntl(nl_batch_fd, F_SETFD, FD_CLOEXEC) != 0)
+		EXIT_LOG_ERRNO(errno,
+			"fcntl(FD_CLOEXEC) for batch in init_netlink()");
+
+	if (fcntl(nl_batch_fd, F_SETFL, O_NONBLOCK) != 0)
+		EXIT_LOG_ERRNO(errno,
+			"fcntl(O_NONBLOCK) for batch in init_netlink()");
+
+	/*
+	 * A full batch generates an ACK per message; make room for
+	 * them (the FORCE variant needs CAP_NET_ADMIN, fall back).
+	 */
+	int size = NETLINK_BATCH_SOCKBUF;
+	if (setsockopt(nl_batch_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0 &&
+	    setsockopt(nl_batch_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
+		LOG_ERRNO(errno, "setsockopt(SO_RCVBUF) for batch in init_netlink()");
+	}
+	if (setsockopt(nl_batch_fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) != 0 &&
+	    setsockopt(nl_batch_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) != 0) {
+		LOG_ERRNO(errno, "setsockopt(SO_SNDBUF) for batch in init_netlink()");
+	}
+
+	init_oneshot_timer(EVENT_FLUSH_NETLINK_BATCH, flush_netlink_batch_event);
+	add_fd_read_event_handler(nl_batch_fd, netlink_batch_ack_cb, NULL,
+				  "KERNEL_XFRM_BATCH_FD");
+}
+
+static void free_sa_counters_cache(void);
+
+static void netlink_shutdown(void)
+{
+	drain_netlink_batch();
+	free_sa_counters_cache();
+#ifdef USE_XFRM_INTERFACE
+	struct logger logger = GLOBAL_LOGGER(null_fd);
+	free_xfrmi_ipsec1(&logger);
+#endif
+}
+
 /*
  * send_netlink_msg
  *
@@ -347,6 +671,9 @@ static bool send_netlink_msg(struct nlmsghdr *hdr,
 
 	netlink_errno = 0;
 
+	/* keep the kernel's view of requests in order */
+	flush_netlink_batch();
+
 	hdr->nlmsg_seq = ++seq;
 	len = hdr->nlmsg_len;
 	do {
@@ -779,6 +1106,19 @@ static bool netlink_raw_eroute(const ip_address *this_host,
 	bool enoent_ok = sadb_op == ERO_DEL_INBOUND ||
 		(sadb_op == ERO_DELETE && ntohl(cur_spi) == SPI_HOLD);
 
+	if (sadb_op == ERO_DEL_INBOUND) {
+		/*
+		 * Teardown only logs a failure so queue the inbound
+		 * and forward policy deletes, with the SA deletes that
+		 * follow, instead of waiting for each ACK.
+		 */
+		passert(dir == XFRM_POLICY_IN);
+		queue_netlink_msg(&req.n, ENOENT, "policy", text_said);
+		req.u.id.dir = XFRM_POLICY_FWD;
+		queue_netlink_msg(&req.n, ENOENT, "policy", text_said);
+		return true;
+	}
+
 	bool ok = netlink_policy(&req.n, enoent_ok, text_said);
 
 	/* ??? deal with any forwarding policy */
@@ -1617,6 +1957,29 @@ static bool netlink_add_sa(const struct kernel_sa *sa, bool replace)
 	return ret;
 }
 
+struct del_sa_req {
+	struct nlmsghdr n;
+	struct xfrm_usersa_id id;
+	char data[MAX_NETLINK_DATA_SIZE];
+};
+
+static void build_del_sa_req(struct del_sa_req *req, const struct kernel_sa *sa)
+{
+	zero(req);
+	req->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req->n.nlmsg_type = XFRM_MSG_DELSA;
+
+	req->id.daddr = xfrm_from_address(sa->dst.address);
+
+	req->id.spi = sa->spi;
+	req->id.family = addrtypeof(sa->src.address);
+	req->id.proto = sa->proto->ipproto;
+
+	req->n.nlmsg_len = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(req->id)));
+
+	dbg("XFRM: deleting IPsec SA with reqid %d", sa->reqid);
+}
+
 /*
  * netlink_del_sa - Delete an SA from the Kernel
  *
@@ -1625,29 +1988,23 @@ static bool netlink_add_sa(const struct kernel_sa *sa, bool replace)
  */
 static bool netlink_del_sa(const struct kernel_sa *sa)
 {
-	struct {
-		struct nlmsghdr n;
-		struct xfrm_usersa_id id;
-		char data[MAX_NETLINK_DATA_SIZE];
-	} req;
-
-	zero(&req);
-	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-	req.n.nlmsg_type = XFRM_MSG_DELSA;
-
-	req.id.daddr = xfrm_from_address(sa->dst.address);
-
-	req.id.spi = sa->spi;
-	req.id.family = addrtypeof(sa->src.address);
-	req.id.proto = sa->proto->ipproto;
-
-	req.n.nlmsg_len = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(req.id)));
-
-	dbg("XFRM: deleting IPsec SA with reqid %d", sa->reqid);
-
+	struct del_sa_req req;
+	build_del_sa_req(&req, sa);
 	return send_netlink_msg(&req.n, NLMSG_NOOP, NULL, "Del SA", sa->text_said);
 }
 
+/*
+ * netlink_queue_del_sa - Delete an SA without waiting for the ACK
+ *
+ * For teardown, where a failure is only logged.
+ */
+static void netlink_queue_del_sa(const struct kernel_sa *sa)
+{
+	struct del_sa_req req;
+	build_del_sa_req(&req, sa);
+	queue_netlink_msg(&req.n, 0, "Del SA", sa->text_said);
+}
+
 /*
  * Create ip_address out of xfrm_address_t.
  *
@@ -2475,6 +2832,286 @@ static void netlink_process_raw_ifaces(struct raw_iface *rifaces)
 	}
 }
 
+/*
+ * SA counter cache.
+ *
+ * Status, idle and lifetime checks want the counters of every child
+ * SA, one at a time; a XFRM_MSG_GETSA per SA doesn't scale.  Instead,
+ * when the counters are older than pluto_sa_counter_cache, all the
+ * SAs are dumped (one NLM_F_DUMP request) into this table, and
+ * lookups are answered from it.  An SA the last dump missed (it is
+ * newer) is fetched and added on its own.
+ */
+
+struct sa_counters {
+	/* key */
+	uint16_t family;
+	uint8_t proto;
+	ipsec_spi_t spi;
+	xfrm_address_t daddr;
+	/* value */
+	uint64_t bytes;
+	uint64_t add_time;
+	monotime_t sampled;
+	unsigned long dump;	/* last dump that included it */
+	struct list_entry hash_entry;
+	struct list_entry list_entry;	/* on sa_counters_list */
+};
+
+static struct {
+	unsigned long nr;		/* dumps so far */
+	monotime_t time;		/* of the last one */
+	unsigned long nr_sas;		/* cached */
+} sa_counters_dump;
+
+static void jam_sa_counters(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "SA counters NULL");
+	} else {
+		const struct sa_counters *sac = data;
+		jam(buf, "SA counters %u.%08x", sac->proto, ntohl(sac->spi));
+	}
+}
+
+static const struct list_info sa_counters_info = {
+	.name = "SA counters list",
+	.jam = jam_sa_counters,
+};
+
+static struct list_head sa_counters_list = INIT_LIST_HEAD(&sa_counters_list, &sa_counters_info);
+
+static size_t xfrm_address_len(uint16_t family)
+{
+	return family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+}
+
+static hash_t sa_counters_key_hasher(uint16_t family, uint8_t proto, ipsec_spi_t spi,
+				     const xfrm_address_t *daddr)
+{
+	hash_t hash = hash_table_hash_u64(((uint64_t)spi << 24) |
+					  ((uint64_t)proto << 16) | family);
+	return hash_table_hasher(shunk2(daddr, xfrm_address_len(family)), hash);
+}
+
+static hash_t sa_counters_hasher(const void *data)
+{
+	const struct sa_counters *sac = data;
+	return sa_counters_key_hasher(sac->family, sac->proto, sac->spi, &sac->daddr);
+}
+
+static struct list_entry *sa_counters_entry(void *data)
+{
+	struct sa_counters *sac = data;
+	return &sac->hash_entry;
+}
+
+static struct list_head sa_counters_slots[STATE_TABLE_SIZE];
+
+static struct hash_table sa_counters_table = {
+	.info = {
+		.name = "SA counters table",
+		.jam = jam_sa_counters,
+	},
+	.hasher = sa_counters_hasher,
+	.entry = sa_counters_entry,
+	.nr_slots = elemsof(sa_counters_slots),
+	.slots = sa_counters_slots,
+};
+
+static struct sa_counters *sa_counters_by_key(uint16_t family, uint8_t proto, ipsec_spi_t spi,
+					      const xfrm_address_t *daddr)
+{
+	struct list_head *bucket =
+		hash_table_bucket(&sa_counters_table,
+				  sa_counters_key_hasher(family, proto, spi, daddr));
+	struct sa_counters *sac;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, sac) {
+		if (sac->family == family && sac->proto == proto &&
+		    sac->spi == spi &&
+		    memeq(&sac->daddr, daddr, xfrm_address_len(family))) {
+			return sac;
+		}
+	}
+	return NULL;
+}
+
+/* add or update the SA's counters; INFO is from the kernel */
+static void cache_sa_counters(const struct xfrm_usersa_info *info, monotime_t now)
+{
+	if (info->family != AF_INET && info->family != AF_INET6) {
+		return;
+	}
+	struct sa_counters *sac = sa_counters_by_key(info->family, info->id.proto,
+						     info->id.spi, &info->id.daddr);
+	if (sac == NULL) {
+		sac = alloc_thing(struct sa_counters, "SA counters");
+		sac->family = info->family;
+		sac->proto = info->id.proto;
+		sac->spi = info->id.spi;
+		memcpy(&sac->daddr, &info->id.daddr, xfrm_address_len(info->family));
+		sac->list_entry = list_entry(&sa_counters_info, sac);
+		insert_list_entry(&sa_counters_list, &sac->list_entry);
+		add_hash_table_entry(&sa_counters_table, sac);
+		sa_counters_dump.nr_sas++;
+	}
+	sac->bytes = info->curlft.bytes;
+	sac->add_time = info->curlft.add_time;
+	sac->sampled = now;
+	sac->dump = sa_counters_dump.nr;
+}
+
+static void free_sa_counters(struct sa_counters **sacp)
+{
+	struct sa_counters *sac = *sacp;
+	*sacp = NULL;
+	del_hash_table_entry(&sa_counters_table, sac);
+	remove_list_entry(&sac->list_entry);
+	pfree(sac);
+	sa_counters_dump.nr_sas--;
+}
+
+/*
+ * Dump every SA into the cache, then forget the SAs the kernel no
+ * longer has.
+ */
+static bool dump_sa_counters(void)
+{
+	static uint32_t seq;	/* STATIC */
+	struct {
+		struct nlmsghdr n;
+		struct xfrm_usersa_id id;	/* ignored */
+	} req;
+
+	zero(&req);
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.n.nlmsg_type = XFRM_MSG_GETSA;
+	req.n.nlmsg_len = NLMSG_ALIGN(NLMSG_LENGTH(0));
+	req.n.nlmsg_seq = seq = 0x80000000 | (seq + 1);	/* not send_netlink_msg()'s */
+
+	/* keep the kernel's view of requests in order */
+	flush_netlink_batch();
+
+	ssize_t r;
+	do {
+		r = write(nl_send_fd, &req.n, req.n.nlmsg_len);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) {
+		LOG_ERRNO(errno, "netlink write() of SA dump request failed");
+		return false;
+	} else if ((size_t)r != req.n.nlmsg_len) {
+		loglog(RC_LOG_SERIOUS, "ERROR: netlink write() of SA dump request truncated: %zd instead of %u",
+		       r, req.n.nlmsg_len);
+		return false;
+	}
+
+	threadtime_t start = threadtime_start();
+	monotime_t now = mononow();
+	sa_counters_dump.nr++;
+	sa_counters_dump.time = now;
+
+	/* big enough for any dump datagram the kernel sends */
+	size_t size = 64 * 1024;
+	struct nlmsghdr *buf = alloc_bytes(size, "SA dump buffer");
+	bool ok = false;
+	bool done = false;
+	unsigned long nr_sas = 0;
+	while (!done) {
+		struct sockaddr_nl addr;
+		socklen_t alen = sizeof(addr);
+		r = recvfrom(nl_send_fd, buf, size, 0,
+			     (struct sockaddr *)&addr, &alen);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_ERRNO(errno, "netlink recvfrom() of SA dump failed");
+			break;
+		}
+		if (addr.nl_pid != 0) {
+			/* not for us: ignore */
+			continue;
+		}
+		size_t len = r;
+		for (struct nlmsghdr *n = buf; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_seq != req.n.nlmsg_seq) {
+				dbg("netlink: ignoring out of sequence (%u/%u) message %s",
+				    n->nlmsg_seq, req.n.nlmsg_seq,
+				    sparse_val_show(xfrm_type_names, n->nlmsg_type));
+				continue;
+			}
+			if (n->nlmsg_type == NLMSG_DONE) {
+				ok = done = true;
+				break;
+			}
+			if (n->nlmsg_type == NLMSG_ERROR) {
+				const struct nlmsgerr *e = NLMSG_DATA(n);
+				loglog(RC_LOG_SERIOUS,
+				       "ERROR: netlink response for SA dump included errno %d: %s",
+				       -e->error, strerror(-e->error));
+				done = true;
+				break;
+			}
+			if (n->nlmsg_type != XFRM_MSG_NEWSA ||
+			    n->nlmsg_len < NLMSG_LENGTH(sizeof(struct xfrm_usersa_info))) {
+				continue;
+			}
+			cache_sa_counters(NLMSG_DATA(n), now);
+			nr_sas++;
+		}
+	}
+	pfree(buf);
+
+	if (ok) {
+		/* what the dump didn't include is gone */
+		struct sa_counters *sac;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&sa_counters_list, sac) {
+			if (sac->dump != sa_counters_dump.nr) {
+				free_sa_counters(&sac);
+			}
+		}
+	}
+
+	threadtime_stop(&start, SOS_NOBODY, "dumping %lu SA counters", nr_sas);
+	return ok;
+}
+
+static void init_sa_counters_cache(void)
+{
+	init_hash_table(&sa_counters_table);
+}
+
+static void free_sa_counters_cache(void)
+{
+	struct sa_counters *sac;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&sa_counters_list, sac) {
+		free_sa_counters(&sac);
+	}
+}
+
+/*
+ * Answer from the SA counter cache without going to the kernel;
+ * fails when the SA's counters aren't cached or are stale.
+ */
+static bool netlink_get_cached_sa(const struct kernel_sa *sa, uint64_t *bytes,
+				  uint64_t *add_time)
+{
+	uint16_t family = addrtypeof(sa->src.address);
+	if (deltasecs(pluto_sa_counter_cache) <= 0 ||
+	    (family != AF_INET && family != AF_INET6)) {
+		return FALSE;
+	}
+	monotime_t stale = monotime_sub(mononow(), pluto_sa_counter_cache);
+	xfrm_address_t daddr = xfrm_from_address(sa->dst.address);
+	struct sa_counters *sac = sa_counters_by_key(family, sa->proto->ipproto,
+						     sa->spi, &daddr);
+	if (sac == NULL || !monobefore(stale, sac->sampled)) {
+		return FALSE;
+	}
+	*bytes = sac->bytes;
+	*add_time = sac->add_time;
+	return TRUE;
+}
+
 /*
  * netlink_get_sa - Get SA information from the kernel
  *
@@ -2505,9 +3142,25 @@ static bool netlink_get_sa(const struct kernel_sa *sa, uint64_t *bytes,
 
 	req.n.nlmsg_len = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(req.id)));
 
+	if (deltasecs(pluto_sa_counter_cache) > 0 &&
+	    (req.id.family == AF_INET || req.id.family == AF_INET6)) {
+		monotime_t stale = monotime_sub(mononow(), pluto_sa_counter_cache);
+		if (!monobefore(stale, sa_counters_dump.time)) {
+			dump_sa_counters();
+		}
+		if (netlink_get_cached_sa(sa, bytes, add_time)) {
+			return TRUE;
+		}
+		dbg("SA counters for %s not cached", sa->text_said);
+	}
+
 	if (!send_netlink_msg(&req.n, XFRM_MSG_NEWSA, &rsp, "Get SA", sa->text_said))
 		return FALSE;
 
+	if (deltasecs(pluto_sa_counter_cache) > 0) {
+		cache_sa_counters(&rsp.u.info, mononow());
+	}
+
 	*bytes = rsp.u.info.curlft.bytes;
 	*add_time = rsp.u.info.curlft.add_time;
 	return TRUE;
@@ -2537,7 +3190,7 @@ static bool netkey_do_command(const struct connection *c, const struct spd_route
 		return FALSE;
 	}
 
-	return invoke_command(verb, verb_suffix, cmd);
+	return invoke_command(c, st, verb, verb_suffix, cmd);
 }
 
 /* add bypass policies/holes icmp */
@@ -2808,16 +3461,14 @@ const struct kernel_ops netkey_kernel_ops = {
 	.replay_window = IPSEC_SA_DEFAULT_REPLAY_WINDOW,
 
 	.init = init_netlink,
-#ifdef USE_XFRM_INTERFACE
-	.shutdown = free_xfrmi_ipsec1,
-#else
-	.shutdown = NULL,
-#endif
+	.shutdown = netlink_shutdown,
 	.process_msg = netlink_process_msg,
 	.raw_eroute = netlink_raw_eroute,
 	.add_sa = netlink_add_sa,
 	.del_sa = netlink_del_sa,
+	.queue_del_sa = netlink_queue_del_sa,
 	.get_sa = netlink_get_sa,
+	.get_cached_sa = netlink_get_cached_sa,
 	.process_queue = NULL,
 	.grp_sa = NULL,
 	.get_spi = netlink_get_spi,
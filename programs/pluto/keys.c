@@ -27,6 +27,7 @@
  *
  */
 
+#include <pthread.h>	/* Must be the first include file */
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -46,6 +47,7 @@
 #include "log.h"
 #include "whack.h"      /* for RC_LOG_SERIOUS */
 #include "timer.h"
+#include "server.h"		/* for schedule_callback() */
 
 #include "fetch.h"
 #include "pluto_x509.h"
@@ -69,6 +71,7 @@
 #include "secrets.h"
 #include "ike_alg_hash.h"
 #include "pluto_timing.h"
+#include "pubkey_db.h"
 
 static struct secret *pluto_secrets = NULL;
 
@@ -78,8 +81,88 @@ void load_preshared_secrets(void)
 	lsw_load_preshared_secrets(&pluto_secrets, oco->secretsfile);
 }
 
+/*
+ * Re-read the secrets file in the background.
+ *
+ * With a large secrets file, parsing it (and resolving any DNS names
+ * it contains) can take a long time.  Instead the new list (and its
+ * index) is built on a separate thread and then, back on the main
+ * thread, swapped in for the old one; until then lookups continue
+ * to use the old secrets.
+ *
+ * A reread requested while one is in progress is run once the
+ * current one finishes.
+ */
+
+static struct {
+	pthread_t thread;
+	bool running;		/* main thread only */
+	bool again;		/* main thread only */
+	char *secretsfile;
+	struct secret *secrets;	/* result, handed to main thread */
+} secrets_reload;
+
+static callback_cb secrets_reloaded;
+
+static void *reload_secrets_thread(void *arg UNUSED)
+{
+	lsw_load_preshared_secrets(&secrets_reload.secrets,
+				   secrets_reload.secretsfile);
+	schedule_callback("secrets reloaded", SOS_NOBODY,
+			  secrets_reloaded, NULL);
+	return NULL;
+}
+
+static void finish_secrets_reload(void)
+{
+	pthread_join(secrets_reload.thread, NULL);
+	secrets_reload.running = false;
+	pfreeany(secrets_reload.secretsfile);
+}
+
+static void secrets_reloaded(struct state *st UNUSED, void *context UNUSED)
+{
+	finish_secrets_reload();
+	struct secret *old = pluto_secrets;
+	pluto_secrets = secrets_reload.secrets;
+	secrets_reload.secrets = NULL;
+	lsw_free_preshared_secrets(&old);
+	libreswan_log("secrets reloaded");
+	if (secrets_reload.again) {
+		secrets_reload.again = false;
+		reload_preshared_secrets();
+	}
+}
+
+void reload_preshared_secrets(void)
+{
+	if (secrets_reload.running) {
+		dbg("secrets reload in progress; will reload again");
+		secrets_reload.again = true;
+		return;
+	}
+	const struct lsw_conf_options *oco = lsw_init_options();
+	secrets_reload.secretsfile = clone_str(oco->secretsfile, "secrets file");
+	secrets_reload.secrets = NULL;
+	int status = pthread_create(&secrets_reload.thread, NULL,
+				    reload_secrets_thread, NULL);
+	if (status != 0) {
+		libreswan_log("could not start thread for reloading secrets, status = %d; loading inline",
+			      status);
+		pfreeany(secrets_reload.secretsfile);
+		load_preshared_secrets();
+		return;
+	}
+	secrets_reload.running = true;
+}
+
 void free_preshared_secrets(void)
 {
+	if (secrets_reload.running) {
+		/* the callback won't run; discard the result */
+		finish_secrets_reload();
+		lsw_free_preshared_secrets(&secrets_reload.secrets);
+	}
 	lsw_free_preshared_secrets(&pluto_secrets);
 }
 
@@ -304,61 +387,87 @@ err_t RSA_signature_verify_nss(const struct RSA_public_key *k,
  * Note: parameter keys_from_dns contains results of DNS lookup for
  * key or is NULL indicating lookup not yet tried.
  *
- * take_a_crack is a helper function.  Mostly forensic.  If only we
- * had coroutines. (XXX: generators).
+ * This is done in three steps so that the middle one, the expensive
+ * bit, can be run by a crypto helper:
+ *
+ * collect_signature_keys(), on the main thread, makes a list of (and
+ * references) the candidate keys; try_signature_keys(), on any
+ * thread, tries them in order stopping at the first that works;
+ * report_signature_keys(), back on the main thread, logs what
+ * happened, records the key that worked, and releases the list.
  */
-struct tac_state {
-	const struct pubkey_type *type;
-	/* check_signature's args that take_a_crack needs */
-	struct state *st;
-	const struct crypt_mac *hash;
-	const pb_stream *sig_pbs;
-	const struct hash_desc *hash_algo;
-	try_signature_fn *try_signature;
-
-	/* state carried between calls */
-	err_t best_ugh; /* most successful failure */
-	int tried_cnt;  /* number of keys tried */
-	char tried[50]; /* keyids of tried public keys */
-	jambuf_t tn;
-};
 
-static bool take_a_crack(struct tac_state *s,
-			 struct pubkey *kr,
-			 const char *story)
+static void add_signature_key(struct signature_keys *keys,
+			      struct pubkey *key, const char *story)
 {
-	s->tried_cnt++;
-	err_t ugh = (s->try_signature)(s->hash, s->sig_pbs,
-				       kr, s->st, s->hash_algo);
-
-	const char *key_id_str = pubkey_keyid(kr);
+	if (keys->nr_keys == keys->max_keys) {
+		unsigned max_keys = (keys->max_keys == 0 ? 4 : keys->max_keys * 2);
+		struct signature_key *key = alloc_things(struct signature_key, max_keys,
+							 "signature keys");
+		if (keys->nr_keys > 0) {
+			memcpy(key, keys->key, keys->nr_keys * sizeof(key[0]));
+		}
+		pfreeany(keys->key);
+		keys->key = key;
+		keys->max_keys = max_keys;
+	}
+	keys->key[keys->nr_keys++] = (struct signature_key) {
+		.key = reference_key(key),
+		.story = story,
+	};
+}
 
-	if (ugh == NULL) {
-		dbg("an %s Sig check passed with *%s [%s]",
-		    kr->type->name, key_id_str, story);
-		return true;
+/*
+ * Returns true when KEY is a candidate; sets *EXPIRED when KEY was
+ * skipped because it has expired (the caller deletes it).
+ */
+static bool candidate_key(struct pubkey *key, const struct pubkey_type *type,
+			  const struct connection *c, realtime_t now,
+			  bool *expired)
+{
+	/* passed to trusted_ca_nss() */
+	int pl;	/* value ignored */
+
+	if (key->type != type) {
+		id_buf printkid;
+		dbg("  skipping '%s' with type %s",
+		    str_id(&key->id, &printkid), key->type->name);
+	} else if (!same_id(&c->spd.that.id, &key->id)) {
+		id_buf printkid;
+		dbg("  skipping '%s' with wrong ID",
+		    str_id(&key->id, &printkid));
+	} else if (!trusted_ca_nss(key->issuer, c->spd.that.ca, &pl)) {
+		id_buf printkid;
+		dn_buf buf;
+		dbg("  skipping '%s' with untrusted CA '%s'",
+		    str_id(&key->id, &printkid),
+		    str_dn_or_null(key->issuer, "%any", &buf));
+	} else if (!is_realtime_epoch(key->until_time) &&
+		   realbefore(key->until_time, now)) {
+		id_buf printkid;
+		loglog(RC_LOG_SERIOUS,
+		       "cached %s public key '%s' has expired and has been deleted",
+		       type->name, str_id(&key->id, &printkid));
+		*expired = true;
 	} else {
-		loglog(RC_LOG_SERIOUS, "an %s Sig check failed '%s' with *%s [%s]",
-		    kr->type->name, ugh + 1, key_id_str, story);
-		if (s->best_ugh == NULL || s->best_ugh[0] < ugh[0])
-			s->best_ugh = ugh;
-		if (ugh[0] > '0') {
-		    jam_string(&s->tn, " *");
-		    jam_string(&s->tn, key_id_str);
-		}
-		return false;
+		id_buf printkid;
+		dn_buf buf;
+		dbg("  trying '%s' issued by CA '%s'",
+		    str_id(&key->id, &printkid), str_dn_or_null(key->issuer, "%any", &buf));
+		return true;
 	}
+	return false;
 }
 
-static bool try_all_keys(const char *pubkey_description,
-			 struct pubkey_list **pubkey_db,
-			 const struct connection *c, realtime_t now,
-			 struct tac_state *s)
+static void collect_all_keys(const char *pubkey_description,
+			     struct pubkey_list **pubkey_db,
+			     const struct connection *c, realtime_t now,
+			     struct signature_keys *keys)
 {
 
 	id_buf thatid;
 	dbg("trying all %s public keys for %s key that matches ID: %s",
-	    pubkey_description, s->type->name, str_id(&c->spd.that.id, &thatid));
+	    pubkey_description, keys->type->name, str_id(&c->spd.that.id, &thatid));
 
 	/*
 	 * XXX: danger, serves double purpose of pruning expired
@@ -366,76 +475,68 @@ static bool try_all_keys(const char *pubkey_description,
 	 */
 	struct pubkey_list **pp = pubkey_db;
 	for (struct pubkey_list *p = *pubkey_db; p != NULL; p = *pp) {
-		struct pubkey *key = p->key;
-
-		/* passed to trusted_ca_nss() */
-		int pl;	/* value ignored */
-
-		if (key->type != s->type) {
-			id_buf printkid;
-			dbg("  skipping '%s' with type %s",
-			    str_id(&key->id, &printkid), key->type->name);
-		} else if (!same_id(&c->spd.that.id, &key->id)) {
-			id_buf printkid;
-			dbg("  skipping '%s' with wrong ID",
-			    str_id(&key->id, &printkid));
-		} else if (!trusted_ca_nss(key->issuer, c->spd.that.ca, &pl)) {
-			id_buf printkid;
-			dn_buf buf;
-			dbg("  skipping '%s' with untrusted CA '%s'",
-			    str_id(&key->id, &printkid),
-			    str_dn_or_null(key->issuer, "%any", &buf));
-		} else if (!is_realtime_epoch(key->until_time) &&
-			   realbefore(key->until_time, now)) {
-			/*
-			 * XXX: danger: found public key has expired;
-			 * deleting mid loop.  Why only do this for
-			 * matched keys as the test is relatively
-			 * cheap?
-			 */
-			id_buf printkid;
-			loglog(RC_LOG_SERIOUS,
-			       "cached %s public key '%s' has expired and has been deleted",
-			       s->type->name, str_id(&key->id, &printkid));
+		bool expired = false;
+		if (candidate_key(p->key, keys->type, c, now, &expired)) {
+			add_signature_key(keys, p->key, pubkey_description);
+		}
+		if (expired) {
 			*pp = free_public_keyentry(p);
 			continue; /* continue with next public key */
-		} else {
-			id_buf printkid;
-			dn_buf buf;
-			dbg("  trying '%s' issued by CA '%s'",
-			    str_id(&key->id, &printkid), str_dn_or_null(key->issuer, "%any", &buf));
-
-			statetime_t try_time = statetime_start(s->st);
-			bool ok = take_a_crack(s, key, pubkey_description);
-			statetime_stop(&try_time, "%s() trying a pubkey", __func__);
-			if (ok) {
-				return true;
-			}
 		}
 		pp = &p->next;
 	}
-	return false;
 }
 
-stf_status check_signature_gen(struct state *st,
-			       const struct crypt_mac *hash,
-			       const pb_stream *sig_pbs,
-			       const struct hash_desc *hash_algo,
-			       const struct pubkey_type *type,
-			       try_signature_fn *try_signature)
+/*
+ * Same as collect_all_keys() but only looking at the keys in the
+ * pubkey database with a matching ID.
+ */
+
+struct collect_db_key {
+	const char *pubkey_description;
+	const struct connection *c;
+	realtime_t now;
+	struct signature_keys *keys;
+};
+
+static bool collect_db_key(struct pubkey *key, void *arg)
+{
+	struct collect_db_key *t = arg;
+	bool expired = false;
+	if (candidate_key(key, t->keys->type, t->c, t->now, &expired)) {
+		add_signature_key(t->keys, key, t->pubkey_description);
+	}
+	if (expired) {
+		delete_pubkey_from_db(key);
+	}
+	return false; /* keep looking */
+}
+
+static void collect_all_db_keys(const char *pubkey_description,
+				const struct connection *c, realtime_t now,
+				struct signature_keys *keys)
+{
+	id_buf thatid;
+	dbg("trying all %s public keys for %s key that matches ID: %s",
+	    pubkey_description, keys->type->name, str_id(&c->spd.that.id, &thatid));
+
+	struct collect_db_key t = {
+		.pubkey_description = pubkey_description,
+		.c = c,
+		.now = now,
+		.keys = keys,
+	};
+	find_pubkey_by_id(&c->spd.that.id, collect_db_key, &t);
+}
+
+void collect_signature_keys(struct state *st,
+			    const struct pubkey_type *type,
+			    struct signature_keys *keys)
 {
 	const struct connection *c = st->st_connection;
-	struct tac_state s = {
+	*keys = (struct signature_keys) {
 		.type = type,
-		.st = st,
-		.hash = hash,
-		.sig_pbs = sig_pbs,
-		.hash_algo = hash_algo,
-		.try_signature = try_signature,
-		.best_ugh = NULL,
-		.tried_cnt = 0,
 	};
-	s.tn = ARRAY_AS_JAMBUF(s.tried);
 
 	/* try all appropriate Public keys */
 	realtime_t now = realnow();
@@ -448,18 +549,85 @@ stf_status check_signature_gen(struct state *st,
 	}
 
 	pexpect(st->st_remote_certs.processed);
-	if (try_all_keys("remote certificates",
+	collect_all_keys("remote certificates",
 			 &st->st_remote_certs.pubkey_db,
-			 c, now, &s) ||
-	    try_all_keys("preloaded keys",
-			 &pluto_pubkeys,
-			 c, now, &s)) {
+			 c, now, keys);
+	collect_all_db_keys("preloaded keys", c, now, keys);
+}
+
+void try_signature_keys(struct signature_keys *keys,
+			const struct crypt_mac *hash,
+			shunk_t signature,
+			const struct hash_desc *hash_algo,
+			try_signature_fn *try_signature)
+{
+	for (unsigned i = 0; i < keys->nr_keys; i++) {
+		struct signature_key *k = &keys->key[i];
+		k->tried = true;
+		k->ugh = try_signature(hash, signature, k->key, hash_algo);
+		if (k->ugh == NULL) {
+			break;
+		}
+	}
+}
+
+void release_signature_keys(struct signature_keys *keys)
+{
+	for (unsigned i = 0; i < keys->nr_keys; i++) {
+		unreference_key(&keys->key[i].key);
+	}
+	pfreeany(keys->key);
+	keys->nr_keys = keys->max_keys = 0;
+}
+
+stf_status report_signature_keys(struct state *st,
+				 struct signature_keys *keys,
+				 const struct hash_desc *hash_algo)
+{
+	const struct connection *c = st->st_connection;
+	const struct pubkey_type *type = keys->type;
+	err_t best_ugh = NULL; /* most successful failure */
+	int tried_cnt = 0;  /* number of keys tried */
+	char tried[50]; /* keyids of tried public keys */
+	jambuf_t tn = ARRAY_AS_JAMBUF(tried);
+	struct pubkey *authenticated = NULL;
+
+	for (unsigned i = 0; i < keys->nr_keys && keys->key[i].tried; i++) {
+		struct signature_key *k = &keys->key[i];
+		const char *key_id_str = pubkey_keyid(k->key);
+		tried_cnt++;
+		if (k->ugh == NULL) {
+			dbg("an %s Sig check passed with *%s [%s]",
+			    k->key->type->name, key_id_str, k->story);
+			authenticated = k->key;
+			break;
+		}
+		loglog(RC_LOG_SERIOUS, "an %s Sig check failed '%s' with *%s [%s]",
+		       k->key->type->name, k->ugh + 1, key_id_str, k->story);
+		if (best_ugh == NULL || best_ugh[0] < k->ugh[0])
+			best_ugh = k->ugh;
+		if (k->ugh[0] > '0') {
+			jam_string(&tn, " *");
+			jam_string(&tn, key_id_str);
+		}
+	}
+
+	if (authenticated != NULL) {
+		/*
+		 * Success: copy successful key into state.  There
+		 * might be an old one if we previously aborted this
+		 * state transition.
+		 */
+		unreference_key(&st->st_peer_pubkey);
+		st->st_peer_pubkey = reference_key(authenticated);
+		release_signature_keys(keys);
 		log_state(RC_LOG_SERIOUS, st,
 			  "authenticated using %s with %s",
 			  type->name,
 			  (c->ike_version == IKEv1) ? "SHA-1" : hash_algo->common.fqn);
 		return STF_OK;
 	}
+	release_signature_keys(keys);
 
 	/*
 	 * if no key was found (evidenced by best_ugh == NULL) and
@@ -474,7 +642,7 @@ stf_status check_signature_gen(struct state *st,
 	str_id(&st->st_connection->spd.that.id, &id_str);
 	passert(id_str.buf[0] != '\0');
 
-	if (s.best_ugh == NULL) {
+	if (best_ugh == NULL) {
 		log_state(RC_LOG_SERIOUS, st,
 			  "no %s public key known for '%s'",
 			  type->name, id_str.buf);
@@ -482,27 +650,43 @@ stf_status check_signature_gen(struct state *st,
 		return STF_FAIL + INVALID_KEY_INFORMATION;
 	}
 
-	if (s.best_ugh[0] == '9') {
-		log_state(RC_LOG_SERIOUS, st, "%s", s.best_ugh + 1);
+	if (best_ugh[0] == '9') {
+		log_state(RC_LOG_SERIOUS, st, "%s", best_ugh + 1);
 		/* XXX Could send notification back */
 		return STF_FAIL + INVALID_HASH_INFORMATION;
 	}
 
-	if (s.tried_cnt == 1) {
+	if (tried_cnt == 1) {
 		log_state(RC_LOG_SERIOUS, st,
 			  "%s Signature check (on %s) failed (wrong key?); tried%s",
-			  type->name, id_str.buf, s.tried);
+			  type->name, id_str.buf, tried);
 	} else {
 		log_state(RC_LOG_SERIOUS, st,
 			  "%s Signature check (on %s) failed: tried%s keys but none worked.",
-			  type->name, id_str.buf, s.tried);
+			  type->name, id_str.buf, tried);
 	}
 	dbg("all %d %s public keys for %s failed: best decrypted SIG payload into a malformed ECB (%s)",
-	    s.tried_cnt, type->name, id_str.buf, s.best_ugh+1/*skip '9'*/);
+	    tried_cnt, type->name, id_str.buf, best_ugh+1/*skip '9'*/);
 
 	return STF_FAIL + INVALID_KEY_INFORMATION;
 }
 
+stf_status check_signature_gen(struct state *st,
+			       const struct crypt_mac *hash,
+			       const pb_stream *sig_pbs,
+			       const struct hash_desc *hash_algo,
+			       const struct pubkey_type *type,
+			       try_signature_fn *try_signature)
+{
+	struct signature_keys keys;
+	collect_signature_keys(st, type, &keys);
+	statetime_t try_time = statetime_start(st);
+	try_signature_keys(&keys, hash, pbs_in_left_as_shunk(sig_pbs),
+			   hash_algo, try_signature);
+	statetime_stop(&try_time, "%s() trying %u pubkeys", __func__, keys.nr_keys);
+	return report_signature_keys(st, &keys, hash_algo);
+}
+
 /*
  * find the struct secret associated with the combination of
  * me and the peer.  We match the Id (if none, the IP address).
@@ -730,32 +914,29 @@ const struct private_key_stuff *get_connection_private_key(const struct connecti
  * public key machinery
  */
 
-/* root of chained public key list */
-
-struct pubkey_list *pluto_pubkeys = NULL;       /* keys from ipsec.conf */
+/* keys from ipsec.conf et.al. are in the pubkey database */
 
 void free_remembered_public_keys(void)
 {
-	free_public_keys(&pluto_pubkeys);
+	free_pubkey_db();
 }
 
 err_t add_public_key(const struct id *id, /* ASKK */
 		     enum dns_auth_level dns_auth_level,
 		     const struct pubkey_type *type,
-		     const chunk_t *key,
-		     struct pubkey_list **head)
+		     const chunk_t *key)
 {
 	struct pubkey *pk = alloc_thing(struct pubkey, "pubkey");
 
 	/* first: algorithm-specific decoding of key chunk */
 	type->unpack_pubkey_content(&pk->u, *key);
-	pk->id = clone_id(id, "public key id");
+	pk->id = *id;	/* cloned by add_pubkey_to_db() */
 	pk->dns_auth_level = dns_auth_level;
 	pk->type = type;
 	pk->until_time = realtime_epoch;
 	pk->issuer = EMPTY_CHUNK;
 
-	install_public_key(pk, head);
+	add_pubkey_to_db(pk, deltatime(0));
 	return NULL;
 }
 
@@ -763,96 +944,109 @@ err_t add_ipseckey(const struct id *id,
 		   enum dns_auth_level dns_auth_level,
 		   const struct pubkey_type *type,
 		   uint32_t ttl, uint32_t ttl_used,
-		   const chunk_t *key,
-		   struct pubkey_list **head)
+		   const chunk_t *key)
 {
 	struct pubkey *pk = alloc_thing(struct pubkey, "ipseckey publickey");
 
 	/* first: algorithm-specific decoding of key chunk */
 	type->unpack_pubkey_content(&pk->u, *key);
 	pk->dns_ttl = ttl;
-	pk->installed_time = realnow();
-	pk->until_time = realtimesum(pk->installed_time, deltatime(ttl_used));
-	pk->id = clone_id(id, "ipsec keyid");
+	pk->id = *id;	/* cloned by add_pubkey_to_db() */
 	pk->dns_auth_level = dns_auth_level;
 	pk->type = type;
 	pk->issuer = EMPTY_CHUNK; /* ipseckey has no issuer */
 
-	install_public_key(pk, head);
+	/* sets .installed_time and .until_time */
+	add_pubkey_to_db(pk, deltatime(ttl_used));
 	return NULL;
 }
 
 /*
- *  list all public keys in the chained list
+ *  list all public keys in the pubkey database
  */
-void list_public_keys(struct fd *whackfd, bool utc, bool check_pub_keys)
-{
-	struct pubkey_list *p = pluto_pubkeys;
 
-	if (!check_pub_keys) {
-		whack_comment(whackfd, " ");
-		whack_comment(whackfd, "List of Public Keys:");
-		whack_comment(whackfd, " ");
-	}
+struct list_public_key {
+	struct fd *whackfd;
+	bool utc;
+	bool check_pub_keys;
+};
 
-	while (p != NULL) {
-		struct pubkey *key = p->key;
-
-		switch (key->type->alg) {
-		case PUBKEY_ALG_RSA:
-		case PUBKEY_ALG_ECDSA:
-		{
-			const char *check_expiry_msg = check_expiry(key->until_time,
-							PUBKEY_WARNING_INTERVAL,
-							TRUE);
-
-			if (!check_pub_keys ||
-			    !startswith(check_expiry_msg, "ok")) {
-				WHACK_LOG(RC_COMMENT, whackfd, buf) {
-					jam_realtime(buf, key->installed_time, utc);
-					jam(buf, ", ");
-					switch (key->type->alg) {
-					case PUBKEY_ALG_RSA:
-						jam(buf, "%4d RSA Key %s",
-						    8 * key->u.rsa.k,
-						    key->u.rsa.keyid);
-						break;
-					case PUBKEY_ALG_ECDSA:
-						jam(buf, "%4d ECDSA Key %s",
-						    8 * key->u.ecdsa.k,
-						    key->u.ecdsa.keyid);
-						break;
-					default:
-						bad_case(key->type->alg);
-					}
-					jam(buf, " (%s private key), until ",
-					    (has_private_rawkey(key) ? "has" : "no"));
-					jam_realtime(buf, key->until_time, utc);
-					jam(buf, " %s", check_expiry_msg);
+static void list_public_key(struct pubkey *key, void *arg)
+{
+	const struct list_public_key *l = arg;
+	struct fd *whackfd = l->whackfd;
+	bool utc = l->utc;
+	bool check_pub_keys = l->check_pub_keys;
+
+	switch (key->type->alg) {
+	case PUBKEY_ALG_RSA:
+	case PUBKEY_ALG_ECDSA:
+	{
+		const char *check_expiry_msg = check_expiry(key->until_time,
+						PUBKEY_WARNING_INTERVAL,
+						TRUE);
+
+		if (!check_pub_keys ||
+		    !startswith(check_expiry_msg, "ok")) {
+			WHACK_LOG(RC_COMMENT, whackfd, buf) {
+				jam_realtime(buf, key->installed_time, utc);
+				jam(buf, ", ");
+				switch (key->type->alg) {
+				case PUBKEY_ALG_RSA:
+					jam(buf, "%4d RSA Key %s",
+					    8 * key->u.rsa.k,
+					    key->u.rsa.keyid);
+					break;
+				case PUBKEY_ALG_ECDSA:
+					jam(buf, "%4d ECDSA Key %s",
+					    8 * key->u.ecdsa.k,
+					    key->u.ecdsa.keyid);
+					break;
+				default:
+					bad_case(key->type->alg);
 				}
+				jam(buf, " (%s private key), until ",
+				    (has_private_rawkey(key) ? "has" : "no"));
+				jam_realtime(buf, key->until_time, utc);
+				jam(buf, " %s", check_expiry_msg);
+			}
 
-				/* XXX could be ikev2_idtype_names */
-				id_buf idb;
+			/* XXX could be ikev2_idtype_names */
+			id_buf idb;
 
-				whack_comment(whackfd, "       %s '%s'",
-					enum_show(&ike_idtype_names,
-						    key->id.kind),
-					str_id(&key->id, &idb));
+			whack_comment(whackfd, "       %s '%s'",
+				enum_show(&ike_idtype_names,
+					    key->id.kind),
+				str_id(&key->id, &idb));
 
-				if (key->issuer.len > 0) {
-					dn_buf b;
-					whack_comment(whackfd,
-						  "       Issuer '%s'",
-						  str_dn(key->issuer, &b));
-				}
+			if (key->issuer.len > 0) {
+				dn_buf b;
+				whack_comment(whackfd,
+					  "       Issuer '%s'",
+					  str_dn(key->issuer, &b));
 			}
-			break;
-		}
-		default:
-			dbg("ignoring key with unsupported alg %d", key->type->alg);
 		}
-		p = p->next;
+		break;
+	}
+	default:
+		dbg("ignoring key with unsupported alg %d", key->type->alg);
+	}
+}
+
+void list_public_keys(struct fd *whackfd, bool utc, bool check_pub_keys)
+{
+	if (!check_pub_keys) {
+		whack_comment(whackfd, " ");
+		whack_comment(whackfd, "List of Public Keys:");
+		whack_comment(whackfd, " ");
 	}
+
+	struct list_public_key l = {
+		.whackfd = whackfd,
+		.utc = utc,
+		.check_pub_keys = check_pub_keys,
+	};
+	for_each_pubkey(list_public_key, &l);
 }
 
 err_t load_nss_cert_secret(CERTCertificate *cert)
@@ -864,32 +1058,6 @@ err_t load_nss_cert_secret(CERTCertificate *cert)
 	return err;
 }
 
-static bool rsa_pubkey_ckaid_matches(struct pubkey *pubkey, char *buf, size_t buflen)
-{
-	if (pubkey->u.rsa.n.ptr == NULL) {
-		dbg("RSA pubkey with NULL modulus");
-		return FALSE;
-	}
-	SECItem modulus = {
-		.type = siBuffer,
-		.len = pubkey->u.rsa.n.len,
-		.data = pubkey->u.rsa.n.ptr,
-	};
-	SECItem *pubkey_ckaid = PK11_MakeIDFromPubKey(&modulus);
-	if (pubkey_ckaid == NULL) {
-		dbg("RSA pubkey incomputable CKAID");
-		return FALSE;
-	}
-	LSWDBGP(DBG_BASE, buf) {
-		lswlogs(buf, "comparing ckaid with: ");
-		lswlog_nss_secitem(buf, pubkey_ckaid);
-	}
-	bool eq = pubkey_ckaid->len == buflen &&
-		  memcmp(pubkey_ckaid->data, buf, buflen) == 0;
-	SECITEM_FreeItem(pubkey_ckaid, PR_TRUE);
-	return eq;
-}
-
 struct pubkey *get_pubkey_with_matching_ckaid(const char *ckaid)
 {
 	/* convert hex string ckaid to binary bin */
@@ -906,22 +1074,10 @@ struct pubkey *get_pubkey_with_matching_ckaid(const char *ckaid)
 		DBG_dump("looking for pubkey with CKAID that matches", bin, binlen);
 	}
 
-	struct pubkey_list *p;
-	for (p = pluto_pubkeys; p != NULL; p = p->next) {
-		DBG_log("looking at a PUBKEY");
-		struct pubkey *key = p->key;
-		switch (key->type->alg) {
-		case PUBKEY_ALG_RSA: {
-			if (rsa_pubkey_ckaid_matches(key, bin, binlen)) {
-				dbg("ckaid matching pubkey");
-				pfree(bin);
-				return key;
-			}
-		}
-		default:
-			break;
-		}
+	struct pubkey *key = find_rsa_pubkey_by_ckaid(bin, binlen);
+	if (key != NULL) {
+		dbg("ckaid matching pubkey");
 	}
 	pfree(bin);
-	return NULL;
+	return key;
 }
@@ -62,21 +62,25 @@ extern chunk_t *get_ppk(const struct connection *c, chunk_t **ppk_id,
 extern const chunk_t *get_ppk_by_id(const chunk_t *ppk_id);
 
 extern void load_preshared_secrets(void);
+extern void reload_preshared_secrets(void);
 extern void free_preshared_secrets(void);
 extern err_t load_nss_cert_secret(CERTCertificate *cert);
 
 extern struct secret *lsw_get_xauthsecret(char *xauthname);
 
-/* keys from ipsec.conf */
-extern struct pubkey_list *pluto_pubkeys;
-
 struct pubkey *get_pubkey_with_matching_ckaid(const char *ckaid);
 
+/*
+ * Try SIGNATURE with a public key.  Returns NULL when it checks out;
+ * otherwise the first character of the result indicates how far
+ * along failure occurred (a greater character signifies greater
+ * progress).  Must be thread-safe.
+ */
 typedef err_t (try_signature_fn) (const struct crypt_mac *hash,
-				  const struct packet_byte_stream *sig_pbs,
-				  struct pubkey *kr,
-				  struct state *st,
+				  shunk_t signature,
+				  const struct pubkey *kr,
 				  const struct hash_desc *hash_algo);
+
 extern stf_status check_signature_gen(struct state *st,
 				      const struct crypt_mac *hash,
 				      const struct packet_byte_stream *sig_pbs,
@@ -84,4 +88,40 @@ extern stf_status check_signature_gen(struct state *st,
 				      const struct pubkey_type *type,
 				      try_signature_fn *try_signature);
 
+/*
+ * check_signature_gen() in pieces, so that trying the keys can be
+ * done by a crypto helper.  collect_signature_keys() snapshots (and
+ * references) the candidate keys on the main thread;
+ * try_signature_keys() can then be run anywhere; and
+ * report_signature_keys() (back on the main thread) logs the result,
+ * records the key that worked, and releases KEYS.
+ */
+
+struct signature_key {
+	struct pubkey *key;
+	const char *story;
+	bool tried;
+	err_t ugh;
+};
+
+struct signature_keys {
+	const struct pubkey_type *type;
+	unsigned nr_keys;
+	unsigned max_keys;
+	struct signature_key *key;
+};
+
+extern void collect_signature_keys(struct state *st,
+				   const struct pubkey_type *type,
+				   struct signature_keys *keys);
+extern void try_signature_keys(struct signature_keys *keys,
+			       const struct crypt_mac *hash,
+			       shunk_t signature,
+			       const struct hash_desc *hash_algo,
+			       try_signature_fn *try_signature);
+extern stf_status report_signature_keys(struct state *st,
+					struct signature_keys *keys,
+					const struct hash_desc *hash_algo);
+extern void release_signature_keys(struct signature_keys *keys);
+
 #endif /* _KEYS_H */
@@ -43,6 +43,7 @@
 #include "impair.h"
 #include "demux.h"	/* for struct msg_digest */
 #include "pending.h"
+#include "server.h"	/* for add_fd_write_event_handler() */
 
 bool
 	log_to_stderr = TRUE,		/* should log go to stderr? */
@@ -389,6 +390,78 @@ static void peerlog_raw(const char *prefix, char *message)
 	}
 }
 
+/*
+ * Whack's socket is non-blocking (see whack_handle_cb()): what it
+ * won't take is buffered by the FD.  Flush that when the socket
+ * becomes writable, holding a reference so that the socket stays
+ * open (and whack waiting) until everything has been sent.
+ */
+
+struct whack_writer {
+	struct fd *whackfd;
+	struct pluto_event *event;
+	struct whack_writer *next;
+};
+
+/* so that they can be released at exit */
+static struct whack_writer *whack_writers;
+
+static void free_whack_writer(struct whack_writer *w)
+{
+	for (struct whack_writer **wp = &whack_writers; *wp != NULL; wp = &(*wp)->next) {
+		if (*wp == w) {
+			*wp = w->next;
+			break;
+		}
+	}
+	delete_pluto_event(&w->event);
+	close_any(&w->whackfd);
+	pfree(w);
+}
+
+static void whack_writer_cb(evutil_socket_t fd UNUSED,
+			    const short event UNUSED, void *arg)
+{
+	struct whack_writer *w = arg;
+	if (fd_flush(w->whackfd, false/*don't block*/) > 0) {
+		/* wait for whack to read more */
+		return;
+	}
+	/* either empty or whack has gone away */
+	free_whack_writer(w);
+}
+
+void free_whack_writers(void)
+{
+	while (whack_writers != NULL) {
+		dbg("exiting; abandoning buffered whack output");
+		free_whack_writer(whack_writers);
+	}
+}
+
+static void flush_whack_later(const struct fd *whackfd)
+{
+	if (!in_main_thread()) {
+		/*
+		 * Events and references belong to the main thread;
+		 * free_logger() hands over anything a helper left
+		 * buffered.
+		 */
+		return;
+	}
+	if (!fd_claim_flush(whackfd)) {
+		/* nothing buffered, or already being flushed */
+		return;
+	}
+	struct whack_writer *w = alloc_thing(struct whack_writer, "whack writer");
+	/* cast away const; only the reference count changes */
+	w->whackfd = dup_any((struct fd *)whackfd);
+	w->event = add_fd_write_event_handler(fd_fileno(whackfd), whack_writer_cb,
+					      w, "whack writer");
+	w->next = whack_writers;
+	whack_writers = w;
+}
+
 void jambuf_to_whack(struct lswlog *buf, const struct fd *whackfd, enum rc_type rc)
 {
 	/*
@@ -423,7 +496,10 @@ void jambuf_to_whack(struct lswlog *buf, const struct fd *whackfd, enum rc_type
 	/* write to whack socket, but suppress possible SIGPIPE */
 	if (fd_sendmsg(whackfd, &msg, MSG_NOSIGNAL, HERE) < 0) {
 		stdlog_raw("whack: ", "write to whack socket failed");
+		return;
 	}
+
+	flush_whack_later(whackfd);
 }
 
 /*
@@ -959,6 +1035,13 @@ struct logger *clone_logger(const struct logger *stack)
 
 void free_logger(struct logger **logp)
 {
+	/* a helper thread may have left output buffered */
+	if ((*logp)->global_whackfd != NULL) {
+		flush_whack_later((*logp)->global_whackfd);
+	}
+	if ((*logp)->object_whackfd != NULL) {
+		flush_whack_later((*logp)->object_whackfd);
+	}
 	close_any(&(*logp)->global_whackfd);
 	close_any(&(*logp)->object_whackfd);
 	/*
@@ -306,6 +306,9 @@ void jambuf_to_whack(jambuf_t *buf, const struct fd *whackfd, enum rc_type rc);
 		/*NO-PREFIX*/,						\
 		jambuf_to_whack(BUF, WHACKFD, RC))
 
+/* on exit, drop whack output still waiting to be flushed; before free_server() */
+void free_whack_writers(void);
+
 extern void show_status(struct show *s);
 extern void show_setup_plutomain(struct show *s);
 extern void show_setup_natt(struct show *s);
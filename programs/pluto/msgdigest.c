@@ -20,6 +20,48 @@
 #include "defs.h"
 #include "demux.h"      /* needs packet.h */
 
+/*
+ * At a high packet rate, allocating and freeing the (large) digest
+ * and its packet buffer for every message dominates; keep a few of
+ * each for re-use.
+ */
+
+#define MD_POOL_SIZE 64
+
+static struct msg_digest *md_pool[MD_POOL_SIZE];
+static unsigned md_pool_size;
+
+static uint8_t *md_packet_buffer_pool[MD_POOL_SIZE];
+static unsigned md_packet_buffer_pool_size;
+
+uint8_t *alloc_md_packet_buffer(void)
+{
+	if (md_packet_buffer_pool_size > 0) {
+		return md_packet_buffer_pool[--md_packet_buffer_pool_size];
+	}
+	return alloc_bytes(MD_PACKET_BUFFER_SIZE, "md packet buffer");
+}
+
+void free_md_packet_buffer(uint8_t **buffer)
+{
+	if (md_packet_buffer_pool_size < elemsof(md_packet_buffer_pool)) {
+		md_packet_buffer_pool[md_packet_buffer_pool_size++] = *buffer;
+	} else {
+		pfree(*buffer);
+	}
+	*buffer = NULL;
+}
+
+void free_md_pools(void)
+{
+	while (md_pool_size > 0) {
+		pfree(md_pool[--md_pool_size]);
+	}
+	while (md_packet_buffer_pool_size > 0) {
+		pfree(md_packet_buffer_pool[--md_packet_buffer_pool_size]);
+	}
+}
+
 struct msg_digest *alloc_md(const char *mdname)
 {
 	/* convenient initializer:
@@ -28,7 +70,8 @@ struct msg_digest *alloc_md(const char *mdname)
 	 * - .encrypted = FALSE
 	 */
 	static const struct msg_digest blank_md;
-	struct msg_digest *md = alloc_thing(struct msg_digest, mdname);
+	struct msg_digest *md = (md_pool_size > 0 ? md_pool[--md_pool_size] :
+				 alloc_thing(struct msg_digest, mdname));
 	*md = blank_md;
 	init_ref(md);
 	return md;
@@ -57,9 +100,19 @@ struct msg_digest *md_addref(struct msg_digest *md, where_t where)
 static void free_mdp(struct msg_digest **mdp,
 		     where_t unused_where UNUSED)
 {
-	free_chunk_content(&(*mdp)->raw_packet);
-	pfreeany((*mdp)->packet_pbs.start);
-	pfree(*mdp);
+	struct msg_digest *md = *mdp;
+	free_chunk_content(&md->raw_packet);
+	if (md->packet_buffer != NULL) {
+		/* packet_pbs points into it */
+		free_md_packet_buffer(&md->packet_buffer);
+	} else {
+		pfreeany(md->packet_pbs.start);
+	}
+	if (md_pool_size < elemsof(md_pool)) {
+		md_pool[md_pool_size++] = md;
+	} else {
+		pfree(md);
+	}
 	*mdp = NULL;
 }
 
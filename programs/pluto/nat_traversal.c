@@ -75,6 +75,7 @@
 #include "state_db.h"
 #include "ip_info.h"
 #include "iface.h"
+#include "pluto_stats.h"		/* for pstats_ike_out_bytes */
 
 /* As per https://tools.ietf.org/html/rfc3948#section-4 */
 #define DEFAULT_KEEP_ALIVE_SECS  20
@@ -82,7 +83,8 @@
 bool nat_traversal_enabled = TRUE; /* can get disabled if kernel lacks support */
 
 static deltatime_t nat_kap = DELTATIME_INIT(DEFAULT_KEEP_ALIVE_SECS);	/* keep-alive period */
-static bool nat_kap_event = FALSE;
+
+static void init_nat_keepalives(void);
 
 #define IKEV2_NATD_HASH_SIZE	SHA1_DIGEST_SIZE
 
@@ -96,7 +98,7 @@ void init_nat_traversal(deltatime_t keep_alive_period)
 	libreswan_log("NAT-Traversal support %s",
 		nat_traversal_enabled ? " [enabled]" : " [disabled]");
 
-	init_oneshot_timer(EVENT_NAT_T_KEEPALIVE, nat_traversal_ka_event);
+	init_nat_keepalives();
 }
 
 static struct crypt_mac natd_hash(const struct hash_desc *hasher,
@@ -339,6 +341,9 @@ static void natd_lookup_common(struct state *st,
 		address_buf b;
 		dbg("NAT_TRAVERSAL nat-keepalive enabled %s", str_address(sender, &b));
 	}
+
+	/* NATED_HOST may have just been set on an established SA */
+	schedule_nat_keepalive(st);
 }
 
 static void ikev1_natd_lookup(struct msg_digest *md)
@@ -618,132 +623,329 @@ void ikev1_natd_init(struct state *st, struct msg_digest *md)
 		}
 	}
 	if (st->hidden_variables.st_nat_traversal & NAT_T_WITH_KA) {
+		/* the IPsec SA is put on the wheel once established */
 		dbg(" NAT_T_WITH_KA detected");
-		nat_traversal_new_ka_event();
 	}
 }
 
-void nat_traversal_new_ka_event(void)
-{
-	if (nat_kap_event)
-		return;	/* Event already schedule */
+/*
+ * NAT-T keepalives.
+ *
+ * Each SA that is behind a NAT and wants keepalives is put on one
+ * slot of a wheel that turns once each keep-alive period.  The slot
+ * is picked from the SA's serial number so the SAs, and the packets,
+ * are spread evenly across the period instead of being sent in one
+ * burst.  Since every SA has the same period, an SA never moves: it
+ * is due again when the wheel comes back round.
+ *
+ * The wheel only holds serial numbers; an SA that has gone, or no
+ * longer needs keepalives, is dropped when its slot next comes due.
+ *
+ * The packets due in a slot are grouped by interface and, when the
+ * interface can, sent using one write per batch.
+ */
 
-	schedule_oneshot_timer(EVENT_NAT_T_KEEPALIVE, nat_kap);
-	nat_kap_event = TRUE;
-}
+#define NAT_KEEPALIVE_SLOTS 64
+#define NAT_KEEPALIVE_INTERFACES 8	/* interfaces batched at once */
+#define NAT_KEEPALIVE_BATCH 64		/* endpoints per batch */
 
-static void nat_traversal_send_ka(struct state *st)
-{
-	set_cur_state(st);
-	endpoint_buf b;
-	dbg("ka_event: send NAT-KA to %s (state=#%lu)",
-	    str_endpoint(&st->st_remote_endpoint, &b),
-	    st->st_serialno);
+struct nat_keepalive {
+	so_serial_t serialno;
+	struct list_entry entry;
+};
 
-	/* send keep alive */
-	dbg("sending NAT-T Keep Alive");
-	send_keepalive(st, "NAT-T Keep Alive");
-	reset_cur_state();
+static void jam_nat_keepalive(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "NAT-T keepalive NULL");
+	} else {
+		const struct nat_keepalive *ka = data;
+		jam(buf, "NAT-T keepalive #%lu", ka->serialno);
+	}
 }
 
+static const struct list_info nat_keepalive_info = {
+	.name = "NAT-T keepalive wheel",
+	.jam = jam_nat_keepalive,
+};
+
+static struct list_head nat_keepalive_wheel[NAT_KEEPALIVE_SLOTS];
+static unsigned nat_keepalive_slot;	/* the slot due next */
+static bool nat_keepalive_scheduled;
+static unsigned nr_nat_keepalives;
+
+static struct {
+	unsigned long sent;
+	unsigned long skipped;
+	unsigned long failed;
+	unsigned long writes;
+} nat_keepalive_stats;
+
+struct nat_keepalive_batch {
+	const struct iface_port *interface;
+	unsigned nr_endpoints;
+	ip_endpoint remote_endpoints[NAT_KEEPALIVE_BATCH];
+};
+
+static struct nat_keepalive_batch nat_keepalive_batches[NAT_KEEPALIVE_INTERFACES];
+
 /*
- * Find ISAKMP States with NAT-T and send keep-alive
+ * Is ST the kind of SA that sends keepalives: for IKEv2 the IKE SA;
+ * for IKEv1 the IPsec SA.
  */
-static void nat_traversal_ka_event_state(struct state *st, void *data)
+static bool nat_keepalive_candidate(const struct state *st)
 {
-	unsigned int *nat_kap_st = (unsigned int *)data;
 	const struct connection *c = st->st_connection;
 
 	if (!LHAS(st->hidden_variables.st_nat_traversal, NATED_HOST)) {
 		dbg("not behind NAT: no NAT-T KEEP-ALIVE required for conn %s",
 		    c->name);
-		return;
+		return false;
 	}
 
 	if (!c->nat_keepalive) {
 		dbg("Suppressing sending of NAT-T KEEP-ALIVE for conn %s (nat-keepalive=no)",
 		    c->name);
-		return;
+		return false;
 	}
 
 	/*
-	 * As long as we don't check get_sa_info() in IPsec SA's, and for
-	 * IKEv1 IPsec SA's always send a keepalive, we might as well
-	 * _not_ send keepalives for IKEv1 IKE SA's.
+	 * IKE SA and IPsec SA keepalives happen over the same
+	 * port/NAT mapping.
+	 *
+	 * For IKEv2, just use the one IKE SA instead of the one or
+	 * more IPsec SA's.
+	 *
+	 * For IKEv1, there can be orphan IPsec SA's so each sends its
+	 * own; and, as a consequence, we might as well _not_ send
+	 * keepalives for IKEv1 IKE SA's.
 	 */
-	if ((st->st_ike_version == IKEv2) && IS_IKE_SA_ESTABLISHED(st)) {
-		/*
-		 * - IKE SA established
-		 * - we are behind NAT
-		 * - NAT-KeepAlive needed (we are NATed)
-		 */
-		if (c->newest_isakmp_sa != st->st_serialno)
-			return;
+	switch (st->st_ike_version) {
+	case IKEv2:
+		return IS_IKE_SA_ESTABLISHED(st);
+	case IKEv1:
+		return IS_IPSEC_SA_ESTABLISHED(st);
+	default:
+		return false;
+	}
+}
 
-		/* consider this connection for the next global loop */
-		(*nat_kap_st)++;
+static bool nat_keepalive_wanted(const struct state *st)
+{
+	if (!nat_keepalive_candidate(st)) {
+		return false;
+	}
+	/* only the newest SA of each connection */
+	const struct connection *c = st->st_connection;
+	return (st->st_ike_version == IKEv2 ?
+		c->newest_isakmp_sa == st->st_serialno :
+		c->newest_ipsec_sa == st->st_serialno);
+}
 
-		/*
-		 * If this IKE SA sent a packet recently, no need for anything
-		 * eg, if short DPD timers are used we can skip this.
-		 */
-		if (!is_monotime_epoch(st->st_last_liveness) &&
-			deltasecs(monotimediff(mononow(), st->st_last_liveness)) < DEFAULT_KEEP_ALIVE_SECS)
-		{
-			dbg("NAT-T: keepalive packet not required as recent DPD event used the IKE SA on conn %s",
-			    c->name);
-			return;
-		}
+/*
+ * When some other packet went out through the NAT mapping within the
+ * last period there's no need for a keepalive.
+ */
+static bool nat_keepalive_recently_used(struct state *st)
+{
+	const struct connection *c = st->st_connection;
+	monotime_t now = mononow();
 
-		/*
-		 * TODO or not?
-		 * We could also check If there is IPsec SA encapsulation traffic, since
-		 * then we also do not need to send keepalives, but that check is a little
-		 * expensive as we have to find some/all IPsec states and ask the kernel,
-		 * every 20s.
-		 */
-		dbg("we are behind NAT: sending of NAT-T KEEP-ALIVE for conn %s (nat-keepalive=yes)",
+	/* eg, if short DPD timers are used we can skip this */
+	if (st->st_ike_version == IKEv2 &&
+	    !is_monotime_epoch(st->st_last_liveness) &&
+	    deltatime_cmp(monotimediff(now, st->st_last_liveness), <, nat_kap)) {
+		dbg("NAT-T: keepalive packet not required as recent DPD event used the IKE SA on conn %s",
 		    c->name);
-		nat_traversal_send_ka(st);
-		return;
+		return true;
 	}
 
 	/*
-	 * IKE SA and IPsec SA keepalives happen over the same port/NAT mapping.
-	 * If the IKE SA is idle and triggers keepalives, we don't need to check
-	 * IPsec SA's being idle. If we were to check IPsec SA, we could then
-	 * also update the IKE SA st->st_last_liveness, but we think this is
-	 * too expensive (call get_sa_info() to kernel _and_ find IKE SA.
-	 *
-	 * For IKEv2, just use the one IKE SA instead of the one or more IPsec SA's
-	 * (and ignore whether IPsec SA was active or not)
-	 *
-	 * for IKEv1, there can be orphan IPsec SA's. We still are not checking
-	 * the kernel, so we just have to always send the keepalive.
+	 * Outbound ESP-in-UDP traffic also keeps the mapping alive.
+	 * Only look when the SA counters are already cached and fresh;
+	 * keepalives must not drive a kernel dump (or query).
 	 */
-	if (st->st_ike_version == IKEv1 && IS_IPSEC_SA_ESTABLISHED(st) &&
-		c->newest_ipsec_sa == st->st_serialno)
-	{
-		nat_traversal_send_ka(st);
-		(*nat_kap_st)++;
+	struct state *ipsec = (st->st_ike_version == IKEv2 ?
+			       state_with_serialno(c->newest_ipsec_sa) : st);
+	if (ipsec == NULL ||
+	    (ipsec != st && ipsec->st_clonedfrom != st->st_serialno) ||
+	    !IS_IPSEC_SA_ESTABLISHED(ipsec)) {
+		return false;
 	}
+	deltatime_t ago;
+	if (get_cached_sa_info(ipsec, false, &ago) &&
+	    deltatime_cmp(ago, <, nat_kap)) {
+		dbg("NAT-T: keepalive packet not required as IPsec SA #%lu sent traffic on conn %s",
+		    ipsec->st_serialno, c->name);
+		return true;
+	}
+	return false;
 }
 
-void nat_traversal_ka_event(struct fd *unused_whackfd UNUSED)
+static void flush_nat_keepalive_batch(struct nat_keepalive_batch *b)
 {
-	unsigned int nat_kap_st = 0;
+	/* same as send_keepalive() */
+	static const uint8_t ka_payload = 0xff;
 
-	nat_kap_event = FALSE;  /* ready to be reschedule */
+	if (b->nr_endpoints == 0) {
+		return;
+	}
+	dbg("NAT-T: sending %u keepalives through %s",
+	    b->nr_endpoints, b->interface->ip_dev->id_rname);
+	unsigned sent = b->interface->io->write_packets(b->interface,
+							&ka_payload, sizeof(ka_payload),
+							b->remote_endpoints,
+							b->nr_endpoints);
+	nat_keepalive_stats.writes++;
+	nat_keepalive_stats.sent += sent;
+	nat_keepalive_stats.failed += b->nr_endpoints - sent;
+	pstats_ike_out_bytes += sent * sizeof(ka_payload);
+	b->nr_endpoints = 0;
+}
 
-	for_each_state(nat_traversal_ka_event_state, &nat_kap_st, __func__);
+static void send_nat_keepalive(struct state *st)
+{
+	const struct iface_port *interface = st->st_interface;
 
-	if (nat_kap_st != 0) {
-		/*
-		 * If there are still states who needs Keep-Alive,
-		 * schedule new event
-		 */
-		nat_traversal_new_ka_event();
+	endpoint_buf eb;
+	dbg("ka_event: send NAT-KA to %s (state=#%lu)",
+	    str_endpoint(&st->st_remote_endpoint, &eb),
+	    st->st_serialno);
+
+	if (interface == NULL || interface->io->write_packets == NULL ||
+	    isanyaddr(&st->st_remote_endpoint)) {
+		/* let send_keepalive() sort it out */
+		set_cur_state(st);
+		if (send_keepalive(st, "NAT-T Keep Alive")) {
+			nat_keepalive_stats.sent++;
+		} else {
+			nat_keepalive_stats.failed++;
+		}
+		reset_cur_state();
+		return;
+	}
+
+	/* find this interface's batch, or an unused one */
+	struct nat_keepalive_batch *b = NULL;
+	for (unsigned i = 0; i < elemsof(nat_keepalive_batches); i++) {
+		struct nat_keepalive_batch *batch = &nat_keepalive_batches[i];
+		if (batch->interface == interface) {
+			b = batch;
+			break;
+		}
+		if (b == NULL && batch->nr_endpoints == 0) {
+			b = batch;
+		}
+	}
+	if (b == NULL) {
+		/* more interfaces than batches */
+		b = &nat_keepalive_batches[0];
+		flush_nat_keepalive_batch(b);
+	}
+	if (b->interface != interface) {
+		passert(b->nr_endpoints == 0);
+		b->interface = interface;
+	}
+
+	b->remote_endpoints[b->nr_endpoints++] = st->st_remote_endpoint;
+	if (b->nr_endpoints == elemsof(b->remote_endpoints)) {
+		flush_nat_keepalive_batch(b);
+	}
+}
+
+static void schedule_nat_keepalive_event(void)
+{
+	if (nat_keepalive_scheduled || nr_nat_keepalives == 0) {
+		return;
+	}
+	intmax_t ms = deltamillisecs(nat_kap) / NAT_KEEPALIVE_SLOTS;
+	schedule_oneshot_timer(EVENT_NAT_T_KEEPALIVE, deltatime_ms(ms > 0 ? ms : 1));
+	nat_keepalive_scheduled = true;
+}
+
+void schedule_nat_keepalive(struct state *st)
+{
+	if (st->st_nat_keepalive || !nat_keepalive_candidate(st)) {
+		return;
+	}
+
+	dbg("we are behind NAT: sending of NAT-T KEEP-ALIVE for conn %s (nat-keepalive=yes)",
+	    st->st_connection->name);
+
+	struct nat_keepalive *ka = alloc_thing(struct nat_keepalive, "NAT-T keepalive");
+	ka->serialno = st->st_serialno;
+	ka->entry = list_entry(&nat_keepalive_info, ka);
+	insert_list_entry(&nat_keepalive_wheel[st->st_serialno % NAT_KEEPALIVE_SLOTS],
+			  &ka->entry);
+	st->st_nat_keepalive = true;
+	nr_nat_keepalives++;
+
+	schedule_nat_keepalive_event();
+}
+
+static void nat_keepalive_event(struct fd *unused_whackfd UNUSED)
+{
+	nat_keepalive_scheduled = false;
+
+	struct list_head *slot = &nat_keepalive_wheel[nat_keepalive_slot];
+	nat_keepalive_slot = (nat_keepalive_slot + 1) % NAT_KEEPALIVE_SLOTS;
+
+	struct nat_keepalive *ka;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(slot, ka) {
+		struct state *st = state_with_serialno(ka->serialno);
+		if (st == NULL || !nat_keepalive_wanted(st)) {
+			dbg("NAT-T: #%lu no longer needs keepalives", ka->serialno);
+			if (st != NULL) {
+				st->st_nat_keepalive = false;
+			}
+			remove_list_entry(&ka->entry);
+			pfree(ka);
+			nr_nat_keepalives--;
+			continue;
+		}
+		if (nat_keepalive_recently_used(st)) {
+			nat_keepalive_stats.skipped++;
+			continue;
+		}
+		send_nat_keepalive(st);
+	}
+
+	for (unsigned i = 0; i < elemsof(nat_keepalive_batches); i++) {
+		flush_nat_keepalive_batch(&nat_keepalive_batches[i]);
+	}
+
+	schedule_nat_keepalive_event();
+}
+
+static void init_nat_keepalives(void)
+{
+	for (unsigned i = 0; i < elemsof(nat_keepalive_wheel); i++) {
+		struct list_head *slot = &nat_keepalive_wheel[i];
+		*slot = (struct list_head) INIT_LIST_HEAD(slot, &nat_keepalive_info);
+	}
+	init_oneshot_timer(EVENT_NAT_T_KEEPALIVE, nat_keepalive_event);
+}
+
+void free_nat_keepalives(void)
+{
+	for (unsigned i = 0; i < elemsof(nat_keepalive_wheel); i++) {
+		struct nat_keepalive *ka;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&nat_keepalive_wheel[i], ka) {
+			remove_list_entry(&ka->entry);
+			pfree(ka);
+		}
 	}
+	nr_nat_keepalives = 0;
+}
+
+void show_nat_keepalive_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	whack_print(whackfd, "current.natt.keepalive.sas=%u", nr_nat_keepalives);
+	whack_print(whackfd, "total.natt.keepalive.sent=%lu", nat_keepalive_stats.sent);
+	whack_print(whackfd, "total.natt.keepalive.skipped=%lu", nat_keepalive_stats.skipped);
+	whack_print(whackfd, "total.natt.keepalive.failed=%lu", nat_keepalive_stats.failed);
+	whack_print(whackfd, "total.natt.keepalive.writes=%lu", nat_keepalive_stats.writes);
 }
 
 struct new_mapp_nfo {
@@ -87,6 +87,7 @@ extern void ikev2_natd_lookup(struct msg_digest *md,
  * NAT-OA
  */
 struct hidden_variables;	/* forward */
+struct show;
 
 void nat_traversal_natoa_lookup(struct msg_digest *md,
 				struct hidden_variables *hv);
@@ -101,9 +102,15 @@ void v1_maybe_natify_initiator_endpoints(struct state *st,
 
 /**
  * NAT-keep_alive
- */
-void nat_traversal_new_ka_event(void);
-void nat_traversal_ka_event(struct fd *whackfd);
+ *
+ * Called whenever ST changes state or its NAT status (NATED_HOST) or
+ * endpoints may have changed; once an SA behind a NAT is established
+ * it is sent a keepalive each keep-alive period unless it has
+ * recently sent other traffic.
+ */
+void schedule_nat_keepalive(struct state *st);
+void free_nat_keepalives(void);
+void show_nat_keepalive_status(struct show *s);
 
 extern void ikev1_natd_init(struct state *st, struct msg_digest *md);
 
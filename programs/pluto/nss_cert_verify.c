@@ -25,6 +25,7 @@
 #include <dirent.h>
 #include <time.h>
 #include <limits.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include "sysdep.h"
 #include "lswnss.h"
@@ -46,6 +47,11 @@
 #include "root_certs.h"
 #include "ip_info.h"
 #include "log.h"
+#include "crypt_hash.h"
+#include "ike_alg_hash.h"	/* for ike_alg_hash_sha2_256 */
+#include "monotime.h"
+#include "whack.h"		/* for whack_print() */
+#include "show.h"
 
 /*
  * set up the slot/handle/trust things that NSS needs
@@ -508,6 +514,271 @@ static struct certs *decode_cert_payloads(CERTCertDBHandle *handle,
 	return certs;
 }
 
+/*
+ * Cache of chains that verified.
+ *
+ * Peers tend to present the same chain each time they reconnect or
+ * rekey.  Once a chain has passed verify_end_cert() (with current
+ * CRLs) remember the SHA-256 of its CERT payloads, along with the
+ * generation of the root certificates and of the CRLs it was checked
+ * against; a later exchange presenting the same chain can then skip
+ * path validation.
+ *
+ * An entry is forgotten once cert-cache-lifetime has passed or a
+ * certificate in the chain expires, whichever comes first; and all
+ * entries are forgotten when a CRL is imported or the NSS DB is
+ * re-read.  Only successes are cached.
+ *
+ * find_and_verify_certs() runs on the helper threads, hence the lock.
+ */
+
+#define MAX_VERIFIED_CHAINS 1024
+#define NR_VERIFIED_CHAIN_SLOTS 256	/* power of two */
+
+deltatime_t verified_chain_lifetime = DELTATIME_INIT(CERT_CACHE_LIFETIME_DEFAULT);
+
+struct verified_chain {
+	struct crypt_mac hash;
+	unsigned long root_certs_generation;
+	unsigned long crl_generation;
+	struct rev_opts rev_opts;
+	monotime_t expires;
+	PRTime not_after;		/* of the first cert to expire */
+	struct list_entry lru_entry;	/* newest is most recently used */
+	struct list_entry slot_entry;
+};
+
+static void jam_verified_chain(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "no verified chain");
+	} else {
+		const struct verified_chain *vc = data;
+		jam(buf, "verified chain %p", vc);
+	}
+}
+
+static const struct list_info verified_chain_info = {
+	.name = "verified chain cache",
+	.jam = jam_verified_chain,
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	unsigned long crl_generation;
+	unsigned nr_entries;
+	struct list_head lru;
+	struct list_head slots[NR_VERIFIED_CHAIN_SLOTS];
+	bool initialized;
+	struct {
+		unsigned long hits;
+		unsigned long misses;
+		unsigned long expired;
+		unsigned long evicted;
+		unsigned long flushes;
+	} stats;
+} verified_chains = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* lock must be held */
+static void init_verified_chains(void)
+{
+	if (!verified_chains.initialized) {
+		verified_chains.lru = (struct list_head)
+			INIT_LIST_HEAD(&verified_chains.lru, &verified_chain_info);
+		for (unsigned i = 0; i < elemsof(verified_chains.slots); i++) {
+			verified_chains.slots[i] = (struct list_head)
+				INIT_LIST_HEAD(&verified_chains.slots[i], &verified_chain_info);
+		}
+		verified_chains.initialized = true;
+	}
+}
+
+/* the hash is SHA-256 so any bits will do */
+static struct list_head *verified_chain_slot(const struct crypt_mac *hash)
+{
+	unsigned h;
+	memcpy(&h, hash->ptr, sizeof(h));
+	return &verified_chains.slots[h & (NR_VERIFIED_CHAIN_SLOTS - 1)];
+}
+
+/* lock must be held */
+static void free_verified_chain(struct verified_chain **vc)
+{
+	remove_list_entry(&(*vc)->lru_entry);
+	remove_list_entry(&(*vc)->slot_entry);
+	verified_chains.nr_entries--;
+	pfree(*vc);
+	*vc = NULL;
+}
+
+static struct crypt_mac hash_cert_payloads(enum ike_version ike_version,
+					   struct payload_digest *cert_payloads)
+{
+	struct crypt_hash *ctx = crypt_hash_init("verified chain",
+						 &ike_alg_hash_sha2_256);
+	for (struct payload_digest *p = cert_payloads; p != NULL; p = p->next) {
+		uint8_t cert_type = (ike_version == IKEv2 ? p->payload.v2cert.isac_enc :
+				     p->payload.cert.isacert_type);
+		shunk_t payload = pbs_in_left_as_shunk(&p->pbs);
+		uint32_t len = payload.len;
+		crypt_hash_digest_byte(ctx, "type", cert_type);
+		crypt_hash_digest_thing(ctx, "length", len);
+		crypt_hash_digest_hunk(ctx, "payload", payload);
+	}
+	return crypt_hash_final_mac(&ctx);
+}
+
+static bool verified_chain_cached(const struct crypt_mac *hash,
+				  const struct root_certs *root_certs,
+				  const struct rev_opts *rev_opts)
+{
+	if (deltasecs(verified_chain_lifetime) == 0) {
+		return false;
+	}
+
+	bool hit = false;
+	monotime_t now = mononow();
+	PRTime prnow = PR_Now();
+	pthread_mutex_lock(&verified_chains.mutex);
+	{
+		init_verified_chains();
+		struct verified_chain *vc;
+		FOR_EACH_LIST_ENTRY_NEW2OLD(verified_chain_slot(hash), vc) {
+			if (!hunk_eq(vc->hash, *hash) ||
+			    vc->root_certs_generation != root_certs->generation ||
+			    vc->crl_generation != verified_chains.crl_generation ||
+			    !memeq(&vc->rev_opts, rev_opts, sizeof(*rev_opts))) {
+				continue;
+			}
+			if (monobefore(vc->expires, now) || vc->not_after < prnow) {
+				verified_chains.stats.expired++;
+				free_verified_chain(&vc);
+				break;
+			}
+			/* move to the front of the LRU */
+			remove_list_entry(&vc->lru_entry);
+			insert_list_entry(&verified_chains.lru, &vc->lru_entry);
+			hit = true;
+			break;
+		}
+		if (hit) {
+			verified_chains.stats.hits++;
+		} else {
+			verified_chains.stats.misses++;
+		}
+	}
+	pthread_mutex_unlock(&verified_chains.mutex);
+	return hit;
+}
+
+static void add_verified_chain(const struct crypt_mac *hash,
+			       const struct root_certs *root_certs,
+			       const struct rev_opts *rev_opts,
+			       unsigned long crl_generation,
+			       struct certs *certs)
+{
+	if (deltasecs(verified_chain_lifetime) == 0) {
+		return;
+	}
+
+	/* the entry can't outlive any cert in the chain */
+	PRTime not_after = LL_MAXINT;
+	for (struct certs *entry = certs; entry != NULL; entry = entry->next) {
+		PRTime cert_not_before, cert_not_after;
+		if (CERT_GetCertTimes(entry->cert, &cert_not_before,
+				      &cert_not_after) != SECSuccess) {
+			return;
+		}
+		if (cert_not_after < not_after) {
+			not_after = cert_not_after;
+		}
+	}
+
+	struct verified_chain *vc = alloc_thing(struct verified_chain, "verified chain");
+	vc->hash = *hash;
+	vc->root_certs_generation = root_certs->generation;
+	vc->crl_generation = crl_generation;
+	vc->rev_opts = *rev_opts;
+	vc->expires = monotime_add(mononow(), verified_chain_lifetime);
+	vc->not_after = not_after;
+	vc->lru_entry = list_entry(&verified_chain_info, vc);
+	vc->slot_entry = list_entry(&verified_chain_info, vc);
+
+	pthread_mutex_lock(&verified_chains.mutex);
+	{
+		init_verified_chains();
+		if (crl_generation != verified_chains.crl_generation) {
+			/* a CRL arrived while verifying; result is stale */
+			pfree(vc);
+		} else {
+			if (verified_chains.nr_entries >= MAX_VERIFIED_CHAINS) {
+				struct verified_chain *oldest;
+				FOR_EACH_LIST_ENTRY_OLD2NEW(&verified_chains.lru, oldest) {
+					free_verified_chain(&oldest);
+					verified_chains.stats.evicted++;
+					break;
+				}
+			}
+			insert_list_entry(&verified_chains.lru, &vc->lru_entry);
+			insert_list_entry(verified_chain_slot(hash), &vc->slot_entry);
+			verified_chains.nr_entries++;
+		}
+	}
+	pthread_mutex_unlock(&verified_chains.mutex);
+}
+
+static unsigned long verified_chains_crl_generation(void)
+{
+	pthread_mutex_lock(&verified_chains.mutex);
+	unsigned long generation = verified_chains.crl_generation;
+	pthread_mutex_unlock(&verified_chains.mutex);
+	return generation;
+}
+
+void flush_verified_chains(const char *why)
+{
+	unsigned nr_flushed = 0;
+	pthread_mutex_lock(&verified_chains.mutex);
+	{
+		init_verified_chains();
+		verified_chains.crl_generation++;
+		struct verified_chain *vc;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&verified_chains.lru, vc) {
+			free_verified_chain(&vc);
+			nr_flushed++;
+		}
+		verified_chains.stats.flushes++;
+	}
+	pthread_mutex_unlock(&verified_chains.mutex);
+	dbg("%s: flushed %u verified certificate chains", why, nr_flushed);
+}
+
+void free_verified_chains(void)
+{
+	flush_verified_chains("shutdown");
+}
+
+void show_verified_chains_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	pthread_mutex_lock(&verified_chains.mutex);
+	whack_print(whackfd, "current.cert_cache.entries=%u",
+		    verified_chains.nr_entries);
+	whack_print(whackfd, "total.cert_cache.hits=%lu",
+		    verified_chains.stats.hits);
+	whack_print(whackfd, "total.cert_cache.misses=%lu",
+		    verified_chains.stats.misses);
+	whack_print(whackfd, "total.cert_cache.expired=%lu",
+		    verified_chains.stats.expired);
+	whack_print(whackfd, "total.cert_cache.evicted=%lu",
+		    verified_chains.stats.evicted);
+	whack_print(whackfd, "total.cert_cache.flushes=%lu",
+		    verified_chains.stats.flushes);
+	pthread_mutex_unlock(&verified_chains.mutex);
+}
+
 /*
  * Decode and verify the chain received by pluto.
  * ee_out is the resulting end cert
@@ -585,6 +856,21 @@ struct verified_certs find_and_verify_certs(struct logger *logger,
 		return result;
 	}
 
+	/*
+	 * Seen (and verified) this exact chain recently?  Skip the
+	 * CRL and path checks.
+	 */
+	struct crypt_mac chain_hash = hash_cert_payloads(ike_version, cert_payloads);
+	if (verified_chain_cached(&chain_hash, root_certs, rev_opts)) {
+		dbg("certificate chain for %s verified earlier", end_cert->subjectName);
+		logtime_t start_add = logtime_start(logger);
+		add_pubkey_from_nss_cert(&result.pubkey_db, keyid, end_cert, logger);
+		logtime_stop(&start_add, "%s() calling add_pubkey_from_nss_cert()", __func__);
+		return result;
+	}
+	/* before checking; so a CRL arriving meanwhile is noticed */
+	unsigned long crl_generation = verified_chains_crl_generation();
+
 	logtime_t crl_time = logtime_start(logger);
 	bool crl_update_needed = crl_update_check(handle, result.cert_chain);
 	logtime_stop(&crl_time, "%s() calling crl_update_check()", __func__);
@@ -614,6 +900,11 @@ struct verified_certs find_and_verify_certs(struct logger *logger,
 		return result;
 	}
 
+	if (!crl_update_needed) {
+		add_verified_chain(&chain_hash, root_certs, rev_opts,
+				   crl_generation, result.cert_chain);
+	}
+
 	logtime_t start_add = logtime_start(logger);
 	add_pubkey_from_nss_cert(&result.pubkey_db, keyid, end_cert, logger);
 	logtime_stop(&start_add, "%s() calling add_pubkey_from_nss_cert()", __func__);
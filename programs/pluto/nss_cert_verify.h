@@ -21,6 +21,7 @@
 
 #include "defs.h"
 #include "chunk.h"
+#include "deltatime.h"
 
 struct certs;
 struct payload_digest;
@@ -55,6 +56,18 @@ struct verified_certs find_and_verify_certs(struct logger *log,
 					    struct root_certs *root_cert,
 					    const struct id *keyid);
 
+/*
+ * Chains that verified are remembered, for cert-cache-lifetime, so
+ * that a peer presenting the same chain again skips path validation.
+ * Flush them when a CRL is imported or the NSS DB is re-read, and
+ * free them at exit (before NSS is shut down).
+ */
+extern deltatime_t verified_chain_lifetime;
+void flush_verified_chains(const char *why);
+void free_verified_chains(void);
+struct show;
+void show_verified_chains_status(struct show *s);
+
 extern bool cert_VerifySubjectAltName(const CERTCertificate *cert,
 				      const struct id *id);
 
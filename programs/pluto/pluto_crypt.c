@@ -56,6 +56,7 @@
 #include "crypt_dh.h"
 #include "ikev1_prf.h"
 #include "state_db.h"
+#include "show.h"
 
 #include "ikev1.h"	/* for complete_v1_state_transition() */
 #include "ikev2.h"	/* for complete_v2_state_transition() */
@@ -98,6 +99,9 @@ struct pluto_crypto_req_cont {
 	struct crypto_task *pcrc_task;
 	const struct crypto_handler *pcrc_handler;
 	struct list_entry pcrc_backlog;
+	struct helper_queue *pcrc_queue;	/* where it was submitted */
+	struct list_entry pcrc_answer;
+	monotime_t pcrc_submitted;
 	so_serial_t pcrc_serialno;	/* sponsoring state's serial number */
 	bool pcrc_cancelled;
 	const char *pcrc_name;
@@ -114,7 +118,22 @@ struct pluto_crypto_req_cont {
 };
 
 /*
- * The work queue.  Accesses must be locked.
+ * The work queues.
+ *
+ * Each helper has its own queue, with its own lock, so that
+ * submitting work and helpers grabbing work don't all contend on a
+ * single mutex (and a single condition variable that wakes every
+ * idle helper).  Work is submitted to the queue with the least
+ * outstanding work; a helper with nothing on its own queue steals
+ * the oldest work-order from another helper's queue before going to
+ * sleep.  When work is left waiting on a queue (its helper is busy,
+ * or there's more than one work-order) a sleeping helper is poked so
+ * that it can steal it.
+ *
+ * Answers go the other way through a single locked list; the main
+ * thread is only poked (by writing to a pipe) when the list goes
+ * from empty to non-empty, and then drains everything queued in one
+ * go.
  */
 
 static void jam_backlog(struct lswlog *buf, const void *data)
@@ -141,11 +160,65 @@ static const struct list_info backlog_info = {
 	.jam = jam_backlog,
 };
 
-static pthread_mutex_t backlog_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t backlog_cond = PTHREAD_COND_INITIALIZER;
+struct helper_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct list_head backlog;
+	/* protected by mutex */
+	unsigned long depth;
+	unsigned long max_depth;
+	unsigned long steals;	/* by this queue's helper */
+	unsigned long stolen;	/* from this queue */
+	bool sleeping;		/* helper is, or is about to, wait */
+	bool poked;		/* helper was woken to steal */
+	/* main thread only */
+	unsigned long outstanding;	/* submitted, not yet answered */
+};
+
+static struct helper_queue *helper_queues = NULL;
+static unsigned nr_helper_queues = 0;
+
+static const struct list_info answers_info = {
+	.name = "helper answers",
+	.jam = jam_backlog,
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	struct list_head list;	/* protected by mutex */
+	int send;
+	int recv;
+	/* main thread only */
+	unsigned long batches;
+	unsigned long answers;
+	unsigned long max_batch;
+} helper_answers = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.list = INIT_LIST_HEAD(&helper_answers.list, &answers_info),
+	.send = -1,
+	.recv = -1,
+};
+
+/*
+ * Latency, from submit to the answer being drained, of each type of
+ * crypto operation; bucket N counts work-orders that took less than
+ * 2^N milliseconds (the last bucket counts everything else).
+ *
+ * Only touched by the main thread.
+ *
+ * Operations are either a pcr_* request type or a crypto_handler,
+ * neither of which is enumerated; so, with room to spare, there are
+ * MAX_CRYPTO_OPS slots and running out is a bug.
+ */
+
+#define CRYPTO_LATENCY_BUCKETS 12
+#define MAX_CRYPTO_OPS 16
 
-struct list_head backlog = INIT_LIST_HEAD(&backlog, &backlog_info);
-static int backlog_queue_len = 0;
+static struct crypto_op_stats {
+	const char *name;
+	unsigned long count;
+	unsigned long latency[CRYPTO_LATENCY_BUCKETS];
+} crypto_op_stats[MAX_CRYPTO_OPS];
 
 /*
  * Create the pluto crypto request object.
@@ -159,6 +232,7 @@ struct pluto_crypto_req_cont *new_pcrc(crypto_req_cont_func fn,
 	r->pcrc_cancelled = false;
 	r->pcrc_name = name;
 	r->pcrc_backlog = list_entry(&backlog_info, r);
+	r->pcrc_answer = list_entry(&answers_info, r);
 	r->pcrc_serialno = SOS_NOBODY;
 	return r;
 }
@@ -363,6 +437,149 @@ static void pcr_compute(struct logger *logger_unused UNUSED,
 	}
 }
 
+/*
+ * Remove the oldest work-order from Q (which must be locked) and
+ * assign it to helper W.
+ */
+
+static struct pluto_crypto_req_cont *take_work_order(struct helper_queue *q,
+						     struct pluto_crypto_worker *w)
+{
+	struct pluto_crypto_req_cont *cn = NULL;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&q->backlog, cn) { break; }
+	if (cn != NULL) {
+		remove_list_entry(&cn->pcrc_backlog);
+		q->depth--;
+		cn->pcrc_helpernum = w->pcw_helpernum;
+		w->pcw_pcrc_id = cn->pcrc_id;
+		w->pcw_pcrc_serialno = cn->pcrc_serialno;
+	}
+	return cn;
+}
+
+/* IN A HELPER THREAD */
+static struct pluto_crypto_req_cont *steal_work_order(struct pluto_crypto_worker *w)
+{
+	for (unsigned i = 1; i < nr_helper_queues; i++) {
+		struct helper_queue *q =
+			&helper_queues[(w->pcw_helpernum + i) % nr_helper_queues];
+		struct pluto_crypto_req_cont *cn = NULL;
+		pthread_mutex_lock(&q->mutex);
+		{
+			cn = take_work_order(q, w);
+			if (cn != NULL) {
+				q->stolen++;
+			}
+		}
+		pthread_mutex_unlock(&q->mutex);
+		if (cn != NULL) {
+			dbg("crypto helper %d stole work-order %u from helper %td",
+			    w->pcw_helpernum, cn->pcrc_id, q - helper_queues);
+			return cn;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * IN A HELPER THREAD
+ *
+ * Grab the next work-order: first from this helper's own queue, then
+ * from any other queue, and failing that wait for something to be
+ * added to this helper's queue (or to be poked by
+ * wake_sleeping_helper()).  Returns NULL when pluto is exiting.
+ *
+ * Before waiting the helper is marked as sleeping and then looks
+ * once more; anything submitted after that look sees the mark and
+ * pokes it so nothing is left waiting while a helper sleeps.
+ */
+static struct pluto_crypto_req_cont *next_work_order(struct pluto_crypto_worker *w)
+{
+	struct helper_queue *own = &helper_queues[w->pcw_helpernum];
+	while (true) {
+		struct pluto_crypto_req_cont *cn = NULL;
+		pthread_mutex_lock(&own->mutex);
+		{
+			cn = take_work_order(own, w);
+			if (cn != NULL) {
+				own->sleeping = false;
+			}
+		}
+		pthread_mutex_unlock(&own->mutex);
+		if (cn != NULL) {
+			return cn;
+		}
+
+		cn = steal_work_order(w);
+		if (cn != NULL) {
+			pthread_mutex_lock(&own->mutex);
+			own->steals++;
+			own->sleeping = false;
+			pthread_mutex_unlock(&own->mutex);
+			return cn;
+		}
+
+		/*
+		 * Nothing to do; top up the DH keypair pool (one
+		 * keypair at a time so that new work isn't kept
+		 * waiting).
+		 */
+		if (!exiting_pluto && refill_dh_keypair_pool()) {
+			continue;
+		}
+
+		bool exiting;
+		pthread_mutex_lock(&own->mutex);
+		{
+			/*
+			 * Re-check under the lock; anything added
+			 * since the above is picked up next time
+			 * round.
+			 */
+			exiting = exiting_pluto;
+			if (!own->sleeping) {
+				/* mark, then look again */
+				own->sleeping = true;
+			} else if (!exiting && own->depth == 0 && !own->poked) {
+				dbg("crypto helper %d waiting (nothing to do)",
+				    w->pcw_helpernum);
+				pthread_cond_wait(&own->cond, &own->mutex);
+				dbg("crypto helper %d resuming", w->pcw_helpernum);
+				own->poked = false;
+			} else {
+				own->poked = false;
+			}
+		}
+		pthread_mutex_unlock(&own->mutex);
+		if (exiting) {
+			return NULL;
+		}
+	}
+}
+
+/*
+ * IN A HELPER THREAD
+ *
+ * Queue the answer for the main thread; only the first answer of a
+ * batch needs to wake it up.
+ */
+static void send_helper_answer(struct pluto_crypto_req_cont *cn)
+{
+	pthread_mutex_lock(&helper_answers.mutex);
+	{
+		void *head = NULL;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&helper_answers.list, head) { break; }
+		insert_list_entry(&helper_answers.list, &cn->pcrc_answer);
+		if (head == NULL) {
+			char poke = 0;
+			if (write(helper_answers.send, &poke, sizeof(poke)) != sizeof(poke)) {
+				LOG_ERRNO(errno, "problem writing to helper answer pipe");
+			}
+		}
+	}
+	pthread_mutex_unlock(&helper_answers.mutex);
+}
+
 /* IN A HELPER THREAD */
 static void *pluto_crypto_helper_thread(void *arg)
 {
@@ -385,47 +602,14 @@ static void *pluto_crypto_helper_thread(void *arg)
 	while (true) {
 		w->pcw_pcrc_id = 0;
 		w->pcw_pcrc_serialno = SOS_NOBODY;
-		struct pluto_crypto_req_cont *cn = NULL;
-		pthread_mutex_lock(&backlog_mutex);
-		{
+		struct pluto_crypto_req_cont *cn = next_work_order(w);
+		if (cn == NULL) {
 			/*
-			 * Search the backlog[] for something to do.
-			 * If needed wait.
+			 * No CN implies pluto is exiting but not
+			 * reverse - could grab a CN in parallel to
+			 * pluto starting to exit.
 			 */
-			pexpect(cn == NULL);
-			while (!exiting_pluto) {
-				/* grab the next entry, if there is one */
-				pexpect(cn == NULL);
-				FOR_EACH_LIST_ENTRY_OLD2NEW(&backlog, cn) { break; }
-				if (cn != NULL) {
-					/*
-					 * Assign the entry to this
-					 * thread, removing it from
-					 * the backlog.
-					 */
-					remove_list_entry(&cn->pcrc_backlog);
-					cn->pcrc_helpernum = w->pcw_helpernum;
-					w->pcw_pcrc_id = cn->pcrc_id;
-					w->pcw_pcrc_serialno = cn->pcrc_serialno;
-					break;
-				}
-				dbg("crypto helper %d waiting (nothing to do)",
-				    w->pcw_helpernum);
-				pthread_cond_wait(&backlog_cond, &backlog_mutex);
-				dbg("crypto helper %d resuming", w->pcw_helpernum);
-			}
-			if (cn == NULL) {
-				/*
-				 * No CN implies pluto is exiting but
-				 * not reverse - could grab a CN in
-				 * parallel to pluto starting to exit.
-				 */
-				pexpect(exiting_pluto);
-			}
-		}
-		pthread_mutex_unlock(&backlog_mutex);
-		if (cn == NULL) {
-			/* per above, must be shutting down */
+			pexpect(exiting_pluto);
 			break;
 		}
 		if (!cn->pcrc_cancelled) {
@@ -437,8 +621,7 @@ static void *pluto_crypto_helper_thread(void *arg)
 		dbg("crypto helper %d sending results from work-order %u for state #%lu to event queue",
 		    w->pcw_helpernum, w->pcw_pcrc_id,
 		    w->pcw_pcrc_serialno);
-		schedule_resume("sending helper answer", w->pcw_pcrc_serialno,
-				handle_helper_answer, cn);
+		send_helper_answer(cn);
 	}
 	dbg("shutting down helper thread %d", w->pcw_helpernum);
 	if (write(helper_exited.send, &w, sizeof(w)) != sizeof(w)) {
@@ -505,6 +688,33 @@ static void inline_worker(struct state *unused_st UNUSED,
  *
  */
 
+/*
+ * Work is waiting on Q (which isn't locked); poke one sleeping helper
+ * so that it steals it.
+ */
+
+static void wake_sleeping_helper(struct helper_queue *q)
+{
+	for (unsigned i = 1; i < nr_helper_queues; i++) {
+		struct helper_queue *o =
+			&helper_queues[(q - helper_queues + i) % nr_helper_queues];
+		bool poked = false;
+		pthread_mutex_lock(&o->mutex);
+		{
+			if (o->sleeping && !o->poked) {
+				o->poked = poked = true;
+				pthread_cond_signal(&o->cond);
+			}
+		}
+		pthread_mutex_unlock(&o->mutex);
+		if (poked) {
+			dbg("poked crypto helper %td to steal from helper %td",
+			    o - helper_queues, q - helper_queues);
+			return;
+		}
+	}
+}
+
 static void submit_crypto_request(struct pluto_crypto_req_cont *cn,
 				  const struct logger *logger,
 				  struct state *st,
@@ -520,6 +730,7 @@ static void submit_crypto_request(struct pluto_crypto_req_cont *cn,
 	cn->pcrc_id = ++pcw_id;
 	cn->pcrc_handler = handler;
 	cn->pcrc_task = task;
+	cn->pcrc_submitted = mononow();
 
 	/*
 	 * Save in case it needs to be cancelled.
@@ -549,18 +760,37 @@ static void submit_crypto_request(struct pluto_crypto_req_cont *cn,
 		 * Clearing retransmits here is wrong, for instance
 		 * when crypto is being run in the background.
 		 */
-		delete_event(st);
-		clear_retransmits(st);
-		event_schedule(EVENT_CRYPTO_TIMEOUT, EVENT_CRYPTO_TIMEOUT_DELAY, st);
-		/* add to backlog */
-		pthread_mutex_lock(&backlog_mutex);
+		if (!handler->keep_state_events) {
+			delete_event(st);
+			clear_retransmits(st);
+			event_schedule(EVENT_CRYPTO_TIMEOUT, EVENT_CRYPTO_TIMEOUT_DELAY, st);
+		}
+		/* add to the least busy helper's backlog */
+		struct helper_queue *q = &helper_queues[0];
+		for (unsigned i = 1; i < nr_helper_queues; i++) {
+			if (helper_queues[i].outstanding < q->outstanding) {
+				q = &helper_queues[i];
+			}
+		}
+		cn->pcrc_queue = q;
+		q->outstanding++;
+		bool waiting;
+		pthread_mutex_lock(&q->mutex);
 		{
-			insert_list_entry(&backlog, &cn->pcrc_backlog);
-			backlog_queue_len++;
-			/* wake up threads waiting for work */
-			pthread_cond_signal(&backlog_cond);
+			insert_list_entry(&q->backlog, &cn->pcrc_backlog);
+			q->depth++;
+			if (q->depth > q->max_depth) {
+				q->max_depth = q->depth;
+			}
+			/* wake up the helper if it is waiting for work */
+			pthread_cond_signal(&q->cond);
+			/* will the work sit there? */
+			waiting = (!q->sleeping || q->depth > 1);
+		}
+		pthread_mutex_unlock(&q->mutex);
+		if (waiting) {
+			wake_sleeping_helper(q);
 		}
-		pthread_mutex_unlock(&backlog_mutex);
 	}
 }
 
@@ -577,19 +807,21 @@ void delete_cryptographic_continuation(struct state *st)
 	/* remove it from any queue */
 	if (pc_workers != NULL) {
 		/* remove it from any queue */
-		pthread_mutex_lock(&backlog_mutex);
+		struct helper_queue *q = cn->pcrc_queue;
+		pthread_mutex_lock(&q->mutex);
 		if (detached_list_entry(&cn->pcrc_backlog)) {
 			/*
-			 * Already grabbed by the helper thread so
+			 * Already grabbed by a helper thread so
 			 * can't delete it here.
 			 */
 			cn = NULL;
 		} else {
 			remove_list_entry(&cn->pcrc_backlog);
-			backlog_queue_len--;
+			q->depth--;
 		}
-		pthread_mutex_unlock(&backlog_mutex);
+		pthread_mutex_unlock(&q->mutex);
 		if (cn != NULL) {
+			q->outstanding--;
 			cn->pcrc_handler->cancelled_cb(&cn->pcrc_task);
 			pexpect(cn->pcrc_task == NULL); /* did their job */
 			/* free the heap space */
@@ -599,6 +831,78 @@ void delete_cryptographic_continuation(struct state *st)
 	}
 }
 
+static void add_crypto_op_latency(const struct pluto_crypto_req_cont *cn)
+{
+	/* pcr is really several operations */
+	const char *name = (cn->pcrc_handler == &pcr_handler ?
+			    pluto_cryptoop_strings[cn->pcrc_pcr.pcr_type] :
+			    cn->pcrc_handler->name);
+	struct crypto_op_stats *op = NULL;
+	for (unsigned i = 0; i < elemsof(crypto_op_stats); i++) {
+		if (crypto_op_stats[i].name == NULL) {
+			crypto_op_stats[i].name = name;
+		}
+		if (crypto_op_stats[i].name == name) {
+			op = &crypto_op_stats[i];
+			break;
+		}
+	}
+	if (op == NULL) {
+		PEXPECT_LOG("no room to record latency of %s; MAX_CRYPTO_OPS is too small",
+			    name);
+		return;
+	}
+	intmax_t ms = deltamillisecs(monotimediff(mononow(), cn->pcrc_submitted));
+	unsigned b = 0;
+	while (b < CRYPTO_LATENCY_BUCKETS - 1 && ms >= ((intmax_t)1 << b)) {
+		b++;
+	}
+	op->count++;
+	op->latency[b]++;
+}
+
+/*
+ * Drain all the answers queued by the helpers in one go.
+ */
+
+static void helper_answers_cb(evutil_socket_t fd UNUSED,
+			      const short event UNUSED,
+			      void *arg UNUSED)
+{
+	struct list_head batch = INIT_LIST_HEAD(&batch, &answers_info);
+	pthread_mutex_lock(&helper_answers.mutex);
+	{
+		struct pluto_crypto_req_cont *cn;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&helper_answers.list, cn) {
+			remove_list_entry(&cn->pcrc_answer);
+			insert_list_entry(&batch, &cn->pcrc_answer);
+		}
+		/* the list is empty so the next answer pokes again */
+		char pokes[16];
+		while (read(helper_answers.recv, pokes, sizeof(pokes)) > 0) {
+			continue;
+		}
+	}
+	pthread_mutex_unlock(&helper_answers.mutex);
+
+	unsigned long n = 0;
+	struct pluto_crypto_req_cont *cn;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&batch, cn) {
+		remove_list_entry(&cn->pcrc_answer);
+		n++;
+		run_resume("sending helper answer", cn->pcrc_serialno,
+			   handle_helper_answer, cn);
+	}
+	dbg("processed %lu helper answers", n);
+	if (n > 0) {
+		helper_answers.batches++;
+		helper_answers.answers += n;
+		if (n > helper_answers.max_batch) {
+			helper_answers.max_batch = n;
+		}
+	}
+}
+
 /*
  * This function is called when a helper passes work back to the main
  * thread using the event loop.
@@ -616,6 +920,11 @@ static stf_status handle_helper_answer(struct state *st,
 	const struct crypto_handler *h = cn->pcrc_handler;
 	passert(h != NULL);
 
+	if (cn->pcrc_queue != NULL) {
+		cn->pcrc_queue->outstanding--;
+	}
+	add_crypto_op_latency(cn);
+
 	dbg("calling continuation function %p", h->completed_cb);
 
 	/*
@@ -770,6 +1079,42 @@ void start_crypto_helpers(int nhelpers)
 		helper_exited.send = exit_pipe[1];
 		helper_exited.recv = exit_pipe[0];
 
+		/*
+		 * Set up a pipe for waking the main thread when there
+		 * are answers; the read end is drained dry so must
+		 * not block.
+		 */
+		int answer_pipe[2];
+		if (pipe(answer_pipe) < 0) {
+			EXIT_LOG_ERRNO(errno, "problem creating helper answer pipe");
+		}
+		for (unsigned i = 0; i < elemsof(answer_pipe); i++) {
+			if (fcntl(answer_pipe[i], F_SETFD, FD_CLOEXEC) < 0) {
+				EXIT_LOG_ERRNO(errno, "problem setting FD_CLOEXE on helper answer pipe");
+			}
+		}
+		if (fcntl(answer_pipe[0], F_SETFL, O_NONBLOCK) < 0) {
+			EXIT_LOG_ERRNO(errno, "problem setting O_NONBLOCK on helper answer pipe");
+		}
+		helper_answers.send = answer_pipe[1];
+		helper_answers.recv = answer_pipe[0];
+		add_fd_read_event_handler(helper_answers.recv, helper_answers_cb,
+					  NULL, "PLUTO_CRYPTO_HELPER_ANSWERS");
+
+		/*
+		 * One work queue per helper; they must exist before
+		 * any thread starts looking for work (or stealing).
+		 */
+		helper_queues = alloc_bytes(sizeof(*helper_queues) * nhelpers,
+					    "pluto crypto helper queues (ignore)");
+		for (i = 0; i < nhelpers; i++) {
+			struct helper_queue *q = &helper_queues[i];
+			pthread_mutex_init(&q->mutex, NULL);
+			pthread_cond_init(&q->cond, NULL);
+			q->backlog = (struct list_head) INIT_LIST_HEAD(&q->backlog, &backlog_info);
+		}
+		nr_helper_queues = nhelpers;
+
 		/*
 		 * create the threads.  Set nr_helpers_started after
 		 * the threads have been created so that shutdown code
@@ -801,9 +1146,12 @@ void stop_crypto_helpers(void)
 		unsigned remaining = nr_helpers_started;
 		do {
 			/* poke threads waiting for work */
-			pthread_mutex_lock(&backlog_mutex);
-			pthread_cond_signal(&backlog_cond);
-			pthread_mutex_unlock(&backlog_mutex);
+			for (unsigned i = 0; i < nr_helper_queues; i++) {
+				struct helper_queue *q = &helper_queues[i];
+				pthread_mutex_lock(&q->mutex);
+				pthread_cond_signal(&q->cond);
+				pthread_mutex_unlock(&q->mutex);
+			}
 			/* wait for one to die; add timeout? */
 			struct pluto_crypto_worker *w = NULL;
 			if (read(helper_exited.recv, &w, sizeof(w)) < 0 ||
@@ -821,6 +1169,61 @@ void stop_crypto_helpers(void)
 	}
 }
 
+unsigned long crypto_helper_backlog(void)
+{
+	if (nr_helper_queues == 0) {
+		return 0;
+	}
+	unsigned long outstanding = 0;
+	for (unsigned i = 0; i < nr_helper_queues; i++) {
+		outstanding += helper_queues[i].outstanding;
+	}
+	return (outstanding + nr_helper_queues - 1) / nr_helper_queues;
+}
+
+void show_crypto_helpers_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	whack_print(whackfd, "current.crypto.helpers=%u", nr_helper_queues);
+	for (unsigned i = 0; i < nr_helper_queues; i++) {
+		struct helper_queue *q = &helper_queues[i];
+		unsigned long depth, max_depth, steals, stolen;
+		pthread_mutex_lock(&q->mutex);
+		{
+			depth = q->depth;
+			max_depth = q->max_depth;
+			steals = q->steals;
+			stolen = q->stolen;
+		}
+		pthread_mutex_unlock(&q->mutex);
+		whack_print(whackfd, "current.crypto.helper.%u.queue_depth=%lu", i, depth);
+		whack_print(whackfd, "current.crypto.helper.%u.max_queue_depth=%lu", i, max_depth);
+		whack_print(whackfd, "current.crypto.helper.%u.outstanding=%lu", i, q->outstanding);
+		whack_print(whackfd, "current.crypto.helper.%u.steals=%lu", i, steals);
+		whack_print(whackfd, "current.crypto.helper.%u.stolen=%lu", i, stolen);
+	}
+	whack_print(whackfd, "current.crypto.answers.batches=%lu", helper_answers.batches);
+	whack_print(whackfd, "current.crypto.answers.total=%lu", helper_answers.answers);
+	whack_print(whackfd, "current.crypto.answers.max_batch=%lu", helper_answers.max_batch);
+	for (unsigned i = 0; i < elemsof(crypto_op_stats) && crypto_op_stats[i].name != NULL; i++) {
+		const struct crypto_op_stats *op = &crypto_op_stats[i];
+		/* "build KE and nonce" -> "build_ke_and_nonce" */
+		char name[64];
+		jambuf_t buf = ARRAY_AS_JAMBUF(name);
+		jam_status_name(&buf, op->name);
+		whack_print(whackfd, "current.crypto.op.%s.count=%lu", name, op->count);
+		for (unsigned b = 0; b < CRYPTO_LATENCY_BUCKETS; b++) {
+			if (b < CRYPTO_LATENCY_BUCKETS - 1) {
+				whack_print(whackfd, "current.crypto.op.%s.latency.lt_%lums=%lu",
+					    name, 1UL << b, op->latency[b]);
+			} else {
+				whack_print(whackfd, "current.crypto.op.%s.latency.ge_%lums=%lu",
+					    name, 1UL << (b - 1), op->latency[b]);
+			}
+		}
+	}
+}
+
 void send_crypto_helper_request(struct state *st,
 				struct pluto_crypto_req_cont *cn)
 {
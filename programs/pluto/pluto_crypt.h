@@ -70,6 +70,12 @@ struct crypto_handler {
 	crypto_compute_fn *compute_fn;
 	crypto_completed_cb *completed_cb;
 	crypto_cancelled_cb *cancelled_cb;
+	/*
+	 * When set, the state's event (and retransmits) are left
+	 * alone and no crypto timeout is scheduled; for short tasks
+	 * that happen outside of a state transition.
+	 */
+	bool keep_state_events;
 };
 
 extern void submit_crypto(const struct logger *logger,
@@ -334,6 +340,16 @@ extern struct pluto_crypto_req_cont *new_pcrc(crypto_req_cont_func fn,
 extern void start_crypto_helpers(int nhelpers);
 extern void stop_crypto_helpers(void);
 
+/*
+ * Requests submitted to the helpers but not yet answered, averaged
+ * over the helpers (rounded up); 0 when crypto is done inline.
+ */
+extern unsigned long crypto_helper_backlog(void);
+
+/* for whack --globalstatus */
+struct show;
+extern void show_crypto_helpers_status(struct show *s);
+
 extern void send_crypto_helper_request(struct state *st,
 				       struct pluto_crypto_req_cont *cn);
 
@@ -354,6 +370,14 @@ extern void request_nonce(const char *name,
 
 extern void calc_ke(struct pcr_kenonce *kn);
 
+/* pre-computed DH keypairs; see crypt_ke.c */
+#define MAX_DH_KEYPAIR_POOL 100000	/* per DH group */
+extern unsigned dh_keypair_pool_low;
+extern unsigned dh_keypair_pool_high;
+extern deltatime_t dh_keypair_pool_lifetime;
+extern bool refill_dh_keypair_pool(void);
+extern void free_dh_keypair_pools(void);
+
 extern void calc_nonce(struct pcr_kenonce *kn);
 
 extern void cancelled_ke_and_nonce(struct pcr_kenonce *kn);
@@ -93,6 +93,7 @@ static void init_seccomp(uint32_t def_action, bool main)
 		LSW_SECCOMP_ADD(ctx, getsockopt);
 		LSW_SECCOMP_ADD(ctx, getuid);
 		LSW_SECCOMP_ADD(ctx, ioctl);
+		LSW_SECCOMP_ADD(ctx, kill);
 		LSW_SECCOMP_ADD(ctx, lstat);
 		LSW_SECCOMP_ADD(ctx, mkdir);
 		LSW_SECCOMP_ADD(ctx, munmap);
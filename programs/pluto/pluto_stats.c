@@ -79,6 +79,10 @@ unsigned long pstats_ipsec_tfc;
 unsigned long pstats_ike_dpd_recv;
 unsigned long pstats_ike_dpd_sent;
 unsigned long pstats_ike_dpd_replied;
+/* updated by the crypto helpers while holding the pool lock */
+unsigned long pstats_dh_keypair_pool_hit[OAKLEY_GROUP_PSTATS_ROOF];
+unsigned long pstats_dh_keypair_pool_miss[OAKLEY_GROUP_PSTATS_ROOF];
+unsigned long pstats_dh_keypair_pool_expired[OAKLEY_GROUP_PSTATS_ROOF];
 unsigned long pstats_iketcp_started[2];
 unsigned long pstats_iketcp_stopped[2];
 unsigned long pstats_iketcp_aborted[2];
@@ -451,6 +455,11 @@ void show_pluto_stats(const struct fd *whackfd)
 	ENUM_STATS(&oakley_group_names, OAKLEY_GROUP_MODP768, "ikev2.sent.invalidke.using", pstats_invalidke_sent_u);
 	ENUM_STATS(&oakley_group_names, OAKLEY_GROUP_MODP768, "ikev2.sent.invalidke.suggesting", pstats_invalidke_sent_s);
 
+	/* pre-computed DH keypairs */
+	ENUM_STATS(&oakley_group_names, OAKLEY_GROUP_MODP768, "dh.keypair_pool.hit", pstats_dh_keypair_pool_hit);
+	ENUM_STATS(&oakley_group_names, OAKLEY_GROUP_MODP768, "dh.keypair_pool.miss", pstats_dh_keypair_pool_miss);
+	ENUM_STATS(&oakley_group_names, OAKLEY_GROUP_MODP768, "dh.keypair_pool.expired", pstats_dh_keypair_pool_expired);
+
 #if 0
 	/* ??? THIS IS BROKEN (hint: array is wrong size (10)) */
 	for (unsigned long e = STF_IGNORE; e <= STF_FAIL; e++)
@@ -512,6 +521,9 @@ void clear_pluto_stats(void)
 	memset(pstats_invalidke_sent_s, 0, sizeof pstats_invalidke_sent_s);
 	memset(pstats_invalidke_recv_s, 0, sizeof pstats_invalidke_recv_s);
 	memset(pstats_invalidke_sent_u, 0, sizeof pstats_invalidke_sent_u);
+	memset(pstats_dh_keypair_pool_hit, 0, sizeof pstats_dh_keypair_pool_hit);
+	memset(pstats_dh_keypair_pool_miss, 0, sizeof pstats_dh_keypair_pool_miss);
+	memset(pstats_dh_keypair_pool_expired, 0, sizeof pstats_dh_keypair_pool_expired);
 	memset(pstats_invalidke_recv_u, 0, sizeof pstats_invalidke_recv_u);
 	memset(pstats_ikev1_sent_notifies_e, 0, sizeof pstats_ikev1_sent_notifies_e);
 	clear_pluto_stat(&pstats_ikev2_sent_notifies_e);
@@ -51,6 +51,10 @@ extern unsigned long pstats_ike_dpd_recv;
 extern unsigned long pstats_ike_dpd_sent;
 extern unsigned long pstats_ike_dpd_replied;
 
+extern unsigned long pstats_dh_keypair_pool_hit[OAKLEY_GROUP_PSTATS_ROOF];
+extern unsigned long pstats_dh_keypair_pool_miss[OAKLEY_GROUP_PSTATS_ROOF];
+extern unsigned long pstats_dh_keypair_pool_expired[OAKLEY_GROUP_PSTATS_ROOF];
+
 extern unsigned long pstats_iketcp_started[2];
 extern unsigned long pstats_iketcp_aborted[2];
 extern unsigned long pstats_iketcp_stopped[2];
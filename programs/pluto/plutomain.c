@@ -61,6 +61,13 @@
 #include "virtual.h"	/* needs connections.h */
 #include "state_db.h"		/* for init_state_db() */
 #include "connection_db.h"	/* for connection_state_db() */
+#include "spd_route_db.h"		/* for init_spd_route_db() */
+#include "pubkey_db.h"		/* for init_pubkey_db() */
+#include "addresspool.h"	/* for init_addresspools() */
+#include "updown.h"		/* for init_updown_hooks() */
+#ifdef USE_DNSSEC
+#include "ddns.h"		/* for init_ddns_hosts() */
+#endif
 #include "nat_traversal.h"
 #include "ike_alg.h"
 #include "ikev2_redirect.h"
@@ -70,6 +77,9 @@
 #include "ikev2.h"		/* for init_ikev2() */
 #include "crl_queue.h"		/* for free_crl_queue() */
 #include "iface.h"
+#include "demux.h"		/* for free_md_pools() */
+#include "xauth.h"		/* for stop_xauth_pam_workers() */
+#include "nss_cert_verify.h"	/* for verified_chain_lifetime, free_verified_chains() */
 
 #ifndef IPSECDIR
 #define IPSECDIR "/etc/ipsec.d"
@@ -136,6 +146,7 @@ static void free_pluto_main(void)
 	pfree(coredir);
 	pfree(conffile);
 	pfreeany(pluto_stats_binary);
+	pfreeany(pluto_updown_helper);
 	pfreeany(pluto_listen);
 	pfree(pluto_vendorid);
 	pfreeany(ocsp_uri);
@@ -491,6 +502,13 @@ enum {
 	OPT_IMPAIR,
 	OPT_DNSSEC_ROOTKEY_FILE,
 	OPT_DNSSEC_TRUSTED,
+	OPT_DH_KEYPAIR_POOL_LOW,
+	OPT_DH_KEYPAIR_POOL_HIGH,
+	OPT_DH_KEYPAIR_POOL_LIFETIME,
+	OPT_UPDOWN_HELPER,
+	OPT_SA_COUNTER_CACHE,
+	OPT_IKE_SOCKET_QUEUES,
+	OPT_CERT_CACHE_LIFETIME,
 };
 
 static const struct option long_opts[] = {
@@ -531,6 +549,7 @@ static const struct option long_opts[] = {
 	{ "ocsp-cache-max-age\0", required_argument, NULL, 'H' },
 	{ "ocsp-method\0", required_argument, NULL, 'B' },
 	{ "crlcheckinterval\0", required_argument, NULL, 'x' },
+	{ "cert-cache-lifetime\0<secs>", required_argument, NULL, OPT_CERT_CACHE_LIFETIME, },
 	{ "uniqueids\0", no_argument, NULL, 'u' },
 	{ "no-dnssec\0", no_argument, NULL, 'R' },
 	{ "nokernel\0>use-nostack", no_argument, NULL, 'n' },	/* redundant spelling */
@@ -550,6 +569,7 @@ static const struct option long_opts[] = {
 	{ "tcpport\0<port-number>", required_argument, NULL, 'm' },
 	{ "ike-socket-bufsize\0<buf-size>", required_argument, NULL, 'W' },
 	{ "ike-socket-no-errqueue\0", no_argument, NULL, '1' },
+	{ "ike-socket-queues\0<number>", required_argument, NULL, OPT_IKE_SOCKET_QUEUES, },
 	{ "nflog-all\0<group-number>", required_argument, NULL, 'G' },
 	{ "natikeport\0<port-number>", required_argument, NULL, 'q' },
 	{ "rundir\0<path>", required_argument, NULL, 'b' }, /* was ctlbase */
@@ -562,6 +582,7 @@ static const struct option long_opts[] = {
 	{ "coredir\0>dumpdir", required_argument, NULL, 'C' },	/* redundant spelling */
 	{ "dumpdir\0<dirname>", required_argument, NULL, 'C' },
 	{ "statsbin\0<filename>", required_argument, NULL, 'S' },
+	{ "updown-helper\0<filename>", required_argument, NULL, OPT_UPDOWN_HELPER, },
 	{ "ipsecdir\0<ipsec-dir>", required_argument, NULL, 'f' },
 	{ "ipsec_dir\0>ipsecdir", required_argument, NULL, 'f' },	/* redundant spelling; _ */
 	{ "foodgroupsdir\0>ipsecdir", required_argument, NULL, 'f' },	/* redundant spelling */
@@ -574,7 +595,11 @@ static const struct option long_opts[] = {
 	{ "virtual_private\0_", required_argument, NULL, '6' },	/* _ */
 	{ "virtual-private\0<network_list>", required_argument, NULL, '6' },
 	{ "nhelpers\0<number>", required_argument, NULL, 'j' },
+	{ "dh-keypair-pool-low\0<number>", required_argument, NULL, OPT_DH_KEYPAIR_POOL_LOW, },
+	{ "dh-keypair-pool-high\0<number>", required_argument, NULL, OPT_DH_KEYPAIR_POOL_HIGH, },
+	{ "dh-keypair-pool-lifetime\0<secs>", required_argument, NULL, OPT_DH_KEYPAIR_POOL_LIFETIME, },
 	{ "expire-shunt-interval\0<secs>", required_argument, NULL, '9' },
+	{ "sa-counter-cache\0<secs>", required_argument, NULL, OPT_SA_COUNTER_CACHE, },
 	{ "seedbits\0<number>", required_argument, NULL, 'c' },
 	/* really an attribute type, not a value */
 	{ "secctx_attr_value\0_", required_argument, NULL, 'w' },	/* obsolete name; _ */
@@ -816,6 +841,11 @@ int main(int argc, char **argv)
 			pluto_stats_binary = clone_str(optarg, "statsbin");
 			continue;
 
+		case OPT_UPDOWN_HELPER:	/* --updown-helper <filename> */
+			pfreeany(pluto_updown_helper);
+			pluto_updown_helper = clone_str(optarg, "updown-helper");
+			continue;
+
 		case 'v':	/* --version */
 			printf("%s%s\n", ipsec_version_string(),
 				compile_time_interop_options);
@@ -834,6 +864,31 @@ int main(int argc, char **argv)
 				nhelpers = u;
 			}
 			continue;
+
+		case OPT_DH_KEYPAIR_POOL_LOW:	/* --dh-keypair-pool-low <number> */
+			ugh = ttoulb(optarg, 0, 10, MAX_DH_KEYPAIR_POOL, &u);
+			if (ugh != NULL)
+				break;
+			dh_keypair_pool_low = u;
+			continue;
+
+		case OPT_DH_KEYPAIR_POOL_HIGH:	/* --dh-keypair-pool-high <number> */
+			ugh = ttoulb(optarg, 0, 10, MAX_DH_KEYPAIR_POOL, &u);
+			if (ugh != NULL)
+				break;
+			dh_keypair_pool_high = u;
+			continue;
+
+		case OPT_DH_KEYPAIR_POOL_LIFETIME:	/* --dh-keypair-pool-lifetime <secs> */
+			ugh = ttoulb(optarg, 0, 10, secs_per_day, &u);
+			if (ugh != NULL)
+				break;
+			if (u == 0) {
+				ugh = "must not be 0";
+				break;
+			}
+			dh_keypair_pool_lifetime = deltatime(u);
+			continue;
 		case 'c':	/* --seedbits */
 			pluto_nss_seedbits = atoi(optarg);
 			if (pluto_nss_seedbits == 0) {
@@ -912,6 +967,20 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		case OPT_SA_COUNTER_CACHE:	/* --sa-counter-cache <secs> */
+			ugh = ttoulb(optarg, 0, 10, secs_per_hour, &u);
+			if (ugh != NULL)
+				break;
+			pluto_sa_counter_cache = deltatime(u);
+			continue;
+
+		case OPT_CERT_CACHE_LIFETIME:	/* --cert-cache-lifetime <secs> */
+			ugh = ttoulb(optarg, 0, 10, secs_per_day, &u);
+			if (ugh != NULL)
+				break;
+			verified_chain_lifetime = deltatime(u);
+			continue;
+
 		case 'L':	/* --listen ip_addr */
 		{
 			ip_address lip;
@@ -1102,6 +1171,17 @@ int main(int argc, char **argv)
 			pluto_sock_bufsize = u;
 			continue;
 
+		case OPT_IKE_SOCKET_QUEUES:	/* --ike-socket-queues <number> */
+			ugh = ttoulb(optarg, 0, 10, MAX_IKE_SOCKET_QUEUES, &u);
+			if (ugh != NULL)
+				break;
+			if (u == 0) {
+				ugh = "must not be 0";
+				break;
+			}
+			pluto_sock_queues = u;
+			continue;
+
 		case 'q':	/* --natikeport <portnumber> */
 			ugh = ttoulb(optarg, 0, 10, 0xFFFF, &u);
 			if (ugh != NULL)
@@ -1267,8 +1347,10 @@ int main(int argc, char **argv)
 			pluto_max_halfopen = cfg->setup.options[KBF_MAX_HALFOPEN_IKE];
 
 			crl_strict = cfg->setup.options[KBF_CRL_STRICT];
+			verified_chain_lifetime = deltatime(cfg->setup.options[KBF_CERT_CACHE_LIFETIME]);
 
 			pluto_shunt_lifetime = deltatime(cfg->setup.options[KBF_SHUNTLIFETIME]);
+			pluto_sa_counter_cache = deltatime(cfg->setup.options[KBF_SA_COUNTER_CACHE]);
 
 			ocsp_enable = cfg->setup.options[KBF_OCSP_ENABLE];
 			ocsp_strict = cfg->setup.options[KBF_OCSP_STRICT];
@@ -1319,6 +1401,15 @@ int main(int argc, char **argv)
 			/* --ike-socket-bufsize */
 			pluto_sock_bufsize = cfg->setup.options[KBF_IKEBUF];
 			pluto_sock_errqueue = cfg->setup.options[KBF_IKE_ERRQUEUE];
+			/* --ike-socket-queues; same limits as the option */
+			if (cfg->setup.options[KBF_IKE_SOCKET_QUEUES] < 1 ||
+			    cfg->setup.options[KBF_IKE_SOCKET_QUEUES] > MAX_IKE_SOCKET_QUEUES) {
+				confread_free(cfg);
+				ugh = builddiag("ike-socket-queues= must be between 1 and %d",
+						MAX_IKE_SOCKET_QUEUES);
+				break;
+			}
+			pluto_sock_queues = cfg->setup.options[KBF_IKE_SOCKET_QUEUES];
 
 			/* --tcpport */
 			pluto_tcpport = cfg->setup.options[KBF_TCPPORT];
@@ -1396,6 +1487,18 @@ int main(int argc, char **argv)
 				}
 			}
 
+			if (cfg->setup.strings[KSF_UPDOWN_HELPER] != NULL) {
+				if (access(cfg->setup.strings[KSF_UPDOWN_HELPER], X_OK) == 0) {
+					pfreeany(pluto_updown_helper);
+					/* updown-helper= */
+					pluto_updown_helper = clone_str(cfg->setup.strings[KSF_UPDOWN_HELPER], "updown-helper via --config");
+					libreswan_log("updown-helper set to %s", pluto_updown_helper);
+				} else {
+					libreswan_log("updown-helper= '%s' ignored - file does not exist or is not executable",
+						cfg->setup.strings[KSF_UPDOWN_HELPER]);
+				}
+			}
+
 			pluto_nss_seedbits = cfg->setup.options[KBF_SEEDBITS];
 			pluto_nat_port =
 				cfg->setup.options[KBF_NATIKEPORT];
@@ -1408,6 +1511,24 @@ int main(int argc, char **argv)
 				cfg->setup.strings[KSF_GLOBAL_REDIRECT_TO]);
 
 			nhelpers = cfg->setup.options[KBF_NHELPERS];
+			/* --dh-keypair-pool-{low,high}; same limits as the options */
+			if (cfg->setup.options[KBF_DH_KEYPAIR_POOL_LOW] > MAX_DH_KEYPAIR_POOL ||
+			    cfg->setup.options[KBF_DH_KEYPAIR_POOL_HIGH] > MAX_DH_KEYPAIR_POOL) {
+				confread_free(cfg);
+				ugh = builddiag("dh-keypair-pool-low= and dh-keypair-pool-high= must be at most %d",
+						MAX_DH_KEYPAIR_POOL);
+				break;
+			}
+			dh_keypair_pool_low = cfg->setup.options[KBF_DH_KEYPAIR_POOL_LOW];
+			dh_keypair_pool_high = cfg->setup.options[KBF_DH_KEYPAIR_POOL_HIGH];
+			/* --dh-keypair-pool-lifetime; same limits as the option */
+			if (cfg->setup.options[KBF_DH_KEYPAIR_POOL_LIFETIME] == 0 ||
+			    cfg->setup.options[KBF_DH_KEYPAIR_POOL_LIFETIME] > secs_per_day) {
+				confread_free(cfg);
+				ugh = "dh-keypair-pool-lifetime= must be between 1 second and 1 day";
+				break;
+			}
+			dh_keypair_pool_lifetime = deltatime(cfg->setup.options[KBF_DH_KEYPAIR_POOL_LIFETIME]);
 			secctx_attr_type = cfg->setup.options[KBF_SECCTX];
 			cur_debugging = cfg->setup.options[KBF_PLUTODEBUG];
 
@@ -1538,6 +1659,10 @@ int main(int argc, char **argv)
 	if (optind != argc)
 		invocation_fail("unexpected argument");
 
+	/* 0, the default, means twice the low watermark */
+	if (dh_keypair_pool_high != 0 && dh_keypair_pool_high < dh_keypair_pool_low)
+		invocation_fail("dh-keypair-pool-high must not be less than dh-keypair-pool-low");
+
 	if (chdir(coredir) == -1) {
 		int e = errno;
 
@@ -1820,7 +1945,15 @@ int main(int argc, char **argv)
 
 	init_state_db();
 	init_connection_db();
+	init_spd_route_db();
 	init_server();
+	init_hash_table_resizer();
+	init_pubkey_db();
+	init_addresspools();
+	init_updown_hooks();
+#ifdef USE_DNSSEC
+	init_ddns_hosts();
+#endif
 
 	init_rate_log();
 	init_nat_traversal(keep_alive);
@@ -1846,6 +1979,10 @@ int main(int argc, char **argv)
 		exit(PLUTO_EXIT_OK);
 	}
 
+	/* an unset high watermark is twice the low */
+	if (dh_keypair_pool_high == 0) {
+		dh_keypair_pool_high = 2 * dh_keypair_pool_low;
+	}
 	start_crypto_helpers(nhelpers);
 	init_kernel();
 	init_vendorid();
@@ -1916,11 +2053,18 @@ void exit_pluto(enum pluto_exit_code status)
 	 * after the've completed?
 	 */
 	stop_crypto_helpers();
+	free_dh_keypair_pools();
 
 	free_root_certs(whackfd);
+	free_verified_chains();	/* after the helpers using them stop */
 	free_preshared_secrets();
 	free_remembered_public_keys();
 	delete_every_connection();
+	/* let the "down" commands, queued above, run */
+	flush_all_updown_hooks();
+#ifdef XAUTH_HAVE_PAM
+	stop_xauth_pam_workers();
+#endif
 
 	/*
 	 * free memory allocated by initialization routines.  Please don't
@@ -1948,12 +2092,20 @@ void exit_pluto(enum pluto_exit_code status)
 
 	lsw_conf_free_oco();	/* free global_oco containing path names */
 
+	free_nat_keepalives();
 	free_ifaces();	/* free interface list from memory */
 	if (kernel_ops->shutdown != NULL)
 		kernel_ops->shutdown();
 	lsw_nss_shutdown();
 	delete_lock();	/* delete any lock files */
 	free_virtual_ip();	/* virtual_private= */
+#ifdef USE_DNSSEC
+	free_ddns_hosts();	/* before the unbound context */
+#endif
+	free_hash_tables();	/* extra buckets allocated by the resizer */
+	free_md_pools();
+	free_streaming_shows();	/* events and their whack fds */
+	free_whack_writers();
 	free_server(); /* no libevent evnts beyond this point */
 	free_pluto_main();	/* our static chars */
 
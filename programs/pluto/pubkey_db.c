@@ -0,0 +1,509 @@
+/* public key database, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <ctype.h>
+
+#include "pubkey_db.h"
+#include "defs.h"
+#include "log.h"
+#include "id.h"
+#include "x509.h"
+#include "secrets.h"
+#include "hash_table.h"
+#include "timer.h"
+
+/*
+ * Each key in the database.
+ *
+ * The ID and CKAID tables index the key directly; the issuer table
+ * indexes a per-issuer record shared by all keys with that issuer.
+ */
+
+struct pubkey_issuer {
+	chunk_t dn;
+	unsigned nr_keys;
+	struct list_entry issuer_db_entry;
+	struct list_entry all_issuers_entry;
+};
+
+struct pubkey_db_entry {
+	struct pubkey *pk;
+	struct pubkey_issuer *issuer;	/* NULL when no issuer */
+	bool ttl;			/* on ttl_pubkeys */
+	struct list_entry id_db_entry;
+	struct list_entry ckaid_db_entry;
+	struct list_entry all_pubkeys_entry;
+	struct list_entry ttl_pubkeys_entry;
+};
+
+static void jam_pubkey_db_entry(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "pubkey NULL");
+	} else {
+		const struct pubkey_db_entry *e = data;
+		jam(buf, "pubkey %s ", e->pk->type->name);
+		jam_id(buf, &e->pk->id, jam_sanitized_bytes);
+	}
+}
+
+static void jam_pubkey_issuer(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "issuer NULL");
+	} else {
+		const struct pubkey_issuer *issuer = data;
+		jam(buf, "issuer ");
+		jam_dn(buf, issuer->dn, jam_sanitized_bytes);
+	}
+}
+
+/*
+ * All keys and all issuers, oldest to newest.
+ */
+
+static const struct list_info all_pubkeys_info = {
+	.name = "all pubkeys",
+	.jam = jam_pubkey_db_entry,
+};
+
+static struct list_head all_pubkeys = INIT_LIST_HEAD(&all_pubkeys,
+						     &all_pubkeys_info);
+
+static const struct list_info all_issuers_info = {
+	.name = "all pubkey issuers",
+	.jam = jam_pubkey_issuer,
+};
+
+static struct list_head all_issuers = INIT_LIST_HEAD(&all_issuers,
+						     &all_issuers_info);
+
+/*
+ * Keys that expire TTL after they were installed, in install order.
+ */
+
+static const struct list_info ttl_pubkeys_info = {
+	.name = "ttl pubkeys",
+	.jam = jam_pubkey_db_entry,
+};
+
+static struct list_head ttl_pubkeys = INIT_LIST_HEAD(&ttl_pubkeys,
+						     &ttl_pubkeys_info);
+
+/* when EVENT_EXPIRE_PUBKEYS will next fire; epoch when idle */
+static realtime_t next_expiry;
+
+/*
+ * Hashers.
+ *
+ * These must be consistent with same_id() and same_dn(): an FQDN is
+ * hashed ignoring case and trailing dots; a DN is hashed from its
+ * RDNs' lower-cased values.  Anything else is hashed by kind alone.
+ */
+
+static void fold_hash(const void *ptr, size_t len, void *arg)
+{
+	hash_t *hash = arg;
+	*hash = hash_table_hasher(shunk2(ptr, len), *hash);
+}
+
+static hash_t dn_hasher(chunk_t dn, hash_t hash)
+{
+	hash_t folded = hash;
+	if (!fold_dn(dn, fold_hash, &folded)) {
+		/* same_dn() only matches identical bytes */
+		return hash_table_hasher(shunk2(dn.ptr, dn.len), hash);
+	}
+	return folded;
+}
+
+static hash_t id_hasher(const struct id *id)
+{
+	hash_t hash = hash_table_hash_u64(id->kind);
+	switch (id->kind) {
+	case ID_IPV4_ADDR:
+	case ID_IPV6_ADDR:
+		return hash_table_hasher(address_as_shunk(&id->ip_addr), hash);
+	case ID_FQDN:
+	case ID_USER_FQDN:
+	{
+		size_t len = id->name.len;
+		while (len > 0 && id->name.ptr[len - 1] == '.') {
+			len--;
+		}
+		uint8_t block[64];
+		for (size_t i = 0; i < len; i += sizeof(block)) {
+			size_t n = min(sizeof(block), len - i);
+			for (size_t j = 0; j < n; j++) {
+				block[j] = tolower(id->name.ptr[i + j]);
+			}
+			hash = hash_table_hasher(shunk2(block, n), hash);
+		}
+		return hash;
+	}
+	case ID_FROMCERT:
+	case ID_DER_ASN1_DN:
+		/* same_id() treats both as a DN */
+		return dn_hasher(id->name, hash_table_hash_u64(ID_DER_ASN1_DN));
+	case ID_KEY_ID:
+		return hash_table_hasher(shunk2(id->name.ptr, id->name.len), hash);
+	default:
+		return hash;
+	}
+}
+
+static hash_t pubkey_id_hasher(const void *data)
+{
+	const struct pubkey_db_entry *e = data;
+	return id_hasher(&e->pk->id);
+}
+
+static struct list_entry *pubkey_id_entry(void *data)
+{
+	struct pubkey_db_entry *e = data;
+	return &e->id_db_entry;
+}
+
+static struct list_head pubkey_id_hash_slots[STATE_TABLE_SIZE];
+
+static struct hash_table pubkey_id_hash_table = {
+	.info = {
+		.name = "pubkey ID table",
+		.jam = jam_pubkey_db_entry,
+	},
+	.hasher = pubkey_id_hasher,
+	.entry = pubkey_id_entry,
+	.nr_slots = elemsof(pubkey_id_hash_slots),
+	.slots = pubkey_id_hash_slots,
+};
+
+static hash_t ckaid_hasher(const void *ptr, size_t len)
+{
+	return hash_table_hasher(shunk2(ptr, len), zero_hash);
+}
+
+static hash_t pubkey_ckaid_hasher(const void *data)
+{
+	const struct pubkey_db_entry *e = data;
+	const ckaid_t *ckaid = pubkey_ckaid(e->pk);
+	return ckaid_hasher(ckaid->ptr, ckaid->len);
+}
+
+static struct list_entry *pubkey_ckaid_entry(void *data)
+{
+	struct pubkey_db_entry *e = data;
+	return &e->ckaid_db_entry;
+}
+
+static struct list_head pubkey_ckaid_hash_slots[STATE_TABLE_SIZE];
+
+static struct hash_table pubkey_ckaid_hash_table = {
+	.info = {
+		.name = "pubkey CKAID table",
+		.jam = jam_pubkey_db_entry,
+	},
+	.hasher = pubkey_ckaid_hasher,
+	.entry = pubkey_ckaid_entry,
+	.nr_slots = elemsof(pubkey_ckaid_hash_slots),
+	.slots = pubkey_ckaid_hash_slots,
+};
+
+static hash_t issuer_hasher(const void *data)
+{
+	const struct pubkey_issuer *issuer = data;
+	return dn_hasher(issuer->dn, zero_hash);
+}
+
+static struct list_entry *issuer_entry(void *data)
+{
+	struct pubkey_issuer *issuer = data;
+	return &issuer->issuer_db_entry;
+}
+
+static struct list_head issuer_hash_slots[STATE_TABLE_SIZE];
+
+static struct hash_table issuer_hash_table = {
+	.info = {
+		.name = "pubkey issuer table",
+		.jam = jam_pubkey_issuer,
+	},
+	.hasher = issuer_hasher,
+	.entry = issuer_entry,
+	.nr_slots = elemsof(issuer_hash_slots),
+	.slots = issuer_hash_slots,
+};
+
+/*
+ * Issuers are reference counted by the keys that use them.
+ */
+
+static struct pubkey_issuer *reference_issuer(chunk_t dn)
+{
+	if (hunk_isempty(dn)) {
+		return NULL;
+	}
+	struct list_head *bucket =
+		hash_table_bucket(&issuer_hash_table, dn_hasher(dn, zero_hash));
+	struct pubkey_issuer *issuer;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, issuer) {
+		if (same_dn(issuer->dn, dn)) {
+			issuer->nr_keys++;
+			return issuer;
+		}
+	}
+	issuer = alloc_thing(struct pubkey_issuer, "pubkey issuer");
+	issuer->dn = clone_hunk(dn, "pubkey issuer dn");
+	issuer->nr_keys = 1;
+	issuer->all_issuers_entry = list_entry(&all_issuers_info, issuer);
+	insert_list_entry(&all_issuers, &issuer->all_issuers_entry);
+	add_hash_table_entry(&issuer_hash_table, issuer);
+	return issuer;
+}
+
+static void unreference_issuer(struct pubkey_issuer **issuerp)
+{
+	struct pubkey_issuer *issuer = *issuerp;
+	*issuerp = NULL;
+	if (issuer == NULL) {
+		return;
+	}
+	passert(issuer->nr_keys > 0);
+	if (--issuer->nr_keys == 0) {
+		del_hash_table_entry(&issuer_hash_table, issuer);
+		remove_list_entry(&issuer->all_issuers_entry);
+		free_chunk_content(&issuer->dn);
+		pfree(issuer);
+	}
+}
+
+/*
+ * Expiring keys.
+ */
+
+static void schedule_pubkey_expiry(realtime_t until)
+{
+	if (!is_realtime_epoch(next_expiry) && !realbefore(until, next_expiry)) {
+		return;
+	}
+	next_expiry = until;
+	deltatime_t delay = realtimediff(until, realnow());
+	schedule_oneshot_timer(EVENT_EXPIRE_PUBKEYS,
+			       deltatime_max(delay, deltatime(0)));
+}
+
+static void del_pubkey_db_entry(struct pubkey_db_entry *e)
+{
+	del_hash_table_entry(&pubkey_id_hash_table, e);
+	del_hash_table_entry(&pubkey_ckaid_hash_table, e);
+	remove_list_entry(&e->all_pubkeys_entry);
+	if (e->ttl) {
+		remove_list_entry(&e->ttl_pubkeys_entry);
+	}
+	unreference_issuer(&e->issuer);
+	unreference_key(&e->pk);
+	pfree(e);
+}
+
+static void expire_pubkeys(struct fd *unused_whackfd UNUSED)
+{
+	realtime_t now = realnow();
+	next_expiry = realtime_epoch;
+	realtime_t next = realtime_epoch;
+	struct pubkey_db_entry *e;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&ttl_pubkeys, e) {
+		if (!realbefore(now, e->pk->until_time)) {
+			id_buf idb;
+			dbg("%s public key '%s' installed %jd seconds ago has expired",
+			    e->pk->type->name, str_id(&e->pk->id, &idb),
+			    deltasecs(realtimediff(now, e->pk->installed_time)));
+			del_pubkey_db_entry(e);
+		} else if (is_realtime_epoch(next) ||
+			   realbefore(e->pk->until_time, next)) {
+			next = e->pk->until_time;
+		}
+	}
+	if (!is_realtime_epoch(next)) {
+		schedule_pubkey_expiry(next);
+	}
+}
+
+/*
+ * Maintain the database.
+ */
+
+void add_pubkey_to_db(struct pubkey *pk, deltatime_t ttl)
+{
+	/* XXX: same as install_public_key() */
+	pk->id = clone_id(&pk->id, "install public key id");
+	pk->issuer = clone_hunk(pk->issuer, "install public key issuer");
+	pk->installed_time = realnow();
+
+	struct pubkey_db_entry *e = alloc_thing(struct pubkey_db_entry,
+						"pubkey db entry");
+	e->pk = reference_key(pk);
+	e->issuer = reference_issuer(pk->issuer);
+	add_hash_table_entry(&pubkey_id_hash_table, e);
+	add_hash_table_entry(&pubkey_ckaid_hash_table, e);
+	e->all_pubkeys_entry = list_entry(&all_pubkeys_info, e);
+	insert_list_entry(&all_pubkeys, &e->all_pubkeys_entry);
+
+	if (deltasecs(ttl) > 0) {
+		pk->until_time = realtimesum(pk->installed_time, ttl);
+		e->ttl = true;
+		e->ttl_pubkeys_entry = list_entry(&ttl_pubkeys_info, e);
+		insert_list_entry(&ttl_pubkeys, &e->ttl_pubkeys_entry);
+		schedule_pubkey_expiry(pk->until_time);
+	}
+}
+
+static struct list_head *pubkey_id_bucket(const struct id *id)
+{
+	return hash_table_bucket(&pubkey_id_hash_table, id_hasher(id));
+}
+
+void delete_pubkeys_from_db(const struct id *id,
+			    const struct pubkey_type *type)
+{
+	struct pubkey_db_entry *e;
+	if (id->kind == ID_NONE) {
+		/* wildcard; matches everything */
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&all_pubkeys, e) {
+			if (e->pk->type == type) {
+				del_pubkey_db_entry(e);
+			}
+		}
+		return;
+	}
+	struct list_head *buckets[] = {
+		pubkey_id_bucket(id),
+		pubkey_id_bucket(&empty_id),
+	};
+	for (unsigned b = 0; b < elemsof(buckets); b++) {
+		if (b > 0 && buckets[b] == buckets[0]) {
+			break;
+		}
+		FOR_EACH_LIST_ENTRY_OLD2NEW(buckets[b], e) {
+			if (same_id(id, &e->pk->id) && e->pk->type == type) {
+				del_pubkey_db_entry(e);
+			}
+		}
+	}
+}
+
+void replace_pubkey_in_db(struct pubkey *pk)
+{
+	delete_pubkeys_from_db(&pk->id, pk->type);
+	add_pubkey_to_db(pk, deltatime(0));
+}
+
+void delete_pubkey_from_db(struct pubkey *pk)
+{
+	struct pubkey_db_entry *e;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(pubkey_id_bucket(&pk->id), e) {
+		if (e->pk == pk) {
+			del_pubkey_db_entry(e);
+			return;
+		}
+	}
+	pexpect(false);	/* not in database */
+}
+
+/*
+ * Searches.
+ */
+
+struct pubkey *find_pubkey_by_id(const struct id *id,
+				 pubkey_db_fn *fn, void *arg)
+{
+	struct pubkey_db_entry *e;
+	if (id->kind == ID_NONE) {
+		/* wildcard; matches everything */
+		FOR_EACH_LIST_ENTRY_NEW2OLD(&all_pubkeys, e) {
+			struct pubkey *pk = e->pk;
+			if (fn(pk, arg)) {
+				return pk;
+			}
+		}
+		return NULL;
+	}
+	/*
+	 * Keys with an ID_NONE ID match any ID; they are in the
+	 * ID_NONE bucket.
+	 */
+	struct list_head *buckets[] = {
+		pubkey_id_bucket(id),
+		pubkey_id_bucket(&empty_id),
+	};
+	for (unsigned b = 0; b < elemsof(buckets); b++) {
+		if (b > 0 && buckets[b] == buckets[0]) {
+			break;
+		}
+		FOR_EACH_LIST_ENTRY_NEW2OLD(buckets[b], e) {
+			struct pubkey *pk = e->pk;
+			if (same_id(id, &pk->id) && fn(pk, arg)) {
+				return pk;
+			}
+		}
+	}
+	return NULL;
+}
+
+struct pubkey *find_rsa_pubkey_by_ckaid(const void *ckaid, size_t len)
+{
+	struct list_head *bucket =
+		hash_table_bucket(&pubkey_ckaid_hash_table,
+				  ckaid_hasher(ckaid, len));
+	struct pubkey_db_entry *e;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(bucket, e) {
+		struct pubkey *pk = e->pk;
+		if (pk->type == &pubkey_type_rsa &&
+		    pk->u.rsa.ckaid.len == len &&
+		    memeq(pk->u.rsa.ckaid.ptr, ckaid, len)) {
+			return pk;
+		}
+	}
+	return NULL;
+}
+
+void for_each_pubkey_issuer(void (*fn)(chunk_t issuer, void *arg),
+			    void *arg)
+{
+	struct pubkey_issuer *issuer;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(&all_issuers, issuer) {
+		fn(issuer->dn, arg);
+	}
+}
+
+void for_each_pubkey(void (*fn)(struct pubkey *pk, void *arg), void *arg)
+{
+	struct pubkey_db_entry *e;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(&all_pubkeys, e) {
+		fn(e->pk, arg);
+	}
+}
+
+void init_pubkey_db(void)
+{
+	init_hash_table(&pubkey_id_hash_table);
+	init_hash_table(&pubkey_ckaid_hash_table);
+	init_hash_table(&issuer_hash_table);
+	init_oneshot_timer(EVENT_EXPIRE_PUBKEYS, expire_pubkeys);
+}
+
+void free_pubkey_db(void)
+{
+	struct pubkey_db_entry *e;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&all_pubkeys, e) {
+		del_pubkey_db_entry(e);
+	}
+}
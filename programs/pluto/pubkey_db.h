@@ -0,0 +1,78 @@
+/* public key database, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef PUBKEY_DB_H
+#define PUBKEY_DB_H
+
+#include <stdbool.h>
+
+#include "chunk.h"
+#include "deltatime.h"
+
+struct id;
+struct pubkey;
+struct pubkey_type;
+
+/*
+ * The public keys pluto was given (ipsec.conf's rsasigkey= and
+ * certificates, whack --keyid, DNS IPSECKEY records), indexed by
+ * ID, by CKAID and by issuer.
+ *
+ * This replaces the pluto_pubkeys list that used to be searched
+ * end-to-end for every RSA/ECDSA authentication.  The keys of a
+ * state's remote certificates are still kept on the state's own
+ * (short) pubkey_list.
+ */
+
+void init_pubkey_db(void);
+void free_pubkey_db(void);
+
+/*
+ * Add PK, taking a reference.  Like install_public_key(), the ID
+ * and issuer are cloned and .installed_time is set.
+ *
+ * When TTL is non-zero, .until_time is set to .installed_time+TTL
+ * and the key is deleted once that passes (DNS records).  Other keys
+ * (certificates) are only deleted when a search finds they've
+ * expired.
+ */
+void add_pubkey_to_db(struct pubkey *pk, deltatime_t ttl);
+
+/* delete any keys matching ID and TYPE, then add PK */
+void replace_pubkey_in_db(struct pubkey *pk);
+
+void delete_pubkeys_from_db(const struct id *id,
+			    const struct pubkey_type *type);
+void delete_pubkey_from_db(struct pubkey *pk);
+
+/*
+ * Call FN on each key whose ID is same_id() as ID, newest first,
+ * until FN returns true; return that key (or NULL).
+ *
+ * FN can delete the key it was passed (but only that key).
+ */
+typedef bool (pubkey_db_fn)(struct pubkey *pk, void *arg);
+struct pubkey *find_pubkey_by_id(const struct id *id,
+				 pubkey_db_fn *fn, void *arg);
+
+/* newest RSA key with CKAID, or NULL */
+struct pubkey *find_rsa_pubkey_by_ckaid(const void *ckaid, size_t len);
+
+/* the (distinct) issuers of the keys */
+void for_each_pubkey_issuer(void (*fn)(chunk_t issuer, void *arg),
+			    void *arg);
+
+/* all keys, newest first (for whack --listpubkeys) */
+void for_each_pubkey(void (*fn)(struct pubkey *pk, void *arg), void *arg);
+
+#endif
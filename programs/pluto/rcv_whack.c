@@ -90,8 +90,10 @@
 
 #include "pluto_stats.h"
 #include "state_db.h"
+#include "pubkey_db.h"
 
 #include "nss_cert_reread.h"
+#include "nss_cert_verify.h"	/* for flush_verified_chains() */
 
 static struct state *find_impaired_state(unsigned biased_what, struct fd *whackfd)
 {
@@ -270,14 +272,14 @@ static void key_add_request(const struct whack_message *msg)
 	}
 
 	if (!msg->whack_addkey)
-		delete_public_keys(&pluto_pubkeys, &keyid,
-				   pubkey_alg_type(msg->pubkey_alg));
+		delete_pubkeys_from_db(&keyid,
+				       pubkey_alg_type(msg->pubkey_alg));
 
 	if (msg->keyval.len != 0) {
 		DBG_dump_hunk("add pubkey", msg->keyval);
 		ugh = add_public_key(&keyid, PUBKEY_LOCAL,
 				     pubkey_alg_type(msg->pubkey_alg),
-				     &msg->keyval, &pluto_pubkeys);
+				     &msg->keyval);
 		if (ugh != NULL) {
 			loglog(RC_LOG_SERIOUS, "%s", ugh);
 		}
@@ -290,6 +292,12 @@ static void key_add_request(const struct whack_message *msg)
 /*
  * handle a whack message.
  */
+/* after any global status, which is queued */
+static void clear_stats(struct show *s UNUSED)
+{
+	clear_pluto_stats();
+}
+
 static bool whack_process(struct fd *whackfd, const struct whack_message *const m)
 {
 	/*
@@ -508,8 +516,10 @@ static bool whack_process(struct fd *whackfd, const struct whack_message *const
 		connection_check_ddns(whackfd);
 	}
 
-	if (m->whack_reread & REREAD_SECRETS)
-		load_preshared_secrets();
+	if (m->whack_reread & REREAD_SECRETS) {
+		flush_verified_chains("rereadsecrets");
+		reload_preshared_secrets();
+	}
 
 	if (m->whack_list & LIST_PUBKEYS)
 		list_public_keys(whackfd, m->whack_utc,
@@ -527,6 +537,7 @@ static bool whack_process(struct fd *whackfd, const struct whack_message *const
 #endif
 
 	if (m->whack_reread & REREAD_CERTS) {
+		flush_verified_chains("rereadcerts");
 		reread_cert_connections(whackfd);
 	}
 
@@ -631,30 +642,34 @@ static bool whack_process(struct fd *whackfd, const struct whack_message *const
 	}
 
 	{
+		/*
+		 * Long listings are streamed; queue what follows them
+		 * so that the output stays in order.
+		 */
 		struct show *s = new_show(whackfd); /* must free */
 
 		if (m->whack_status)
 			show_status(s);
 
 		if (m->whack_global_status)
-			show_global_status(s);
+			show_queue(s, show_global_status);
 
 		if (m->whack_clear_stats)
-			clear_pluto_stats();
+			show_queue(s, clear_stats);
 
 		if (m->whack_traffic_status)
 			show_traffic_status(s, m->name);
 
 		if (m->whack_shunt_status)
-			show_shunt_status(s);
+			show_queue(s, show_shunt_status);
 
 		if (m->whack_fips_status)
-			show_fips_status(s);
+			show_queue(s, show_fips_status);
 
 		if (m->whack_brief_status)
-			show_brief_status(s);
+			show_queue(s, show_brief_status);
 		if (m->whack_addresspool_status)
-			show_addresspool_status(s);
+			show_queue(s, show_addresspool_status);
 
 		if (m->whack_show_states)
 			show_states(s);
@@ -724,6 +739,13 @@ static bool whack_process(struct fd *whackfd, const struct whack_message *const
 
 static bool whack_handle(struct fd *whackfd);
 
+/*
+ * Output whack isn't reading is buffered; beyond this much whack is
+ * assumed to be stuck and the connection is dropped.  Streamed
+ * listings stop well before this, see SHOW_BACKLOG.
+ */
+#define MAX_WHACK_OUTPUT (16 * 1024 * 1024)
+
 void whack_handle_cb(evutil_socket_t fd, const short event UNUSED,
 		     void *arg UNUSED)
 {
@@ -734,6 +756,8 @@ void whack_handle_cb(evutil_socket_t fd, const short event UNUSED,
 			/* already logged */
 			return;
 		}
+		/* don't let a slow whack stall pluto */
+		fd_buffer_output(whackfd, MAX_WHACK_OUTPUT);
 		whack_log_fd = whackfd;
 		bool shutdown = whack_handle(whackfd);
 		whack_log_fd = null_fd;
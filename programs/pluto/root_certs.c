@@ -25,6 +25,7 @@
 #include "log.h"
 
 static struct root_certs *root_certs;
+static unsigned long root_certs_generation;
 
 struct root_certs *root_certs_addref(where_t where)
 {
@@ -50,6 +51,7 @@ struct root_certs *root_certs_addref(where_t where)
 	ref_init(root_certs, where); /* static pointer */
 	ref_add(root_certs, where); /* function result */
 	root_certs->trustcl = CERT_NewCertList();
+	root_certs->generation = ++root_certs_generation;
 
 	PK11SlotInfo *slot = PK11_GetInternalKeySlot();
 	if (slot == NULL) {
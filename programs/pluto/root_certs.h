@@ -26,6 +26,8 @@ void free_root_certs(struct fd *whackfd);
 struct root_certs {
 	refcnt_t refcnt;
 	CERTCertList *trustcl;
+	/* changes each time the cache is (re)loaded */
+	unsigned long generation;
 };
 
 struct root_certs *root_certs_addref(where_t where);
@@ -195,6 +195,7 @@ unsigned int pluto_ddos_threshold = DEFAULT_IKE_SA_DDOS_THRESHOLD;
 deltatime_t pluto_shunt_lifetime = DELTATIME_INIT(PLUTO_SHUNT_LIFE_DURATION_DEFAULT);
 
 unsigned int pluto_sock_bufsize = IKE_BUF_AUTO; /* use system values */
+unsigned int pluto_sock_queues = 1;
 bool pluto_sock_errqueue = TRUE; /* Enable MSG_ERRQUEUE on IKE socket */
 
 /*
@@ -239,6 +240,9 @@ static struct global_timer_desc global_timers[] = {
 	E(EVENT_RESET_LOG_RATE_LIMIT),
 	E(EVENT_PROCESS_KERNEL_QUEUE),
 	E(EVENT_NAT_T_KEEPALIVE),
+	E(EVENT_RESIZE_HASH_TABLES),
+	E(EVENT_FLUSH_NETLINK_BATCH),
+	E(EVENT_EXPIRE_PUBKEYS),
 #undef E
 };
 
@@ -590,29 +594,20 @@ struct resume_event {
 	struct event *event;
 };
 
-static void resume_handler(evutil_socket_t fd UNUSED,
-			   short events UNUSED, void *arg)
+void run_resume(const char *name, so_serial_t serialno,
+		resume_cb *callback, void *context)
 {
-	struct resume_event *e = (struct resume_event *)arg;
-	/*
-	 * At one point, .ne_event was was being set after the event
-	 * was enabled.  With multiple threads this resulted in a race
-	 * where the event ran before .ne_event was set.  The
-	 * pexpect() followed by the passert() demonstrated this - the
-	 * pexpect() failed yet the passert() passed.
-	 */
-	pexpect(e->event != NULL);
-	dbg("processing resume %s for #%lu", e->name, e->serialno);
+	dbg("processing resume %s for #%lu", name, serialno);
 	/*
 	 * XXX: Don't confuse this and the "callback") code path.
 	 * This unsuspends MD, "callback" does not.
 	 */
-	struct state *st = state_with_serialno(e->serialno);
+	struct state *st = state_with_serialno(serialno);
 	if (st == NULL) {
 		threadtime_t start = threadtime_start();
-		stf_status status = e->callback(NULL, NULL, e->context);
+		stf_status status = callback(NULL, NULL, context);
 		pexpect(status == STF_SKIP_COMPLETE_STATE_TRANSITION);
-		threadtime_stop(&start, e->serialno, "resume %s", e->name);
+		threadtime_stop(&start, serialno, "resume %s", name);
 	} else {
 		/* no previous state */
 		pexpect(push_cur_state(st) == SOS_NOBODY);
@@ -627,13 +622,13 @@ static void resume_handler(evutil_socket_t fd UNUSED,
 		pexpect(old_md_st == SOS_NOBODY || old_md_st == old_st);
 
 		/* run the callback */
-		stf_status status = e->callback(st, md, e->context);
+		stf_status status = callback(st, md, context);
 		/* this may trash MD.ST */
 
 		if (status == STF_SKIP_COMPLETE_STATE_TRANSITION) {
 			/* MD.ST may have been freed! */
 			dbg("resume %s for #%lu suppresed complete_v%d_state_transition()%s",
-			    e->name, e->serialno, ike_version,
+			    name, serialno, ike_version,
 			    (old_md_st != SOS_NOBODY && md->st == NULL ? "; MD.ST disappeared" :
 			     old_md_st != SOS_NOBODY && md->st != st ? "; MD.ST was switched" :
 			     ""));
@@ -688,7 +683,7 @@ static void resume_handler(evutil_socket_t fd UNUSED,
 			 * state object at this point.
 			 */
 			pexpect(ike_version == IKEv2);
-			dbg("XXX: resume %s for #%lu deleted MD.ST", e->name, old_st);
+			dbg("XXX: resume %s for #%lu deleted MD.ST", name, old_st);
 		} else {
 			/* XXX: mumble something about struct ike_version */
 			switch (ike_version) {
@@ -705,7 +700,7 @@ static void resume_handler(evutil_socket_t fd UNUSED,
 				} else if (pexpect(md != NULL && md->st != NULL)) {
 					if (md->st->st_serialno != old_st) {
 						dbg("XXX: resume %s for #%lu switched MD.ST to #%lu",
-						    e->name, old_st, md->st->st_serialno);
+						    name, old_st, md->st->st_serialno);
 						st = md->st;
 					}
 				}
@@ -716,9 +711,24 @@ static void resume_handler(evutil_socket_t fd UNUSED,
 			}
 		}
 		release_any_md(&md);
-		statetime_stop(&start, "resume %s", e->name);
+		statetime_stop(&start, "resume %s", name);
 		pop_cur_state(SOS_NOBODY);
 	}
+}
+
+static void resume_handler(evutil_socket_t fd UNUSED,
+			   short events UNUSED, void *arg)
+{
+	struct resume_event *e = (struct resume_event *)arg;
+	/*
+	 * At one point, .ne_event was was being set after the event
+	 * was enabled.  With multiple threads this resulted in a race
+	 * where the event ran before .ne_event was set.  The
+	 * pexpect() followed by the passert() demonstrated this - the
+	 * pexpect() failed yet the passert() passed.
+	 */
+	pexpect(e->event != NULL);
+	run_resume(e->name, e->serialno, e->callback, e->context);
 	passert(e->event != NULL);
 	event_free(e->event);
 	pfree(e);
@@ -824,9 +834,9 @@ extern void schedule_callback(const char *name, so_serial_t serialno,
  * XXX: Some of the callers save the struct pluto_event reference but
  * some do not.
  */
-struct pluto_event *add_fd_read_event_handler(evutil_socket_t fd,
-					      event_callback_fn cb, void *arg,
-					      const char *name)
+static struct pluto_event *add_fd_event_handler(evutil_socket_t fd, short events,
+						event_callback_fn cb, void *arg,
+						const char *name)
 {
 	passert(in_main_thread());
 	pexpect(fd >= 0);
@@ -840,12 +850,30 @@ struct pluto_event *add_fd_read_event_handler(evutil_socket_t fd,
 	 * running, there can't be a race between the event being
 	 * added and the event firing.
 	 */
-	e->ev = event_new(pluto_eb, fd, EV_READ|EV_PERSIST, cb, arg);
+	e->ev = event_new(pluto_eb, fd, events|EV_PERSIST, cb, arg);
 	passert(e->ev != NULL);
 	passert(event_add(e->ev, NULL) >= 0);
 	return e; /* compatible with pluto_event_new for the time being */
 }
 
+struct pluto_event *add_fd_read_event_handler(evutil_socket_t fd,
+					      event_callback_fn cb, void *arg,
+					      const char *name)
+{
+	return add_fd_event_handler(fd, EV_READ, cb, arg, name);
+}
+
+/*
+ * Called each time FD can be written; delete the event once there's
+ * nothing more to write.
+ */
+struct pluto_event *add_fd_write_event_handler(evutil_socket_t fd,
+					       event_callback_fn cb, void *arg,
+					       const char *name)
+{
+	return add_fd_event_handler(fd, EV_WRITE, cb, arg, name);
+}
+
 /*
  * XXX: Some of the callers save the struct pluto_event reference but
  * some do not.
@@ -964,7 +992,7 @@ static void jam_pid_entry(struct lswlog *buf, const void *data)
 
 static hash_t pid_hasher(const pid_t *pid)
 {
-	return hash_table_hasher(shunk2(pid, sizeof(*pid)), zero_hash);
+	return hash_table_hash_u64((uint64_t)*pid);
 }
 
 static hash_t pid_entry_hasher(const void *data)
@@ -1066,6 +1094,58 @@ static void log_status(struct lswlog *buf, int status)
 	lswlogs(buf, ")");
 }
 
+static void reap_child(pid_t child, int status)
+{
+	struct pid_entry *pid_entry = NULL;
+	hash_t hash = pid_hasher(&child);
+	struct list_head *bucket = hash_table_bucket(&pids_hash_table, hash);
+	FOR_EACH_LIST_ENTRY_OLD2NEW(bucket, pid_entry) {
+		passert(pid_entry->magic == PID_MAGIC);
+		if (pid_entry->pid == child) {
+			break;
+		}
+	}
+	if (pid_entry == NULL) {
+		LSWLOG(buf) {
+			lswlogf(buf, "waitpid return unknown child pid %d",
+				child);
+			log_status(buf, status);
+		}
+	} else {
+		struct state *st = state_with_serialno(pid_entry->serialno);
+		if (pid_entry->serialno == SOS_NOBODY) {
+			pid_entry->callback(NULL, NULL,
+					    status, pid_entry->context);
+		} else if (st == NULL) {
+			LSWDBGP(DBG_BASE, buf) {
+				jam_pid_entry(buf, pid_entry);
+				lswlogs(buf, " disappeared");
+			}
+			pid_entry->callback(NULL, NULL,
+					    status, pid_entry->context);
+		} else {
+			so_serial_t old_state = push_cur_state(st);
+			struct msg_digest *md = unsuspend_md(st);
+			if (DBGP(DBG_CPU_USAGE)) {
+				deltatime_t took = monotimediff(mononow(), pid_entry->start_time);
+				deltatime_buf dtb;
+				DBG_log("#%lu waited %s for '%s' fork()",
+					st->st_serialno, str_deltatime(took, &dtb),
+					pid_entry->name);
+			}
+			statetime_t start = statetime_start(st);
+			pid_entry->callback(st, md, status,
+					    pid_entry->context);
+			statetime_stop(&start, "callback for %s",
+				       pid_entry->name);
+			release_any_md(&md);
+			pop_cur_state(old_state);
+		}
+		del_hash_table_entry(&pids_hash_table, pid_entry);
+		pfree(pid_entry);
+	}
+}
+
 static void childhandler_cb(void)
 {
 	while (true) {
@@ -1089,59 +1169,35 @@ static void childhandler_cb(void)
 					child);
 				log_status(buf, status);
 			}
-			struct pid_entry *pid_entry = NULL;
-			hash_t hash = pid_hasher(&child);
-			struct list_head *bucket = hash_table_bucket(&pids_hash_table, hash);
-			FOR_EACH_LIST_ENTRY_OLD2NEW(bucket, pid_entry) {
-				passert(pid_entry->magic == PID_MAGIC);
-				if (pid_entry->pid == child) {
-					break;
-				}
-			}
-			if (pid_entry == NULL) {
-				LSWLOG(buf) {
-					lswlogf(buf, "waitpid return unknown child pid %d",
-						child);
-					log_status(buf, status);
-				}
-			} else {
-				struct state *st = state_with_serialno(pid_entry->serialno);
-				if (pid_entry->serialno == SOS_NOBODY) {
-					pid_entry->callback(NULL, NULL,
-							    status, pid_entry->context);
-				} else if (st == NULL) {
-					LSWDBGP(DBG_BASE, buf) {
-						jam_pid_entry(buf, pid_entry);
-						lswlogs(buf, " disappeared");
-					}
-					pid_entry->callback(NULL, NULL,
-							    status, pid_entry->context);
-				} else {
-					so_serial_t old_state = push_cur_state(st);
-					struct msg_digest *md = unsuspend_md(st);
-					if (DBGP(DBG_CPU_USAGE)) {
-						deltatime_t took = monotimediff(mononow(), pid_entry->start_time);
-						deltatime_buf dtb;
-						DBG_log("#%lu waited %s for '%s' fork()",
-							st->st_serialno, str_deltatime(took, &dtb),
-							pid_entry->name);
-					}
-					statetime_t start = statetime_start(st);
-					pid_entry->callback(st, md, status,
-							    pid_entry->context);
-					statetime_stop(&start, "callback for %s",
-						       pid_entry->name);
-					release_any_md(&md);
-					pop_cur_state(old_state);
-				}
-				del_hash_table_entry(&pids_hash_table, pid_entry);
-				pfree(pid_entry);
-			}
+			reap_child(child, status);
 			break;
 		}
 	}
 }
 
+/*
+ * Block until child PID exits, and then run its callback.
+ */
+void wait_for_pluto_fork(pid_t pid)
+{
+	int status;
+	pid_t child;
+	do {
+		child = waitpid(pid, &status, 0);
+	} while (child < 0 && errno == EINTR);
+	if (child < 0) {
+		LOG_ERRNO(errno, "waitpid for child %d unexpectedly failed", pid);
+		/* still run the callback; as if the exec failed */
+		status = 127 << 8;
+	} else {
+		LSWDBGP(DBG_BASE, buf) {
+			lswlogf(buf, "waitpid returned pid %d", child);
+			log_status(buf, status);
+		}
+	}
+	reap_child(pid, status);
+}
+
 #ifdef EVENT_SET_MEM_FUNCTIONS_IMPLEMENTED
 static void *libevent_malloc(size_t size)
 {
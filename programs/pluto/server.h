@@ -55,6 +55,7 @@ extern unsigned int pluto_ddos_threshold; /* Max incoming IKE before activating
 extern deltatime_t pluto_shunt_lifetime; /* lifetime before we cleanup bare shunts (for OE) */
 extern unsigned int pluto_sock_bufsize; /* pluto IKE socket buffer */
 extern bool pluto_sock_errqueue; /* Enable MSG_ERRQUEUE on IKE socket */
+extern unsigned int pluto_sock_queues; /* SO_REUSEPORT sockets per UDP IKE port */
 
 extern enum pluto_ddos_mode ddos_mode;
 extern bool pluto_drop_oppo_null;
@@ -68,6 +69,9 @@ void fire_timer_photon_torpedo(struct event **evp, event_callback_fn cb, void *a
 extern struct pluto_event *add_fd_read_event_handler(evutil_socket_t fd,
 						     event_callback_fn cb, void *arg,
 						     const char *name);
+struct pluto_event *add_fd_write_event_handler(evutil_socket_t fd,
+					       event_callback_fn cb, void *arg,
+					       const char *name);
 struct evconnlistener *add_fd_accept_event_handler(struct iface_port *ifp,
 						   evconnlistener_cb cb);
 extern void delete_pluto_event(struct pluto_event **evp);
@@ -113,6 +117,14 @@ typedef stf_status resume_cb(struct state *st, struct msg_digest *md,
 void schedule_resume(const char *name, so_serial_t serialno,
 		     resume_cb *callback, void *context);
 
+/*
+ * Same as schedule_resume() but run CALLBACK immediately; only call
+ * this from the main thread (e.g., when draining a batch of helper
+ * answers).
+ */
+void run_resume(const char *name, so_serial_t serialno,
+		resume_cb *callback, void *context);
+
 /*
  * Schedule a callback on the main event loop now.
  *
@@ -149,5 +161,7 @@ typedef void pluto_fork_cb(struct state *st, struct msg_digest *mdp,
 extern int pluto_fork(const char *name, so_serial_t serialno,
 		      int op(void *context),
 		      pluto_fork_cb *callback, void *context);
+/* block until PID exits, then call its callback */
+extern void wait_for_pluto_fork(pid_t pid);
 
 #endif /* _SERVER_H */
@@ -23,6 +23,8 @@
  *
  */
 
+#include <ctype.h>
+
 #include "sysdep.h"
 #include "constants.h"
 #include "lswconf.h"
@@ -42,11 +44,30 @@
 #include "db_ops.h"
 #include "kernel_xfrm_interface.h"
 #include "iface.h"
+#include "nat_traversal.h"
 #include "show.h"
+#include "updown.h"
+#ifdef USE_DNSSEC
+#include "ddns.h"
+#endif
+#include "hash_table.h"
+#include "pluto_crypt.h"		/* for show_crypto_helpers_status() */
+#include "ike_admission.h"
+#include "ikev2_cookie.h"
+#include "xauth.h"		/* for show_xauth_pam_status() */
+#include "nss_cert_verify.h"	/* for show_verified_chains_status() */
 #ifdef HAVE_SECCOMP
 #include "pluto_seccomp.h"
 #endif
 
+struct show_job {
+	struct show_job *next;
+	/* one of */
+	void (*show)(struct show *s);
+	show_step_fn *step;
+	void *cursor;
+};
+
 struct show {
 	/*
 	 * where to send the output
@@ -56,34 +77,173 @@ struct show {
 	 * Should the next output be preceded by a blank line?
 	 */
 	enum separation { NO_SEPARATOR = 1, HAD_OUTPUT, SEPARATE_NEXT_OUTPUT, } separator;
+	/*
+	 * Streamed output, run from EVENT; see show_stream().
+	 */
+	struct show_job *jobs;
+	struct show_job **last_job;
+	struct pluto_event *event;
+	bool freed;
+	struct show *next_streaming;	/* while EVENT != NULL */
 };
 
+/* shows with an EVENT, so they can be released at exit */
+static struct show *streaming_shows;
+
 struct show *new_show(struct fd *whackfd)
 {
 	struct show s = {
 		.separator = NO_SEPARATOR,
-		.whackfd = whackfd,
+		.whackfd = dup_any(whackfd),
 	};
-	return clone_thing(s, "on show");
+	struct show *sp = clone_thing(s, "on show");
+	sp->last_job = &sp->jobs;
+	return sp;
+}
+
+static void release_show(struct show *s)
+{
+	switch (s->separator) {
+	case NO_SEPARATOR:
+	case HAD_OUTPUT:
+		break;
+	case SEPARATE_NEXT_OUTPUT:
+		whack_comment(s->whackfd, " ");
+		break;
+	default:
+		bad_case(s->separator);
+	}
+	close_any(&s->whackfd);
+	pfree(s);
 }
 
 void free_show(struct show **sp)
 {
-	{
-		struct show *s = *sp;
-		switch (s->separator) {
-		case NO_SEPARATOR:
-		case HAD_OUTPUT:
-			break;
-		case SEPARATE_NEXT_OUTPUT:
-			whack_comment(s->whackfd, " ");
+	struct show *s = *sp;
+	*sp = NULL;
+	if (s->jobs != NULL) {
+		/* released once the queue drains */
+		s->freed = true;
+		return;
+	}
+	release_show(s);
+}
+
+static void pop_show_job(struct show *s)
+{
+	struct show_job *job = s->jobs;
+	s->jobs = job->next;
+	if (s->jobs == NULL) {
+		s->last_job = &s->jobs;
+	}
+	pfreeany(job->cursor);
+	pfree(job);
+}
+
+static void run_show_job(struct show *s)
+{
+	struct show_job *job = s->jobs;
+	if (job->show != NULL) {
+		job->show(s);
+		pop_show_job(s);
+	} else if (job->step(s, job->cursor)) {
+		pop_show_job(s);
+	}
+}
+
+static void stop_streaming(struct show *s)
+{
+	for (struct show **sp = &streaming_shows; *sp != NULL; sp = &(*sp)->next_streaming) {
+		if (*sp == s) {
+			*sp = s->next_streaming;
 			break;
-		default:
-			bad_case(s->separator);
 		}
 	}
-	pfree(*sp);
-	*sp = NULL;
+	s->next_streaming = NULL;
+	delete_pluto_event(&s->event);
+}
+
+static void show_event_cb(evutil_socket_t fd UNUSED,
+			  const short event UNUSED, void *arg)
+{
+	struct show *s = arg;
+	ssize_t backlog = fd_flush(s->whackfd, false/*don't block*/);
+	if (backlog < 0) {
+		/* whack has gone away */
+		dbg("whack went away; abandoning show output");
+		while (s->jobs != NULL) {
+			pop_show_job(s);
+		}
+	} else if (backlog > SHOW_BACKLOG) {
+		/* wait for whack to catch up */
+		return;
+	} else {
+		threadtime_t start = threadtime_start();
+		run_show_job(s);
+		threadtime_stop(&start, SOS_NOBODY, "show");
+	}
+	if (s->jobs == NULL) {
+		stop_streaming(s);
+		if (s->freed) {
+			release_show(s);
+		}
+	}
+}
+
+static void queue_show_job(struct show *s, struct show_job job)
+{
+	*s->last_job = clone_thing(job, "show job");
+	s->last_job = &(*s->last_job)->next;
+	if (s->event == NULL) {
+		/* run each time whack can take more output */
+		s->event = add_fd_write_event_handler(fd_fileno(s->whackfd),
+						      show_event_cb, s, "show");
+		s->next_streaming = streaming_shows;
+		streaming_shows = s;
+	}
+}
+
+void free_streaming_shows(void)
+{
+	while (streaming_shows != NULL) {
+		struct show *s = streaming_shows;
+		dbg("exiting; abandoning show output");
+		while (s->jobs != NULL) {
+			pop_show_job(s);
+		}
+		stop_streaming(s);
+		/* else whoever called new_show() still has it */
+		if (s->freed) {
+			release_show(s);
+		}
+	}
+}
+
+void show_stream(struct show *s, show_step_fn *step, void *cursor)
+{
+	if (!fd_p(s->whackfd)) {
+		/* no event loop to run it from; do it now */
+		while (!step(s, cursor)) {
+			continue;
+		}
+		pfreeany(cursor);
+		return;
+	}
+	queue_show_job(s, (struct show_job) {
+			.step = step,
+			.cursor = cursor,
+		});
+}
+
+void show_queue(struct show *s, void (*show)(struct show *s))
+{
+	if (s->jobs == NULL) {
+		show(s);
+		return;
+	}
+	queue_show_job(s, (struct show_job) {
+			.show = show,
+		});
 }
 
 struct fd *show_fd(struct show *s)
@@ -139,6 +299,24 @@ void show_comment(struct show *s, const char *message, ...)
 	s->separator = HAD_OUTPUT;
 }
 
+size_t jam_status_name(jambuf_t *buf, const char *name)
+{
+	size_t size = 0;
+	bool separate = false;
+	for (const char *c = name; *c != '\0'; c++) {
+		if (!isalnum((unsigned char)*c)) {
+			separate = (size > 0);
+			continue;
+		}
+		if (separate) {
+			size += jam_char(buf, '_');
+			separate = false;
+		}
+		size += jam_char(buf, tolower((unsigned char)*c));
+	}
+	return size;
+}
+
 static void show_system_security(struct show *s)
 {
 	int selinux = libreswan_selinux();
@@ -160,6 +338,19 @@ static void show_system_security(struct show *s)
 void show_global_status(struct show *s)
 {
 	show_globalstate_status(s);
+	show_hash_tables_status(s);
+	show_crypto_helpers_status(s);
+	show_ike_admission_status(s);
+	show_v2_cookie_status(s);
+	show_verified_chains_status(s);
+	show_updown_status(s);
+	show_nat_keepalive_status(s);
+#ifdef XAUTH_HAVE_PAM
+	show_xauth_pam_status(s);
+#endif
+#ifdef USE_DNSSEC
+	show_ddns_status(s);
+#endif
 	show_pluto_stats(s->whackfd);
 }
 
@@ -175,11 +366,11 @@ void show_status(struct show *s)
 	show_kernel_alg_status(s);
 	show_ike_alg_status(s);
 	show_db_ops_status(s);
-	show_connections_status(s);
-	show_brief_status(s);
-	show_states(s);
+	show_connections_status(s);	/* streamed */
+	show_queue(s, show_brief_status);
+	show_states(s);			/* streamed */
 #if defined(XFRM_SUPPORT)
-	show_shunt_status(s);
+	show_queue(s, show_shunt_status);
 #endif
 }
 
@@ -16,6 +16,8 @@
 #ifndef SHOW_H
 #define SHOW_H
 
+#include "jambuf.h"		/* for jambuf_t */
+
 /*
  * Try to deal with the separator (aka blank line or spacer) problem
  * in show output.
@@ -27,6 +29,14 @@ struct show *new_show(struct fd *whackfd);
 void free_show(struct show **s);
 struct fd *show_fd(struct show *s);
 
+/*
+ * Turn a descriptive NAME into a key for "whack --globalstatus":
+ * lower case, each run of anything other than letters and digits
+ * becomes a single '_', none leading or trailing.  For instance
+ * "build KE and nonce" -> "build_ke_and_nonce".
+ */
+size_t jam_status_name(jambuf_t *buf, const char *name);
+
 /*
  * Flag that the next line needs to be preceded by a separator (aka
  * blank line).  For instance:
@@ -57,4 +67,33 @@ void show_separator(struct show *s);
 
 void show_comment(struct show *s, const char *message, ...) PRINTF_LIKE(2);
 
+/*
+ * Stream long listings (every connection, every state).
+ *
+ * Rather than showing everything in one go, and stalling the event
+ * loop, a listing takes a snapshot (the CURSOR, typically an array of
+ * serial numbers) and queues STEP.  STEP is then called from the
+ * event loop to show the next batch, until it returns true.  While
+ * whack is not keeping up (more than SHOW_BACKLOG bytes are waiting
+ * to be written) STEP is held back.
+ *
+ * Since a streamed listing finishes later, anything shown after it
+ * must also be queued: show_queue() runs SHOW immediately when
+ * nothing is queued, and after everything else when there is.  The
+ * show, and its whack FD, are kept until the queue is empty so
+ * free_show() can be called straight away.
+ *
+ * CURSOR must be a single allocation; it is pfree()d once STEP
+ * returns true, or whack goes away.
+ */
+
+#define SHOW_BATCH 100
+#define SHOW_BACKLOG (64 * 1024)
+
+typedef bool show_step_fn(struct show *s, void *cursor);
+void show_stream(struct show *s, show_step_fn *step, void *cursor);
+void show_queue(struct show *s, void (*show)(struct show *s));
+/* on exit, abandon anything still streaming; before free_server() */
+void free_streaming_shows(void);
+
 #endif
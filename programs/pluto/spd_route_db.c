@@ -0,0 +1,189 @@
+/* SPD route database indexed by peer client, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "spd_route_db.h"
+#include "connections.h"
+#include "log.h"
+#include "hash_table.h"
+#include "ip_info.h"
+
+/*
+ * Number of indexed .that.client selectors with each prefix length,
+ * by address family; lets a containment lookup skip lengths that
+ * can't match.
+ */
+static unsigned long that_client_census[2][128 + 1];
+
+static unsigned long *that_client_count(const ip_selector *client)
+{
+	const struct ip_info *afi = subnet_type(client);
+	if (afi == NULL) {
+		return NULL;
+	}
+	if (!pexpect(client->maskbits >= 0 &&
+		     client->maskbits <= afi->mask_cnt)) {
+		return NULL;
+	}
+	return &that_client_census[afi == &ipv6_info][client->maskbits];
+}
+
+/*
+ * The hash covers the address family, the prefix length, and the
+ * prefix (host bits and port cleared) so that an address can be
+ * masked and then looked up for each prefix length.
+ */
+
+static hash_t that_prefix_hasher(const ip_address *address, unsigned maskbits)
+{
+	const struct ip_info *afi = address_type(address);
+	if (afi == NULL) {
+		/* all unset clients share a bucket */
+		return hash_table_hash_u64(0);
+	}
+	ip_address prefix = address_blit(*address,
+					 /*routing-prefix*/&keep_bits,
+					 /*host-id*/&clear_bits,
+					 maskbits);
+	hash_t hash = hash_table_hash_u64((uint64_t)afi->ip_version << 8 | maskbits);
+	return hash_table_hasher(address_as_shunk(&prefix), hash);
+}
+
+static hash_t that_client_hasher(const ip_selector *client)
+{
+	ip_address address = endpoint_address(&client->addr);
+	return that_prefix_hasher(&address, client->maskbits);
+}
+
+static void jam_spd_route(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "spd_route NULL");
+	} else {
+		const struct spd_route *sr = data;
+		jam_connection(buf, sr->connection);
+		jam(buf, " ");
+		jam_selector(buf, &sr->that_client_in_db);
+	}
+}
+
+static hash_t spd_route_that_client_hasher(const void *data)
+{
+	const struct spd_route *sr = data;
+	return that_client_hasher(&sr->that_client_in_db);
+}
+
+static struct list_entry *spd_route_that_client_entry(void *data)
+{
+	struct spd_route *sr = data;
+	return &sr->that_client_db_entry;
+}
+
+static struct list_head that_client_hash_slots[STATE_TABLE_SIZE];
+
+static struct hash_table that_client_hash_table = {
+	.info = {
+		.name = "spd_route that.client table",
+		.jam = jam_spd_route,
+	},
+	.hasher = spd_route_that_client_hasher,
+	.entry = spd_route_that_client_entry,
+	.nr_slots = elemsof(that_client_hash_slots),
+	.slots = that_client_hash_slots,
+};
+
+/*
+ * Only an spd_route that was added for C is in the table; the
+ * spd_routes of a connection cloned from C start out with a copy of
+ * C's .connection and list entry.
+ */
+
+static bool spd_route_in_db(const struct connection *c,
+			    const struct spd_route *sr)
+{
+	return sr->connection == c &&
+		!detached_list_entry(&sr->that_client_db_entry);
+}
+
+void add_spd_route_to_db(struct connection *c, struct spd_route *sr)
+{
+	sr->connection = c;
+	sr->that_client_in_db = sr->that.client;
+	unsigned long *count = that_client_count(&sr->that_client_in_db);
+	if (count != NULL) {
+		(*count)++;
+	}
+	add_hash_table_entry(&that_client_hash_table, sr);
+}
+
+static void del_spd_route_from_db(struct spd_route *sr)
+{
+	del_hash_table_entry(&that_client_hash_table, sr);
+	unsigned long *count = that_client_count(&sr->that_client_in_db);
+	if (count != NULL && pexpect(*count > 0)) {
+		(*count)--;
+	}
+}
+
+void add_spd_routes_to_db(struct connection *c)
+{
+	connection_buf cb;
+	dbg("SPD route DB: adding "PRI_CONNECTION, pri_connection(c, &cb));
+	for (struct spd_route *sr = &c->spd; sr != NULL; sr = sr->spd_next) {
+		add_spd_route_to_db(c, sr);
+	}
+}
+
+void remove_spd_routes_from_db(struct connection *c)
+{
+	for (struct spd_route *sr = &c->spd; sr != NULL; sr = sr->spd_next) {
+		if (spd_route_in_db(c, sr)) {
+			del_spd_route_from_db(sr);
+		}
+	}
+}
+
+void rehash_spd_routes(struct connection *c)
+{
+	for (struct spd_route *sr = &c->spd; sr != NULL; sr = sr->spd_next) {
+		if (spd_route_in_db(c, sr) &&
+		    !samesubnet(&sr->that.client, &sr->that_client_in_db)) {
+			del_spd_route_from_db(sr);
+			add_spd_route_to_db(c, sr);
+		}
+	}
+}
+
+struct list_head *spd_route_bucket_by_that_client(const ip_selector *client)
+{
+	return hash_table_bucket(&that_client_hash_table,
+				 that_client_hasher(client));
+}
+
+struct list_head *spd_route_bucket_by_that_prefix(const ip_address *address,
+						  unsigned maskbits)
+{
+	const struct ip_info *afi = address_type(address);
+	if (afi == NULL || maskbits > (unsigned)afi->mask_cnt) {
+		return NULL;
+	}
+	if (that_client_census[afi == &ipv6_info][maskbits] == 0) {
+		return NULL;
+	}
+	return hash_table_bucket(&that_client_hash_table,
+				 that_prefix_hasher(address, maskbits));
+}
+
+void init_spd_route_db(void)
+{
+	init_hash_table(&that_client_hash_table);
+}
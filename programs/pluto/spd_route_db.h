@@ -0,0 +1,62 @@
+/* SPD route database, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SPD_ROUTE_DB_H
+#define SPD_ROUTE_DB_H
+
+#include <stdbool.h>
+
+#include "ip_address.h"
+#include "ip_selector.h"
+
+struct connection;
+struct spd_route;
+struct list_head;
+struct ip_info;
+
+/*
+ * Index of every connection's spd_routes hashed by the peer's client
+ * (.that.client).
+ *
+ * Lookups that used to walk the entire connections list comparing
+ * .that.client use this instead: an exact match is a single bucket;
+ * a "which .that.client contains this address" match probes one
+ * bucket per prefix length currently in use (longest first).
+ *
+ * Anything that changes .that.client of an indexed connection must
+ * call rehash_spd_routes() afterwards.
+ */
+
+void init_spd_route_db(void);
+
+void add_spd_routes_to_db(struct connection *c);
+void add_spd_route_to_db(struct connection *c, struct spd_route *sr);
+void remove_spd_routes_from_db(struct connection *c);
+void rehash_spd_routes(struct connection *c);
+
+/*
+ * Return the bucket that would contain spd_routes with .that.client
+ * equal to CLIENT.  As always, the caller still needs to check each
+ * entry.
+ */
+struct list_head *spd_route_bucket_by_that_client(const ip_selector *client);
+
+/*
+ * Return the bucket that would contain spd_routes with .that.client
+ * being the MASKBITS prefix of ADDRESS, or NULL when no .that.client
+ * of that length (and address family) is indexed.
+ */
+struct list_head *spd_route_bucket_by_that_prefix(const ip_address *address,
+						  unsigned maskbits);
+
+#endif
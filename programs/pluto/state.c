@@ -78,6 +78,7 @@
 #include "kernel.h"
 #include "kernel_xfrm_interface.h"
 #include "iface.h"
+#include "nat_traversal.h"	/* for schedule_nat_keepalive() */
 #include "ikev1_send.h"		/* for free_v1_messages() */
 #include "ikev2_send.h"		/* for free_v2_messages() */
 
@@ -91,6 +92,7 @@
 #include "ip_address.h"
 #include "ip_info.h"
 #include "ip_selector.h"
+#include "ike_admission.h"	/* for crypto_backlog_requires_cookies() */
 
 bool uniqueIDs = FALSE;
 
@@ -453,6 +455,7 @@ void change_state(struct state *st, enum state_kind new_state_kind)
 		update_state_stats(st, old_state, new_state);
 		binlog_state(st, new_state_kind /* XXX */);
 		st->st_state = new_state;
+		schedule_nat_keepalive(st);
 	}
 }
 
@@ -2443,6 +2446,63 @@ static struct state **sort_states(int (*sort_fn)(const void *, const void *),
 	return array;
 }
 
+/*
+ * Snapshot of the states, sorted, for show_stream(); the states are
+ * looked up by serial number as they are shown so ones deleted in
+ * the meantime are skipped.
+ */
+
+struct state_cursor {
+	bool started;
+	unsigned next;
+	unsigned nr;
+	so_serial_t serialno[];
+};
+
+static struct state_cursor *sort_state_cursor(int (*sort_fn)(const void *, const void *),
+					      const char *func)
+{
+	struct state **array = sort_states(sort_fn, func);
+	unsigned nr = 0;
+	while (array != NULL && array[nr] != NULL) {
+		nr++;
+	}
+	struct state_cursor *cursor =
+		alloc_bytes(sizeof(struct state_cursor) + nr * sizeof(so_serial_t),
+			    "state cursor");
+	cursor->nr = nr;
+	for (unsigned i = 0; i < nr; i++) {
+		cursor->serialno[i] = array[i]->st_serialno;
+	}
+	pfreeany(array);
+	return cursor;
+}
+
+/* returns the next state, or NULL when the batch is done */
+static struct state *next_state_in_batch(struct state_cursor *cursor,
+					 unsigned *batch)
+{
+	while (*batch < SHOW_BATCH && cursor->next < cursor->nr) {
+		(*batch)++;
+		struct state *st = state_by_serialno(cursor->serialno[cursor->next++]);
+		if (st != NULL) {
+			return st;
+		}
+	}
+	return NULL;
+}
+
+static bool show_traffic_step(struct show *s, void *arg)
+{
+	struct state_cursor *cursor = arg;
+	unsigned batch = 0;
+	struct state *st;
+	while ((st = next_state_in_batch(cursor, &batch)) != NULL) {
+		show_state_traffic(s, RC_INFORMATIONAL_TRAFFIC, st);
+	}
+	return cursor->next >= cursor->nr;
+}
+
 static int show_newest_state_traffic(struct connection *c,
 				     struct fd *unused_whackfd UNUSED,
 				     void *arg)
@@ -2460,19 +2520,8 @@ static int show_newest_state_traffic(struct connection *c,
 void show_traffic_status(struct show *s, const char *name)
 {
 	if (name == NULL) {
-		struct state **array = sort_states(state_compare_serial,
-						   __func__);
-
-		/* now print sorted results */
-		if (array != NULL) {
-			int i;
-			for (i = 0; array[i] != NULL; i++) {
-				show_state_traffic(s,
-						   RC_INFORMATIONAL_TRAFFIC,
-						   array[i]);
-			}
-			pfree(array);
-		}
+		show_stream(s, show_traffic_step,
+			    sort_state_cursor(state_compare_serial, __func__));
 	} else {
 		struct connection *c = conn_by_name(name, true/*strict*/);
 
@@ -2511,34 +2560,37 @@ void show_brief_status(struct show *s)
 		  cat_count_child_sa[CAT_ANONYMOUS]);
 }
 
-void show_states(struct show *s)
+static bool show_states_step(struct show *s, void *arg)
 {
-	show_separator(s);
-	struct state **array = sort_states(state_compare_connection,
-					   __func__);
-
-	if (array != NULL) {
-		monotime_t n = mononow();
-		/* now print sorted results */
-		int i;
-		for (i = 0; array[i] != NULL; i++) {
-			struct state *st = array[i];
-
-			char state_buf[LOG_WIDTH];
-			char state_buf2[LOG_WIDTH];
-			fmt_state(st, n, state_buf, sizeof(state_buf),
-				  state_buf2, sizeof(state_buf2));
-			show_comment(s, "%s", state_buf);
-			if (state_buf2[0] != '\0')
-				show_comment(s, "%s", state_buf2);
-
-			/* show any associated pending Phase 2s */
-			if (IS_IKE_SA(st))
-				show_pending_phase2(s, st->st_connection,
-						    pexpect_ike_sa(st));
-		}
-		pfree(array);
+	struct state_cursor *cursor = arg;
+	if (!cursor->started) {
+		cursor->started = true;
+		show_separator(s);
 	}
+	monotime_t n = mononow();
+	unsigned batch = 0;
+	struct state *st;
+	while ((st = next_state_in_batch(cursor, &batch)) != NULL) {
+		char state_buf[LOG_WIDTH];
+		char state_buf2[LOG_WIDTH];
+		fmt_state(st, n, state_buf, sizeof(state_buf),
+			  state_buf2, sizeof(state_buf2));
+		show_comment(s, "%s", state_buf);
+		if (state_buf2[0] != '\0')
+			show_comment(s, "%s", state_buf2);
+
+		/* show any associated pending Phase 2s */
+		if (IS_IKE_SA(st))
+			show_pending_phase2(s, st->st_connection,
+					    pexpect_ike_sa(st));
+	}
+	return cursor->next >= cursor->nr;
+}
+
+void show_states(struct show *s)
+{
+	show_stream(s, show_states_step,
+		    sort_state_cursor(state_compare_connection, __func__));
 }
 
 /*
@@ -2777,6 +2829,10 @@ bool update_mobike_endpoints(struct ike_sa *ike, const struct msg_digest *md)
 	ike->sa.st_pend_liveness = FALSE;
 	ike->sa.st_last_liveness = monotime_epoch;
 
+	/* the new path may be behind a NAT */
+	schedule_nat_keepalive(&ike->sa);
+	schedule_nat_keepalive(&child->sa);
+
 	delete_oriented_hp(c); /* hp list may have changed */
 	if (!orient(c)) {
 		PEXPECT_LOG("%s after mobike failed", "orient");
@@ -3029,7 +3085,8 @@ bool require_ddos_cookies(void)
 {
 	return pluto_ddos_mode == DDOS_FORCE_BUSY ||
 		(pluto_ddos_mode == DDOS_AUTO &&
-		 cat_count[CAT_HALF_OPEN_IKE_SA] >= pluto_ddos_threshold);
+		 (cat_count[CAT_HALF_OPEN_IKE_SA] >= pluto_ddos_threshold ||
+		  crypto_backlog_requires_cookies()));
 }
 
 bool drop_new_exchanges(void)
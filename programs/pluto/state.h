@@ -451,6 +451,12 @@ struct state {
 	struct v2_outgoing_fragment *st_v2_outgoing[MESSAGE_ROLE_ROOF];
 	struct v2_incomming_fragments *st_v2_incomming[MESSAGE_ROLE_ROOF];
 
+	/* messages that arrived while decrypting; see v2_hold_md() */
+#define MAX_V2_HELD_MDS 8
+	bool st_v2_decrypting;
+	unsigned st_v2_nr_held_mds;
+	struct msg_digest *st_v2_held_mds[MAX_V2_HELD_MDS];
+
 	bool st_viable_parent;	/* can initiate new CERAET_CHILD_SA */
 	struct ikev2_proposal *st_accepted_ike_proposal;
 	struct ikev2_proposal *st_accepted_esp_or_ah_proposal;
@@ -733,6 +739,7 @@ struct state {
 	chunk_t st_xauth_password;
 
 	monotime_t st_last_liveness;		/* Time of last v2 informational (0 means never?) */
+	bool st_nat_keepalive;			/* on the NAT-T keepalive wheel */
 	bool st_pend_liveness;			/* Waiting on an informational response */
 	struct pluto_event *st_liveness_event;	/* IKEv2 only event */
 	struct pluto_event *st_rel_whack_event;
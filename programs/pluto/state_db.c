@@ -72,7 +72,7 @@ struct list_head state_serialno_list_head = INIT_LIST_HEAD(&state_serialno_list_
 
 static hash_t serialno_hasher(const so_serial_t *serialno)
 {
-	return hash_table_hasher(shunk2(serialno, sizeof(*serialno)), zero_hash);
+	return hash_table_hash_u64(*serialno);
 }
 
 static hash_t state_serialno_hasher(const void *data)
@@ -120,7 +120,7 @@ struct child_sa *child_sa_by_serialno(so_serial_t serialno)
 
 static hash_t connection_hasher(struct connection *const *connection)
 {
-	return hash_table_hasher(shunk2(connection, sizeof(*connection)), zero_hash);
+	return hash_table_hash_u64((uintptr_t)*connection);
 }
 
 static hash_t state_connection_hasher(const void *data)
@@ -174,7 +174,7 @@ void rehash_state_connection(struct state *st)
 
 static hash_t reqid_hasher(const reqid_t *reqid)
 {
-	return hash_table_hasher(shunk2(reqid, sizeof(*reqid)), zero_hash);
+	return hash_table_hash_u64(*reqid);
 }
 
 static hash_t state_reqid_hasher(const void *data)
@@ -235,7 +235,9 @@ void rehash_state_reqid(struct state *st)
 
 static hash_t ike_initiator_spi_hasher(const ike_spi_t *ike_initiator_spi)
 {
-	return hash_table_hasher(shunk2(ike_initiator_spi, sizeof(*ike_initiator_spi)), zero_hash);
+	uint64_t spi;
+	memcpy(&spi, ike_initiator_spi->bytes, sizeof(spi));
+	return hash_table_hash_u64(spi);
 }
 
 static hash_t state_ike_initiator_spi_hasher(const void *data)
@@ -302,7 +304,10 @@ struct state *state_by_ike_initiator_spi(enum ike_version ike_version,
 
 static hash_t ike_spis_hasher(const ike_spis_t *ike_spis)
 {
-	return hash_table_hasher(shunk2(ike_spis, sizeof(*ike_spis)), zero_hash);
+	uint64_t spii, spir;
+	memcpy(&spii, ike_spis->initiator.bytes, sizeof(spii));
+	memcpy(&spir, ike_spis->responder.bytes, sizeof(spir));
+	return hash_table_hash_u64x2(spii, spir);
 }
 
 static hash_t state_ike_spis_hasher(const void *data)
@@ -423,10 +423,9 @@ static void timer_event_cb(evutil_socket_t unused_fd UNUSED,
 		dbg("PAM thread timeout on state #%lu", st->st_serialno);
 		xauth_pam_abort(st);
 		/*
-		 * Things get cleaned up when the PAM process exits.
-		 *
-		 * Should this schedule an event for the case when the
-		 * child process (which is SIGKILLed) doesn't exit!?!
+		 * The callback is scheduled with a failure; a PAM
+		 * process that has been at it this long is killed and
+		 * replaced.
 		 */
 		break;
 #endif
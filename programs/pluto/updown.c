@@ -0,0 +1,889 @@
+/* asynchronous updown commands, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "defs.h"
+#include "lswalloc.h"
+#include "log.h"
+#include "state.h"
+#include "connections.h"
+#include "server.h"
+#include "hash_table.h"
+#include "show.h"
+#include "whack.h"		/* for RC_LOG_SERIOUS */
+#include "updown.h"
+
+/*
+ * Output not yet logged; lines are folded like the fgets() this
+ * replaced.
+ */
+
+struct output_line {
+	char line[256];
+	size_t len;
+};
+
+static void split_output_lines(struct output_line *output,
+			       const char *buf, size_t n,
+			       void (*line)(const char *line, void *arg),
+			       void *arg)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (buf[i] != '\n') {
+			output->line[output->len++] = buf[i];
+		}
+		if (buf[i] == '\n' || output->len == sizeof(output->line) - 1) {
+			output->line[output->len] = '\0';
+			output->len = 0;
+			line(output->line, arg);
+		}
+	}
+}
+
+static void flush_output_line(struct output_line *output,
+			      void (*line)(const char *line, void *arg),
+			      void *arg)
+{
+	if (output->len > 0) {
+		split_output_lines(output, "\n", 1, line, arg);
+	}
+}
+
+/*
+ * A queued, or running, hook.
+ *
+ * All of a connection's hooks are in the same bucket of
+ * updown_hook_table, oldest first; only the oldest can be on
+ * ready_hooks or running_hooks.
+ */
+
+struct updown_hook {
+	co_serial_t serialno;
+	so_serial_t so;
+	const char *verb;	/* string literals */
+	const char *verb_suffix;
+	char *cmd;
+	monotime_t queued;
+	pid_t pid;		/* 0 while queued */
+	int out_fd;		/* command's stdout+stderr; -1 once closed */
+	int child_fd;		/* other end, only until the fork */
+	struct pluto_event *out_event;
+	struct output_line output;
+	struct list_entry serialno_entry;
+	struct list_entry queue_entry;	/* on ready_hooks or running_hooks */
+};
+
+static unsigned nr_queued;	/* includes running */
+static unsigned max_queued;
+static unsigned nr_running;
+
+static void jam_updown_hook(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "updown hook NULL");
+	} else {
+		const struct updown_hook *hook = data;
+		jam(buf, PRI_CO" %s%s", pri_co(hook->serialno),
+		    hook->verb, hook->verb_suffix);
+		if (hook->pid != 0) {
+			jam(buf, " pid %d", hook->pid);
+		}
+	}
+}
+
+static const struct list_info updown_queue_info = {
+	.name = "updown queue",
+	.jam = jam_updown_hook,
+};
+
+static struct list_head ready_hooks = INIT_LIST_HEAD(&ready_hooks, &updown_queue_info);
+static struct list_head running_hooks = INIT_LIST_HEAD(&running_hooks, &updown_queue_info);
+
+static hash_t serialno_hasher(co_serial_t serialno)
+{
+	return hash_table_hash_u64(serialno.co);
+}
+
+static hash_t updown_hook_hasher(const void *data)
+{
+	const struct updown_hook *hook = data;
+	return serialno_hasher(hook->serialno);
+}
+
+static struct list_entry *updown_hook_entry(void *data)
+{
+	struct updown_hook *hook = data;
+	return &hook->serialno_entry;
+}
+
+static struct list_head updown_hook_slots[STATE_TABLE_SIZE];
+
+static struct hash_table updown_hook_table = {
+	.info = {
+		.name = "updown hook table",
+		.jam = jam_updown_hook,
+	},
+	.hasher = updown_hook_hasher,
+	.entry = updown_hook_entry,
+	.nr_slots = elemsof(updown_hook_slots),
+	.slots = updown_hook_slots,
+};
+
+static struct updown_hook *oldest_updown_hook(co_serial_t serialno)
+{
+	struct list_head *bucket =
+		hash_table_bucket(&updown_hook_table, serialno_hasher(serialno));
+	struct updown_hook *hook;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(bucket, hook) {
+		if (co_serial_eq(hook->serialno, serialno)) {
+			return hook;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Latency, from being queued to exiting, of each verb; bucket N
+ * counts commands that took less than 2^N milliseconds (the last
+ * bucket counts everything else).
+ *
+ * There's one entry for each verb pluto passes to do_command().
+ */
+
+#define UPDOWN_LATENCY_BUCKETS 14
+
+static struct updown_verb_stats {
+	const char *name;
+	unsigned long count;
+	unsigned long failed;
+	unsigned long latency[UPDOWN_LATENCY_BUCKETS];
+} updown_verb_stats[] = {
+	{ .name = "prepare", },
+	{ .name = "route", },
+	{ .name = "unroute", },
+	{ .name = "up", },
+	{ .name = "down", },
+	{ .name = "disconnectNM", },
+};
+
+void add_updown_latency(const char *verb, monotime_t start, bool ok)
+{
+	struct updown_verb_stats *stats = NULL;
+	for (unsigned i = 0; i < elemsof(updown_verb_stats); i++) {
+		if (streq(updown_verb_stats[i].name, verb)) {
+			stats = &updown_verb_stats[i];
+			break;
+		}
+	}
+	if (stats == NULL) {
+		PEXPECT_LOG("updown verb %s is missing from updown_verb_stats[]",
+			    verb);
+		return;
+	}
+	intmax_t ms = deltamillisecs(monotimediff(mononow(), start));
+	unsigned b = 0;
+	while (b < UPDOWN_LATENCY_BUCKETS - 1 && ms >= ((intmax_t)1 << b)) {
+		b++;
+	}
+	stats->count++;
+	stats->failed += ok ? 0 : 1;
+	stats->latency[b]++;
+}
+
+/*
+ * Log the command's output in the context of its state or, when
+ * that has gone, its connection.
+ */
+
+static void log_updown_output(const char *line, void *arg)
+{
+	struct updown_hook *hook = arg;
+	struct connection *c = connection_by_serialno(hook->serialno);
+	struct connection *old_connection = push_cur_connection(c);
+	struct state *st = state_with_serialno(hook->so);
+	so_serial_t old_state = push_cur_state(st);
+	libreswan_log("%s%s output: %s", hook->verb, hook->verb_suffix, line);
+	pop_cur_state(old_state);
+	pop_cur_connection(old_connection);
+}
+
+static void close_updown_output(struct updown_hook *hook)
+{
+	flush_output_line(&hook->output, log_updown_output, hook);
+	delete_pluto_event(&hook->out_event);
+	if (hook->out_fd >= 0) {
+		close(hook->out_fd);
+		hook->out_fd = -1;
+	}
+}
+
+/*
+ * Read what is available, logging each complete line.  Returns the
+ * number of bytes read: 0 at EOF (or on an error) and -1 when
+ * nothing is available yet.
+ */
+
+static ssize_t read_updown_output(struct updown_hook *hook)
+{
+	char buf[1024];
+	ssize_t n;
+	do {
+		n = read(hook->out_fd, buf, sizeof(buf));
+	} while (n < 0 && errno == EINTR);
+	if (n < 0 && errno == EAGAIN) {
+		return -1;
+	}
+	if (n < 0) {
+		LOG_ERRNO(errno, "read failed on output of %s%s command",
+			  hook->verb, hook->verb_suffix);
+		return 0;
+	}
+	if (n > 0) {
+		split_output_lines(&hook->output, buf, n, log_updown_output, hook);
+	}
+	return n;
+}
+
+static void updown_output_cb(evutil_socket_t fd UNUSED,
+			     const short event UNUSED, void *arg)
+{
+	struct updown_hook *hook = arg;
+	if (read_updown_output(hook) == 0) {
+		close_updown_output(hook);
+	}
+}
+
+static int updown_hook_child(void *context)
+{
+	struct updown_hook *hook = context;
+	/* the command line includes 2>&1 */
+	if (dup2(hook->child_fd, STDOUT_FILENO) < 0) {
+		return 127;
+	}
+	close(hook->child_fd);
+	execl("/bin/sh", "sh", "-c", hook->cmd, (char *)NULL);
+	return 127;
+}
+
+static pluto_fork_cb updown_hook_exited; /* type assertion */
+static void start_ready_updown_hooks(void);
+
+static void start_updown_hook(struct updown_hook *hook)
+{
+	passert(hook->pid == 0);
+	remove_list_entry(&hook->queue_entry);
+
+	bool ok = false;
+	int fds[2];
+	if (pipe(fds) < 0) {
+		LOG_ERRNO(errno, "unable to create pipe for %s%s command",
+			  hook->verb, hook->verb_suffix);
+	} else {
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+		hook->out_fd = fds[0];
+		hook->child_fd = fds[1];
+		/* the child's copy, via dup2(), doesn't have CLOEXEC */
+		int pid = pluto_fork("updown", SOS_NOBODY, updown_hook_child,
+				     updown_hook_exited, hook);
+		close(hook->child_fd);
+		hook->child_fd = -1;
+		if (pid > 0) {
+			hook->pid = pid;
+			insert_list_entry(&running_hooks, &hook->queue_entry);
+			nr_running++;
+			fcntl(hook->out_fd, F_SETFL, O_NONBLOCK);
+			hook->out_event = add_fd_read_event_handler(hook->out_fd,
+								    updown_output_cb, hook,
+								    "updown output");
+			ok = true;
+		}
+	}
+	if (!ok) {
+		loglog(RC_LOG_SERIOUS, "unable to run %s%s command",
+		       hook->verb, hook->verb_suffix);
+		/* pretend it ran, and failed */
+		updown_hook_exited(NULL, NULL, 127 << 8, hook);
+	}
+}
+
+static void free_updown_hook(struct updown_hook **hook)
+{
+	pfree((*hook)->cmd);
+	pfree(*hook);
+	*hook = NULL;
+}
+
+static void updown_hook_exited(struct state *null_st UNUSED,
+			       struct msg_digest *null_mdp UNUSED,
+			       int status, void *context)
+{
+	struct updown_hook *hook = context;
+
+	/*
+	 * The command has exited, pick up what it wrote (but don't
+	 * wait for EOF, a grandchild may still hold the pipe open).
+	 */
+	if (hook->out_fd >= 0) {
+		while (read_updown_output(hook) > 0) {
+			continue;
+		}
+		close_updown_output(hook);
+	}
+
+	bool ok = false;
+	if (WIFEXITED(status)) {
+		if (WEXITSTATUS(status) != 0) {
+			loglog(RC_LOG_SERIOUS,
+			       "%s%s command exited with status %d",
+			       hook->verb, hook->verb_suffix,
+			       WEXITSTATUS(status));
+		} else {
+			ok = true;
+		}
+	} else if (WIFSIGNALED(status)) {
+		loglog(RC_LOG_SERIOUS,
+		       "%s%s command exited with signal %d",
+		       hook->verb, hook->verb_suffix, WTERMSIG(status));
+	} else {
+		loglog(RC_LOG_SERIOUS,
+		       "%s%s command exited with unknown status %d",
+		       hook->verb, hook->verb_suffix, status);
+	}
+	add_updown_latency(hook->verb, hook->queued, ok);
+
+	if (hook->pid != 0) {
+		remove_list_entry(&hook->queue_entry);
+		nr_running--;
+	}
+	nr_queued--;
+	co_serial_t serialno = hook->serialno;
+	del_hash_table_entry(&updown_hook_table, hook);
+	free_updown_hook(&hook);
+
+	/* the connection's next hook, if any, can now run */
+	struct updown_hook *next = oldest_updown_hook(serialno);
+	if (next != NULL) {
+		insert_list_entry(&ready_hooks, &next->queue_entry);
+	}
+	start_ready_updown_hooks();
+}
+
+static struct updown_hook *first_updown_hook(struct list_head *queue)
+{
+	struct updown_hook *hook;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(queue, hook) {
+		return hook;
+	}
+	return NULL;
+}
+
+static void start_ready_updown_hooks(void)
+{
+	/* starting one can (on failure) start others; re-check */
+	struct updown_hook *hook;
+	while (nr_running < MAX_UPDOWN_HOOKS &&
+	       (hook = first_updown_hook(&ready_hooks)) != NULL) {
+		start_updown_hook(hook);
+	}
+}
+
+void queue_updown_hook(co_serial_t serialno, so_serial_t so,
+		       const char *verb, const char *verb_suffix,
+		       const char *cmd)
+{
+	struct updown_hook *hook = alloc_thing(struct updown_hook, "updown hook");
+	hook->serialno = serialno;
+	hook->so = so;
+	hook->verb = verb;
+	hook->verb_suffix = verb_suffix;
+	hook->cmd = clone_str(cmd, "updown command");
+	hook->queued = mononow();
+	hook->out_fd = -1;
+	hook->child_fd = -1;
+	hook->queue_entry = list_entry(&updown_queue_info, hook);
+
+	bool first = (oldest_updown_hook(serialno) == NULL);
+	add_hash_table_entry(&updown_hook_table, hook);
+	nr_queued++;
+	if (nr_queued > max_queued) {
+		max_queued = nr_queued;
+	}
+	dbg("queued %s%s command for connection "PRI_CO"; %u queued %u running",
+	    verb, verb_suffix, pri_co(serialno), nr_queued, nr_running);
+
+	if (first) {
+		insert_list_entry(&ready_hooks, &hook->queue_entry);
+		start_ready_updown_hooks();
+	}
+}
+
+/*
+ * Block until HOOK, which must be the oldest for its connection, has
+ * exited.
+ */
+
+static void wait_for_updown_hook(struct updown_hook *hook)
+{
+	if (hook->pid == 0) {
+		/* jump the queue (and the limit) */
+		start_updown_hook(hook);
+		/* might have failed to start, and been freed */
+		return;
+	}
+	if (hook->out_fd >= 0) {
+		/* like the popen() it replaces; read until EOF */
+		fcntl(hook->out_fd, F_SETFL, 0);
+		while (read_updown_output(hook) > 0) {
+			continue;
+		}
+		close_updown_output(hook);
+	}
+	/* calls updown_hook_exited() */
+	wait_for_pluto_fork(hook->pid);
+}
+
+void flush_updown_hooks(co_serial_t serialno)
+{
+	struct updown_hook *hook;
+	while ((hook = oldest_updown_hook(serialno)) != NULL) {
+		dbg("waiting for %s%s command for connection "PRI_CO,
+		    hook->verb, hook->verb_suffix, pri_co(serialno));
+		wait_for_updown_hook(hook);
+	}
+}
+
+/*
+ * updown-helper=: rather than a shell per command, each command is
+ * sent, as a one line record, to a long-lived helper.
+ */
+
+char *pluto_updown_helper = NULL;
+
+#define UPDOWN_HELPER_TIMEOUT_MS (10 * 1000)
+
+struct updown_record {
+	unsigned long seq;
+	const char *verb;	/* string literals */
+	const char *verb_suffix;
+	monotime_t sent;
+	struct list_entry entry;
+};
+
+static void jam_updown_record(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "updown record NULL");
+	} else {
+		const struct updown_record *record = data;
+		jam(buf, "updown record %lu %s%s", record->seq,
+		    record->verb, record->verb_suffix);
+	}
+}
+
+static const struct list_info updown_record_info = {
+	.name = "updown records",
+	.jam = jam_updown_record,
+};
+
+static struct {
+	pid_t pid;		/* 0 when not running */
+	int fd;			/* records out; replies and output in */
+	struct pluto_event *event;
+	struct output_line output;
+	unsigned long seq;	/* of the last record */
+	struct list_head records;	/* waiting for a reply, oldest first */
+	unsigned nr_records;
+	unsigned long starts;
+	bool replied;		/* since it was started */
+	bool disabled;		/* unusable; run the scripts */
+	/* the record pluto is blocked on */
+	unsigned long waiting_seq;
+	bool waiting_done;
+	bool waiting_ok;
+} updown_helper = {
+	.fd = -1,
+	.records = INIT_LIST_HEAD(&updown_helper.records, &updown_record_info),
+};
+
+static void finish_updown_record(struct updown_record *record, int status)
+{
+	bool ok = (status == 0);
+	if (!ok) {
+		loglog(RC_LOG_SERIOUS, "%s%s command exited with status %d",
+		       record->verb, record->verb_suffix, status);
+	}
+	add_updown_latency(record->verb, record->sent, ok);
+	if (record->seq == updown_helper.waiting_seq) {
+		updown_helper.waiting_done = true;
+		updown_helper.waiting_ok = ok;
+	}
+	remove_list_entry(&record->entry);
+	updown_helper.nr_records--;
+	pfree(record);
+}
+
+/*
+ * The helper replies "done <seq> <status>" to each record, in order;
+ * anything else it writes is logged.
+ */
+
+static void updown_helper_line(const char *line, void *arg UNUSED)
+{
+	unsigned long seq;
+	int status;
+	if (sscanf(line, "done %lu %d", &seq, &status) != 2) {
+		libreswan_log("updown-helper output: %s", line);
+		return;
+	}
+	updown_helper.replied = true;
+	struct updown_record *record;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&updown_helper.records, record) {
+		if (record->seq == seq) {
+			finish_updown_record(record, status);
+			return;
+		}
+		if (record->seq > seq) {
+			break;
+		}
+		/* skipped; the helper lost it */
+		loglog(RC_LOG_SERIOUS, "updown-helper did not reply to %s%s command",
+		       record->verb, record->verb_suffix);
+		finish_updown_record(record, -1);
+	}
+	loglog(RC_LOG_SERIOUS, "updown-helper replied to unknown command %lu", seq);
+}
+
+static void close_updown_helper(void)
+{
+	flush_output_line(&updown_helper.output, updown_helper_line, NULL);
+	delete_pluto_event(&updown_helper.event);
+	if (updown_helper.fd >= 0) {
+		close(updown_helper.fd);
+		updown_helper.fd = -1;
+	}
+}
+
+/* same as read_updown_output() */
+static ssize_t read_updown_helper(int flags)
+{
+	char buf[4096];
+	ssize_t n;
+	do {
+		n = recv(updown_helper.fd, buf, sizeof(buf), flags);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0 && errno == EAGAIN) {
+		return -1;
+	}
+	if (n < 0) {
+		LOG_ERRNO(errno, "read failed on updown-helper");
+		return 0;
+	}
+	if (n > 0) {
+		split_output_lines(&updown_helper.output, buf, n,
+				   updown_helper_line, NULL);
+	}
+	return n;
+}
+
+static void updown_helper_cb(evutil_socket_t fd UNUSED,
+			     const short event UNUSED, void *arg UNUSED)
+{
+	if (read_updown_helper(MSG_DONTWAIT) == 0) {
+		close_updown_helper();
+	}
+}
+
+static pluto_fork_cb updown_helper_exited; /* type assertion */
+
+static void updown_helper_exited(struct state *null_st UNUSED,
+				 struct msg_digest *null_mdp UNUSED,
+				 int status, void *context UNUSED)
+{
+	if (updown_helper.fd >= 0) {
+		while (read_updown_helper(MSG_DONTWAIT) > 0) {
+			continue;
+		}
+		close_updown_helper();
+	}
+	loglog(RC_LOG_SERIOUS, "updown-helper %s exited with %s %d",
+	       pluto_updown_helper,
+	       WIFSIGNALED(status) ? "signal" : "status",
+	       WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+	updown_helper.pid = 0;
+	if (!updown_helper.replied) {
+		/* presumably it can't be run */
+		loglog(RC_LOG_SERIOUS, "updown-helper %s exited without replying; running updown scripts instead",
+		       pluto_updown_helper);
+		updown_helper.disabled = true;
+	}
+	struct updown_record *record;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&updown_helper.records, record) {
+		finish_updown_record(record, -1);
+	}
+}
+
+static int updown_helper_child(void *context)
+{
+	int fd = *(int *)context;
+	if (dup2(fd, STDIN_FILENO) < 0 ||
+	    dup2(fd, STDOUT_FILENO) < 0 ||
+	    dup2(fd, STDERR_FILENO) < 0) {
+		return 127;
+	}
+	close(fd);
+	execl(pluto_updown_helper, pluto_updown_helper, (char *)NULL);
+	return 127;
+}
+
+static bool start_updown_helper(void)
+{
+	if (updown_helper.pid != 0) {
+		return true;
+	}
+	if (updown_helper.disabled) {
+		return false;
+	}
+	if (access(pluto_updown_helper, X_OK) < 0) {
+		LOG_ERRNO(errno, "updown-helper %s can't be run; running updown scripts instead",
+			  pluto_updown_helper);
+		updown_helper.disabled = true;
+		return false;
+	}
+	/* a socket, not pipes, so that writes can suppress SIGPIPE */
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		LOG_ERRNO(errno, "unable to create socket for updown-helper");
+		return false;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	int pid = pluto_fork("updown-helper", SOS_NOBODY, updown_helper_child,
+			     updown_helper_exited, &fds[1]);
+	close(fds[1]);
+	if (pid < 0) {
+		close(fds[0]);
+		return false;
+	}
+	updown_helper.pid = pid;
+	updown_helper.fd = fds[0];
+	updown_helper.starts++;
+	updown_helper.replied = false;
+	updown_helper.event = add_fd_read_event_handler(updown_helper.fd,
+							updown_helper_cb, NULL,
+							"updown-helper");
+	libreswan_log("started updown-helper %s (pid %d)",
+		      pluto_updown_helper, pid);
+	return true;
+}
+
+/*
+ * Kill the helper outright; SIGTERM could be blocked or ignored and
+ * pluto is about to block in waitpid().
+ */
+
+static void kill_updown_helper(void)
+{
+	kill(updown_helper.pid, SIGKILL);
+	close_updown_helper();
+}
+
+/*
+ * Block until the helper has replied to SEQ; or, after waiting too
+ * long, kill it.
+ */
+
+static bool wait_for_updown_helper(unsigned long seq)
+{
+	updown_helper.waiting_seq = seq;
+	updown_helper.waiting_done = false;
+	updown_helper.waiting_ok = false;
+	while (!updown_helper.waiting_done && updown_helper.pid != 0) {
+		if (updown_helper.fd < 0) {
+			/* output closed so it can't reply; make sure it exits */
+			kill(updown_helper.pid, SIGKILL);
+			wait_for_pluto_fork(updown_helper.pid);
+			continue;
+		}
+		struct pollfd pfd = {
+			.fd = updown_helper.fd,
+			.events = POLLIN,
+		};
+		int r = poll(&pfd, 1, UPDOWN_HELPER_TIMEOUT_MS);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			if (r < 0) {
+				LOG_ERRNO(errno, "poll failed on updown-helper");
+			} else {
+				loglog(RC_LOG_SERIOUS, "updown-helper did not reply within %d seconds; killing it",
+				       UPDOWN_HELPER_TIMEOUT_MS / 1000);
+			}
+			kill_updown_helper();
+			continue;
+		}
+		if (read_updown_helper(MSG_DONTWAIT) == 0) {
+			close_updown_helper();
+		}
+	}
+	updown_helper.waiting_seq = 0;
+	return updown_helper.waiting_ok;
+}
+
+bool updown_helper_command(const char *verb, const char *verb_suffix,
+			   const char *updown, const char *env,
+			   bool wait, bool *ok)
+{
+	if (!start_updown_helper()) {
+		return false;
+	}
+	/* until it has shown it works, so a failure can fall back */
+	wait = wait || !updown_helper.replied;
+
+	char record[4096];
+	jambuf_t buf = ARRAY_AS_JAMBUF(record);
+	unsigned long seq = updown_helper.seq + 1;
+	jam(&buf, "%lu PLUTO_VERB='%s%s' PLUTO_UPDOWN='", seq, verb, verb_suffix);
+	jam_meta_escaped_bytes(&buf, updown, strlen(updown));
+	jam(&buf, "' %s\n", env);
+	if (!jambuf_ok(&buf)) {
+		loglog(RC_LOG_SERIOUS, "%s%s command too long!", verb, verb_suffix);
+		*ok = false;
+		return true;
+	}
+
+	shunk_t out = jambuf_as_shunk(&buf);
+	const char *ptr = out.ptr;
+	size_t len = out.len;
+	while (len > 0) {
+		ssize_t n = send(updown_helper.fd, ptr, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			/* presumably it is exiting; fall back to the script */
+			LOG_ERRNO(errno, "write to updown-helper failed");
+			return false;
+		}
+		ptr += n;
+		len -= n;
+	}
+
+	struct updown_record *r = alloc_thing(struct updown_record, "updown record");
+	r->seq = updown_helper.seq = seq;
+	r->verb = verb;
+	r->verb_suffix = verb_suffix;
+	r->sent = mononow();
+	r->entry = list_entry(&updown_record_info, r);
+	insert_list_entry(&updown_helper.records, &r->entry);
+	updown_helper.nr_records++;
+
+	*ok = (wait ? wait_for_updown_helper(seq) : true);
+	if (updown_helper.disabled) {
+		/* it exited early; run the script */
+		return false;
+	}
+	return true;
+}
+
+static void stop_updown_helper(void)
+{
+	if (updown_helper.pid == 0) {
+		return;
+	}
+	/*
+	 * Let it finish what was sent (it sees EOF), but not for
+	 * ever.  Once its output is closed it has nothing more to
+	 * say, so make sure it exits.
+	 */
+	if (updown_helper.fd >= 0) {
+		shutdown(updown_helper.fd, SHUT_WR);
+		while (updown_helper.fd >= 0) {
+			struct pollfd pfd = {
+				.fd = updown_helper.fd,
+				.events = POLLIN,
+			};
+			int r = poll(&pfd, 1, UPDOWN_HELPER_TIMEOUT_MS);
+			if (r < 0 && errno == EINTR) {
+				continue;
+			}
+			if (r <= 0) {
+				loglog(RC_LOG_SERIOUS, "updown-helper did not exit within %d seconds; killing it",
+				       UPDOWN_HELPER_TIMEOUT_MS / 1000);
+				break;
+			}
+			if (read_updown_helper(MSG_DONTWAIT) == 0) {
+				break;
+			}
+		}
+	}
+	kill_updown_helper();
+	wait_for_pluto_fork(updown_helper.pid);
+}
+
+void flush_all_updown_hooks(void)
+{
+	struct updown_hook *hook;
+	while ((hook = first_updown_hook(&running_hooks)) != NULL ||
+	       (hook = first_updown_hook(&ready_hooks)) != NULL) {
+		flush_updown_hooks(hook->serialno);
+	}
+	pexpect(nr_queued == 0);
+	stop_updown_helper();
+}
+
+void show_updown_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	whack_print(whackfd, "current.updown.queued=%u", nr_queued - nr_running);
+	whack_print(whackfd, "current.updown.running=%u", nr_running);
+	whack_print(whackfd, "current.updown.max_queued=%u", max_queued);
+	if (pluto_updown_helper != NULL) {
+		whack_print(whackfd, "current.updown.helper.outstanding=%u",
+			    updown_helper.nr_records);
+		whack_print(whackfd, "total.updown.helper.starts=%lu",
+			    updown_helper.starts);
+	}
+	for (unsigned i = 0; i < elemsof(updown_verb_stats); i++) {
+		const struct updown_verb_stats *stats = &updown_verb_stats[i];
+		/* "disconnectNM" -> "disconnectnm" */
+		char name[64];
+		jambuf_t buf = ARRAY_AS_JAMBUF(name);
+		jam_status_name(&buf, stats->name);
+		whack_print(whackfd, "current.updown.verb.%s.count=%lu", name, stats->count);
+		whack_print(whackfd, "current.updown.verb.%s.failed=%lu", name, stats->failed);
+		for (unsigned b = 0; b < UPDOWN_LATENCY_BUCKETS; b++) {
+			if (b < UPDOWN_LATENCY_BUCKETS - 1) {
+				whack_print(whackfd, "current.updown.verb.%s.latency.lt_%lums=%lu",
+					    name, 1UL << b, stats->latency[b]);
+			} else {
+				whack_print(whackfd, "current.updown.verb.%s.latency.ge_%lums=%lu",
+					    name, 1UL << (b - 1), stats->latency[b]);
+			}
+		}
+	}
+}
+
+void init_updown_hooks(void)
+{
+	init_hash_table(&updown_hook_table);
+}
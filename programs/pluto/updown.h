@@ -0,0 +1,82 @@
+/* asynchronous updown commands, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef UPDOWN_H
+#define UPDOWN_H
+
+#include <stdbool.h>
+
+#include "defs.h"		/* for so_serial_t */
+#include "connection_db.h"	/* for co_serial_t */
+#include "monotime.h"
+
+struct show;
+
+void init_updown_hooks(void);
+
+/*
+ * Run the updown (or other hook) command CMD for connection
+ * SERIALNO in the background.
+ *
+ * Commands for the same connection run one at a time, in the order
+ * they were queued; at most MAX_UPDOWN_HOOKS run at once.  Output is
+ * logged, a line at a time, as "VERB VERB_SUFFIX output: ..." as it
+ * arrives; a failure is logged when the command exits.  The state
+ * SO, when it still exists, is used to prefix that log.
+ *
+ * VERB and VERB_SUFFIX must be string literals.
+ */
+
+#define MAX_UPDOWN_HOOKS 16
+
+void queue_updown_hook(co_serial_t serialno, so_serial_t so,
+		       const char *verb, const char *verb_suffix,
+		       const char *cmd);
+
+/*
+ * Block until all the hooks queued for connection SERIALNO have
+ * exited; so that a command run directly is ordered after them.
+ */
+void flush_updown_hooks(co_serial_t serialno);
+
+/* at exit: block until everything queued has run */
+void flush_all_updown_hooks(void);
+
+/*
+ * updown-helper=: send the command (VERB VERB_SUFFIX, the updown
+ * script UPDOWN and its environment ENV) to the long-lived helper as
+ * a one line record:
+ *
+ *   <seq> PLUTO_VERB='<verb>' PLUTO_UPDOWN='<updown>' <env>
+ *
+ * The helper must reply "done <seq> <status>", in order.  When WAIT,
+ * block until it has and set OK; otherwise OK is true and a failure
+ * is logged later.  Returns false when there is no helper (the
+ * caller should run the script).
+ */
+
+extern char *pluto_updown_helper;
+
+bool updown_helper_command(const char *verb, const char *verb_suffix,
+			   const char *updown, const char *env,
+			   bool wait, bool *ok);
+
+/*
+ * Record that a VERB command, run directly or in the background,
+ * took from START until now.
+ */
+void add_updown_latency(const char *verb, monotime_t start, bool ok);
+
+void show_updown_status(struct show *s);
+
+#endif
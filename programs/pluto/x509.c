@@ -89,6 +89,7 @@
 #include "crypt_hash.h"
 #include "crl_queue.h"
 #include "ip_info.h"
+#include "pubkey_db.h"
 
 bool crl_strict = FALSE;
 bool ocsp_strict = FALSE;
@@ -465,6 +466,10 @@ static void get_pluto_gn_from_nss_cert(CERTCertificate *cert, generalName_t **gn
 static void replace_public_key(struct pubkey_list **pubkey_db,
 			       struct pubkey *pk)
 {
+	if (pubkey_db == NULL) {
+		replace_pubkey_in_db(pk);
+		return;
+	}
 	/* ??? clang 3.5 thinks pk might be NULL */
 	delete_public_keys(pubkey_db, &pk->id, pk->type);
 	install_public_key(pk, pubkey_db);
@@ -532,6 +537,7 @@ static void add_cert_san_pubkeys(struct pubkey_list **pubkey_db,
  * An entry with the ID_DER_ASN1_DN subject is always added
  * with subjectAltNames
  * @keyid provides an id for a secondary entry
+ * @pubkey_db when NULL the entries go into the pubkey database
  */
 bool add_pubkey_from_nss_cert(struct pubkey_list **pubkey_db,
 			      const struct id *keyid, CERTCertificate *cert,
@@ -1691,4 +1697,6 @@ void clear_ocsp_cache(void)
 {
 	dbg("calling NSS to clear OCSP cache");
 	(void)CERT_ClearOCSPCache();
+	/* the cached chains were checked against those answers */
+	flush_verified_chains("OCSP cache cleared");
 }
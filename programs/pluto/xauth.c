@@ -14,9 +14,15 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include <sys/wait.h>		/* for WIFEXITED() et.al. */
 #include <signal.h>		/* for kill() and signals in general */
 
+#include <event2/event.h>
+
 #include "constants.h"
 #include "lswlog.h"
 #include "defs.h"
@@ -34,6 +40,47 @@
 #include "demux.h"
 #include "deltatime.h"
 #include "monotime.h"
+#include "list_entry.h"
+#include "show.h"
+#include "whack.h"		/* for whack_print() */
+
+/*
+ * A pool of long-lived PAM processes.
+ *
+ * The first authentication starts MAX_PAM_WORKERS processes (using
+ * pluto_fork()); each then loops reading one request at a time from
+ * a SOCK_SEQPACKET socketpair and writing back the result.  Each
+ * authentication gets a fresh PAM handle so that nothing (the
+ * previous user's PAM_AUTHTOK, module data) carries over.
+ *
+ * At most MAX_PAM_WORKERS authentications are in progress; further
+ * requests wait, oldest first.  A worker still authenticating
+ * EVENT_PAM_TIMEOUT_DELAY after it was sent a request is presumed
+ * stuck and is killed; a worker that dies is replaced.
+ */
+
+#define MAX_PAM_WORKERS 8
+#define PAM_REQUEST_SIZE 4096
+
+struct pam_worker {
+	pid_t pid;		/* 0 when not running */
+	int fd;			/* pluto's end */
+	int child_fd;		/* the worker's end; only while forking */
+	struct pluto_event *event;
+	bool busy;
+	struct xauth *xauth;	/* NULL when idle or abandoned */
+	struct event *deadline;	/* while busy */
+};
+
+static struct pam_worker pam_workers[MAX_PAM_WORKERS];
+static bool pam_workers_started;
+static bool pam_workers_stopping;
+
+static struct {
+	unsigned long queued;
+	unsigned long restarts;
+	unsigned long abandoned;
+} pam_worker_stats;
 
 /* information for tracking xauth PAM work in flight */
 
@@ -42,9 +89,29 @@ struct xauth {
 	struct pam_thread_arg ptarg;
 	monotime_t start_time;
 	xauth_callback_t *callback;
-	pid_t child;
+	bool success;
+	struct pam_worker *worker;	/* NULL while pending */
+	struct list_entry pending_entry;
 };
 
+static void jam_xauth(struct lswlog *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "xauth NULL");
+	} else {
+		const struct xauth *xauth = data;
+		jam(buf, "#%lu user '%s'", xauth->serialno, xauth->ptarg.name);
+	}
+}
+
+static const struct list_info pending_xauth_info = {
+	.name = "pending xauth",
+	.jam = jam_xauth,
+};
+
+static struct list_head pending_xauths = INIT_LIST_HEAD(&pending_xauths, &pending_xauth_info);
+static unsigned nr_pending_xauths;
+
 static void pfree_xauth(struct xauth *x)
 {
 	pfree(x->ptarg.name);
@@ -56,100 +123,404 @@ static void pfree_xauth(struct xauth *x)
 }
 
 /*
- * Abort the transaction, disconnecting it from state.
- *
- * Need to pass in serialno so that something sane can be logged when
- * the xauth request has already been deleted.  Need to pass in
- * st_callback, but only when it needs to notify an abort.
+ * The request and answer passed over the socketpair.  The request's
+ * strings (name, password, connection name, remote address and
+ * atype), each NUL terminated, follow the header.
  */
-void xauth_pam_abort(struct state *st)
-{
-	struct xauth *xauth = st->st_xauth;
 
-	if (xauth == NULL) {
-		PEXPECT_LOG("PAM: #%lu: main-process: no process to abort (already aborted?)",
-			    st->st_serialno);
-	} else {
-		st->st_xauth = NULL; /* aborted */
-		pstats_xauth_aborted++;
-		passert(xauth->serialno == st->st_serialno);
-		libreswan_log("PAM: #%lu: main-process: aborting authentication PAM-process for '%s'",
-			      st->st_serialno, xauth->ptarg.name);
-		/*
-		 * Don't hold back.
-		 *
-		 * XXX: need to fix child so that more friendly
-		 * SIGTERM is handled - currently the forked process
-		 * has it blocked by libvent.
-		 */
-		kill(xauth->child, SIGKILL);
-		/*
-		 * xauth is deleted by xauth_pam_callback() _after_
-		 * the process exits and the callback has been called.
-		 */
-	}
-}
+enum { PAM_NAME, PAM_PASSWORD, PAM_C_NAME, PAM_RA, PAM_ATYPE, PAM_STRINGS, };
+
+struct pam_request {
+	so_serial_t serialno;
+	unsigned long c_instance_serial;
+	uint16_t len[PAM_STRINGS];
+};
+
+struct pam_answer {
+	so_serial_t serialno;
+	bool success;
+};
 
 /*
- * This is the callback from pluto_fork when the process dies.
- * On the main thread; notify the state (if it is present) of the
- * xauth result, and then release everything.
+ * This is the callback once the PAM work is done (or abandoned).  On
+ * the main thread; notify the state (if it is present) of the xauth
+ * result, and then release everything.
  */
 
-static pluto_fork_cb pam_callback; /* type assertion */
+static resume_cb pam_resume; /* type assertion */
 
-static void pam_callback(struct state *st,
-			 struct msg_digest *md,
-			 int status, void *arg)
+static stf_status pam_resume(struct state *st,
+			     struct msg_digest *md,
+			     void *arg)
 {
 	struct xauth *xauth = arg;
 
 	pstats_xauth_stopped++;
 
-	bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
 	deltatime_buf db;
 	dbg("PAM: #%lu: main-process cleaning up PAM-process for user '%s' result %s time elapsed %s seconds%s",
 	    xauth->serialno,
 	    xauth->ptarg.name,
-	    success ? "SUCCESS" : "FAILURE",
+	    xauth->success ? "SUCCESS" : "FAILURE",
 	    str_deltatime(monotimediff(mononow(), xauth->start_time), &db),
 	    (st == NULL ? " (state deleted)" :
-	     st->st_xauth == NULL ? " (aborted)" :
+	     st->st_xauth != xauth ? " (aborted)" :
 	     ""));
 
-	/*
-	 * Try to find the corresponding state.
-	 *
-	 * Since this is running on the main thread, it and
-	 * Xauth_abort() can't get into a race.
-	 */
 	if (st != NULL) {
-		st->st_xauth = NULL; /* all done */
+		if (st->st_xauth == xauth) {
+			st->st_xauth = NULL; /* all done */
+		}
 		log_state(RC_LOG, st,
 			  "PAM: #%lu: completed for user '%s' with status %s",
 			  xauth->serialno, xauth->ptarg.name,
-			  success ? "SUCCESS" : "FAILURE");
-		xauth->callback(st, md, xauth->ptarg.name, success);
+			  xauth->success ? "SUCCESS" : "FAILURE");
+		xauth->callback(st, md, xauth->ptarg.name, xauth->success);
 	}
 
 	pfree_xauth(xauth);
+	return STF_SKIP_COMPLETE_STATE_TRANSITION;
 }
 
 /*
- * Perform the authentication in the child process.
+ * Perform the authentications in the worker process.
  */
-static int pam_child(void *arg)
+
+static bool read_pam_request(uint8_t *buf, ssize_t len,
+			     struct pam_thread_arg *ptarg)
 {
-	struct xauth *xauth = arg;
+	struct pam_request req;
+	if (len < (ssize_t)sizeof(req)) {
+		return false;
+	}
+	memcpy(&req, buf, sizeof(req));
+	char *strings[PAM_STRINGS];
+	size_t offset = sizeof(req);
+	for (unsigned i = 0; i < PAM_STRINGS; i++) {
+		if (req.len[i] == 0 || offset + req.len[i] > (size_t)len ||
+		    buf[offset + req.len[i] - 1] != '\0') {
+			return false;
+		}
+		strings[i] = (char *)buf + offset;
+		offset += req.len[i];
+	}
+	*ptarg = (struct pam_thread_arg) {
+		.name = strings[PAM_NAME],
+		.password = strings[PAM_PASSWORD],
+		.c_name = strings[PAM_C_NAME],
+		.ra = strings[PAM_RA],
+		.atype = strings[PAM_ATYPE],
+		.st_serialno = req.serialno,
+		.c_instance_serial = req.c_instance_serial,
+	};
+	return true;
+}
 
-	dbg("PAM: #%lu: PAM-process authenticating user '%s'",
-	    xauth->serialno,
-	    xauth->ptarg.name);
-	bool success = do_pam_authentication(&xauth->ptarg);
-	dbg("PAM: #%lu: PAM-process completed for user '%s' with result %s",
-	    xauth->serialno, xauth->ptarg.name,
-	    success ? "SUCCESS" : "FAILURE");
-	return success ? 0 : 1;
+static int pam_worker(void *arg)
+{
+	struct pam_worker *w = arg;
+
+	/* only this worker's end of its socketpair is needed */
+	for (unsigned i = 0; i < elemsof(pam_workers); i++) {
+		if (pam_workers[i].fd >= 0 && pam_workers[i].pid != 0) {
+			close(pam_workers[i].fd);
+		}
+	}
+	close(w->fd);
+
+	while (true) {
+		uint8_t buf[PAM_REQUEST_SIZE];
+		ssize_t len = read(w->child_fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+		if (len <= 0) {
+			/* EOF: pluto is done with this worker */
+			break;
+		}
+		struct pam_thread_arg ptarg;
+		struct pam_answer answer = { .success = false, };
+		if (read_pam_request(buf, len, &ptarg)) {
+			answer.serialno = ptarg.st_serialno;
+			dbg("PAM: #%lu: PAM-process authenticating user '%s'",
+			    ptarg.st_serialno, ptarg.name);
+			answer.success = do_pam_authentication(&ptarg);
+			dbg("PAM: #%lu: PAM-process completed for user '%s' with result %s",
+			    ptarg.st_serialno, ptarg.name,
+			    answer.success ? "SUCCESS" : "FAILURE");
+		}
+		/* don't leave the password lying around */
+		memset(buf, 0, sizeof(buf));
+		if (write(w->child_fd, &answer, sizeof(answer)) != sizeof(answer)) {
+			break;
+		}
+	}
+	return 0;
+}
+
+static void kill_pam_worker(struct pam_worker *w)
+{
+	/*
+	 * Don't hold back.
+	 *
+	 * XXX: need to fix child so that more friendly
+	 * SIGTERM is handled - currently the forked process
+	 * has it blocked by libvent.
+	 */
+	kill(w->pid, SIGKILL);
+}
+
+static void cancel_pam_deadline(struct pam_worker *w)
+{
+	if (w->deadline != NULL) {
+		event_del(w->deadline);
+		event_free(w->deadline);
+		w->deadline = NULL;
+	}
+}
+
+/*
+ * The worker hasn't answered in time (or the answer was abandoned and
+ * it still hasn't finished); presume it is stuck.  Once it has exited
+ * pam_worker_exited() fails any request and starts a replacement.
+ */
+
+static void pam_deadline_cb(evutil_socket_t fd UNUSED,
+			    const short event UNUSED, void *arg)
+{
+	struct pam_worker *w = arg;
+	cancel_pam_deadline(w);
+	if (w->busy) {
+		libreswan_log("PAM: PAM-process %d did not answer within %jd seconds; killing it",
+			      w->pid, deltasecs(EVENT_PAM_TIMEOUT_DELAY));
+		kill_pam_worker(w);
+	}
+}
+
+static bool send_pam_request(struct pam_worker *w, struct xauth *xauth)
+{
+	const char *strings[PAM_STRINGS] = {
+		[PAM_NAME] = xauth->ptarg.name,
+		[PAM_PASSWORD] = xauth->ptarg.password,
+		[PAM_C_NAME] = xauth->ptarg.c_name,
+		[PAM_RA] = xauth->ptarg.ra,
+		[PAM_ATYPE] = xauth->ptarg.atype,
+	};
+	struct pam_request req = {
+		.serialno = xauth->serialno,
+		.c_instance_serial = xauth->ptarg.c_instance_serial,
+	};
+	uint8_t buf[PAM_REQUEST_SIZE];
+	size_t len = sizeof(req);
+	for (unsigned i = 0; i < PAM_STRINGS; i++) {
+		size_t l = strlen(strings[i]) + 1;
+		if (len + l > sizeof(buf)) {
+			libreswan_log("PAM: #%lu: request for user '%s' is too big",
+				      xauth->serialno, xauth->ptarg.name);
+			return false;
+		}
+		req.len[i] = l;
+		memcpy(buf + len, strings[i], l);
+		len += l;
+	}
+	memcpy(buf, &req, sizeof(req));
+	ssize_t n = write(w->fd, buf, len);
+	memset(buf, 0, sizeof(buf));
+	if (n != (ssize_t)len) {
+		LOG_ERRNO(errno, "PAM: #%lu: sending request to PAM-process %d failed",
+			  xauth->serialno, w->pid);
+		/* xauth is failed when the worker exits */
+		kill_pam_worker(w);
+	}
+	return true;
+}
+
+/*
+ * On the main thread, send the oldest pending requests to idle
+ * workers.
+ */
+
+static void dispatch_pam_requests(void)
+{
+	for (unsigned i = 0; i < elemsof(pam_workers) && nr_pending_xauths > 0; i++) {
+		struct pam_worker *w = &pam_workers[i];
+		if (w->pid == 0 || w->busy) {
+			continue;
+		}
+		struct xauth *xauth = pending_xauths.head.newer->data;
+		remove_list_entry(&xauth->pending_entry);
+		nr_pending_xauths--;
+		dbg("PAM: #%lu: main-process sending user '%s' to PAM-process %d",
+		    xauth->serialno, xauth->ptarg.name, w->pid);
+		w->busy = true;
+		w->xauth = xauth;
+		xauth->worker = w;
+		if (!send_pam_request(w, xauth)) {
+			w->busy = false;
+			w->xauth = NULL;
+			xauth->worker = NULL;
+			xauth->success = false;
+			schedule_resume("PAM failed", xauth->serialno,
+					pam_resume, xauth);
+			continue;
+		}
+		fire_timer_photon_torpedo(&w->deadline, pam_deadline_cb, w,
+					  EVENT_PAM_TIMEOUT_DELAY);
+	}
+}
+
+static void pam_worker_answer_cb(evutil_socket_t fd, const short event UNUSED,
+				 void *arg)
+{
+	struct pam_worker *w = arg;
+	struct pam_answer answer;
+	ssize_t n = read(fd, &answer, sizeof(answer));
+	if (n != sizeof(answer)) {
+		if (n < 0 && errno == EINTR) {
+			return;
+		}
+		/* worker is dying; let pam_worker_exited() clean up */
+		dbg("PAM: PAM-process %d answer truncated", w->pid);
+		delete_pluto_event(&w->event);
+		return;
+	}
+
+	struct xauth *xauth = w->xauth;
+	cancel_pam_deadline(w);
+	w->busy = false;
+	w->xauth = NULL;
+	if (xauth == NULL) {
+		dbg("PAM: #%lu: discarding abandoned answer from PAM-process %d",
+		    answer.serialno, w->pid);
+	} else {
+		pexpect(xauth->serialno == answer.serialno);
+		xauth->worker = NULL;
+		xauth->success = answer.success;
+		run_resume("PAM answer", xauth->serialno, pam_resume, xauth);
+	}
+
+	dispatch_pam_requests();
+}
+
+static pluto_fork_cb pam_worker_exited; /* type assertion */
+
+static bool start_pam_worker(struct pam_worker *w);
+
+static void pam_worker_exited(struct state *null_st UNUSED,
+			      struct msg_digest *null_md UNUSED,
+			      int status, void *arg)
+{
+	struct pam_worker *w = arg;
+
+	dbg("PAM: PAM-process %d exited with status %d", w->pid, status);
+	delete_pluto_event(&w->event);
+	cancel_pam_deadline(w);
+	close(w->fd);
+	w->fd = -1;
+	w->pid = 0;
+	w->busy = false;
+
+	if (w->xauth != NULL) {
+		struct xauth *xauth = w->xauth;
+		w->xauth = NULL;
+		xauth->worker = NULL;
+		xauth->success = false;
+		schedule_resume("PAM failed", xauth->serialno,
+				pam_resume, xauth);
+	}
+
+	if (!pam_workers_stopping) {
+		pam_worker_stats.restarts++;
+		start_pam_worker(w);
+		dispatch_pam_requests();
+	}
+}
+
+static bool start_pam_worker(struct pam_worker *w)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0) {
+		LOG_ERRNO(errno, "PAM: socketpair() for PAM-process failed");
+		return false;
+	}
+	w->fd = sv[0];
+	w->child_fd = sv[1];
+	pid_t pid = pluto_fork("xauth", SOS_NOBODY,
+			       pam_worker, pam_worker_exited, w);
+	close(w->child_fd);
+	w->child_fd = -1;
+	if (pid < 0) {
+		libreswan_log("PAM: creation of PAM-process failed");
+		close(w->fd);
+		w->fd = -1;
+		return false;
+	}
+	w->pid = pid;
+	w->event = add_fd_read_event_handler(w->fd, pam_worker_answer_cb,
+					     w, "PAM-process answer");
+	dbg("PAM: started PAM-process %d", pid);
+	return true;
+}
+
+static bool start_pam_workers(void)
+{
+	if (!pam_workers_started) {
+		pam_workers_started = true;
+		for (unsigned i = 0; i < elemsof(pam_workers); i++) {
+			pam_workers[i].fd = -1;
+			pam_workers[i].child_fd = -1;
+		}
+		for (unsigned i = 0; i < elemsof(pam_workers); i++) {
+			start_pam_worker(&pam_workers[i]);
+		}
+	}
+	for (unsigned i = 0; i < elemsof(pam_workers); i++) {
+		if (pam_workers[i].pid != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Abort the transaction, disconnecting it from state.
+ *
+ * A pending request is simply dropped.  A worker already
+ * authenticating is left to finish (its answer is discarded); if it
+ * is stuck its deadline kills it.
+ *
+ * Either way the callback is scheduled with a failure; it is only
+ * called when the state still exists (i.e., on EVENT_PAM_TIMEOUT,
+ * not delete).
+ */
+void xauth_pam_abort(struct state *st)
+{
+	struct xauth *xauth = st->st_xauth;
+
+	if (xauth == NULL) {
+		PEXPECT_LOG("PAM: #%lu: main-process: no process to abort (already aborted?)",
+			    st->st_serialno);
+		return;
+	}
+
+	st->st_xauth = NULL; /* aborted */
+	pstats_xauth_aborted++;
+	passert(xauth->serialno == st->st_serialno);
+	libreswan_log("PAM: #%lu: main-process: aborting authentication PAM-process for '%s'",
+		      st->st_serialno, xauth->ptarg.name);
+
+	struct pam_worker *w = xauth->worker;
+	if (w == NULL) {
+		remove_list_entry(&xauth->pending_entry);
+		nr_pending_xauths--;
+	} else {
+		w->xauth = NULL;
+		xauth->worker = NULL;
+		pam_worker_stats.abandoned++;
+	}
+
+	xauth->success = false;
+	schedule_resume("PAM aborted", xauth->serialno, pam_resume, xauth);
 }
 
 void xauth_fork_pam_process(struct state *st,
@@ -160,7 +531,11 @@ void xauth_fork_pam_process(struct state *st,
 {
 	so_serial_t serialno = st->st_serialno;
 
-	/* now start the xauth child process */
+	if (!start_pam_workers()) {
+		libreswan_log("PAM: #%lu: no PAM-process available for user '%s'",
+			      serialno, name);
+		return;
+	}
 
 	struct xauth *xauth = alloc_thing(struct xauth, "xauth arg");
 
@@ -168,7 +543,7 @@ void xauth_fork_pam_process(struct state *st,
 	xauth->serialno = serialno;
 	xauth->start_time = mononow();
 
-	/* fill in pam_thread_arg with info for the child process */
+	/* fill in pam_thread_arg with info for the PAM process */
 
 	xauth->ptarg.name = clone_str(name, "pam name");
 
@@ -181,17 +556,63 @@ void xauth_fork_pam_process(struct state *st,
 	xauth->ptarg.c_instance_serial = st->st_connection->instance_serial;
 	xauth->ptarg.atype = atype;
 
-	dbg("PAM: #%lu: main-process starting PAM-process for authenticating user '%s'",
+	dbg("PAM: #%lu: main-process queueing PAM authentication of user '%s'",
 	    xauth->serialno, xauth->ptarg.name);
-	xauth->child = pluto_fork("xauth", xauth->serialno,
-				  pam_child, pam_callback, xauth);
-	if (xauth->child < 0) {
-		libreswan_log("PAM: #%lu: creation of PAM-process for user '%s' failed",
-			      xauth->serialno, xauth->ptarg.name);
-		pfree_xauth(xauth);
-		return;
-	}
+	xauth->pending_entry = list_entry(&pending_xauth_info, xauth);
+	insert_list_entry(&pending_xauths, &xauth->pending_entry);
+	nr_pending_xauths++;
+	pam_worker_stats.queued++;
 
 	st->st_xauth = xauth;
 	pstats_xauth_started++;
+
+	dispatch_pam_requests();
+}
+
+/*
+ * Close the workers' sockets (they exit once they've finished any
+ * authentication) and then wait for them.
+ */
+void stop_xauth_pam_workers(void)
+{
+	pam_workers_stopping = true;
+	struct xauth *xauth;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&pending_xauths, xauth) {
+		remove_list_entry(&xauth->pending_entry);
+		pfree_xauth(xauth);
+	}
+	nr_pending_xauths = 0;
+	for (unsigned i = 0; i < elemsof(pam_workers); i++) {
+		struct pam_worker *w = &pam_workers[i];
+		if (w->pid != 0) {
+			pid_t pid = w->pid;
+			delete_pluto_event(&w->event);
+			cancel_pam_deadline(w);
+			if (w->busy) {
+				kill_pam_worker(w);
+			}
+			shutdown(w->fd, SHUT_RDWR);
+			wait_for_pluto_fork(pid);
+		}
+	}
+}
+
+void show_xauth_pam_status(struct show *s)
+{
+	struct fd *whackfd = show_fd(s);
+	unsigned running = 0, busy = 0;
+	for (unsigned i = 0; i < elemsof(pam_workers); i++) {
+		if (pam_workers[i].pid != 0) {
+			running++;
+			if (pam_workers[i].busy) {
+				busy++;
+			}
+		}
+	}
+	whack_print(whackfd, "current.pam.workers=%u", running);
+	whack_print(whackfd, "current.pam.busy=%u", busy);
+	whack_print(whackfd, "current.pam.pending=%u", nr_pending_xauths);
+	whack_print(whackfd, "total.pam.queued=%lu", pam_worker_stats.queued);
+	whack_print(whackfd, "total.pam.abandoned=%lu", pam_worker_stats.abandoned);
+	whack_print(whackfd, "total.pam.restarts=%lu", pam_worker_stats.restarts);
 }
@@ -17,6 +17,7 @@
 
 struct state;
 struct msg_digest;
+struct show;
 
 /* ??? needlessly used even if !XAUTH_HAVE_PAM */
 
@@ -28,7 +29,7 @@ typedef void xauth_callback_t(struct state *st,
 #ifdef XAUTH_HAVE_PAM
 
 /*
- * XXX: Should XAUTH handle timeouts internally?
+ * Called on EVENT_PAM_TIMEOUT and when the state is deleted.
  */
 void xauth_pam_abort(struct state *st);
 
@@ -38,4 +39,7 @@ void xauth_fork_pam_process(struct state *st,
 			    const char *atype,
 			    xauth_callback_t *callback);
 
+void stop_xauth_pam_workers(void);
+void show_xauth_pam_status(struct show *s);
+
 #endif
@@ -0,0 +1,167 @@
+/* test and benchmark the free bitmap, for libreswan
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/lgpl-2.1.txt>.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+ * License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lswcdefs.h"		/* for elemsof() UNUSED */
+#include "free_bitmap.h"
+
+unsigned fails;
+
+#define PRINTLN(FILE, FMT, ...)						\
+	fprintf(FILE, "%s[%zu]:"FMT"\n",				\
+		__func__, ti,##__VA_ARGS__)
+
+#define FAIL(FMT, ...)						\
+	{							\
+		fails++;					\
+		PRINTLN(stderr, " "FMT,##__VA_ARGS__);		\
+		continue;					\
+	}
+
+static void check_lowest_first(void)
+{
+	/* sizes either side of the word and summary boundaries */
+	static const unsigned sizes[] = { 1, 63, 64, 65, 4095, 4096, 4097, 10000, };
+	for (size_t ti = 0; ti < elemsof(sizes); ti++) {
+		unsigned size = sizes[ti];
+		struct free_bitmap b = EMPTY_FREE_BITMAP;
+		/* grow in two steps, like a pool doubling */
+		grow_free_bitmap(&b, size / 2);
+		grow_free_bitmap(&b, size);
+		if (b.nr_free != size) {
+			FAIL("nr_free %u should be %u", b.nr_free, size);
+		}
+		unsigned i;
+		for (i = 0; i < size; i++) {
+			unsigned index;
+			if (!take_free_bitmap(&b, &index) || index != i) {
+				break;
+			}
+		}
+		if (i != size) {
+			FAIL("take %u returned the wrong index", i);
+		}
+		unsigned index;
+		if (take_free_bitmap(&b, &index)) {
+			FAIL("take from a full bitmap returned %u", index);
+		}
+		/* release every third; they come back lowest first */
+		for (i = 0; i < size; i += 3) {
+			release_free_bitmap(&b, i);
+		}
+		for (i = 0; i < size; i += 3) {
+			if (!take_free_bitmap(&b, &index) || index != i) {
+				break;
+			}
+		}
+		if (i < size) {
+			FAIL("re-take %u returned the wrong index", i);
+		}
+		if (b.nr_free != 0) {
+			FAIL("nr_free %u should be 0", b.nr_free);
+		}
+		free_free_bitmap(&b);
+	}
+}
+
+/*
+ * Benchmarks.  These report, they don't fail unless the rate is
+ * hopeless.
+ */
+
+static double seconds(struct timespec start)
+{
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	return ((stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+#define POOL_SIZE 65534		/* a /16 */
+#define NR_CLIENTS 60000
+#define CHURN_RATE 10000	/* leases per second */
+#define CHURN_SECONDS 10
+
+static void bench_churn(void)
+{
+	/*
+	 * Fill the pool the way pluto does, doubling as clients
+	 * arrive, then each "second" release CHURN_RATE random leases
+	 * and re-take them.
+	 */
+	size_t ti = 0;
+	struct free_bitmap b = EMPTY_FREE_BITMAP;
+	unsigned *leased = malloc(NR_CLIENTS * sizeof(leased[0]));
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned nr_leases = 0;
+	for (unsigned c = 0; c < NR_CLIENTS; c++) {
+		if (!take_free_bitmap(&b, &leased[c])) {
+			nr_leases = (nr_leases == 0 ? 1 :
+				     nr_leases * 2 > POOL_SIZE ? POOL_SIZE :
+				     nr_leases * 2);
+			grow_free_bitmap(&b, nr_leases);
+			if (!take_free_bitmap(&b, &leased[c])) {
+				FAIL("fill %u failed", c);
+			}
+		}
+	}
+	PRINTLN(stdout, " filled %u of %u leases in %.3f ms",
+		NR_CLIENTS, POOL_SIZE, seconds(start) * 1e3);
+
+	srandom(1);
+	double worst = 0;
+	for (unsigned s = 0; s < CHURN_SECONDS; s++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned n = 0; n < CHURN_RATE; n++) {
+			unsigned c = random() % NR_CLIENTS;
+			release_free_bitmap(&b, leased[c]);
+			if (!take_free_bitmap(&b, &leased[c])) {
+				FAIL("churn %u failed", n);
+			}
+		}
+		double t = seconds(start);
+		if (t > worst) {
+			worst = t;
+		}
+	}
+	PRINTLN(stdout, " churned %u leases per (simulated) second for %u seconds; slowest took %.3f ms",
+		CHURN_RATE, CHURN_SECONDS, worst * 1e3);
+	if (worst > 1.0) {
+		fails++;
+		PRINTLN(stderr, " can't keep up with %u leases/s", CHURN_RATE);
+	}
+
+	free(leased);
+	free_free_bitmap(&b);
+}
+
+int main(int argc UNUSED, char *argv[] UNUSED)
+{
+	check_lowest_first();
+
+	bench_churn();
+
+	if (fails > 0) {
+		fprintf(stderr, "TOTAL FAILURES: %d\n", fails);
+		return 1;
+	} else {
+		return 0;
+	}
+}
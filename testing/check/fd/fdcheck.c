@@ -0,0 +1,224 @@
+/* test buffered fd output, for libreswan
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/lgpl-2.1.txt>.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+ * License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "lswcdefs.h"		/* for elemsof() UNUSED */
+#include "lswalloc.h"
+#include "fd.h"
+
+unsigned fails;
+
+#define PRINTLN(FILE, FMT, ...)						\
+	fprintf(FILE, "%s[%zu]:"FMT"\n",				\
+		__func__, ti,##__VA_ARGS__)
+
+#define FAIL(FMT, ...)						\
+	{							\
+		fails++;					\
+		PRINTLN(stderr, " "FMT,##__VA_ARGS__);		\
+		continue;					\
+	}
+
+/*
+ * Connect a client to pluto's end the way whack does; nothing reads
+ * the client until told to.
+ */
+
+static struct fd *connect_pair(int *client)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX, };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/fdcheck.%d", getpid());
+	unlink(addr.sun_path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 ||
+	    bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(listener, 1) < 0) {
+		perror("listen");
+		exit(1);
+	}
+	*client = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (*client < 0 ||
+	    connect(*client, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	struct fd *fd = fd_accept(listener, HERE);
+	if (fd == NULL) {
+		exit(1);
+	}
+	close(listener);
+	unlink(addr.sun_path);
+	return fd;
+}
+
+static ssize_t send_line(struct fd *fd, unsigned i)
+{
+	char line[32];
+	struct iovec iov = {
+		.iov_base = line,
+		.iov_len = snprintf(line, sizeof(line), "line %07u\n", i),
+	};
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, };
+	return fd_sendmsg(fd, &msg, MSG_NOSIGNAL, HERE);
+}
+
+#define LINE_LEN 13		/* "line NNNNNNN\n" */
+
+static void check_buffered_output(void)
+{
+	/* more than a socket buffer, and then some */
+	static const unsigned nr_lines[] = { 1, 1000, 100000, 400000, };
+	for (size_t ti = 0; ti < elemsof(nr_lines); ti++) {
+		unsigned nr = nr_lines[ti];
+		int client;
+		struct fd *fd = connect_pair(&client);
+		fd_buffer_output(fd, 64 * 1024 * 1024);
+
+		/* none of this should block */
+		unsigned i;
+		for (i = 0; i < nr; i++) {
+			if (send_line(fd, i) != LINE_LEN) {
+				break;
+			}
+		}
+		if (i < nr) {
+			FAIL("send of line %u failed", i);
+		}
+		if (nr * LINE_LEN > 4 * 1024 * 1024 &&
+		    fd_output_pending(fd) == 0) {
+			FAIL("%u bytes went out without buffering", nr * LINE_LEN);
+		}
+
+		/* only one claim on the buffered output */
+		bool claimed = fd_claim_flush(fd);
+		if (claimed != (fd_output_pending(fd) > 0)) {
+			FAIL("claim returned %s with %zu bytes buffered",
+			     claimed ? "true" : "false", fd_output_pending(fd));
+		}
+		if (fd_claim_flush(fd)) {
+			FAIL("second claim succeeded");
+		}
+
+		/* read it back, flushing as the socket drains */
+		size_t total = nr * LINE_LEN;
+		char *buf = malloc(total + 1);
+		size_t received = 0;
+		while (received < total) {
+			if (fd_flush(fd, false) < 0) {
+				break;
+			}
+			ssize_t n = read(client, buf + received, total - received);
+			if (n <= 0) {
+				break;
+			}
+			received += n;
+		}
+		if (received < total) {
+			free(buf);
+			FAIL("received %zu of %zu bytes", received, total);
+		}
+		buf[total] = '\0';
+		for (i = 0; i < nr; i++) {
+			char line[32];
+			snprintf(line, sizeof(line), "line %07u\n", i);
+			if (memcmp(buf + i * LINE_LEN, line, LINE_LEN) != 0) {
+				break;
+			}
+		}
+		free(buf);
+		if (i < nr) {
+			FAIL("line %u is wrong", i);
+		}
+		if (fd_flush(fd, false) != 0 || fd_output_pending(fd) != 0) {
+			FAIL("buffer not empty after everything was read");
+		}
+		/* the claim was released */
+		if (send_line(fd, nr) != LINE_LEN) {
+			FAIL("send after drain failed");
+		}
+
+		close(client);
+		close_any(&fd);
+	}
+}
+
+static void check_overflow(void)
+{
+	static const size_t maxes[] = { 0, 64 * 1024, 1024 * 1024, };
+	for (size_t ti = 0; ti < elemsof(maxes); ti++) {
+		int client;
+		struct fd *fd = connect_pair(&client);
+		fd_buffer_output(fd, maxes[ti]);
+
+		/* fill the socket and then the buffer */
+		unsigned i;
+		ssize_t n = 0;
+		for (i = 0; i < 10 * 1024 * 1024 / LINE_LEN; i++) {
+			n = send_line(fd, i);
+			if (n < 0) {
+				break;
+			}
+		}
+		if (n >= 0) {
+			FAIL("%u lines went out with a %zu byte buffer", i, maxes[ti]);
+		}
+		if (errno != ENOBUFS) {
+			FAIL("overflow errno %d should be ENOBUFS", errno);
+		}
+		/* stays broken */
+		if (send_line(fd, i) >= 0 || fd_flush(fd, true) >= 0) {
+			FAIL("output after overflow succeeded");
+		}
+		if (fd_output_pending(fd) != 0) {
+			FAIL("%zu bytes still buffered after overflow",
+			     fd_output_pending(fd));
+		}
+		/* the reader sees what the socket took and then EOF */
+		char buf[4096];
+		size_t received = 0;
+		while ((n = read(client, buf, sizeof(buf))) > 0) {
+			received += n;
+		}
+		if (n != 0) {
+			FAIL("reader got error %d instead of EOF", errno);
+		}
+		if (received == 0) {
+			FAIL("reader got nothing");
+		}
+
+		close(client);
+		close_any(&fd);
+	}
+}
+
+int main(int argc UNUSED, char *argv[] UNUSED)
+{
+	check_buffered_output();
+	check_overflow();
+
+	if (fails > 0) {
+		fprintf(stderr, "TOTAL FAILURES: %d\n", fails);
+		return 1;
+	} else {
+		return 0;
+	}
+}
@@ -0,0 +1,238 @@
+/* test and benchmark hash functions, for libreswan
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/lgpl-2.1.txt>.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+ * License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "lswcdefs.h"		/* for elemsof() UNUSED */
+#include "siphash.h"
+
+unsigned fails;
+
+#define PRINTLN(FILE, FMT, ...)						\
+	fprintf(FILE, "%s[%zu]:"FMT"\n",				\
+		__func__, ti,##__VA_ARGS__)
+
+#define FAIL(FMT, ...)						\
+	{							\
+		fails++;					\
+		PRINTLN(stderr, " "FMT,##__VA_ARGS__);		\
+		continue;					\
+	}
+
+/*
+ * The hasher pluto used before SipHash; kept here as the baseline
+ * for the benchmarks.
+ */
+
+static uint32_t hash251(const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	uint32_t hash = 0;
+	for (unsigned j = 0; j < len; j++) {
+		hash = hash * 251 + bytes[j];
+	}
+	return hash;
+}
+
+static uint32_t fold(uint64_t h)
+{
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+static const struct siphash_key test_key = {
+	/* 00 01 .. 0f as two little-endian words */
+	.k = { UINT64_C(0x0706050403020100), UINT64_C(0x0f0e0d0c0b0a0908), },
+};
+
+static void check_siphash24_vectors(void)
+{
+	/*
+	 * From the SipHash paper's reference vectors: key 00..0f,
+	 * message 00..(len-1).
+	 */
+	static const struct test {
+		size_t len;
+		uint64_t out;
+	} tests[] = {
+		{ 0, UINT64_C(0x726fdb47dd0e0e31), },
+		{ 1, UINT64_C(0x74f839c593dc67fd), },
+		{ 15, UINT64_C(0xa129ca6149be45e5), },
+	};
+
+	uint8_t message[64];
+	for (unsigned i = 0; i < sizeof(message); i++) {
+		message[i] = i;
+	}
+
+	for (size_t ti = 0; ti < elemsof(tests); ti++) {
+		const struct test *t = &tests[ti];
+		PRINTLN(stdout, " len=%zu out=%016"PRIx64, t->len, t->out);
+		uint64_t out = siphash24(&test_key, message, t->len);
+		if (out != t->out) {
+			FAIL("siphash24() returned %016"PRIx64", expecting %016"PRIx64,
+			     out, t->out);
+		}
+	}
+}
+
+static void check_siphash13_fast_paths(void)
+{
+	static const uint64_t words[] = {
+		0, 1, UINT64_C(0x0123456789abcdef), UINT64_MAX,
+	};
+	for (size_t ti = 0; ti < elemsof(words); ti++) {
+		uint64_t w0 = words[ti];
+		uint64_t w1 = ~w0 ^ (w0 << 7);
+		uint8_t buf[16];
+		for (unsigned i = 0; i < 8; i++) {
+			buf[i] = w0 >> (8 * i);
+			buf[8 + i] = w1 >> (8 * i);
+		}
+		PRINTLN(stdout, " w0=%016"PRIx64" w1=%016"PRIx64, w0, w1);
+		if (siphash13_u64(&test_key, w0) != siphash13(&test_key, buf, 8)) {
+			FAIL("siphash13_u64() does not match siphash13()");
+		}
+		if (siphash13_u64x2(&test_key, w0, w1) != siphash13(&test_key, buf, 16)) {
+			FAIL("siphash13_u64x2() does not match siphash13()");
+		}
+	}
+}
+
+/*
+ * Benchmarks.  These report, they don't fail.
+ */
+
+static double seconds(struct timespec start)
+{
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	return ((stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+#define NR_HASHES 4000000
+
+static volatile uint32_t sink;
+
+static void bench_throughput(void)
+{
+	static const size_t lens[] = { 4, 8, 16, 32, };
+	for (size_t ti = 0; ti < elemsof(lens); ti++) {
+		uint8_t key[32] = { 0, };
+		size_t len = lens[ti];
+		struct timespec start;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (uint32_t i = 0; i < NR_HASHES; i++) {
+			memcpy(key, &i, sizeof(i));
+			sink ^= hash251(key, len);
+		}
+		double old = seconds(start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (uint32_t i = 0; i < NR_HASHES; i++) {
+			memcpy(key, &i, sizeof(i));
+			sink ^= fold(siphash13(&test_key, key, len));
+		}
+		double sip = seconds(start);
+
+		PRINTLN(stdout, " %2zu byte keys: hash251 %.1f Mhash/s; siphash13 %.1f Mhash/s",
+			len, NR_HASHES / old / 1e6, NR_HASHES / sip / 1e6);
+	}
+
+	size_t ti = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint64_t i = 0; i < NR_HASHES; i++) {
+		sink ^= fold(siphash13_u64(&test_key, i));
+	}
+	double u64 = seconds(start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint64_t i = 0; i < NR_HASHES; i++) {
+		sink ^= fold(siphash13_u64x2(&test_key, i, ~i));
+	}
+	double u64x2 = seconds(start);
+	PRINTLN(stdout, " fast paths: siphash13_u64 %.1f Mhash/s; siphash13_u64x2 %.1f Mhash/s",
+		NR_HASHES / u64 / 1e6, NR_HASHES / u64x2 / 1e6);
+}
+
+#define NR_BUCKETS 499	/* STATE_TABLE_SIZE */
+#define NR_KEYS (NR_BUCKETS * 40)
+
+static void report_chains(size_t ti, const char *what, const unsigned *buckets)
+{
+	unsigned longest = 0, empty = 0;
+	for (unsigned b = 0; b < NR_BUCKETS; b++) {
+		if (buckets[b] > longest) {
+			longest = buckets[b];
+		}
+		if (buckets[b] == 0) {
+			empty++;
+		}
+	}
+	PRINTLN(stdout, " %s: %u keys in %u buckets; longest chain %u; %u empty",
+		what, NR_KEYS, NR_BUCKETS, longest, empty);
+}
+
+static void bench_distribution(void)
+{
+	/*
+	 * Sequential serial numbers, and IKE SPIs chosen by an
+	 * attacker so that they all land in one hash251 bucket (with
+	 * no secret, brute force finds them quickly).
+	 */
+	static const char *const what[] = { "serialno", "chosen SPIi", };
+	for (size_t ti = 0; ti < elemsof(what); ti++) {
+		unsigned old[NR_BUCKETS] = { 0, };
+		unsigned sip[NR_BUCKETS] = { 0, };
+		uint64_t spi = 0;
+		for (uint64_t i = 0; i < NR_KEYS; i++) {
+			uint8_t key[8];
+			if (ti == 0) {
+				memcpy(key, &i, sizeof(i));
+			} else {
+				do {
+					spi++;
+					memcpy(key, &spi, sizeof(spi));
+				} while (hash251(key, sizeof(key)) % NR_BUCKETS != 0);
+			}
+			old[hash251(key, sizeof(key)) % NR_BUCKETS]++;
+			sip[fold(siphash13(&test_key, key, sizeof(key))) % NR_BUCKETS]++;
+		}
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%s hash251", what[ti]);
+		report_chains(ti, buf, old);
+		snprintf(buf, sizeof(buf), "%s siphash13", what[ti]);
+		report_chains(ti, buf, sip);
+	}
+}
+
+int main(int argc UNUSED, char *argv[] UNUSED)
+{
+	check_siphash24_vectors();
+	check_siphash13_fast_paths();
+
+	bench_throughput();
+	bench_distribution();
+
+	if (fails > 0) {
+		fprintf(stderr, "TOTAL FAILURES: %d\n", fails);
+		return 1;
+	} else {
+		return 0;
+	}
+}